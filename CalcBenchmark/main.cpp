@@ -0,0 +1,75 @@
+// main.cpp
+// QXlsx // MIT License // https://github.com/j2doll/QXlsx
+//
+// Measures the formula engine on a synthetic workbook of one million
+// formulas, evaluated by one thread and then by the global thread pool.
+
+#include <QtGlobal>
+#include <QCoreApplication>
+#include <QElapsedTimer>
+#include <QThreadPool>
+#include <QDebug>
+
+#include "xlsxdocument.h"
+#include "xlsxworkbook.h"
+#include "xlsxworksheet.h"
+#include "xlsxcellformula.h"
+using namespace QXlsx;
+
+static const int sheetCount = 8;
+static const int rowCount = 25000;
+
+static void buildWorkbook(Document &xlsx)
+{
+    for (int s = 1; s <= sheetCount; ++s) {
+        xlsx.addSheet(QStringLiteral("Data%1").arg(s));
+        Worksheet *sheet = xlsx.currentWorksheet();
+        for (int row = 1; row <= rowCount; ++row) {
+            const QString r = QString::number(row);
+            sheet->write(row, 1, row % 97);
+            sheet->writeFormula(row, 2, CellFormula(QStringLiteral("A") + r + QStringLiteral("*2")));
+            sheet->writeFormula(row, 3, CellFormula(QStringLiteral("B") + r + QStringLiteral("+1")));
+            sheet->writeFormula(row, 4, CellFormula(QStringLiteral("SUM(B") + r + QStringLiteral(":C") + r + QStringLiteral(")")));
+            sheet->writeFormula(row, 5, CellFormula(QStringLiteral("IF(D") + r + QStringLiteral(">10,D") + r + QStringLiteral(",0)")));
+            sheet->writeFormula(row, 6, CellFormula(QStringLiteral("ROUND(E") + r + QStringLiteral("/3,2)")));
+        }
+    }
+}
+
+static qint64 timeFullCalculation(Document &xlsx, bool parallel)
+{
+    xlsx.workbook()->setParallelCalculationEnabled(parallel);
+    QElapsedTimer timer;
+    timer.start();
+    xlsx.calculateAll();
+    return timer.elapsed();
+}
+
+int main(int argc, char *argv[])
+{
+    QCoreApplication app(argc, argv);
+
+    Document xlsx;
+    QElapsedTimer timer;
+    timer.start();
+    buildWorkbook(xlsx);
+    qDebug() << "formulas:" << sheetCount * rowCount * 5 << "built in" << timer.elapsed() << "ms";
+
+    //Warm up, the formulas get parsed once.
+    xlsx.calculateAll();
+
+    const qint64 sequential = timeFullCalculation(xlsx, false);
+    const qint64 parallel = timeFullCalculation(xlsx, true);
+    qDebug() << "sequential:" << sequential << "ms";
+    qDebug() << "parallel:" << parallel << "ms with" << QThreadPool::globalInstance()->maxThreadCount() << "threads";
+    if (parallel > 0)
+        qDebug() << "speedup:" << double(sequential) / double(parallel);
+
+    xlsx.selectSheet(QStringLiteral("Data1"));
+    xlsx.write(1, 1, 42);
+    timer.restart();
+    xlsx.calculate();
+    qDebug() << "incremental after one write:" << timer.elapsed() << "ms, B1 =" << xlsx.read(1, 2).toDouble();
+
+    return 0;
+}
@@ -58,6 +58,7 @@ $${QXLSX_HEADERPATH}xlsxabstractooxmlfile.h \
 $${QXLSX_HEADERPATH}xlsxabstractooxmlfile_p.h \
 $${QXLSX_HEADERPATH}xlsxabstractsheet.h \
 $${QXLSX_HEADERPATH}xlsxabstractsheet_p.h \
+$${QXLSX_HEADERPATH}xlsxcalcchain_p.h \
 $${QXLSX_HEADERPATH}xlsxcell.h \
 $${QXLSX_HEADERPATH}xlsxcellformula.h \
 $${QXLSX_HEADERPATH}xlsxcellformula_p.h \
@@ -70,11 +71,14 @@ $${QXLSX_HEADERPATH}xlsxchartsheet.h \
 $${QXLSX_HEADERPATH}xlsxchartsheet_p.h \
 $${QXLSX_HEADERPATH}xlsxchart_p.h \
 $${QXLSX_HEADERPATH}xlsxcolor_p.h \
+$${QXLSX_HEADERPATH}xlsxcolumnwidthcalculator_p.h \
 $${QXLSX_HEADERPATH}xlsxconditionalformatting.h \
 $${QXLSX_HEADERPATH}xlsxconditionalformatting_p.h \
+$${QXLSX_HEADERPATH}xlsxconditionalformattingevaluator_p.h \
 $${QXLSX_HEADERPATH}xlsxcontenttypes_p.h \
 $${QXLSX_HEADERPATH}xlsxdatavalidation.h \
 $${QXLSX_HEADERPATH}xlsxdatavalidation_p.h \
+$${QXLSX_HEADERPATH}xlsxdatavalidationchecker_p.h \
 $${QXLSX_HEADERPATH}xlsxdatetype.h \
 $${QXLSX_HEADERPATH}xlsxdocpropsapp_p.h \
 $${QXLSX_HEADERPATH}xlsxdocpropscore_p.h \
@@ -84,13 +88,19 @@ $${QXLSX_HEADERPATH}xlsxdrawinganchor_p.h \
 $${QXLSX_HEADERPATH}xlsxdrawing_p.h \
 $${QXLSX_HEADERPATH}xlsxformat.h \
 $${QXLSX_HEADERPATH}xlsxformat_p.h \
+$${QXLSX_HEADERPATH}xlsxformulaengine_p.h \
+$${QXLSX_HEADERPATH}xlsxformulaparser_p.h \
 $${QXLSX_HEADERPATH}xlsxglobal.h \
 $${QXLSX_HEADERPATH}xlsxmediafile_p.h \
+$${QXLSX_HEADERPATH}xlsxnumberformatter_p.h \
 $${QXLSX_HEADERPATH}xlsxnumformatparser_p.h \
+$${QXLSX_HEADERPATH}xlsxparallel_p.h \
+$${QXLSX_HEADERPATH}xlsxrangeindex_p.h \
 $${QXLSX_HEADERPATH}xlsxrelationships_p.h \
 $${QXLSX_HEADERPATH}xlsxrichstring.h \
 $${QXLSX_HEADERPATH}xlsxrichstring_p.h \
 $${QXLSX_HEADERPATH}xlsxsharedstrings_p.h \
+$${QXLSX_HEADERPATH}xlsxsheetshift_p.h \
 $${QXLSX_HEADERPATH}xlsxsimpleooxmlfile_p.h \
 $${QXLSX_HEADERPATH}xlsxstyles_p.h \
 $${QXLSX_HEADERPATH}xlsxtheme_p.h \
@@ -105,6 +115,7 @@ $${QXLSX_HEADERPATH}xlsxzipwriter_p.h
 SOURCES += \
 $${QXLSX_SOURCEPATH}xlsxabstractooxmlfile.cpp \
 $${QXLSX_SOURCEPATH}xlsxabstractsheet.cpp \
+$${QXLSX_SOURCEPATH}xlsxcalcchain.cpp \
 $${QXLSX_SOURCEPATH}xlsxcell.cpp \
 $${QXLSX_SOURCEPATH}xlsxcellformula.cpp \
 $${QXLSX_SOURCEPATH}xlsxcelllocation.cpp \
@@ -113,9 +124,12 @@ $${QXLSX_SOURCEPATH}xlsxcellreference.cpp \
 $${QXLSX_SOURCEPATH}xlsxchart.cpp \
 $${QXLSX_SOURCEPATH}xlsxchartsheet.cpp \
 $${QXLSX_SOURCEPATH}xlsxcolor.cpp \
+$${QXLSX_SOURCEPATH}xlsxcolumnwidthcalculator.cpp \
 $${QXLSX_SOURCEPATH}xlsxconditionalformatting.cpp \
+$${QXLSX_SOURCEPATH}xlsxconditionalformattingevaluator.cpp \
 $${QXLSX_SOURCEPATH}xlsxcontenttypes.cpp \
 $${QXLSX_SOURCEPATH}xlsxdatavalidation.cpp \
+$${QXLSX_SOURCEPATH}xlsxdatavalidationchecker.cpp \
 $${QXLSX_SOURCEPATH}xlsxdatetype.cpp \
 $${QXLSX_SOURCEPATH}xlsxdocpropsapp.cpp \
 $${QXLSX_SOURCEPATH}xlsxdocpropscore.cpp \
@@ -123,11 +137,17 @@ $${QXLSX_SOURCEPATH}xlsxdocument.cpp \
 $${QXLSX_SOURCEPATH}xlsxdrawing.cpp \
 $${QXLSX_SOURCEPATH}xlsxdrawinganchor.cpp \
 $${QXLSX_SOURCEPATH}xlsxformat.cpp \
+$${QXLSX_SOURCEPATH}xlsxformulaengine.cpp \
+$${QXLSX_SOURCEPATH}xlsxformulaparser.cpp \
 $${QXLSX_SOURCEPATH}xlsxmediafile.cpp \
+$${QXLSX_SOURCEPATH}xlsxnumberformatter.cpp \
 $${QXLSX_SOURCEPATH}xlsxnumformatparser.cpp \
+$${QXLSX_SOURCEPATH}xlsxparallel.cpp \
+$${QXLSX_SOURCEPATH}xlsxrangeindex.cpp \
 $${QXLSX_SOURCEPATH}xlsxrelationships.cpp \
 $${QXLSX_SOURCEPATH}xlsxrichstring.cpp \
 $${QXLSX_SOURCEPATH}xlsxsharedstrings.cpp \
+$${QXLSX_SOURCEPATH}xlsxsheetshift.cpp \
 $${QXLSX_SOURCEPATH}xlsxsimpleooxmlfile.cpp \
 $${QXLSX_SOURCEPATH}xlsxstyles.cpp \
 $${QXLSX_SOURCEPATH}xlsxtheme.cpp \
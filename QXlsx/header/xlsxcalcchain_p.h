@@ -0,0 +1,56 @@
+// xlsxcalcchain_p.h
+
+#ifndef XLSXCALCCHAIN_H
+#define XLSXCALCCHAIN_H
+
+//
+//  W A R N I N G
+//  -------------
+//
+// This file is not part of the Qt Xlsx API.  It exists for the convenience
+// of the Qt Xlsx.  This header file may change from
+// version to version without notice, or even be removed.
+//
+// We mean it.
+//
+
+#include <QVector>
+
+#include "xlsxglobal.h"
+#include "xlsxabstractooxmlfile.h"
+#include "xlsxcellreference.h"
+
+class QIODevice;
+
+QT_BEGIN_NAMESPACE_XLSX
+
+/*
+ * The calcChain part, the formula cells of the workbook in the order they
+ * were calculated. Excel rebuilds it when it's missing.
+ */
+class CalcChain : public AbstractOOXmlFile
+{
+public:
+    struct Entry
+    {
+        int sheetId;
+        CellReference cell;
+        bool array;
+    };
+
+    CalcChain(CreateFlag flag);
+
+    void addCell(int sheetId, const CellReference &cell, bool array = false);
+    bool isEmpty() const;
+    QVector<Entry> entries() const;
+
+    void saveToXmlFile(QIODevice *device) const;
+    bool loadFromXmlFile(QIODevice *device);
+
+private:
+    QVector<Entry> m_entries;
+};
+
+QT_END_NAMESPACE_XLSX
+
+#endif // XLSXCALCCHAIN_H
@@ -61,6 +61,7 @@ public:
 	CellType cellType() const;
 	QVariant value() const;
 	QVariant readValue() const;
+	QString formattedText() const;
 	Format format() const;
 	
 	bool hasFormula() const;
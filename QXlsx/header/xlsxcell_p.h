@@ -16,12 +16,16 @@
 
 QT_BEGIN_NAMESPACE_XLSX
 
+class NumberFormatter;
+
 class CellPrivate
 {
     Q_DECLARE_PUBLIC(Cell)
 public:
     CellPrivate(Cell *p);
     CellPrivate(const CellPrivate * const cp);
+
+    QString formattedText(const NumberFormatter &formatter, bool date1904) const;
 public:
     Worksheet *parent;
     Cell *q_ptr;
@@ -30,11 +34,10 @@ public:
     QVariant value;
 
     CellFormula formula;
-    Format format;
 
     RichString richString;
 
-    qint32 styleNumber;
+    qint32 styleNumber; //xf index in the workbook styles, -1 when unstyled.
 };
 
 QT_END_NAMESPACE_XLSX
@@ -18,6 +18,9 @@
 
 QT_BEGIN_NAMESPACE_XLSX
 
+class Worksheet;
+class Cell;
+
 class XlsxSeries
 {
 public:
@@ -114,6 +117,9 @@ public:
     void saveXmlAreaChart(QXmlStreamWriter &writer) const;
     void saveXmlDoughnutChart(QXmlStreamWriter &writer) const;
     void saveXmlSer(QXmlStreamWriter &writer, XlsxSeries *ser, int id) const;
+    void saveXmlNumCache(QXmlStreamWriter &writer, const QString &reference) const;
+    void saveXmlStrCache(QXmlStreamWriter &writer, const QString &reference) const;
+    const Worksheet *referencedCells(const QString &reference, QVector<const Cell *> &cells) const;
     void saveXmlAxis(QXmlStreamWriter &writer) const;
     void saveXmlChartLegend(QXmlStreamWriter &writer) const;
 
@@ -0,0 +1,101 @@
+// xlsxcolumnwidthcalculator_p.h
+
+#ifndef QXLSX_COLUMNWIDTHCALCULATOR_P_H
+#define QXLSX_COLUMNWIDTHCALCULATOR_P_H
+
+//
+//  W A R N I N G
+//  -------------
+//
+// This file is not part of the Qt Xlsx API.  It exists for the convenience
+// of the Qt Xlsx.  This header file may change from
+// version to version without notice, or even be removed.
+//
+// We mean it.
+//
+
+#include <QtGlobal>
+#include <QMap>
+#include <QHash>
+#include <QVector>
+#include <QString>
+#include <QSharedPointer>
+#include <QFontMetricsF>
+
+#include "xlsxglobal.h"
+#include "xlsxcellrange.h"
+
+QT_BEGIN_NAMESPACE_XLSX
+
+class Cell;
+class Styles;
+class NumberFormatter;
+
+/*
+ * Works out the width the cells of a range need, column by column, in one
+ * pass over the cell table. The values are rendered with their number
+ * format and measured with the font of their xf, taking wrapping, rotation
+ * and indentation into account. Widths are in characters of the default
+ * font, as taken by Worksheet::setColumnWidth().
+ */
+class ColumnWidthCalculator
+{
+public:
+    typedef QMap<int, QMap<int, QSharedPointer<Cell> > > CellTable;
+
+    ColumnWidthCalculator(const CellTable &cells, Styles *styles, bool date1904, bool parallel);
+
+    QMap<int, double> widths(const CellRange &range) const;
+
+private:
+    struct Xf
+    {
+        Xf() : fontSize(0), wrap(false), rotation(0), indent(0) {}
+
+        QSharedPointer<const NumberFormatter> formatter;
+        QSharedPointer<QFontMetricsF> metrics;  //null without a QGuiApplication
+        int fontSize;
+        bool wrap;
+        int rotation;
+        int indent;
+    };
+
+    /*
+     * The fonts and number formats resolved by one thread. Fonts aren't
+     * shared between threads, each one measures with its own.
+     */
+    class Measurer
+    {
+    public:
+        Measurer(Styles *styles, bool date1904, bool useFonts);
+
+        double width(const Cell &cell);
+
+    private:
+        const Xf &xf(int index);
+        QString text(const Cell &cell, const Xf &xf) const;
+        double textWidth(const QString &text, const Xf &xf) const;
+        double lineWidth(const QString &line, const Xf &xf) const;
+
+        Styles *m_styles;
+        bool m_date1904;
+        bool m_useFonts;
+        double m_digitWidth;    //of the default font, in pixels
+        QHash<int, Xf> m_xfs;
+        QHash<QString, QSharedPointer<const NumberFormatter> > m_formatters;   //by format code
+        QHash<QString, QSharedPointer<QFontMetricsF> > m_metrics;              //by QFont::key()
+    };
+
+    void measureColumns(Measurer &measurer, const QVector<int> &rows, int firstColumn, int lastColumn,
+                        QMap<int, double> &widths) const;
+
+    const CellTable &m_cells;
+    Styles *m_styles;
+    bool m_date1904;
+    bool m_parallel;
+    bool m_useFonts;
+};
+
+QT_END_NAMESPACE_XLSX
+
+#endif // QXLSX_COLUMNWIDTHCALCULATOR_P_H
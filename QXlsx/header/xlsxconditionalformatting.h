@@ -14,6 +14,7 @@
 #include "xlsxglobal.h"
 #include "xlsxcellrange.h"
 #include "xlsxcellreference.h"
+#include "xlsxformat.h"
 
 class ConditionalFormattingTest;
 
@@ -106,6 +107,8 @@ public:
 
 private:
     friend class Worksheet;
+    friend class WorksheetPrivate;
+    friend class ConditionalFormattingEvaluator;
     friend class ::ConditionalFormattingTest;
 
 private:
@@ -115,6 +118,29 @@ private:
     QSharedDataPointer<ConditionalFormattingPrivate> d;
 };
 
+/*
+ * The conditional formatting shown by one cell, see
+ * Worksheet::conditionalFormats().
+ */
+struct QXLSX_EXPORT CellConditionalFormat
+{
+    CellConditionalFormat()
+        : row(0), column(0), dataBarLength(-1), dataBarValueHidden(false)
+    {
+    }
+
+    inline bool hasColorScale() const { return color.isValid(); }
+    inline bool hasDataBar() const { return dataBarLength >= 0; }
+
+    int row;
+    int column;
+    QList<Format> formats;      // of the rules that apply, highest priority first
+    QColor color;               // color scale fill
+    QColor dataBarColor;
+    double dataBarLength;       // from 0 to 1, negative without a data bar
+    bool dataBarValueHidden;
+};
+
 QT_END_NAMESPACE_XLSX
 
 #endif // QXLSX_XLSXCONDITIONALFORMATTING_H
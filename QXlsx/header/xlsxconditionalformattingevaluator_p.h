@@ -0,0 +1,139 @@
+// xlsxconditionalformattingevaluator_p.h
+
+#ifndef QXLSX_CONDITIONALFORMATTINGEVALUATOR_P_H
+#define QXLSX_CONDITIONALFORMATTINGEVALUATOR_P_H
+
+//
+//  W A R N I N G
+//  -------------
+//
+// This file is not part of the Qt Xlsx API.  It exists for the convenience
+// of the Qt Xlsx.  This header file may change from
+// version to version without notice, or even be removed.
+//
+// We mean it.
+//
+
+#include <QtGlobal>
+#include <QList>
+#include <QVector>
+#include <QMap>
+#include <QHash>
+#include <QColor>
+#include <QSharedPointer>
+
+#include "xlsxglobal.h"
+#include "xlsxcellrange.h"
+#include "xlsxcellreference.h"
+#include "xlsxconditionalformatting.h"
+#include "xlsxformulaengine_p.h"
+
+QT_BEGIN_NAMESPACE_XLSX
+
+class Worksheet;
+class Cell;
+class FormulaCache;
+class ParsedFormula;
+class XlsxCfRuleData;
+class XlsxCfVoData;
+
+/*
+ * Works out which conditional formatting rules apply to the cells of a
+ * range. Each rule is compiled once: its formulas are parsed, and the
+ * statistics it needs over the cells it covers (sorted values, average,
+ * rank thresholds, duplicate counts, scale bounds) are computed before any
+ * cell is looked at.
+ */
+class ConditionalFormattingEvaluator
+{
+public:
+    typedef QMap<int, QMap<int, QSharedPointer<Cell> > > CellTable;
+
+    ConditionalFormattingEvaluator(Worksheet *sheet, const CellTable &cells, FormulaEngine *engine,
+                                   FormulaCache *cache, const CellRange &usedRange, bool date1904);
+
+    QList<CellConditionalFormat> evaluate(const QList<ConditionalFormatting> &formattings, const CellRange &range);
+
+private:
+    struct Formula
+    {
+        Formula() : constant(false) {}
+
+        QSharedPointer<const ParsedFormula> parsed;
+        bool constant;          //no references, evaluated once
+        FormulaValue value;
+    };
+
+    enum Kind
+    {
+        CellIs,
+        Expression,
+        ContainsText,
+        NotContainsText,
+        BeginsWith,
+        EndsWith,
+        TimePeriod,
+        Duplicate,
+        Unique,
+        ContainsErrors,
+        NotContainsErrors,
+        ContainsBlanks,
+        NotContainsBlanks,
+        Top10,
+        AboveAverage,
+        ColorScale,
+        DataBar,
+        Unknown
+    };
+
+    struct Rule
+    {
+        Rule() : kind(Unknown), priority(0), stopIfTrue(false), formatting(0), data(nullptr), below(false),
+            orEqual(false), low(0), high(0), mid(0), colorCount(0), hideValue(false) {}
+
+        Kind kind;
+        int priority;
+        bool stopIfTrue;
+        int formatting;         //index in m_ranges
+        const XlsxCfRuleData *data;
+
+        QString op;
+        QString text;
+        QVector<Formula> formulas;
+
+        //statistics of the covered cells
+        bool below;             //bottom or below average
+        bool orEqual;
+        double low;             //threshold or lower bound of the scale
+        double high;
+        double mid;
+        QHash<QString, int> counts;
+
+        int colorCount;
+        QColor colors[3];
+        bool hideValue;
+    };
+
+    void compile(Rule &rule, const CellReference &anchor);
+    Formula compileFormula(const QString &text, const CellReference &anchor) const;
+    FormulaValue formulaValue(const Formula &formula, int row, int column) const;
+    QVector<double> numbers(int formatting) const;
+    double cfvoValue(const XlsxCfVoData &cfvo, const QVector<double> &sorted, const CellReference &anchor) const;
+    bool matches(const Rule &rule, int row, int column, const FormulaValue &value) const;
+    QColor scaleColor(const Rule &rule, double value) const;
+    template <typename Visitor> void visitCells(int formatting, Visitor visitor) const;
+
+    static QString valueKey(const FormulaValue &value);
+
+    Worksheet *m_sheet;
+    const CellTable &m_cells;
+    FormulaEngine *m_engine;
+    FormulaCache *m_cache;
+    CellRange m_usedRange;
+    bool m_date1904;
+    QVector<QList<CellRange> > m_ranges;    //of each formatting, clipped to the used range
+};
+
+QT_END_NAMESPACE_XLSX
+
+#endif // QXLSX_CONDITIONALFORMATTINGEVALUATOR_P_H
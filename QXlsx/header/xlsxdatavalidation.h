@@ -97,9 +97,26 @@ public:
     bool saveToXml(QXmlStreamWriter &writer) const;
     static DataValidation loadFromXml(QXmlStreamReader &reader);
 private:
+    friend class WorksheetPrivate;
+
     QSharedDataPointer<DataValidationPrivate> d;
 };
 
+/*
+ * A cell whose value breaks a data validation, see Worksheet::validate().
+ */
+struct QXLSX_EXPORT DataValidationViolation
+{
+    DataValidationViolation()
+        : row(0), column(0)
+    {
+    }
+
+    int row;
+    int column;
+    DataValidation validation;
+};
+
 QT_END_NAMESPACE_XLSX
 
 #endif // QXLSX_XLSXDATAVALIDATION_H
@@ -0,0 +1,99 @@
+// xlsxdatavalidationchecker_p.h
+
+#ifndef QXLSX_DATAVALIDATIONCHECKER_P_H
+#define QXLSX_DATAVALIDATIONCHECKER_P_H
+
+//
+//  W A R N I N G
+//  -------------
+//
+// This file is not part of the Qt Xlsx API.  It exists for the convenience
+// of the Qt Xlsx.  This header file may change from
+// version to version without notice, or even be removed.
+//
+// We mean it.
+//
+
+#include <QtGlobal>
+#include <QList>
+#include <QVector>
+#include <QMap>
+#include <QSet>
+#include <QSharedPointer>
+
+#include "xlsxglobal.h"
+#include "xlsxcellrange.h"
+#include "xlsxcellreference.h"
+#include "xlsxdatavalidation.h"
+#include "xlsxformulaengine_p.h"
+
+QT_BEGIN_NAMESPACE_XLSX
+
+class Worksheet;
+class Cell;
+class FormulaCache;
+class ParsedFormula;
+
+/*
+ * Checks the cells of a range against data validations. Each validation is
+ * compiled once: its formulas are parsed, constant bounds are evaluated and
+ * list sources are read into a hash set. Large ranges are split in blocks
+ * of rows checked by the threads of the global pool.
+ */
+class DataValidationChecker
+{
+public:
+    typedef QMap<int, QMap<int, QSharedPointer<Cell> > > CellTable;
+
+    DataValidationChecker(Worksheet *sheet, const CellTable &cells, FormulaEngine *engine,
+                          FormulaCache *cache, bool parallel);
+
+    QList<DataValidationViolation> check(const QList<DataValidation> &validations, const CellRange &range);
+
+private:
+    struct Formula
+    {
+        Formula() : constant(false) {}
+
+        QSharedPointer<const ParsedFormula> parsed;
+        bool constant;          //doesn't depend on the cell, evaluated once
+        FormulaValue value;
+    };
+
+    struct Rule
+    {
+        Rule() : type(DataValidation::None), op(DataValidation::Between), allowBlank(false), listKnown(false) {}
+
+        DataValidation validation;
+        DataValidation::ValidationType type;
+        DataValidation::ValidationOperator op;
+        bool allowBlank;
+        QList<CellRange> ranges;
+        CellReference anchor;   //relative references are from there
+        QVector<Formula> formulas;
+        QSet<QString> list;
+        bool listKnown;         //false when the list source can't be read
+    };
+
+    void compile(Rule &rule);
+    void compileList(Rule &rule);
+    Formula compileFormula(const QString &text, const CellReference &anchor) const;
+    FormulaValue formulaValue(const Formula &formula, int row, int column) const;
+    bool isValid(const Rule &rule, int row, int column, const FormulaValue &value) const;
+    bool inBounds(const Rule &rule, int row, int column, double number) const;
+    void checkRows(const QVector<int> &rows, int first, int last, const CellRange &range,
+                   QVector<DataValidationViolation> &violations) const;
+
+    static QString listKey(const FormulaValue &value);
+
+    Worksheet *m_sheet;
+    const CellTable &m_cells;
+    FormulaEngine *m_engine;
+    FormulaCache *m_cache;
+    bool m_parallel;
+    QVector<Rule> m_rules;
+};
+
+QT_END_NAMESPACE_XLSX
+
+#endif // QXLSX_DATAVALIDATIONCHECKER_P_H
@@ -10,6 +10,7 @@
 #include <QDateTime>
 #include <QDate>
 #include <QTime>
+#include <QVector>
 
 #include "xlsxglobal.h"
 
@@ -19,6 +20,9 @@ class QXLSX_EXPORT DateType
 {
 public:
     DateType();
+
+    static QVector<double> toNumbers(const QVector<QDateTime> &dateTimes, bool is1904 = false);
+    static QVector<QDateTime> fromNumbers(const QVector<double> &numbers, bool is1904 = false, Qt::TimeSpec spec = Qt::LocalTime);
 /*
     DateType(bool is1904 = false);
     DateType(double d, bool is1904 = false);
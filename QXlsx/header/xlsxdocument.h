@@ -37,11 +37,14 @@ public:
 
 	bool write(const CellReference &cell, const QVariant &value, const Format &format=Format());
 	bool write(int row, int col, const QVariant &value, const Format &format=Format());
+	bool write(int row, int col, const QVariant &value, StyleId style);
+	StyleId internStyle(const Format &format);
 	
 	QVariant read(const CellReference &cell) const;
 	QVariant read(int row, int col) const;
 	
     int insertImage(int row, int col, const QImage &image);
+    int insertImage(int row, int col, const QByteArray &encodedImage);
     bool getImage(int imageIndex, QImage& img);
     bool getImage(int row, int col, QImage& img);
     uint getImageCount();
@@ -51,6 +54,11 @@ public:
 	bool mergeCells(const CellRange &range, const Format &format=Format());
 	bool unmergeCells(const CellRange &range);
 
+	bool insertRows(int row, int count = 1);
+	bool deleteRows(int row, int count = 1);
+	bool insertColumns(int column, int count = 1);
+	bool deleteColumns(int column, int count = 1);
+
 	bool setColumnWidth(const CellRange &range, double width);
 	bool setColumnFormat(const CellRange &range, const Format &format);
 	bool setColumnHidden(const CellRange &range, bool hidden);
@@ -115,6 +123,10 @@ public:
 	bool saveAs(const QString &xlsXname) const;
 	bool saveAs(QIODevice *device) const;
 
+	bool calculate();
+	bool calculateAll();
+	QStringList circularReferences() const;
+
 	// copy style from one xlsx file to other
 	static bool copyStyle(const QString &from, const QString &to);
 
@@ -128,10 +140,6 @@ public:
     bool autosizeColumnWidth(int colFirst, int colLast);
     bool autosizeColumnWidth(void);
 
-private:
-    QMap<int, int> getMaximalColumnWidth(int firstRow=1, int lastRow=INT_MAX);
-
-
 private:
     Q_DISABLE_COPY(Document) // Disables the use of copy constructors and
                              // assignment operators for the given Class.
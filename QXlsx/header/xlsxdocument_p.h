@@ -22,6 +22,8 @@ public:
 
     bool loadPackage(QIODevice *device);
     bool savePackage(QIODevice *device) const;
+    void readPackageMedia(const QString &fileName) const;
+    QMap<int, double> contentWidths(const CellRange &range) const;
 
 	// copy style from one xlsx file to other
 	static bool copyStyle(const QString &from, const QString &to);
@@ -29,6 +31,7 @@ public:
     Document *q_ptr;
     const QString defaultPackageName; //default name when package name not specified
     QString packageName; //name of the .xlsx file
+    QString packageFile; //canonical path of the loaded file, media may still be read from it
 
     QMap<QString, QString> documentProperties; //core, app and custom properties
     QSharedPointer<Workbook> workbook;
@@ -5,6 +5,8 @@
 
 #include <QtGlobal>
 #include <QList>
+#include <QHash>
+#include <QPair>
 #include <QString>
 #include <QSharedPointer>
 
@@ -29,9 +31,16 @@ public:
     void saveToXmlFile(QIODevice *device) const;
     bool loadFromXmlFile(QIODevice *device);
 
+    DrawingAnchor *anchorAt(int row, int column);
+    void invalidateAnchorIndex();
+
     AbstractSheet *sheet;
     Workbook *workbook;
     QList<DrawingAnchor *> anchors;
+
+private:
+    QHash<QPair<int, int>, int> m_anchorIndex; // cell to position of its first anchor
+    int m_anchorsIndexed;                       // anchors before it are in m_anchorIndex
 };
 
 QT_END_NAMESPACE_XLSX
@@ -53,7 +53,9 @@ public:
     virtual ~DrawingAnchor();
 
     void setObjectPicture(const QImage &img);
+    void setObjectPicture(const QByteArray &bytes, const QString &suffix, const QString &mimeType);
     bool getObjectPicture(QImage &img);
+    QSharedPointer<MediaFile> pictureFile() const;
 	
     void setObjectGraphicFrame(QSharedPointer<Chart> chart);
 
@@ -223,15 +223,15 @@ public:
 
     bool fontIndexValid() const;
     int fontIndex() const;
-    QByteArray fontKey() const;
+    quint64 fontKey() const;
     bool borderIndexValid() const;
-    QByteArray borderKey() const;
+    quint64 borderKey() const;
     int borderIndex() const;
     bool fillIndexValid() const;
-    QByteArray fillKey() const;
+    quint64 fillKey() const;
     int fillIndex() const;
 
-    QByteArray formatKey() const;
+    quint64 formatKey() const;
     bool xfIndexValid() const;
     int xfIndex() const;
     bool dxfIndexValid() const;
@@ -257,6 +257,22 @@ private:
   QDebug operator<<(QDebug dbg, const Format &f);
 #endif
 
+class StyleId
+{
+public:
+    StyleId() : m_xfIndex(-1) {}
+    explicit StyleId(int xfIndex) : m_xfIndex(xfIndex) {}
+
+    bool isValid() const { return m_xfIndex >= 0; }
+    int xfIndex() const { return m_xfIndex; }
+
+    bool operator ==(const StyleId &other) const { return m_xfIndex == other.m_xfIndex; }
+    bool operator !=(const StyleId &other) const { return m_xfIndex != other.m_xfIndex; }
+
+private:
+    int m_xfIndex;
+};
+
 QT_END_NAMESPACE_XLSX
 
 #endif // QXLSX_FORMAT_H
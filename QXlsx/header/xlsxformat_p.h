@@ -4,8 +4,8 @@
 
 #include <QtGlobal>
 #include <QSharedData>
-#include <QMap>
-#include <QSet>
+#include <QVector>
+#include <QVariant>
 
 #include "xlsxformat.h"
 
@@ -94,22 +94,32 @@ public:
     FormatPrivate(const FormatPrivate &other);
     ~FormatPrivate();
 
+    static quint64 rangeMask(int startId, int endId);
+
+    bool hasValue(int propertyId) const;
+    QVariant value(int propertyId) const;
+    void setValue(int propertyId, const QVariant &value);
+    void removeValue(int propertyId);
+
+    quint64 hashRange(int startId, int endId) const;
+    bool equalRange(const FormatPrivate &other, int startId, int endId) const;
+
     bool dirty; //The key re-generation is need.
-    QByteArray formatKey;
+    quint64 formatKey;
 
     bool font_dirty;
     bool font_index_valid;
-    QByteArray font_key;
+    quint64 font_key;
     int font_index;
 
     bool fill_dirty;
     bool fill_index_valid;
-    QByteArray fill_key;
+    quint64 fill_key;
     int fill_index;
 
     bool border_dirty;
     bool border_index_valid;
-    QByteArray border_key;
+    quint64 border_key;
     int border_index;
 
     int xf_index;
@@ -121,9 +131,17 @@ public:
 
     int theme;
 
-    QMap<int, QVariant> properties;
+    //Bit n is set when property n is present. The values of the present
+    //properties are packed in propertyValues, in the order of their ids.
+    quint64 propertyMask;
+    QVector<QVariant> propertyValues;
+
+private:
+    int slot(int propertyId) const;
 };
 
+Q_STATIC_ASSERT(FormatPrivate::P_ENDID <= 64);
+
 
 QT_END_NAMESPACE_XLSX
 
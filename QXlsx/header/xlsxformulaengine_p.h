@@ -0,0 +1,209 @@
+// xlsxformulaengine_p.h
+
+#ifndef QXLSX_FORMULAENGINE_P_H
+#define QXLSX_FORMULAENGINE_P_H
+
+//
+//  W A R N I N G
+//  -------------
+//
+// This file is not part of the Qt Xlsx API.  It exists for the convenience
+// of the Qt Xlsx.  This header file may change from
+// version to version without notice, or even be removed.
+//
+// We mean it.
+//
+
+#include <QtGlobal>
+#include <QString>
+#include <QStringList>
+#include <QVector>
+#include <QHash>
+#include <QSet>
+#include <QMap>
+#include <QSharedPointer>
+
+#include "xlsxglobal.h"
+#include "xlsxcellrange.h"
+#include "xlsxcellreference.h"
+#include "xlsxformulaparser_p.h"
+
+QT_BEGIN_NAMESPACE_XLSX
+
+class Workbook;
+class Worksheet;
+class Cell;
+class CalcChain;
+class SheetShift;
+
+/*
+ * A value seen by the formula engine. References keep the sheet and the
+ * range, they are turned into a single value only where a scalar is needed.
+ */
+struct FormulaValue
+{
+    enum Type
+    {
+        Empty,
+        Missing,    //omitted function argument
+        Number,
+        String,
+        Boolean,
+        Error,
+        Reference,
+        Unsupported //the formula can't be evaluated by the engine
+    };
+
+    FormulaValue() : type(Empty), number(0), sheet(nullptr) {}
+
+    static FormulaValue fromNumber(double number);
+    static FormulaValue fromString(const QString &text);
+    static FormulaValue fromBoolean(bool value);
+    static FormulaValue error(const QString &code);
+    static FormulaValue reference(Worksheet *sheet, const CellRange &range);
+    static FormulaValue unsupported();
+
+    inline bool isError() const { return type == Error; }
+
+    Type type;
+    double number;  //number or boolean value
+    QString text;   //string or error code
+    Worksheet *sheet;
+    CellRange range;
+};
+
+/*
+ * Evaluates the formulas of a workbook and stores their results as the
+ * cached cell values. Formulas the engine doesn't understand, such as
+ * unknown functions or array formulas, keep their current value.
+ *
+ * The engine keeps a dependency graph between the formula cells and the
+ * areas they refer to, so that after the first calculation only the
+ * formulas depending on changed cells are evaluated again. Large batches
+ * are split into levels of formulas which don't depend on each other, and
+ * each level is evaluated by several threads.
+ */
+class FormulaEngine
+{
+public:
+    explicit FormulaEngine(Workbook *workbook);
+
+    bool calculate(bool full = false);
+    void cellChanged(Worksheet *sheet, int row, int column);
+    void invalidate();
+    QStringList circularReferences() const;
+    void prepareEvaluation();
+    void fillCalcChain(CalcChain &chain);
+    QHash<Worksheet *, QVector<CellReference> > takeShiftedFormulas(Worksheet *sheet, const SheetShift &shift);
+
+    FormulaValue evaluate(Worksheet *sheet, const CellReference &cell, const ParsedFormula &formula, int depth = 0) const;
+    FormulaValue cellValue(Worksheet *sheet, int row, int column) const;
+
+    static void storeResult(Cell *cell, const FormulaValue &value);
+    static bool numberOf(const FormulaValue &value, double &number);
+    static QString textOf(const FormulaValue &value);
+    static bool booleanOf(const FormulaValue &value, bool &result);
+    static int compare(const FormulaValue &left, const FormulaValue &right);
+
+private:
+    struct Area
+    {
+        Worksheet *sheet;
+        CellRange range;
+    };
+
+    struct FormulaCell
+    {
+        Worksheet *sheet;
+        int row;
+        int column;
+        Cell *cell;
+        QSharedPointer<const ParsedFormula> formula;
+        QVector<Area> areas;    //precedent areas
+        bool alive;             //false once the cell was rewritten
+        bool dirty;
+        bool isVolatile;        //calls TODAY() or NOW(), evaluated by every calculation
+        quint8 visit;           //depth first search state
+        int level;              //one more than the deepest dirty precedent
+    };
+
+    struct Dependency
+    {
+        CellRange range;
+        int formula;
+    };
+
+    /*
+     * The formulas depending on the cells of one sheet. Single cells are
+     * hashed, short ranges are filed under the blocks of rows they span and
+     * tall ranges under their columns. The remaining ranges are scanned.
+     */
+    struct SheetDependents
+    {
+        QHash<quint64, QVector<int> > cells;
+        QHash<int, QVector<Dependency> > rowBlocks;
+        QHash<int, QVector<Dependency> > columns;
+        QVector<Dependency> others;
+    };
+
+    struct Change
+    {
+        Worksheet *sheet;
+        int row;
+        int column;
+    };
+
+    void collectSheets();
+    void updateGraph();
+    void buildGraph();
+    void compact();
+    int addFormula(Worksheet *sheet, int row, int column, Cell *cell);
+    void removeFormula(int index);
+    void addDependency(const Area &area, int index);
+    int formulaAt(Worksheet *sheet, int row, int column) const;
+    void applyChanges();
+    void markDirty(int index);
+    void propagateDirty(QVector<int> &queue);
+    void markVolatileDirty();
+    bool isVolatileFormula(const ParsedFormula &formula, Worksheet *sheet, int depth = 0) const;
+    void dependents(Worksheet *sheet, int row, int column, QVector<int> &result) const;
+    void dependents(Worksheet *sheet, const CellRange &range, QVector<int> &result) const;
+    void formulaAreas(const ParsedFormula &formula, Worksheet *sheet, const CellReference &cell,
+                      QVector<Area> &areas, int depth = 0) const;
+    void precedents(int index, QVector<int> &result) const;
+    QVector<int> calculationOrder(const QVector<int> &formulas, bool dirtyOnly = true);
+    void evaluateInParallel(const QVector<int> &order);
+    FormulaValue evaluateFormula(int index) const;
+
+    Worksheet *worksheet(const QString &sheetPrefix, Worksheet *current) const;
+    const ParsedFormula *definedName(const QString &name, Worksheet *current) const;
+    bool resolveReference(const FormulaToken &token, Worksheet *sheet, const CellReference &cell, Area &area) const;
+
+    FormulaValue scalar(const FormulaValue &value, const CellReference &cell) const;
+    CellRange usedRange(const FormulaValue &reference) const;
+    template <typename Visitor> void visitCells(const FormulaValue &reference, Visitor visitor) const;
+
+    FormulaValue binary(const QString &op, const FormulaValue &left, const FormulaValue &right) const;
+    FormulaValue function(const QString &name, const QVector<FormulaValue> &args,
+                          const CellReference &cell) const;
+    int lookup(const FormulaValue &value, const FormulaValue &vector, int mode, bool wildcards, bool reverse) const;
+
+    Workbook *m_workbook;
+    bool m_date1904;
+    bool m_valid;   //the graph matches the workbook
+    QHash<QString, Worksheet *> m_sheets;   //keyed by lower case name
+    QHash<QString, QSharedPointer<const ParsedFormula> > m_names; //keyed by lower case name, "sheetId!name" when local
+    QVector<FormulaCell> m_formulas;
+    int m_deadCount;
+    QHash<Worksheet *, QMap<int, QMap<int, int> > > m_formulaTable; //formula index by sheet, row and column
+    QHash<Worksheet *, SheetDependents> m_dependents;
+    QVector<Change> m_changes;  //cells written since the last calculation
+    QVector<int> m_dirty;
+    QVector<int> m_volatile;
+    QVector<int> m_circular;
+    QHash<Worksheet *, QSet<quint64> > m_unevaluated;   //cells of the array and data table formulas
+};
+
+QT_END_NAMESPACE_XLSX
+
+#endif // QXLSX_FORMULAENGINE_P_H
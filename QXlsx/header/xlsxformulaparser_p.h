@@ -0,0 +1,178 @@
+// xlsxformulaparser_p.h
+
+#ifndef QXLSX_FORMULAPARSER_P_H
+#define QXLSX_FORMULAPARSER_P_H
+
+//
+//  W A R N I N G
+//  -------------
+//
+// This file is not part of the Qt Xlsx API.  It exists for the convenience
+// of the Qt Xlsx.  This header file may change from
+// version to version without notice, or even be removed.
+//
+// We mean it.
+//
+
+#include <QtGlobal>
+#include <QString>
+#include <QVector>
+#include <QHash>
+#include <QSharedPointer>
+
+#include "xlsxglobal.h"
+#include "xlsxcellreference.h"
+
+QT_BEGIN_NAMESPACE_XLSX
+
+/*
+ * A cell position used by a formula. Relative rows and columns are kept as
+ * offsets from the cell holding the formula, so that filled-down and shared
+ * formulas get the same representation.
+ */
+struct FormulaRef
+{
+    FormulaRef() : row(0), column(0), rowAbsolute(false), columnAbsolute(false) {}
+
+    inline int resolvedRow(const CellReference &cell) const
+    { return rowAbsolute ? row : cell.row() + row; }
+    inline int resolvedColumn(const CellReference &cell) const
+    { return columnAbsolute ? column : cell.column() + column; }
+
+    int row;
+    int column;
+    bool rowAbsolute;
+    bool columnAbsolute;
+};
+
+struct FormulaToken
+{
+    enum Type
+    {
+        Number,
+        String,
+        Boolean,
+        Error,
+        Reference,
+        Name,
+        Function,
+        Operator,
+        Separator,
+        OpenParen,
+        CloseParen
+    };
+
+    enum RefKind
+    {
+        CellRef,    // A1
+        AreaRef,    // A1:B2
+        ColumnsRef, // A:B
+        RowsRef     // 1:2
+    };
+
+    FormulaToken() : type(Operator), number(0), refKind(CellRef), position(0), length(0) {}
+
+    Type type;
+    QString text;   //literal text, string contents, operator, error, name
+    double number;  //number or boolean value
+    RefKind refKind;
+    QString sheet;  //sheet prefix as written, without the '!'
+    FormulaRef first;
+    FormulaRef last;
+    int position;   //references only, the span in the formula text
+    int length;     //including the sheet prefix
+};
+
+class FormulaTokenizer
+{
+public:
+    static bool tokenize(const QString &formula, const CellReference &cell, QVector<FormulaToken> &tokens);
+};
+
+struct FormulaNode
+{
+    enum Type
+    {
+        Number,
+        String,
+        Boolean,
+        Error,
+        Missing,
+        Reference,
+        Name,
+        Function,
+        UnaryOperator,
+        BinaryOperator,
+        Percent,
+        Parenthesis
+    };
+
+    FormulaNode() : type(Missing), argumentCount(0) {}
+
+    Type type;
+    int argumentCount;  //function arguments
+    FormulaToken token;
+};
+
+/*
+ * An immutable parsed formula, kept as a list of nodes in reverse polish
+ * order. It doesn't depend on the cell holding it, so one instance serves
+ * all the cells of a shared formula.
+ */
+class ParsedFormula
+{
+public:
+    ParsedFormula(const QVector<FormulaNode> &nodes, bool valid);
+
+    inline bool isValid() const { return m_valid; }
+    inline const QVector<FormulaNode> &nodes() const { return m_nodes; }
+    bool isCellIndependent() const;
+
+    QString formulaText(const CellReference &cell) const;
+
+    static QString referenceText(const FormulaToken &token, const CellReference &cell);
+
+private:
+    QVector<FormulaNode> m_nodes;
+    bool m_valid;
+};
+
+/*
+ * A formula split into its text and its references, the latter kept as
+ * offsets from the cell it was written in. The text as written in another
+ * cell is produced in a single pass, for the followers of shared formulas.
+ */
+class FormulaTemplate
+{
+public:
+    FormulaTemplate() : m_valid(false) {}
+    FormulaTemplate(const QString &formula, const CellReference &cell);
+
+    inline bool isValid() const { return m_valid; }
+    QString formulaText(const CellReference &cell) const;
+
+private:
+    QString m_text;
+    QVector<FormulaToken> m_references;
+    bool m_valid;
+};
+
+/*
+ * Parsed formulas of a document, keyed by their cell independent form.
+ * "=A1+1" in B1 and "=A2+1" in B2 are parsed only once.
+ */
+class FormulaCache
+{
+public:
+    QSharedPointer<const ParsedFormula> parse(const QString &formula, const CellReference &cell);
+
+    int count() const;
+    void clear();
+
+private:
+    QHash<QString, QSharedPointer<const ParsedFormula> > m_formulas;
+};
+
+QT_END_NAMESPACE_XLSX
+
+#endif // QXLSX_FORMULAPARSER_P_H
@@ -7,38 +7,66 @@
 
 #include <QString>
 #include <QByteArray>
+#include <QImage>
+#include <QMutex>
+#include <QSharedPointer>
 
 QT_BEGIN_NAMESPACE_XLSX
 
+class ImageEncoding;
+class ZipReader;
+
 class MediaFile
 {
 public:
     MediaFile(const QString &fileName);
     MediaFile(const QByteArray &bytes, const QString &suffix, const QString &mimeType=QString());
+    MediaFile(const QImage &image);
 
 public:
     void set(const QByteArray &bytes, const QString &suffix, const QString &mimeType=QString());
+    void setSource(const QSharedPointer<ZipReader> &package, const QString &suffix, const QString &mimeType=QString());
     QString suffix() const;
     QString mimeType() const;
     QByteArray contents() const;
+    QByteArray readContents() const;
+    qint64 size() const;
 
     bool isIndexValid() const;
     int index() const;
     void setIndex(int idx);
-    QByteArray hashKey() const;
+    quint64 hashKey() const;
 
     void setFileName(const QString &name);
     QString fileName() const;
 
+    bool isPending() const;
+    bool isInPackage() const;
+    qint64 imageKey() const;
+
+    static bool imageFormat(const QByteArray &bytes, QString &suffix, QString &mimeType);
+
 protected:
+    void waitForContents() const;
+
     QString m_fileName;
-    QByteArray m_contents;
+    mutable QByteArray m_contents;
     QString m_suffix;
     QString m_mimeType;
 
     int m_index;
     bool m_indexValid;
-    QByteArray m_hashKey;
+    mutable quint64 m_hashKey;
+
+    //contents still being produced, taken over by waitForContents()
+    mutable QSharedPointer<ImageEncoding> m_encoding;
+    mutable QMutex m_mutex;
+    qint64 m_imageKey;
+
+    //contents left in the loaded package, read by waitForContents()
+    mutable QSharedPointer<ZipReader> m_package;
+    QString m_packagePath;
+    qint64 m_packageSize;
 };
 
 QT_END_NAMESPACE_XLSX
@@ -0,0 +1,144 @@
+// xlsxnumberformatter_p.h
+
+#ifndef QXLSX_NUMBERFORMATTER_P_H
+#define QXLSX_NUMBERFORMATTER_P_H
+
+//
+//  W A R N I N G
+//  -------------
+//
+// This file is not part of the Qt Xlsx API.  It exists for the convenience
+// of the Qt Xlsx.  This header file may change from
+// version to version without notice, or even be removed.
+//
+// We mean it.
+//
+
+#include <QtGlobal>
+#include <QString>
+#include <QVariant>
+#include <QVector>
+#include <QColor>
+
+#include "xlsxglobal.h"
+
+QT_BEGIN_NAMESPACE_XLSX
+
+class NumberFormatter
+{
+public:
+    explicit NumberFormatter(const QString &formatCode);
+
+    QString formatCode() const { return m_formatCode; }
+
+    QString format(const QVariant &value, bool date1904 = false, QColor *color = nullptr) const;
+    QString formatNumber(double value, bool date1904 = false, QColor *color = nullptr) const;
+    QString formatText(const QString &text, QColor *color = nullptr) const;
+
+    static QString builtinFormatCode(int numFmtId);
+    static QString generalNumber(double value);
+
+private:
+    enum TokenType
+    {
+        Literal,
+        General,
+        TextValue,
+        Digit,
+        DecimalPoint,
+        Thousands,
+        Percent,
+        Exponent,
+        FractionSlash,
+        Denominator,
+        Year,
+        Month,
+        Day,
+        Hour,
+        Minute,
+        Second,
+        SubSecond,
+        ElapsedHour,
+        ElapsedMinute,
+        ElapsedSecond,
+        AmPm
+    };
+
+    enum Zone
+    {
+        NoZone,
+        IntegerZone,
+        DecimalZone,
+        ExponentZone,
+        NumeratorZone,
+        DenominatorZone
+    };
+
+    enum Condition
+    {
+        NoCondition,
+        LessThan,
+        LessEqual,
+        GreaterThan,
+        GreaterEqual,
+        Equal,
+        NotEqual
+    };
+
+    struct Token
+    {
+        Token(TokenType type = Literal, const QString &text = QString(), int width = 1)
+            : type(type), zone(NoZone), width(width), text(text) {}
+
+        TokenType type;
+        Zone zone;
+        int width;      //run length of date/time tokens
+        QString text;   //literal text, placeholder char or exponent sign
+    };
+
+    struct Section
+    {
+        Section();
+
+        bool matches(double value) const;
+
+        QVector<Token> tokens;
+        QColor color;
+        Condition condition;
+        double conditionValue;
+        bool isDateTime;
+        bool isText;
+        bool hasAmPm;
+        bool thousands;
+        bool hasExponent;
+        bool hasFraction;
+        bool hasDigits;
+        double multiplier;
+        int decimalDigits;
+        int integerDigits;
+        int denominatorDigits;
+        int fixedDenominator;
+        int subSecondDigits;
+        bool engineering;
+    };
+
+    static Section compileSection(const QString &code);
+    static void resolveNumberTokens(Section &section);
+    static void fillDigits(const QVector<Token> &tokens, Zone zone, const QString &digits,
+                           QVector<QString> &parts, bool group);
+    static void fillLeftDigits(const QVector<Token> &tokens, Zone zone, const QString &digits,
+                               QVector<QString> &parts, bool trimZeros);
+
+    QString renderNumber(const Section &section, double value) const;
+    QString renderFraction(const Section &section, double value) const;
+    QString renderDateTime(const Section &section, double value, bool date1904) const;
+    QString renderText(const Section &section, const QString &text) const;
+
+    QString m_formatCode;
+    QVector<Section> m_sections;
+    int m_textSection;
+};
+
+QT_END_NAMESPACE_XLSX
+
+#endif // QXLSX_NUMBERFORMATTER_P_H
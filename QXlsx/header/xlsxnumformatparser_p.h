@@ -43,7 +43,18 @@ QT_BEGIN_NAMESPACE_XLSX
 class NumFormatParser
 {
 public:
+    enum Kind
+    {
+        NumberKind,
+        TextKind,
+        DateKind,
+        TimeKind,
+        DateTimeKind
+    };
+
     static bool isDateTime(const QString &formatCode);
+    static Kind kind(const QString &formatCode);
+    static Kind builtinKind(int numFmtId);
 };
 
 QT_END_NAMESPACE_XLSX
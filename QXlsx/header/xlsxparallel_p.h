@@ -0,0 +1,30 @@
+// xlsxparallel_p.h
+
+#ifndef QXLSX_PARALLEL_P_H
+#define QXLSX_PARALLEL_P_H
+
+//
+//  W A R N I N G
+//  -------------
+//
+// This file is not part of the Qt Xlsx API.  It exists for the convenience
+// of the Qt Xlsx.  This header file may change from
+// version to version without notice, or even be removed.
+//
+// We mean it.
+//
+
+#include <QtGlobal>
+
+#include <functional>
+
+#include "xlsxglobal.h"
+
+QT_BEGIN_NAMESPACE_XLSX
+
+int chunkWorkerCount(int chunks);
+void runChunked(int chunks, const std::function<void(int chunk, int worker)> &work);
+
+QT_END_NAMESPACE_XLSX
+
+#endif // QXLSX_PARALLEL_P_H
@@ -0,0 +1,71 @@
+// xlsxrangeindex_p.h
+
+#ifndef XLSXRANGEINDEX_H
+#define XLSXRANGEINDEX_H
+
+//
+//  W A R N I N G
+//  -------------
+//
+// This file is not part of the Qt Xlsx API.  It exists for the convenience
+// of the Qt Xlsx.  This header file may change from
+// version to version without notice, or even be removed.
+//
+// We mean it.
+//
+
+#include <QtGlobal>
+#include <QVector>
+
+#include "xlsxglobal.h"
+#include "xlsxcellrange.h"
+
+QT_BEGIN_NAMESPACE_XLSX
+
+/*
+ * An R-tree of cell ranges, each one stored with an int value. Finds the
+ * ranges holding a cell or overlapping a range in logarithmic time.
+ */
+class RangeIndex
+{
+public:
+    RangeIndex();
+
+    void insert(const CellRange &range, int value);
+    bool remove(const CellRange &range, int value);
+    void clear();
+
+    inline int size() const { return m_size; }
+    inline bool isEmpty() const { return m_size == 0; }
+
+    QVector<int> find(int row, int column) const;
+    QVector<int> find(const CellRange &range) const;
+    bool intersects(const CellRange &range) const;
+
+private:
+    struct Node
+    {
+        int parent;
+        bool leaf;
+        QVector<CellRange> boxes;
+        QVector<int> items; // child nodes, or values in leaves
+    };
+
+    int newNode(bool leaf, int parent);
+    void freeNode(int node);
+    int chooseLeaf(const CellRange &range) const;
+    int findLeaf(const CellRange &range, int value, int &position) const;
+    void append(int node, const CellRange &range, int item);
+    void split(int node);
+    void updateBounds(int node);
+    void collectEntries(int node, QVector<CellRange> &ranges, QVector<int> &values);
+
+    QVector<Node> m_nodes;
+    QVector<int> m_freeNodes;
+    int m_root;
+    int m_size;
+};
+
+QT_END_NAMESPACE_XLSX
+
+#endif // XLSXRANGEINDEX_H
@@ -0,0 +1,66 @@
+// xlsxsheetshift_p.h
+
+#ifndef QXLSX_SHEETSHIFT_P_H
+#define QXLSX_SHEETSHIFT_P_H
+
+//
+//  W A R N I N G
+//  -------------
+//
+// This file is not part of the Qt Xlsx API.  It exists for the convenience
+// of the Qt Xlsx.  This header file may change from
+// version to version without notice, or even be removed.
+//
+// We mean it.
+//
+
+#include <QtGlobal>
+#include <QString>
+
+#include "xlsxglobal.h"
+#include "xlsxcellrange.h"
+#include "xlsxcellreference.h"
+
+QT_BEGIN_NAMESPACE_XLSX
+
+/*
+ * Rows or columns inserted into or deleted from a sheet. Maps the positions
+ * before the change to the ones after it, and moves the references of
+ * formulas the same way. A positive count inserts, a negative one deletes.
+ */
+class SheetShift
+{
+public:
+    enum Axis
+    {
+        Rows,
+        Columns
+    };
+
+    SheetShift(Axis axis, int first, int count);
+
+    inline Axis axis() const { return m_axis; }
+    inline int first() const { return m_first; }
+    inline int count() const { return m_count; }
+    inline int limit() const { return m_limit; }
+
+    int shifted(int index) const;
+    bool shiftSpan(int &first, int &last) const;
+    CellReference shifted(const CellReference &cell) const;
+    CellRange shifted(const CellRange &range) const;
+
+    QString shiftedFormula(const QString &formula, const CellReference &oldCell, const CellReference &newCell,
+                           const QString &sheetName, bool onSheet) const;
+
+    static bool refersToSheet(const QString &formula, const QString &sheetName, bool onSheet);
+
+private:
+    Axis m_axis;
+    int m_first;
+    int m_count;
+    int m_limit;
+};
+
+QT_END_NAMESPACE_XLSX
+
+#endif // QXLSX_SHEETSHIFT_P_H
@@ -38,8 +38,10 @@
 
 #include <QSharedPointer>
 #include <QHash>
+#include <QMutex>
 #include <QList>
 #include <QMap>
+#include <QSet>
 #include <QStringList>
 #include <QVector>
 #include <QXmlStreamWriter>
@@ -50,6 +52,8 @@
 
 #include "xlsxglobal.h"
 #include "xlsxformat.h"
+#include "xlsxnumformatparser_p.h"
+#include "xlsxnumberformatter_p.h"
 #include "xlsxabstractooxmlfile.h"
 
 QT_BEGIN_NAMESPACE_XLSX
@@ -72,6 +76,15 @@ public:
     ~Styles();
     void addXfFormat(const Format &format, bool force=false);
     Format xfFormat(int idx) const;
+    StyleId intern(const Format &format);
+    NumFormatParser::Kind xfNumberKind(int idx) const;
+    bool isDateTimeXf(int idx) const;
+    QSharedPointer<const NumberFormatter> numberFormatter(int idx) const;
+    static QString numberFormatCode(const Format &format);
+
+    void pruneUnusedStyles(const QSet<int> &usedXfIndexes);
+    void clearPruning();
+    int savedXfIndex(int xfIndex) const;
     void addDxfFormat(const Format &format, bool force=false);
     Format dxfFormat(int idx) const;
 
@@ -87,6 +100,7 @@ private:
     // friend class ::StylesTest;
 
     void fixNumFmt(const Format &format);
+    static NumFormatParser::Kind numberKind(const Format &format);
 
     void writeNumFmts(QXmlStreamWriter &writer) const;
     void writeFonts(QXmlStreamWriter &writer) const;
@@ -117,6 +131,9 @@ private:
 
     bool readCellStyleXfs(QXmlStreamReader &reader);
 
+    static QHash<quint64, Format>::const_iterator findFormat(const QHash<quint64, Format> &hash, quint64 key,
+                                                           const Format &format, int startId, int endId);
+
     QHash<QString, int> m_builtinNumFmtsHash;
     QMap<int, QSharedPointer<XlsxFormatNumberData> > m_customNumFmtIdMap;
     QHash<QString, QSharedPointer<XlsxFormatNumberData> > m_customNumFmtsHash;
@@ -124,20 +141,33 @@ private:
     QList<Format> m_fontsList;
     QList<Format> m_fillsList;
     QList<Format> m_bordersList;
-    QHash<QByteArray, Format> m_fontsHash;
-    QHash<QByteArray, Format> m_fillsHash;
-    QHash<QByteArray, Format> m_bordersHash;
+    QHash<quint64, Format> m_fontsHash;
+    QHash<quint64, Format> m_fillsHash;
+    QHash<quint64, Format> m_bordersHash;
 
     QVector<QColor> m_indexedColors;
     bool m_isIndexedColorsDefault;
 
     QList<Format> m_xf_formatsList;
-    QHash<QByteArray, Format> m_xf_formatsHash;
+    QHash<quint64, Format> m_xf_formatsHash;
+    //NumFormatParser::Kind of each xf, so that readers don't parse number formats per cell.
+    QVector<quint8> m_xfNumberKinds;
+    //Compiled number formats, by numFmt id. Filled on first use, under the mutex.
+    mutable QHash<int, QSharedPointer<const NumberFormatter> > m_numberFormatters;
+    mutable QMutex m_numberFormattersMutex;
 
     QList<Format> m_dxf_formatsList;
-    QHash<QByteArray, Format> m_dxf_formatsHash;
+    QHash<quint64, Format> m_dxf_formatsHash;
 
     bool m_emptyFormatAdded;
+
+    //Old index -> written index, -1 when dropped. Only set while
+    //saving with pruneUnusedStyles().
+    QVector<int> m_xfSaveMap;
+    QVector<int> m_fontSaveMap;
+    QVector<int> m_fillSaveMap;
+    QVector<int> m_borderSaveMap;
+    QSet<int> m_usedNumFmtIds;
 };
 
 QT_END_NAMESPACE_XLSX
@@ -14,6 +14,7 @@
 #include <QDate>
 #include <QTime>
 #include <QVariant>
+#include <QVector>
 
 #include "xlsxglobal.h"
 
@@ -26,9 +27,18 @@ bool parseXsdBoolean(const QString &value, bool defaultValue=false);
 QStringList splitPath(const QString &path);
 QString getRelFilePath(const QString &filePath);
 
+qint64 daysFromCivil(int year, int month, int day);
+void civilFromDays(qint64 days, int &year, int &month, int &day);
+double serialFromCivil(int year, int month, int day, bool is1904=false);
+void civilFromSerial(qint64 serial, bool is1904, int &year, int &month, int &day);
+
+double dateToNumber(const QDate &date, bool is1904=false);
 double datetimeToNumber(const QDateTime &dt, bool is1904=false);
 QVariant datetimeFromNumber(double num, bool is1904=false);
+QDateTime datetimeFromSerial(double num, bool is1904=false, Qt::TimeSpec spec=Qt::LocalTime);
 double timeToNumber(const QTime &t);
+QVector<double> datetimesToNumbers(const QVector<QDateTime> &dateTimes, bool is1904=false);
+QVector<QDateTime> datetimesFromNumbers(const QVector<double> &numbers, bool is1904=false, Qt::TimeSpec spec=Qt::LocalTime);
 
 QString createSafeSheetName(const QString &nameProposal);
 QString escapeSheetName(const QString &sheetName);
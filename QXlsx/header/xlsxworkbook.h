@@ -27,6 +27,8 @@ class Chart;
 class Chartsheet;
 class Worksheet;
 class WorkbookPrivate;
+class FormulaCache;
+class FormulaEngine;
 
 class QXLSX_EXPORT Workbook : public AbstractOOXmlFile
 {
@@ -57,11 +59,16 @@ public:
     void setStringsToHyperlinksEnabled(bool enable=true);
     bool isHtmlToRichStringEnabled() const;
     void setHtmlToRichStringEnabled(bool enable=true);
+    bool isUnusedStylesPruningEnabled() const;
+    void setUnusedStylesPruningEnabled(bool enable=true);
+    bool isParallelCalculationEnabled() const;
+    void setParallelCalculationEnabled(bool enable=true);
     QString defaultDateFormat() const;
     void setDefaultDateFormat(const QString &format);
 
     //internal used member
     void addMediaFile(QSharedPointer<MediaFile> media, bool force=false);
+    QSharedPointer<MediaFile> addImageFile(const QImage &image);
     QList<QSharedPointer<MediaFile> > mediaFiles() const;
     void addChartFile(QSharedPointer<Chart> chartFile);
     QList<QSharedPointer<Chart> > chartFiles() const;
@@ -72,6 +79,8 @@ private:
     friend class WorksheetPrivate;
     friend class Document;
     friend class DocumentPrivate;
+    friend class Cell;
+    friend class FormulaEngine;
 
     Workbook(Workbook::CreateFlag flag);
 
@@ -80,6 +89,8 @@ private:
 
     SharedStrings *sharedStrings() const;
     Styles *styles();
+    FormulaCache *formulaCache();
+    FormulaEngine *formulaEngine();
     Theme *theme();
     QList<QImage> images();
     QList<Drawing *> drawings();
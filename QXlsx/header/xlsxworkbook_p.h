@@ -5,6 +5,7 @@
 
 #include <QtGlobal>
 #include <QSharedPointer>
+#include <QHash>
 #include <QStringList>
 
 #include "xlsxworkbook.h"
@@ -12,6 +13,8 @@
 #include "xlsxtheme_p.h"
 #include "xlsxsimpleooxmlfile_p.h"
 #include "xlsxrelationships_p.h"
+#include "xlsxformulaparser_p.h"
+#include "xlsxformulaengine_p.h"
 
 QT_BEGIN_NAMESPACE_XLSX
 
@@ -45,12 +48,20 @@ public:
     QSharedPointer<Styles> styles;
     QSharedPointer<Theme> theme;
     QList<QSharedPointer<MediaFile> > mediaFiles;
+    QHash<quint64, int> mediaHashes; // content hash to position in mediaFiles
+    int mediaHashed;                 // mediaFiles before it are in mediaHashes or mediaSizes
+    QMultiHash<qint64, int> mediaSizes; // size to position of the files not read from the package
+    QHash<qint64, int> mediaImageKeys; // QImage::cacheKey() to position in mediaFiles
     QList<QSharedPointer<Chart> > chartFiles;
     QList<XlsxDefineNameData> definedNamesList;
+    FormulaCache formulaCache;
+    FormulaEngine formulaEngine;
 
     bool strings_to_numbers_enabled;
     bool strings_to_hyperlinks_enabled;
     bool html_to_richstring_enabled;
+    bool unused_styles_pruning_enabled;
+    bool parallel_calculation_enabled;
     bool date1904;
     QString defaultDateFormat;
 
@@ -31,11 +31,31 @@ class Format;
 class Drawing;
 class DataValidation;
 class ConditionalFormatting;
+struct CellConditionalFormat;
+struct DataValidationViolation;
 class CellRange;
 class RichString;
 class Relationships;
 class Chart;
 
+/*
+ * A picture of a worksheet as stored in the package, see Worksheet::images().
+ */
+struct QXLSX_EXPORT WorksheetImage
+{
+    WorksheetImage()
+        : index(0), row(-1), column(-1)
+    {
+    }
+
+    int index;          //as taken by Worksheet::getImage()
+    int row;            //cell of the top left corner, -1 for absolute anchors
+    int column;
+    QByteArray data;    //encoded
+    QString suffix;
+    QString mimeType;
+};
+
 class WorksheetPrivate;
 class QXLSX_EXPORT Worksheet : public AbstractSheet
 {
@@ -44,6 +64,9 @@ class QXLSX_EXPORT Worksheet : public AbstractSheet
 private:
     friend class DocumentPrivate;
     friend class Workbook;
+    friend class FormulaEngine;
+    friend class ChartPrivate;
+    friend class WorksheetPrivate;
     friend class ::WorksheetTest;
     Worksheet(const QString &sheetName, int sheetId, Workbook *book, CreateFlag flag);
     Worksheet *copy(const QString &distName, int distId) const override;
@@ -80,6 +103,16 @@ public:
         NA
     };
 
+    enum AggregateFunction
+    {
+        AggregateSum,
+        AggregateAverage,
+        AggregateMin,
+        AggregateMax,
+        AggregateCount,
+        AggregateCountA
+    };
+
     // printOptions
     bool isPrintHorizontalCentered() const;
     void setPrintHorizontalCentered(bool centered);
@@ -137,39 +170,54 @@ public:
     void setPrintCopies(quint32 copies);
     bool write(const CellReference &row_column, const QVariant &value, const Format &format=Format());
     bool write(int row, int column, const QVariant &value, const Format &format=Format());
+    bool write(int row, int column, const QVariant &value, StyleId style);
+
+    StyleId internStyle(const Format &format);
 
     QVariant read(const CellReference &row_column) const;
     QVariant read(int row, int column) const;
+    QList<QStringList> formatRange(const CellRange &range) const;
+    QVariant aggregate(const CellRange &range, AggregateFunction function) const;
 
     bool writeString(const CellReference &row_column, const QString &value, const Format &format=Format());
     bool writeString(int row, int column, const QString &value, const Format &format=Format());
     bool writeString(const CellReference &row_column, const RichString &value, const Format &format=Format());
     bool writeString(int row, int column, const RichString &value, const Format &format=Format());
+    bool writeString(int row, int column, const QString &value, StyleId style);
+    bool writeString(int row, int column, const RichString &value, StyleId style);
 
     bool writeInlineString(const CellReference &row_column, const QString &value, const Format &format=Format());
     bool writeInlineString(int row, int column, const QString &value, const Format &format=Format());
+    bool writeInlineString(int row, int column, const QString &value, StyleId style);
 
     bool writeNumeric(const CellReference &row_column, double value, const Format &format=Format());
     bool writeNumeric(int row, int column, double value, const Format &format=Format());
+    bool writeNumeric(int row, int column, double value, StyleId style);
 
     bool writeFormula(const CellReference &row_column, const CellFormula &formula, const Format &format=Format(), double result=0);
     bool writeFormula(int row, int column, const CellFormula &formula, const Format &format=Format(), double result=0);
+    bool writeFormula(int row, int column, const CellFormula &formula, StyleId style, double result=0);
 
     bool writeBlank(const CellReference &row_column, const Format &format=Format());
     bool writeBlank(int row, int column, const Format &format=Format());
+    bool writeBlank(int row, int column, StyleId style);
 
     bool writeBool(const CellReference &row_column, bool value, const Format &format=Format());
     bool writeBool(int row, int column, bool value, const Format &format=Format());
+    bool writeBool(int row, int column, bool value, StyleId style);
 
     bool writeDateTime(const CellReference &row_column, const QDateTime& dt, const Format &format=Format());
     bool writeDateTime(int row, int column, const QDateTime& dt, const Format &format=Format());
+    bool writeDateTime(int row, int column, const QDateTime& dt, StyleId style);
 
     // dev67
     bool writeDate(const CellReference &row_column, const QDate& dt, const Format &format=Format());
     bool writeDate(int row, int column, const QDate& dt, const Format &format=Format());
+    bool writeDate(int row, int column, const QDate& dt, StyleId style);
 
     bool writeTime(const CellReference &row_column, const QTime& t, const Format &format=Format());
     bool writeTime(int row, int column, const QTime& t, const Format &format=Format());
+    bool writeTime(int row, int column, const QTime& t, StyleId style);
 
     bool writeHyperlink(const CellReference &row_column, const QUrl &url, const Format &format=Format(), const QString &display=QString(), const QString &tip=QString());
     bool writeHyperlink(int row, int column, const QUrl &url, const Format &format=Format(), const QString &display=QString(), const QString &tip=QString());
@@ -181,15 +229,27 @@ public:
     Cell *cellAt(int row, int column) const;
 
     int insertImage(int row, int column, const QImage &image);
+    int insertImage(int row, int column, const QByteArray &encodedImage);
     bool getImage(int imageIndex, QImage& img);
     bool getImage(int row, int column, QImage& img);
     uint getImageCount();
+    QList<WorksheetImage> images() const;
 
     Chart *insertChart(int row, int column, const QSize &size);
 
     bool mergeCells(const CellRange &range, const Format &format=Format());
     bool unmergeCells(const CellRange &range);
     QList<CellRange> mergedCells() const;
+    CellRange mergedRangeAt(int row, int column) const;
+    QList<DataValidation> dataValidationsAt(int row, int column) const;
+    QList<DataValidationViolation> validate(const CellRange &range) const;
+    QList<ConditionalFormatting> conditionalFormattingsAt(int row, int column) const;
+    QList<CellConditionalFormat> conditionalFormats(const CellRange &range) const;
+
+    bool insertRows(int row, int count = 1);
+    bool deleteRows(int row, int count = 1);
+    bool insertColumns(int column, int count = 1);
+    bool deleteColumns(int column, int count = 1);
 
     bool setColumnWidth(const CellRange& range, double width);
     bool setColumnFormat(const CellRange& range, const Format &format);
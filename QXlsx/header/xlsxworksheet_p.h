@@ -7,6 +7,10 @@
 #include <QObject>
 #include <QString>
 #include <QVector>
+#include <QSet>
+#include <QPair>
+#include <QAtomicInt>
+#include <QMutex>
 #include <QImage>
 #include <QSharedPointer>
 
@@ -16,12 +20,17 @@
 #include <QRegExp>
 #endif
 
+#include <limits>
+
 #include "xlsxworksheet.h"
 #include "xlsxabstractsheet_p.h"
 #include "xlsxcell.h"
 #include "xlsxdatavalidation.h"
 #include "xlsxconditionalformatting.h"
 #include "xlsxcellformula.h"
+#include "xlsxformulaparser_p.h"
+#include "xlsxsheetshift_p.h"
+#include "xlsxrangeindex_p.h"
 
 class QXmlStreamWriter;
 class QXmlStreamReader;
@@ -241,6 +250,32 @@ struct XlsxPageSetup
     QString rID;
 };
 
+// Running totals of the cells of one or more ranges, see
+// WorksheetPrivate::aggregateRange().
+struct XlsxAggregateData
+{
+    XlsxAggregateData()
+        :sum(0), minimum(std::numeric_limits<double>::infinity()),
+          maximum(-std::numeric_limits<double>::infinity()), numbers(0), nonBlank(0)
+    {
+    }
+
+    double sum;
+    double minimum;
+    double maximum;
+    qint64 numbers;     //numeric cells
+    qint64 nonBlank;    //cells holding any value
+    QString error;      //first error code met
+};
+
+// Filled-down formulas of one column, saved as a shared formula. Keyed by
+// their first row in WorksheetPrivate::sharedFormulaRuns.
+struct XlsxSharedFormulaRun
+{
+    int lastRow;
+    int si;
+};
+
 // #ifndef QMapIntSharedPointerCell
 // typedef QMap<int, QSharedPointer<Cell> > QMapIntSharedPointerCell;
 // #endif
@@ -256,13 +291,25 @@ public:
 public:
     int checkDimensions(int row, int col, bool ignore_row=false, bool ignore_col=false);
     Format cellFormat(int row, int col) const;
+    void collectXfIndexes(QSet<int> &xfIndexes) const;
+    StyleId dateTimeStyle(StyleId style, const QString &numFmt);
     QString generateDimensionString() const;
     void calculateSpans() const;
     void splitColsInfo(int colFirst, int colLast);
     void validateDimension();
+    void aggregateRange(const CellRange &range, XlsxAggregateData &data) const;
+    void collectCells(const CellRange &range, QVector<const Cell *> &cells) const;
+    void buildRangeIndexes() const;
+    bool shiftCells(const SheetShift &shift);
+    void shiftFormulas(const SheetShift &shift, const QString &sheetName, bool onSheet,
+                       const QVector<CellReference> &cells);
+    void unshareFormulas(const SheetShift &shift, const QString &sheetName, bool onSheet);
 
     void saveXmlSheetData(QXmlStreamWriter &writer) const;
     void saveXmlCellData(QXmlStreamWriter &writer, int row, int col, QSharedPointer<Cell> cell) const;
+    void addSharedFormula(int si, const CellFormula &formula);
+    void collectSharedFormulaRuns() const;
+    void saveXmlCellFormula(QXmlStreamWriter &writer, int row, int col, const Cell *cell) const;
     void saveXmlMergeCells(QXmlStreamWriter &writer) const;
     void saveXmlHyperlinks(QXmlStreamWriter &writer) const;
     void saveXmlDrawings(QXmlStreamWriter &writer) const;
@@ -308,13 +355,21 @@ public:
 
     QList<DataValidation> dataValidationsList;
     QList<ConditionalFormatting> conditionalFormattingList;
+    mutable RangeIndex mergeIndex; // positions in merges, built when first searched
+    mutable RangeIndex validationIndex; // positions in dataValidationsList
+    mutable RangeIndex formattingIndex; // positions in conditionalFormattingList
+    mutable QAtomicInt rangeIndexesValid;
+    mutable QMutex rangeIndexesMutex; // serializes the lazy build of the indexes above
 
     QMap<int, CellFormula> sharedFormulaMap; // shared formula map
+    QMap<int, FormulaTemplate> sharedFormulaTemplates; // followers' formulas, by shared index
 
     CellRange dimension;
     int previous_row;
 
     mutable QMap<int, QString> row_spans;
+    mutable QHash<int, QMap<int, XlsxSharedFormulaRun> > sharedFormulaRuns; // by column and first row, while saving
+    QHash<QPair<int, QString>, StyleId> dateTimeStyles; // by source xf and number format, see dateTimeStyle()
     QMap<int, double> row_sizes;
     QMap<int, double> col_sizes;
 
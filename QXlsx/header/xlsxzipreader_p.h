@@ -6,6 +6,9 @@
 #include <QScopedPointer>
 #include <QStringList>
 #include <QIODevice>
+#include <QBuffer>
+#include <QHash>
+#include <QMutex>
 
 #include "xlsxglobal.h"
 
@@ -22,16 +25,23 @@ class  ZipReader
 public:
     explicit ZipReader(const QString &fileName);
     explicit ZipReader(QIODevice *device);
+    explicit ZipReader(const QByteArray &data);
     ~ZipReader();
     bool exists() const;
     QStringList filePaths() const;
     QByteArray fileData(const QString &fileName) const;
+    qint64 fileSize(const QString &fileName) const;
+    void releaseFile();
 
 private:
     Q_DISABLE_COPY(ZipReader)
     void init();
-    QScopedPointer<QZipReader> m_reader;
+    QScopedPointer<QBuffer> m_buffer;
+    QScopedPointer<QZipReader> m_reader;   //null once the file is released
+    QString m_filePath;
     QStringList m_filePaths;
+    QHash<QString, qint64> m_fileSizes;
+    mutable QMutex m_mutex;
 };
 
 QT_END_NAMESPACE_XLSX
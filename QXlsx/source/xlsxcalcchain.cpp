@@ -0,0 +1,78 @@
+// xlsxcalcchain.cpp
+
+#include "xlsxcalcchain_p.h"
+
+#include <QXmlStreamWriter>
+#include <QXmlStreamReader>
+#include <QIODevice>
+
+QT_BEGIN_NAMESPACE_XLSX
+
+CalcChain::CalcChain(CreateFlag flag)
+    :AbstractOOXmlFile(flag)
+{
+}
+
+void CalcChain::addCell(int sheetId, const CellReference &cell, bool array)
+{
+    Entry entry;
+    entry.sheetId = sheetId;
+    entry.cell = cell;
+    entry.array = array;
+    m_entries.append(entry);
+}
+
+bool CalcChain::isEmpty() const
+{
+    return m_entries.isEmpty();
+}
+
+QVector<CalcChain::Entry> CalcChain::entries() const
+{
+    return m_entries;
+}
+
+void CalcChain::saveToXmlFile(QIODevice *device) const
+{
+    QXmlStreamWriter writer(device);
+
+    writer.writeStartDocument(QStringLiteral("1.0"), true);
+    writer.writeStartElement(QStringLiteral("calcChain"));
+    writer.writeAttribute(QStringLiteral("xmlns"), QStringLiteral("http://schemas.openxmlformats.org/spreadsheetml/2006/main"));
+
+    //The sheet id is only written when it differs from the previous cell.
+    int sheetId = -1;
+    for (const Entry &entry : m_entries) {
+        writer.writeEmptyElement(QStringLiteral("c"));
+        writer.writeAttribute(QStringLiteral("r"), entry.cell.toString());
+        if (entry.sheetId != sheetId) {
+            writer.writeAttribute(QStringLiteral("i"), QString::number(entry.sheetId));
+            sheetId = entry.sheetId;
+        }
+        if (entry.array)
+            writer.writeAttribute(QStringLiteral("a"), QStringLiteral("1"));
+    }
+
+    writer.writeEndElement(); //calcChain
+    writer.writeEndDocument();
+}
+
+bool CalcChain::loadFromXmlFile(QIODevice *device)
+{
+    QXmlStreamReader reader(device);
+    int sheetId = 1;
+    while (!reader.atEnd()) {
+        QXmlStreamReader::TokenType token = reader.readNext();
+        if (token == QXmlStreamReader::StartElement && reader.name() == QLatin1String("c")) {
+            QXmlStreamAttributes attributes = reader.attributes();
+            if (attributes.hasAttribute(QLatin1String("i")))
+                sheetId = attributes.value(QLatin1String("i")).toInt();
+            const QString array = attributes.value(QLatin1String("a")).toString();
+            addCell(sheetId, CellReference(attributes.value(QLatin1String("r")).toString()),
+                    array == QLatin1String("1") || array == QLatin1String("true"));
+        }
+    }
+    return !reader.hasError();
+}
+
+QT_END_NAMESPACE_XLSX
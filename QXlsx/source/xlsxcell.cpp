@@ -15,6 +15,7 @@
 #include "xlsxutility_p.h"
 #include "xlsxworksheet.h"
 #include "xlsxworkbook.h"
+#include "xlsxstyles_p.h"
 
 QT_BEGIN_NAMESPACE_XLSX
 
@@ -29,7 +30,6 @@ CellPrivate::CellPrivate(const CellPrivate * const cp)
     , cellType(cp->cellType)
     , value(cp->value)
     , formula(cp->formula)
-    , format(cp->format)
     , richString(cp->richString)
     , styleNumber(cp->styleNumber)
 {
@@ -56,6 +56,8 @@ CellPrivate::CellPrivate(const CellPrivate * const cp)
 /*!
  * \internal
  * Created by Worksheet only.
+ * The cell only keeps the xf index of its style: \a styleIndex if given,
+ * otherwise the one already assigned to \a format by the workbook styles.
  */
 // qint32 styleIndex = (-1)
 Cell::Cell(const QVariant &data, 
@@ -67,9 +69,10 @@ Cell::Cell(const QVariant &data,
 {
 	d_ptr->value = data;
 	d_ptr->cellType = type;
-	d_ptr->format = format;
 	d_ptr->parent = parent;
-	d_ptr->styleNumber = styleIndex; 
+	d_ptr->styleNumber = styleIndex;
+	if (styleIndex < 0 && format.xfIndexValid() && !format.isEmpty())
+		d_ptr->styleNumber = format.xfIndex();
 }
 
 /*!
@@ -234,6 +237,51 @@ QVariant Cell::readValue() const
 	return ret;
 }
 
+/*!
+ * Returns the value of this Cell as Excel displays it, rendered with the
+ * number format of the cell's style. Booleans are shown as TRUE or FALSE,
+ * strings through the text section of the format.
+ */
+QString Cell::formattedText() const
+{
+	Q_D(const Cell);
+
+	if (d->cellType == BooleanType)
+		return d->value.toBool() ? QStringLiteral("TRUE") : QStringLiteral("FALSE");
+	if (d->cellType == ErrorType || !d->parent)
+		return d->value.toString();
+
+	Workbook *book = d->parent->workbook();
+	return d->formattedText(*book->styles()->numberFormatter(d->styleNumber), book->isDate1904());
+}
+
+/*!
+ * \internal
+ * Returns the value rendered with \a formatter, the number format of the
+ * cell, for callers resolving it once for many cells.
+ */
+QString CellPrivate::formattedText(const NumberFormatter &formatter, bool date1904) const
+{
+	if (cellType == Cell::BooleanType)
+		return value.toBool() ? QStringLiteral("TRUE") : QStringLiteral("FALSE");
+	if (cellType == Cell::ErrorType)
+		return value.toString();
+
+	if (cellType == Cell::SharedStringType ||
+			cellType == Cell::InlineStringType ||
+			cellType == Cell::StringType)
+	{
+		return formatter.formatText(value.toString());
+	}
+
+	// numbers of custom typed cells are kept as strings
+	bool ok = false;
+	const double number = value.toDouble(&ok);
+	if (ok)
+		return formatter.formatNumber(number, date1904);
+	return formatter.format(value, date1904);
+}
+
 /*!
  * Return the style used by this Cell. If no style used, 0 will be returned.
  */
@@ -241,7 +289,9 @@ Format Cell::format() const
 {
 	Q_D(const Cell);
 
-	return d->format;
+	if (d->styleNumber < 0 || !d->parent)
+		return Format();
+	return d->parent->workbook()->styles()->xfFormat(d->styleNumber);
 }
 
 /*!
@@ -274,8 +324,9 @@ bool Cell::isDateTime() const
 	Cell::CellType cellType = d->cellType;
     double dValue = d->value.toDouble(); // number
 //	QString strValue = d->value.toString().toUtf8();
-	bool isValidFormat = d->format.isValid();
-    bool isDateTimeFormat = d->format.isDateTimeFormat(); // datetime format
+    // datetime format, looked up in the per-xf table of the styles
+    bool isDateTimeFormat = d->parent
+            && d->parent->workbook()->styles()->isDateTimeXf(d->styleNumber);
 
     // dev67
     if ( cellType == NumberType ||
@@ -283,7 +334,6 @@ bool Cell::isDateTime() const
          cellType == CustomType )
     {
         if ( dValue >= 0 &&
-             isValidFormat &&
              isDateTimeFormat )
         {
             return true;
@@ -9,11 +9,58 @@
 
 #include "xlsxchart_p.h"
 #include "xlsxworksheet.h"
+#include "xlsxworksheet_p.h"
+#include "xlsxworkbook.h"
+#include "xlsxcell.h"
+#include "xlsxformat.h"
 #include "xlsxcellrange.h"
 #include "xlsxutility_p.h"
 
 QT_BEGIN_NAMESPACE_XLSX
 
+namespace {
+
+// Reads the number shown by a cell the way sheet aggregates do: loaded
+// numbers and formula results are kept untyped, dates count as serials.
+bool cellNumber(const Cell *cell, bool date1904, double &number)
+{
+    if (!cell)
+        return false;
+    switch (cell->cellType()) {
+    case Cell::BooleanType:
+    case Cell::ErrorType:
+    case Cell::SharedStringType:
+    case Cell::InlineStringType:
+    case Cell::StringType:
+        return false;
+    default:
+        break;
+    }
+
+    const QVariant value = cell->value();
+    switch (value.userType()) {
+    case QMetaType::UnknownType:
+    case QMetaType::Bool:
+        return false;
+    case QMetaType::QDateTime:
+        number = datetimeToNumber(value.toDateTime(), date1904);
+        return true;
+    case QMetaType::QDate:
+        number = dateToNumber(value.toDate(), date1904);
+        return true;
+    case QMetaType::QTime:
+        number = timeToNumber(value.toTime());
+        return true;
+    default: {
+        bool ok = false;
+        number = value.toDouble(&ok);
+        return ok;
+    }
+    }
+}
+
+} // namespace
+
 ChartPrivate::ChartPrivate(Chart *q, Chart::CreateFlag flag)
     : AbstractOOXmlFilePrivate(q, flag), chartType(static_cast<Chart::ChartType>(0))
 {
@@ -1294,6 +1341,7 @@ void ChartPrivate::saveXmlSer(QXmlStreamWriter &writer, XlsxSeries *ser, int id)
         writer.writeStartElement(QStringLiteral("c:tx"));
         writer.writeStartElement(QStringLiteral("c:strRef"));
         writer.writeTextElement(QStringLiteral("c:f"), header1);
+        saveXmlStrCache(writer, header1);
         writer.writeEndElement();
         writer.writeEndElement();
     }
@@ -1302,6 +1350,7 @@ void ChartPrivate::saveXmlSer(QXmlStreamWriter &writer, XlsxSeries *ser, int id)
         writer.writeStartElement(QStringLiteral("c:cat"));
         writer.writeStartElement(QStringLiteral("c:strRef"));
         writer.writeTextElement(QStringLiteral("c:f"), header2);
+        saveXmlStrCache(writer, header2);
         writer.writeEndElement();
         writer.writeEndElement();
     }
@@ -1333,6 +1382,7 @@ void ChartPrivate::saveXmlSer(QXmlStreamWriter &writer, XlsxSeries *ser, int id)
             writer.writeStartElement(QStringLiteral("c:val"));
         writer.writeStartElement(QStringLiteral("c:numRef"));
         writer.writeTextElement(QStringLiteral("c:f"), ser->numberDataSource_numRef);
+        saveXmlNumCache(writer, ser->numberDataSource_numRef);
         writer.writeEndElement();//c:numRef
         writer.writeEndElement();//c:val or c:yVal
     }
@@ -1340,6 +1390,118 @@ void ChartPrivate::saveXmlSer(QXmlStreamWriter &writer, XlsxSeries *ser, int id)
     writer.writeEndElement();//c:ser
 }
 
+/*!
+ * \internal
+ * Fills \a cells with the cells \a reference, such as Sheet1!$B$2:$B$9, is
+ * to, row by row, and returns their sheet. The rows are fetched once each
+ * rather than looking up the cells one at a time. Returns nullptr when the
+ * reference can't be resolved.
+ */
+const Worksheet *ChartPrivate::referencedCells(const QString &reference, QVector<const Cell *> &cells) const
+{
+    if (!sheet || !sheet->workbook())
+        return nullptr;
+
+    const int separator = reference.lastIndexOf(QLatin1Char('!'));
+    QString sheetName = separator == -1 ? sheet->sheetName() : reference.left(separator);
+    if (sheetName.startsWith(QLatin1Char('\'')))
+        sheetName = unescapeSheetName(sheetName);
+
+    const Workbook *workbook = sheet->workbook();
+    const Worksheet *worksheet = nullptr;
+    for (int i = 0; i < workbook->sheetCount(); ++i) {
+        AbstractSheet *candidate = workbook->sheet(i);
+        if (candidate->sheetType() == AbstractSheet::ST_WorkSheet
+                && candidate->sheetName().compare(sheetName, Qt::CaseInsensitive) == 0) {
+            worksheet = static_cast<const Worksheet *>(candidate);
+            break;
+        }
+    }
+    if (!worksheet)
+        return nullptr;
+
+    const CellRange range(reference.mid(separator + 1));
+    if (!range.isValid())
+        return nullptr;
+    worksheet->d_func()->collectCells(range, cells);
+    return worksheet;
+}
+
+/*!
+ * \internal
+ * Writes the values of the cells \a reference is to, so that the chart can
+ * be drawn by applications which don't read the sheet data. Every cell
+ * holding a number is written, whatever its cell type, with dates as their
+ * serial numbers. The number format of the first number is the one of the
+ * series, points with another one carry their own.
+ */
+void ChartPrivate::saveXmlNumCache(QXmlStreamWriter &writer, const QString &reference) const
+{
+    QVector<const Cell *> cells;
+    if (!referencedCells(reference, cells))
+        return;
+
+    const bool date1904 = sheet->workbook()->isDate1904();
+    double number = 0;
+    QString formatCode;
+    for (const Cell *cell : cells) {
+        if (cellNumber(cell, date1904, number)) {
+            formatCode = cell->format().numberFormat();
+            break;
+        }
+    }
+    if (formatCode.isEmpty())
+        formatCode = QStringLiteral("General");
+
+    writer.writeStartElement(QStringLiteral("c:numCache"));
+    writer.writeTextElement(QStringLiteral("c:formatCode"), formatCode);
+    writer.writeEmptyElement(QStringLiteral("c:ptCount"));
+    writer.writeAttribute(QStringLiteral("val"), QString::number(cells.size()));
+    for (int i = 0; i < cells.size(); ++i) {
+        const Cell *cell = cells[i];
+        if (!cellNumber(cell, date1904, number))
+            continue;
+
+        writer.writeStartElement(QStringLiteral("c:pt"));
+        writer.writeAttribute(QStringLiteral("idx"), QString::number(i));
+        QString pointFormat = cell->format().numberFormat();
+        if (pointFormat.isEmpty())
+            pointFormat = QStringLiteral("General");
+        if (pointFormat != formatCode)
+            writer.writeAttribute(QStringLiteral("formatCode"), pointFormat);
+        writer.writeTextElement(QStringLiteral("c:v"), QString::number(number, 'g', 15));
+        writer.writeEndElement();//c:pt
+    }
+    writer.writeEndElement();//c:numCache
+}
+
+/*!
+ * \internal
+ * Writes the texts of the cells \a reference is to, as they are displayed.
+ */
+void ChartPrivate::saveXmlStrCache(QXmlStreamWriter &writer, const QString &reference) const
+{
+    QVector<const Cell *> cells;
+    if (!referencedCells(reference, cells))
+        return;
+
+    writer.writeStartElement(QStringLiteral("c:strCache"));
+    writer.writeEmptyElement(QStringLiteral("c:ptCount"));
+    writer.writeAttribute(QStringLiteral("val"), QString::number(cells.size()));
+    for (int i = 0; i < cells.size(); ++i) {
+        if (!cells[i])
+            continue;
+        const QString text = cells[i]->formattedText();
+        if (text.isEmpty())
+            continue;
+        writer.writeStartElement(QStringLiteral("c:pt"));
+        writer.writeAttribute(QStringLiteral("idx"), QString::number(i));
+        writer.writeTextElement(QStringLiteral("c:v"), text);
+        writer.writeEndElement();//c:pt
+    }
+    writer.writeEndElement();//c:strCache
+}
+
 bool ChartPrivate::loadXmlAxisCatAx(QXmlStreamReader &reader)
 {
 
@@ -0,0 +1,268 @@
+// xlsxcolumnwidthcalculator.cpp
+
+#include <QtGlobal>
+#include <QCoreApplication>
+#include <QGuiApplication>
+#include <QFont>
+#include <QFontDatabase>
+#include <QThreadPool>
+#include <QStringList>
+
+#include <cmath>
+
+#include "xlsxcolumnwidthcalculator_p.h"
+#include "xlsxcell.h"
+#include "xlsxformat.h"
+#include "xlsxstyles_p.h"
+#include "xlsxnumberformatter_p.h"
+#include "xlsxparallel_p.h"
+
+QT_BEGIN_NAMESPACE_XLSX
+
+namespace {
+
+const int minParallelCells = 16384;
+const int defaultFontSize = 11;
+const double defaultDigitWidth = 7;     //pixels of a digit of 11pt Calibri at 96 dpi
+const double pi = 3.14159265358979323846;
+
+QFont cellFont(const Format &format)
+{
+    QFont font = format.font();
+    if (format.fontName().isEmpty())
+        font.setFamily(QStringLiteral("Calibri"));
+    if (format.fontSize() <= 0)
+        font.setPointSize(defaultFontSize);
+    return font;
+}
+
+inline double advance(const QFontMetricsF &metrics, const QString &text)
+{
+#if QT_VERSION >= QT_VERSION_CHECK(5, 11, 0)
+    return metrics.horizontalAdvance(text);
+#else
+    return metrics.width(text);
+#endif
+}
+
+} // namespace
+
+ColumnWidthCalculator::ColumnWidthCalculator(const CellTable &cells, Styles *styles, bool date1904, bool parallel)
+    : m_cells(cells), m_styles(styles), m_date1904(date1904), m_parallel(parallel)
+{
+    //Fonts can only be measured in GUI applications, the others estimate
+    //the widths from the number of characters.
+    m_useFonts = qobject_cast<QGuiApplication *>(QCoreApplication::instance()) != nullptr;
+    //Platforms without threaded font rendering measure on the calling thread.
+    if (m_useFonts && !QFontDatabase::supportsThreadedFontRendering())
+        m_parallel = false;
+}
+
+/*!
+ * \internal
+ * Returns the width needed by each column of \a range holding cells. Large
+ * ranges are split in blocks of columns measured by the threads of the
+ * global pool, where fonts can be used from several threads.
+ */
+QMap<int, double> ColumnWidthCalculator::widths(const CellRange &range) const
+{
+    QMap<int, double> result;
+    if (!range.isValid())
+        return result;
+
+    //Only the rows holding cells are visited.
+    QVector<int> rows;
+    int cellCount = 0;
+    auto rowIt = m_cells.lowerBound(range.firstRow());
+    for (; rowIt != m_cells.constEnd() && rowIt.key() <= range.lastRow(); ++rowIt) {
+        rows.append(rowIt.key());
+        cellCount += rowIt.value().size();
+    }
+
+    QThreadPool *pool = QThreadPool::globalInstance();
+    const int columns = range.columnCount();
+    if (!m_parallel || cellCount < minParallelCells || columns < 2 || pool->maxThreadCount() < 2) {
+        Measurer measurer(m_styles, m_date1904, m_useFonts);
+        measureColumns(measurer, rows, range.firstColumn(), range.lastColumn(), result);
+        return result;
+    }
+
+    //Blocks of columns are taken from a shared counter, each one keeps its own
+    //results. A thread keeps its measurer, and so its fonts, across its blocks.
+    const int chunkColumns = qMax(1, columns / (pool->maxThreadCount() * 4));
+    const int chunks = (columns + chunkColumns - 1) / chunkColumns;
+    QVector<QMap<int, double> > found(chunks);
+    QVector<QSharedPointer<Measurer> > measurers(chunkWorkerCount(chunks));
+    runChunked(chunks, [&](int chunk, int worker) {
+        QSharedPointer<Measurer> &measurer = measurers[worker];
+        if (measurer.isNull())
+            measurer = QSharedPointer<Measurer>(new Measurer(m_styles, m_date1904, m_useFonts));
+        const int first = range.firstColumn() + chunk * chunkColumns;
+        measureColumns(*measurer, rows, first, qMin(range.lastColumn(), first + chunkColumns - 1), found[chunk]);
+    });
+
+    for (const QMap<int, double> &widths : found) {
+        for (auto it = widths.constBegin(); it != widths.constEnd(); ++it)
+            result.insert(it.key(), it.value());
+    }
+    return result;
+}
+
+void ColumnWidthCalculator::measureColumns(Measurer &measurer, const QVector<int> &rows, int firstColumn,
+                                           int lastColumn, QMap<int, double> &widths) const
+{
+    for (int row : rows) {
+        const QMap<int, QSharedPointer<Cell> > &columns = *m_cells.constFind(row);
+        auto it = columns.lowerBound(firstColumn);
+        for (; it != columns.constEnd() && it.key() <= lastColumn; ++it) {
+            const double width = measurer.width(*it.value());
+            if (width <= 0)
+                continue;
+            auto found = widths.find(it.key());
+            if (found == widths.end())
+                widths.insert(it.key(), width);
+            else if (width > found.value())
+                found.value() = width;
+        }
+    }
+}
+
+ColumnWidthCalculator::Measurer::Measurer(Styles *styles, bool date1904, bool useFonts)
+    : m_styles(styles), m_date1904(date1904), m_useFonts(useFonts), m_digitWidth(defaultDigitWidth)
+{
+    if (!m_useFonts)
+        return;
+
+    //Excel counts widths in digits of the font of the first xf.
+    const QFontMetricsF metrics(cellFont(m_styles->xfFormat(0)));
+    double widest = 0;
+    for (char digit = '0'; digit <= '9'; ++digit)
+        widest = qMax(widest, advance(metrics, QString(QLatin1Char(digit))));
+    if (widest > 0)
+        m_digitWidth = widest;
+}
+
+/*!
+ * \internal
+ * Returns the width of \a cell in characters, 0 when it shows nothing.
+ */
+double ColumnWidthCalculator::Measurer::width(const Cell &cell)
+{
+    const Xf &format = xf(cell.styleNumber());
+    const QString shown = text(cell, format);
+    if (shown.isEmpty())
+        return 0;
+
+    double pixels = textWidth(shown, format);
+    if (format.indent > 0)
+        pixels += format.indent * lineWidth(QStringLiteral("   "), format);
+    return pixels / m_digitWidth + 1;
+}
+
+const ColumnWidthCalculator::Xf &ColumnWidthCalculator::Measurer::xf(int index)
+{
+    auto it = m_xfs.constFind(index);
+    if (it != m_xfs.constEnd())
+        return it.value();
+
+    const Format format = index < 0 ? Format() : m_styles->xfFormat(index);
+    Xf result;
+    result.fontSize = format.fontSize() > 0 ? format.fontSize() : defaultFontSize;
+    result.wrap = format.textWrap();
+    result.rotation = format.rotation();
+    result.indent = format.indent();
+
+    //Formats and fonts shared by several xfs are only built once.
+    const QString code = Styles::numberFormatCode(format);
+    result.formatter = m_formatters.value(code);
+    if (result.formatter.isNull()) {
+        result.formatter = QSharedPointer<const NumberFormatter>(new NumberFormatter(code));
+        m_formatters.insert(code, result.formatter);
+    }
+    if (m_useFonts) {
+        const QFont font = cellFont(format);
+        result.metrics = m_metrics.value(font.key());
+        if (result.metrics.isNull()) {
+            result.metrics = QSharedPointer<QFontMetricsF>(new QFontMetricsF(font));
+            m_metrics.insert(font.key(), result.metrics);
+        }
+    }
+    return m_xfs.insert(index, result).value();
+}
+
+/*!
+ * \internal
+ * Returns the value of \a cell as displayed, like Cell::formattedText()
+ * but with the formatters of this thread.
+ */
+QString ColumnWidthCalculator::Measurer::text(const Cell &cell, const Xf &xf) const
+{
+    const QVariant value = cell.value();
+    switch (cell.cellType()) {
+    case Cell::BooleanType:
+        return value.toBool() ? QStringLiteral("TRUE") : QStringLiteral("FALSE");
+    case Cell::ErrorType:
+        return value.toString();
+    case Cell::SharedStringType:
+    case Cell::InlineStringType:
+    case Cell::StringType:
+        return xf.formatter->formatText(value.toString());
+    default:
+        break;
+    }
+
+    if (value.isNull())
+        return QString();
+    bool ok = false;
+    const double number = value.toDouble(&ok);
+    if (ok)
+        return xf.formatter->formatNumber(number, m_date1904);
+    return xf.formatter->format(value, m_date1904);
+}
+
+/*!
+ * \internal
+ * Returns the horizontal extent of \a text in pixels. Wrapped text only
+ * needs room for its longest word, rotated text for the projection of its
+ * lines and stacked text for its widest character.
+ */
+double ColumnWidthCalculator::Measurer::textWidth(const QString &text, const Xf &xf) const
+{
+    if (xf.rotation == 255) {
+        double widest = 0;
+        for (const QChar ch : text) {
+            if (ch != QLatin1Char('\n'))
+                widest = qMax(widest, lineWidth(QString(ch), xf));
+        }
+        return widest;
+    }
+
+    const QStringList lines = text.split(QLatin1Char('\n'));
+    double widest = 0;
+    for (const QString &line : lines) {
+        if (xf.wrap) {
+            const QStringList words = line.split(QLatin1Char(' '));
+            for (const QString &word : words)
+                widest = qMax(widest, lineWidth(word, xf));
+        } else {
+            widest = qMax(widest, lineWidth(line, xf));
+        }
+    }
+    if (xf.rotation == 0)
+        return widest;
+
+    //0 to 90 degrees go up, 91 to 180 down by the angle less 90.
+    const int degrees = xf.rotation <= 90 ? xf.rotation : xf.rotation - 90;
+    const double angle = degrees * pi / 180;
+    const double lineHeight = xf.metrics ? xf.metrics->lineSpacing() : xf.fontSize * 4.0 / 3 * 1.25;
+    return widest * std::cos(angle) + lines.size() * lineHeight * std::sin(angle);
+}
+
+double ColumnWidthCalculator::Measurer::lineWidth(const QString &line, const Xf &xf) const
+{
+    if (xf.metrics)
+        return advance(*xf.metrics, line);
+    return line.size() * defaultDigitWidth * xf.fontSize / defaultFontSize;
+}
+
+QT_END_NAMESPACE_XLSX
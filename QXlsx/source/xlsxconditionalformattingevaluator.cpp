@@ -0,0 +1,515 @@
+// xlsxconditionalformattingevaluator.cpp
+
+#include <QtGlobal>
+#include <QDate>
+#include <QMap>
+
+#include <algorithm>
+#include <cmath>
+
+#include "xlsxconditionalformattingevaluator_p.h"
+#include "xlsxconditionalformatting_p.h"
+#include "xlsxformulaparser_p.h"
+#include "xlsxcolor_p.h"
+#include "xlsxutility_p.h"
+#include "xlsxworksheet.h"
+
+QT_BEGIN_NAMESPACE_XLSX
+
+namespace {
+
+inline bool holds(const CellRange &range, int row, int column)
+{
+    return range.firstRow() <= row && row <= range.lastRow()
+            && range.firstColumn() <= column && column <= range.lastColumn();
+}
+
+CellRange intersected(const CellRange &a, const CellRange &b)
+{
+    const int firstRow = qMax(a.firstRow(), b.firstRow());
+    const int firstColumn = qMax(a.firstColumn(), b.firstColumn());
+    const int lastRow = qMin(a.lastRow(), b.lastRow());
+    const int lastColumn = qMin(a.lastColumn(), b.lastColumn());
+    if (firstRow > lastRow || firstColumn > lastColumn)
+        return CellRange();
+    return CellRange(firstRow, firstColumn, lastRow, lastColumn);
+}
+
+bool isBlank(const FormulaValue &value)
+{
+    return value.type == FormulaValue::Empty || value.type == FormulaValue::Missing;
+}
+
+// Percentile of sorted values, interpolated like PERCENTILE.INC.
+double percentile(const QVector<double> &sorted, double fraction)
+{
+    if (sorted.isEmpty())
+        return 0;
+    fraction = qBound(0.0, fraction, 1.0);
+    const double position = fraction * (sorted.size() - 1);
+    const int index = int(position);
+    if (index + 1 >= sorted.size())
+        return sorted.last();
+    return sorted[index] + (position - index) * (sorted[index + 1] - sorted[index]);
+}
+
+QColor blend(const QColor &from, const QColor &to, double ratio)
+{
+    return QColor::fromRgbF(from.redF() + (to.redF() - from.redF()) * ratio,
+                            from.greenF() + (to.greenF() - from.greenF()) * ratio,
+                            from.blueF() + (to.blueF() - from.blueF()) * ratio);
+}
+
+} // namespace
+
+ConditionalFormattingEvaluator::ConditionalFormattingEvaluator(Worksheet *sheet, const CellTable &cells,
+                                                               FormulaEngine *engine, FormulaCache *cache,
+                                                               const CellRange &usedRange, bool date1904)
+    : m_sheet(sheet), m_cells(cells), m_engine(engine), m_cache(cache), m_usedRange(usedRange),
+      m_date1904(date1904)
+{
+}
+
+/*!
+ * \internal
+ * Returns the formatting shown by the cells of \a range which at least one
+ * rule of \a formattings applies to, row by row. Only the cells of the used
+ * range are looked at.
+ */
+QList<CellConditionalFormat> ConditionalFormattingEvaluator::evaluate(const QList<ConditionalFormatting> &formattings,
+                                                                      const CellRange &range)
+{
+    QList<CellConditionalFormat> result;
+    const CellRange area = intersected(range, m_usedRange);
+    if (!area.isValid() || formattings.isEmpty())
+        return result;
+
+    m_ranges.clear();
+    QVector<Rule> rules;
+    for (int i = 0; i < formattings.size(); ++i) {
+        const ConditionalFormatting &formatting = formattings[i];
+        QList<CellRange> ranges;
+        for (const CellRange &r : formatting.ranges()) {
+            const CellRange clipped = intersected(r, m_usedRange);
+            if (clipped.isValid())
+                ranges.append(clipped);
+        }
+        m_ranges.append(ranges);
+        if (ranges.isEmpty())
+            continue;
+
+        //Relative references of the formulas are from the first cell of the formatting.
+        const CellReference anchor = formatting.ranges().first().topLeft();
+        for (const QSharedPointer<XlsxCfRuleData> &data : formatting.d->cfRules) {
+            Rule rule;
+            rule.data = data.data();
+            rule.priority = data->priority;
+            rule.formatting = i;
+            compile(rule, anchor);
+            if (rule.kind != Unknown)
+                rules.append(rule);
+        }
+    }
+    std::stable_sort(rules.begin(), rules.end(), [](const Rule &a, const Rule &b) {
+        return a.priority < b.priority;
+    });
+
+    for (int row = area.firstRow(); row <= area.lastRow(); ++row) {
+        for (int column = area.firstColumn(); column <= area.lastColumn(); ++column) {
+            CellConditionalFormat format;
+            bool valueRead = false;
+            FormulaValue value;
+            for (const Rule &rule : rules) {
+                bool covered = false;
+                for (const CellRange &r : m_ranges[rule.formatting]) {
+                    if (holds(r, row, column)) {
+                        covered = true;
+                        break;
+                    }
+                }
+                if (!covered)
+                    continue;
+
+                if (!valueRead) {
+                    value = m_engine->cellValue(m_sheet, row, column);
+                    valueRead = true;
+                }
+
+                if (rule.kind == ColorScale || rule.kind == DataBar) {
+                    double number;
+                    if (value.type != FormulaValue::Number || !FormulaEngine::numberOf(value, number))
+                        continue;
+                    if (rule.kind == ColorScale) {
+                        if (format.hasColorScale())
+                            continue;
+                        format.color = scaleColor(rule, number);
+                    } else {
+                        if (format.hasDataBar())
+                            continue;
+                        const double span = rule.high - rule.low;
+                        format.dataBarLength = span > 0 ? qBound(0.0, (number - rule.low) / span, 1.0)
+                                                        : (number >= rule.high ? 1.0 : 0.0);
+                        format.dataBarColor = rule.colors[0];
+                        format.dataBarValueHidden = rule.hideValue;
+                    }
+                } else if (matches(rule, row, column, value)) {
+                    format.formats.append(rule.data->dxfFormat);
+                } else {
+                    continue;
+                }
+                if (rule.stopIfTrue)
+                    break;
+            }
+
+            if (!format.formats.isEmpty() || format.hasColorScale() || format.hasDataBar()) {
+                format.row = row;
+                format.column = column;
+                result.append(format);
+            }
+        }
+    }
+    return result;
+}
+
+/*!
+ * \internal
+ * Reads the attributes of the rule, parses its formulas and computes the
+ * statistics of the cells it covers.
+ */
+void ConditionalFormattingEvaluator::compile(Rule &rule, const CellReference &anchor)
+{
+    const QMap<int, QVariant> &attrs = rule.data->attrs;
+    const QString type = attrs.value(XlsxCfRuleData::A_type).toString();
+    rule.stopIfTrue = attrs.value(XlsxCfRuleData::A_stopIfTrue).toBool();
+    rule.op = attrs.value(XlsxCfRuleData::A_operator).toString();
+    rule.text = attrs.value(XlsxCfRuleData::A_text).toString();
+
+    if (type == QLatin1String("cellIs")) {
+        rule.kind = CellIs;
+        rule.formulas.append(compileFormula(attrs.value(XlsxCfRuleData::A_formula1).toString(), anchor));
+        if (rule.op == QLatin1String("between") || rule.op == QLatin1String("notBetween"))
+            rule.formulas.append(compileFormula(attrs.value(XlsxCfRuleData::A_formula2).toString(), anchor));
+    } else if (type == QLatin1String("expression")) {
+        rule.kind = Expression;
+        rule.formulas.append(compileFormula(attrs.value(XlsxCfRuleData::A_formula1).toString(), anchor));
+    } else if (type == QLatin1String("containsText")) {
+        rule.kind = ContainsText;
+    } else if (type == QLatin1String("notContainsText")) {
+        rule.kind = NotContainsText;
+    } else if (type == QLatin1String("beginsWith")) {
+        rule.kind = BeginsWith;
+    } else if (type == QLatin1String("endsWith")) {
+        rule.kind = EndsWith;
+    } else if (type == QLatin1String("containsErrors")) {
+        rule.kind = ContainsErrors;
+    } else if (type == QLatin1String("notContainsErrors")) {
+        rule.kind = NotContainsErrors;
+    } else if (type == QLatin1String("containsBlanks")) {
+        rule.kind = ContainsBlanks;
+    } else if (type == QLatin1String("notContainsBlanks")) {
+        rule.kind = NotContainsBlanks;
+    } else if (type == QLatin1String("timePeriod")) {
+        //Window of serial days, from low included to high excluded.
+        rule.kind = TimePeriod;
+        const QDate today = QDate::currentDate();
+        const QString period = attrs.value(XlsxCfRuleData::A_timePeriod).toString();
+        const int weekStart = -(today.dayOfWeek() % 7); //weeks start on Sunday
+        QDate from = today;
+        QDate to = today.addDays(1);
+        if (period == QLatin1String("yesterday")) {
+            from = today.addDays(-1);
+            to = today;
+        } else if (period == QLatin1String("tomorrow")) {
+            from = today.addDays(1);
+            to = today.addDays(2);
+        } else if (period == QLatin1String("last7Days")) {
+            from = today.addDays(-6);
+        } else if (period == QLatin1String("thisWeek")) {
+            from = today.addDays(weekStart);
+            to = from.addDays(7);
+        } else if (period == QLatin1String("lastWeek")) {
+            from = today.addDays(weekStart - 7);
+            to = from.addDays(7);
+        } else if (period == QLatin1String("nextWeek")) {
+            from = today.addDays(weekStart + 7);
+            to = from.addDays(7);
+        } else if (period == QLatin1String("thisMonth")) {
+            from = QDate(today.year(), today.month(), 1);
+            to = from.addMonths(1);
+        } else if (period == QLatin1String("lastMonth")) {
+            to = QDate(today.year(), today.month(), 1);
+            from = to.addMonths(-1);
+        } else if (period == QLatin1String("nextMonth")) {
+            from = QDate(today.year(), today.month(), 1).addMonths(1);
+            to = from.addMonths(1);
+        }
+        rule.low = dateToNumber(from, m_date1904);
+        rule.high = dateToNumber(to, m_date1904);
+    } else if (type == QLatin1String("duplicateValues") || type == QLatin1String("uniqueValues")) {
+        rule.kind = type == QLatin1String("duplicateValues") ? Duplicate : Unique;
+        QHash<QString, int> &counts = rule.counts;
+        visitCells(rule.formatting, [&counts](const FormulaValue &value) {
+            if (!isBlank(value))
+                ++counts[valueKey(value)];
+        });
+    } else if (type == QLatin1String("top10")) {
+        rule.kind = Top10;
+        rule.below = attrs.value(XlsxCfRuleData::A_bottom).toString() == QLatin1String("1");
+        const QVector<double> sorted = numbers(rule.formatting);
+        if (sorted.isEmpty()) {
+            rule.kind = Unknown;
+            return;
+        }
+        const int rank = attrs.value(XlsxCfRuleData::A_rank, 10).toInt();
+        int count = rank;
+        if (attrs.value(XlsxCfRuleData::A_percent).toString() == QLatin1String("1"))
+            count = int(sorted.size() * rank / 100.0);
+        count = qBound(1, count, sorted.size());
+        rule.low = rule.below ? sorted[count - 1] : sorted[sorted.size() - count];
+    } else if (type == QLatin1String("aboveAverage")) {
+        rule.kind = AboveAverage;
+        rule.below = attrs.value(XlsxCfRuleData::A_aboveAverage).toString() == QLatin1String("0");
+        rule.orEqual = attrs.value(XlsxCfRuleData::A_equalAverage).toString() == QLatin1String("1");
+        const QVector<double> values = numbers(rule.formatting);
+        if (values.isEmpty()) {
+            rule.kind = Unknown;
+            return;
+        }
+        double sum = 0;
+        for (double v : values)
+            sum += v;
+        const double mean = sum / values.size();
+        double deviation = 0;
+        const int stdDev = attrs.value(XlsxCfRuleData::A_stdDev).toInt();
+        if (stdDev > 0 && values.size() > 1) {
+            double squares = 0;
+            for (double v : values)
+                squares += (v - mean) * (v - mean);
+            deviation = stdDev * std::sqrt(squares / (values.size() - 1));
+        }
+        rule.low = rule.below ? mean - deviation : mean + deviation;
+    } else if (type == QLatin1String("colorScale") || type == QLatin1String("dataBar")) {
+        const bool scale = type == QLatin1String("colorScale");
+        rule.kind = scale ? ColorScale : DataBar;
+        rule.hideValue = attrs.contains(XlsxCfRuleData::A_hideData);
+        const QVector<double> sorted = numbers(rule.formatting);
+        if (sorted.isEmpty()) {
+            rule.kind = Unknown;
+            return;
+        }
+
+        const bool threeColors = scale && attrs.contains(XlsxCfRuleData::A_cfvo3);
+        rule.colorCount = scale ? (threeColors ? 3 : 2) : 1;
+        for (int i = 0; i < rule.colorCount; ++i) {
+            const XlsxColor color = attrs.value(XlsxCfRuleData::A_color1 + i).value<XlsxColor>();
+            rule.colors[i] = color.isRgbColor() ? color.rgbColor() : QColor(Qt::black);
+        }
+        rule.low = cfvoValue(attrs.value(XlsxCfRuleData::A_cfvo1).value<XlsxCfVoData>(), sorted, anchor);
+        if (threeColors) {
+            rule.mid = cfvoValue(attrs.value(XlsxCfRuleData::A_cfvo2).value<XlsxCfVoData>(), sorted, anchor);
+            rule.high = cfvoValue(attrs.value(XlsxCfRuleData::A_cfvo3).value<XlsxCfVoData>(), sorted, anchor);
+        } else {
+            rule.high = cfvoValue(attrs.value(XlsxCfRuleData::A_cfvo2).value<XlsxCfVoData>(), sorted, anchor);
+        }
+    }
+}
+
+ConditionalFormattingEvaluator::Formula ConditionalFormattingEvaluator::compileFormula(const QString &text,
+                                                                                       const CellReference &anchor) const
+{
+    Formula formula;
+    formula.parsed = m_cache->parse(text, anchor);
+    if (formula.parsed->isCellIndependent()) {
+        formula.constant = true;
+        formula.value = m_engine->evaluate(m_sheet, anchor, *formula.parsed);
+    }
+    return formula;
+}
+
+FormulaValue ConditionalFormattingEvaluator::formulaValue(const Formula &formula, int row, int column) const
+{
+    if (formula.constant)
+        return formula.value;
+    return m_engine->evaluate(m_sheet, CellReference(row, column), *formula.parsed);
+}
+
+/*!
+ * \internal
+ * Calls \a visitor with the value of each existing cell covered by the
+ * formatting at \a formatting. Cells in several of its ranges are visited
+ * once.
+ */
+template <typename Visitor>
+void ConditionalFormattingEvaluator::visitCells(int formatting, Visitor visitor) const
+{
+    const QList<CellRange> &ranges = m_ranges[formatting];
+    for (int i = 0; i < ranges.size(); ++i) {
+        const CellRange &range = ranges[i];
+        auto rowIt = m_cells.lowerBound(range.firstRow());
+        for (; rowIt != m_cells.constEnd() && rowIt.key() <= range.lastRow(); ++rowIt) {
+            auto it = rowIt.value().lowerBound(range.firstColumn());
+            for (; it != rowIt.value().constEnd() && it.key() <= range.lastColumn(); ++it) {
+                bool seen = false;
+                for (int j = 0; j < i && !seen; ++j)
+                    seen = holds(ranges[j], rowIt.key(), it.key());
+                if (!seen)
+                    visitor(m_engine->cellValue(m_sheet, rowIt.key(), it.key()));
+            }
+        }
+    }
+}
+
+// The numbers of the cells covered by the formatting, sorted.
+QVector<double> ConditionalFormattingEvaluator::numbers(int formatting) const
+{
+    QVector<double> values;
+    visitCells(formatting, [&values](const FormulaValue &value) {
+        if (value.type == FormulaValue::Number)
+            values.append(value.number);
+    });
+    std::sort(values.begin(), values.end());
+    return values;
+}
+
+double ConditionalFormattingEvaluator::cfvoValue(const XlsxCfVoData &cfvo, const QVector<double> &sorted,
+                                                 const CellReference &anchor) const
+{
+    switch (cfvo.type) {
+    case ConditionalFormatting::VOT_Min:
+        return sorted.first();
+    case ConditionalFormatting::VOT_Max:
+        return sorted.last();
+    case ConditionalFormatting::VOT_Percent:
+        return sorted.first() + (sorted.last() - sorted.first()) * cfvo.value.toDouble() / 100;
+    case ConditionalFormatting::VOT_Percentile:
+        return percentile(sorted, cfvo.value.toDouble() / 100);
+    case ConditionalFormatting::VOT_Num:
+    case ConditionalFormatting::VOT_Formula:
+    default:
+        break;
+    }
+
+    bool ok = false;
+    double number = cfvo.value.toDouble(&ok);
+    if (ok)
+        return number;
+    QString text = cfvo.value;
+    if (text.startsWith(QLatin1Char('=')))
+        text.remove(0, 1);
+    const Formula formula = compileFormula(text, anchor);
+    if (!FormulaEngine::numberOf(formulaValue(formula, anchor.row(), anchor.column()), number))
+        return 0;
+    return number;
+}
+
+bool ConditionalFormattingEvaluator::matches(const Rule &rule, int row, int column, const FormulaValue &value) const
+{
+    switch (rule.kind) {
+    case CellIs: {
+        const int first = FormulaEngine::compare(value, formulaValue(rule.formulas[0], row, column));
+        if (rule.op == QLatin1String("between") || rule.op == QLatin1String("notBetween")) {
+            //The bounds can be given in any order.
+            const int second = FormulaEngine::compare(value, formulaValue(rule.formulas[1], row, column));
+            const bool inside = (first >= 0 && second <= 0) || (first <= 0 && second >= 0);
+            return rule.op == QLatin1String("between") ? inside : !inside;
+        }
+        if (rule.op == QLatin1String("equal"))
+            return first == 0;
+        if (rule.op == QLatin1String("notEqual"))
+            return first != 0;
+        if (rule.op == QLatin1String("greaterThan"))
+            return first > 0;
+        if (rule.op == QLatin1String("greaterThanOrEqual"))
+            return first >= 0;
+        if (rule.op == QLatin1String("lessThan"))
+            return first < 0;
+        if (rule.op == QLatin1String("lessThanOrEqual"))
+            return first <= 0;
+        return false;
+    }
+    case Expression: {
+        const FormulaValue result = formulaValue(rule.formulas[0], row, column);
+        bool fired = false;
+        return !result.isError() && FormulaEngine::booleanOf(result, fired) && fired;
+    }
+    case ContainsText:
+        return !value.isError() && FormulaEngine::textOf(value).contains(rule.text, Qt::CaseInsensitive);
+    case NotContainsText:
+        return value.isError() || !FormulaEngine::textOf(value).contains(rule.text, Qt::CaseInsensitive);
+    case BeginsWith:
+        return !value.isError() && FormulaEngine::textOf(value).startsWith(rule.text, Qt::CaseInsensitive);
+    case EndsWith:
+        return !value.isError() && FormulaEngine::textOf(value).endsWith(rule.text, Qt::CaseInsensitive);
+    case ContainsErrors:
+        return value.isError();
+    case NotContainsErrors:
+        return !value.isError();
+    case ContainsBlanks:
+        return !value.isError() && FormulaEngine::textOf(value).trimmed().isEmpty();
+    case NotContainsBlanks:
+        return !value.isError() && !FormulaEngine::textOf(value).trimmed().isEmpty();
+    case TimePeriod: {
+        if (value.type != FormulaValue::Number)
+            return false;
+        const double day = std::floor(value.number);
+        return day >= rule.low && day < rule.high;
+    }
+    case Duplicate:
+    case Unique: {
+        if (isBlank(value))
+            return false;
+        const int count = rule.counts.value(valueKey(value));
+        return rule.kind == Duplicate ? count > 1 : count == 1;
+    }
+    case Top10:
+        if (value.type != FormulaValue::Number)
+            return false;
+        return rule.below ? value.number <= rule.low : value.number >= rule.low;
+    case AboveAverage:
+        if (value.type != FormulaValue::Number)
+            return false;
+        if (rule.below)
+            return rule.orEqual ? value.number <= rule.low : value.number < rule.low;
+        return rule.orEqual ? value.number >= rule.low : value.number > rule.low;
+    default:
+        break;
+    }
+    return false;
+}
+
+QColor ConditionalFormattingEvaluator::scaleColor(const Rule &rule, double value) const
+{
+    if (rule.colorCount == 3) {
+        if (value <= rule.low)
+            return rule.colors[0];
+        if (value >= rule.high)
+            return rule.colors[2];
+        if (value <= rule.mid)
+            return rule.mid > rule.low ? blend(rule.colors[0], rule.colors[1], (value - rule.low) / (rule.mid - rule.low))
+                                       : rule.colors[1];
+        return rule.high > rule.mid ? blend(rule.colors[1], rule.colors[2], (value - rule.mid) / (rule.high - rule.mid))
+                                    : rule.colors[2];
+    }
+    if (value <= rule.low)
+        return rule.colors[0];
+    if (value >= rule.high)
+        return rule.colors[1];
+    return blend(rule.colors[0], rule.colors[1], (value - rule.low) / (rule.high - rule.low));
+}
+
+// Duplicate values are compared by type, text ignoring case.
+QString ConditionalFormattingEvaluator::valueKey(const FormulaValue &value)
+{
+    switch (value.type) {
+    case FormulaValue::Number:
+        return QLatin1Char('n') + QString::number(value.number, 'g', 15);
+    case FormulaValue::Boolean:
+        return QLatin1Char('b') + QString::number(value.number);
+    case FormulaValue::Error:
+        return QLatin1Char('e') + value.text;
+    default:
+        return QLatin1Char('s') + value.text.toLower();
+    }
+}
+
+QT_END_NAMESPACE_XLSX
@@ -0,0 +1,330 @@
+// xlsxdatavalidationchecker.cpp
+
+#include <QtGlobal>
+#include <QThreadPool>
+#include <QStringList>
+
+#include <cmath>
+
+#include "xlsxdatavalidationchecker_p.h"
+#include "xlsxformulaparser_p.h"
+#include "xlsxparallel_p.h"
+#include "xlsxworksheet.h"
+
+QT_BEGIN_NAMESPACE_XLSX
+
+namespace {
+
+const int minParallelCells = 16384;
+const int minChunkRows = 64;
+
+inline bool holds(const CellRange &range, int row, int column)
+{
+    return range.firstRow() <= row && row <= range.lastRow()
+            && range.firstColumn() <= column && column <= range.lastColumn();
+}
+
+inline bool overlaps(const CellRange &a, const CellRange &b)
+{
+    return a.firstRow() <= b.lastRow() && b.firstRow() <= a.lastRow()
+            && a.firstColumn() <= b.lastColumn() && b.firstColumn() <= a.lastColumn();
+}
+
+bool isBlank(const FormulaValue &value)
+{
+    return value.type == FormulaValue::Empty || value.type == FormulaValue::Missing;
+}
+
+} // namespace
+
+DataValidationChecker::DataValidationChecker(Worksheet *sheet, const CellTable &cells, FormulaEngine *engine,
+                                             FormulaCache *cache, bool parallel)
+    : m_sheet(sheet), m_cells(cells), m_engine(engine), m_cache(cache), m_parallel(parallel)
+{
+}
+
+/*!
+ * \internal
+ * Returns the cells of \a range breaking one of \a validations, row by row.
+ * A cell breaking several validations is listed once for each. Blank cells
+ * aren't checked.
+ */
+QList<DataValidationViolation> DataValidationChecker::check(const QList<DataValidation> &validations,
+                                                           const CellRange &range)
+{
+    QList<DataValidationViolation> result;
+    if (!range.isValid())
+        return result;
+
+    m_rules.clear();
+    for (const DataValidation &validation : validations) {
+        Rule rule;
+        rule.validation = validation;
+        for (const CellRange &r : validation.ranges()) {
+            if (r.isValid() && overlaps(r, range))
+                rule.ranges.append(r);
+        }
+        if (rule.ranges.isEmpty() || validation.validationType() == DataValidation::None)
+            continue;
+        rule.anchor = validation.ranges().first().topLeft();
+        compile(rule);
+        m_rules.append(rule);
+    }
+    if (m_rules.isEmpty())
+        return result;
+
+    //Only the rows holding cells are visited.
+    QVector<int> rows;
+    int cellCount = 0;
+    auto rowIt = m_cells.lowerBound(range.firstRow());
+    for (; rowIt != m_cells.constEnd() && rowIt.key() <= range.lastRow(); ++rowIt) {
+        rows.append(rowIt.key());
+        cellCount += rowIt.value().size();
+    }
+
+    QThreadPool *pool = QThreadPool::globalInstance();
+    QVector<QVector<DataValidationViolation> > found;
+    if (!m_parallel || cellCount < minParallelCells || pool->maxThreadCount() < 2) {
+        found.resize(1);
+        checkRows(rows, 0, rows.size(), range, found[0]);
+    } else {
+        //Blocks of rows are taken from a shared counter, each one keeps its own results.
+        const int chunkRows = qMax(minChunkRows, rows.size() / (pool->maxThreadCount() * 8));
+        const int chunks = (rows.size() + chunkRows - 1) / chunkRows;
+        found.resize(chunks);
+        runChunked(chunks, [&](int chunk, int) {
+            checkRows(rows, chunk * chunkRows, qMin(rows.size(), (chunk + 1) * chunkRows), range, found[chunk]);
+        });
+    }
+
+    for (const QVector<DataValidationViolation> &violations : found) {
+        for (const DataValidationViolation &violation : violations)
+            result.append(violation);
+    }
+    return result;
+}
+
+void DataValidationChecker::checkRows(const QVector<int> &rows, int first, int last, const CellRange &range,
+                                      QVector<DataValidationViolation> &violations) const
+{
+    for (int i = first; i < last; ++i) {
+        const int row = rows[i];
+        const QMap<int, QSharedPointer<Cell> > &columns = *m_cells.constFind(row);
+        auto it = columns.lowerBound(range.firstColumn());
+        for (; it != columns.constEnd() && it.key() <= range.lastColumn(); ++it) {
+            const int column = it.key();
+            FormulaValue value;
+            bool valueRead = false;
+            for (const Rule &rule : m_rules) {
+                bool covered = false;
+                for (const CellRange &r : rule.ranges) {
+                    if (holds(r, row, column)) {
+                        covered = true;
+                        break;
+                    }
+                }
+                if (!covered)
+                    continue;
+
+                if (!valueRead) {
+                    value = m_engine->cellValue(m_sheet, row, column);
+                    valueRead = true;
+                    if (isBlank(value))
+                        break;
+                }
+                if (!isValid(rule, row, column, value)) {
+                    DataValidationViolation violation;
+                    violation.row = row;
+                    violation.column = column;
+                    violation.validation = rule.validation;
+                    violations.append(violation);
+                }
+            }
+        }
+    }
+}
+
+void DataValidationChecker::compile(Rule &rule)
+{
+    const DataValidation &validation = rule.validation;
+    rule.type = validation.validationType();
+    rule.op = validation.validationOperator();
+    rule.allowBlank = validation.allowBlank();
+
+    if (rule.type == DataValidation::List) {
+        compileList(rule);
+        return;
+    }
+
+    rule.formulas.append(compileFormula(validation.formula1(), rule.anchor));
+    if (rule.type != DataValidation::Custom
+            && (rule.op == DataValidation::Between || rule.op == DataValidation::NotBetween))
+        rule.formulas.append(compileFormula(validation.formula2(), rule.anchor));
+}
+
+/*!
+ * \internal
+ * Reads the items of a list validation into a hash set. The source is
+ * either a quoted list of items separated by commas, or a formula giving a
+ * range, such as a reference or a defined name.
+ */
+void DataValidationChecker::compileList(Rule &rule)
+{
+    QString source = rule.validation.formula1().trimmed();
+    if (source.startsWith(QLatin1Char('=')))
+        source.remove(0, 1);
+
+    if (source.size() >= 2 && source.startsWith(QLatin1Char('"')) && source.endsWith(QLatin1Char('"'))) {
+        const QStringList items = source.mid(1, source.size() - 2).split(QLatin1Char(','));
+        for (const QString &item : items) {
+            const QString text = item.trimmed();
+            bool ok = false;
+            const double number = text.toDouble(&ok);
+            if (ok)
+                rule.list.insert(listKey(FormulaValue::fromNumber(number)));
+            rule.list.insert(listKey(FormulaValue::fromString(text)));
+        }
+        rule.listKnown = true;
+        return;
+    }
+
+    const Formula formula = compileFormula(source, rule.anchor);
+    const FormulaValue value = m_engine->evaluate(m_sheet, rule.anchor, *formula.parsed, 1);
+    if (value.type == FormulaValue::Reference) {
+        const CellRange used = value.sheet->dimension();
+        const int firstRow = qMax(value.range.firstRow(), used.firstRow());
+        const int lastRow = qMin(value.range.lastRow(), used.lastRow());
+        const int firstColumn = qMax(value.range.firstColumn(), used.firstColumn());
+        const int lastColumn = qMin(value.range.lastColumn(), used.lastColumn());
+        if (used.isValid()) {
+            for (int row = firstRow; row <= lastRow; ++row) {
+                for (int column = firstColumn; column <= lastColumn; ++column) {
+                    const FormulaValue item = m_engine->cellValue(value.sheet, row, column);
+                    if (!isBlank(item))
+                        rule.list.insert(listKey(item));
+                }
+            }
+        }
+        rule.listKnown = true;
+    } else if (value.type != FormulaValue::Unsupported && !value.isError()) {
+        rule.list.insert(listKey(value));
+        rule.listKnown = true;
+    }
+}
+
+DataValidationChecker::Formula DataValidationChecker::compileFormula(const QString &text,
+                                                                     const CellReference &anchor) const
+{
+    Formula formula;
+    formula.parsed = m_cache->parse(text.startsWith(QLatin1Char('=')) ? text.mid(1) : text, anchor);
+    if (formula.parsed->isCellIndependent()) {
+        formula.constant = true;
+        formula.value = m_engine->evaluate(m_sheet, anchor, *formula.parsed);
+    }
+    return formula;
+}
+
+/*!
+ * \internal
+ * Returns the value of \a formula in the cell (\a row, \a column). A formula
+ * made of a single blank cell gives a blank value rather than 0, for the
+ * allowBlank option.
+ */
+FormulaValue DataValidationChecker::formulaValue(const Formula &formula, int row, int column) const
+{
+    if (formula.constant)
+        return formula.value;
+
+    const FormulaValue value = m_engine->evaluate(m_sheet, CellReference(row, column), *formula.parsed, 1);
+    if (value.type != FormulaValue::Reference)
+        return value;
+    if (value.range.rowCount() == 1 && value.range.columnCount() == 1)
+        return m_engine->cellValue(value.sheet, value.range.firstRow(), value.range.firstColumn());
+    return m_engine->evaluate(m_sheet, CellReference(row, column), *formula.parsed);
+}
+
+bool DataValidationChecker::isValid(const Rule &rule, int row, int column, const FormulaValue &value) const
+{
+    if (value.isError())
+        return false;
+
+    switch (rule.type) {
+    case DataValidation::List:
+        return !rule.listKnown || rule.list.contains(listKey(value));
+    case DataValidation::Custom: {
+        const FormulaValue result = formulaValue(rule.formulas[0], row, column);
+        bool valid = false;
+        if (result.type == FormulaValue::Unsupported)
+            return true;
+        return !result.isError() && FormulaEngine::booleanOf(result, valid) && valid;
+    }
+    case DataValidation::TextLength:
+        return inBounds(rule, row, column, FormulaEngine::textOf(value).size());
+    case DataValidation::Whole:
+        if (value.type != FormulaValue::Number || value.number != std::floor(value.number))
+            return false;
+        return inBounds(rule, row, column, value.number);
+    case DataValidation::Decimal:
+    case DataValidation::Date:
+    case DataValidation::Time:
+        if (value.type != FormulaValue::Number)
+            return false;
+        return inBounds(rule, row, column, value.number);
+    default:
+        break;
+    }
+    return true;
+}
+
+/*!
+ * \internal
+ * Compares \a number with the bounds of the rule. Blank bounds let any
+ * value through when blanks are allowed, bounds the engine can't evaluate
+ * too.
+ */
+bool DataValidationChecker::inBounds(const Rule &rule, int row, int column, double number) const
+{
+    double bounds[2] = {0, 0};
+    for (int i = 0; i < rule.formulas.size(); ++i) {
+        const FormulaValue value = formulaValue(rule.formulas[i], row, column);
+        if (value.type == FormulaValue::Unsupported || (rule.allowBlank && isBlank(value)))
+            return true;
+        if (value.isError() || !FormulaEngine::numberOf(value, bounds[i]))
+            return false;
+    }
+
+    switch (rule.op) {
+    case DataValidation::Between:
+        return number >= qMin(bounds[0], bounds[1]) && number <= qMax(bounds[0], bounds[1]);
+    case DataValidation::NotBetween:
+        return number < qMin(bounds[0], bounds[1]) || number > qMax(bounds[0], bounds[1]);
+    case DataValidation::Equal:
+        return number == bounds[0];
+    case DataValidation::NotEqual:
+        return number != bounds[0];
+    case DataValidation::LessThan:
+        return number < bounds[0];
+    case DataValidation::LessThanOrEqual:
+        return number <= bounds[0];
+    case DataValidation::GreaterThan:
+        return number > bounds[0];
+    case DataValidation::GreaterThanOrEqual:
+        return number >= bounds[0];
+    }
+    return true;
+}
+
+// List items are compared by type, text ignoring case.
+QString DataValidationChecker::listKey(const FormulaValue &value)
+{
+    switch (value.type) {
+    case FormulaValue::Number:
+        return QLatin1Char('n') + QString::number(value.number, 'g', 15);
+    case FormulaValue::Boolean:
+        return QLatin1Char('b') + QString::number(value.number);
+    default:
+        return QLatin1Char('s') + FormulaEngine::textOf(value).toLower();
+    }
+}
+
+QT_END_NAMESPACE_XLSX
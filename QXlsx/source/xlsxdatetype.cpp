@@ -12,6 +12,27 @@ DateType::DateType()
 {
 }
 
+/*!
+ * Converts \a dateTimes to Excel serial numbers of the 1900 date system,
+ * or the 1904 one when \a is1904 is true. Their wall clock date and time
+ * are converted, without any time zone adjustment. Invalid date times
+ * give 0.
+ */
+QVector<double> DateType::toNumbers(const QVector<QDateTime> &dateTimes, bool is1904)
+{
+    return datetimesToNumbers(dateTimes, is1904);
+}
+
+/*!
+ * Converts the Excel serial \a numbers to date times with the time \a spec.
+ * Numbers that aren't dates, negative or after 9999-12-31, give invalid
+ * date times.
+ */
+QVector<QDateTime> DateType::fromNumbers(const QVector<double> &numbers, bool is1904, Qt::TimeSpec spec)
+{
+    return datetimesFromNumbers(numbers, is1904, spec);
+}
+
 /*
 DateType::DateType(bool is1904)
 {
@@ -5,6 +5,7 @@
 #include <QPointF>
 #include <QBuffer>
 #include <QDir>
+#include <QFileInfo>
 #include <QTemporaryFile>
 #include <QFile>
 #include <QSharedPointer>
@@ -14,6 +15,7 @@
 #include "xlsxdocument_p.h"
 #include "xlsxworkbook.h"
 #include "xlsxworksheet.h"
+#include "xlsxworksheet_p.h"
 #include "xlsxcontenttypes_p.h"
 #include "xlsxrelationships_p.h"
 #include "xlsxstyles_p.h"
@@ -23,9 +25,12 @@
 #include "xlsxsharedstrings_p.h"
 #include "xlsxutility_p.h"
 #include "xlsxworkbook_p.h"
+#include "xlsxformulaengine_p.h"
+#include "xlsxcalcchain_p.h"
 #include "xlsxdrawing_p.h"
 #include "xlsxmediafile_p.h"
 #include "xlsxchart.h"
+#include "xlsxcolumnwidthcalculator_p.h"
 #include "xlsxzipreader_p.h"
 #include "xlsxzipwriter_p.h"
 
@@ -172,7 +177,23 @@ void DocumentPrivate::init()
 bool DocumentPrivate::loadPackage(QIODevice *device)
 {
 	Q_Q(Document);
-	ZipReader zipReader(device);
+
+	//The media parts of files and buffers are left in the package until they
+	//are read. A file is closed once loaded and opened again for each read,
+	//saving over it reads the remaining parts first.
+	QSharedPointer<ZipReader> package;
+	QFile *file = qobject_cast<QFile *>(device);
+	QBuffer *buffer = qobject_cast<QBuffer *>(device);
+	if (file && !file->fileName().isEmpty()) {
+		package = QSharedPointer<ZipReader>(new ZipReader(file->fileName()));
+		packageFile = QFileInfo(file->fileName()).canonicalFilePath();
+	} else if (buffer) {
+		package = QSharedPointer<ZipReader>(new ZipReader(buffer->data()));
+	} else {
+		package = QSharedPointer<ZipReader>(new ZipReader(device));
+	}
+	const bool lazyMedia = !packageFile.isEmpty() || buffer;
+	ZipReader &zipReader = *package;
 	QStringList filePaths = zipReader.filePaths();
 
 	//Load the Content_Types file
@@ -312,8 +333,12 @@ bool DocumentPrivate::loadPackage(QIODevice *device)
 		QSharedPointer<MediaFile> mf = mediaFileToLoad[i];
 		const QString path = mf->fileName();
 		const QString suffix = path.mid(path.lastIndexOf(QLatin1Char('.'))+1);
-		mf->set(zipReader.fileData(path), suffix);
+		if (lazyMedia)
+			mf->setSource(package, suffix);
+		else
+			mf->set(zipReader.fileData(path), suffix);
 	}
+	zipReader.releaseFile();
 
 	isLoad = true; 
 	return true;
@@ -337,6 +362,14 @@ bool DocumentPrivate::savePackage(QIODevice *device) const
 	if (!worksheets.isEmpty())
 		docPropsApp.addHeadingPair(QStringLiteral("Worksheets"), worksheets.size());
 
+	// the sheets below write their style indexes as remapped by the pruning
+	if (workbook->isUnusedStylesPruningEnabled()) {
+		QSet<int> usedXfIndexes;
+		for (const auto &sheet : worksheets)
+			static_cast<Worksheet *>(sheet.data())->d_func()->collectXfIndexes(usedXfIndexes);
+		workbook->styles()->pruneUnusedStyles(usedXfIndexes);
+	}
+
     for (int i = 0 ; i < worksheets.size(); ++i)
     {
 		QSharedPointer<AbstractSheet> sheet = worksheets[i];
@@ -381,6 +414,15 @@ bool DocumentPrivate::savePackage(QIODevice *device) const
 	// save workbook xml file
 	contentTypes->addWorkbook();
 	zipWriter.addFile(QStringLiteral("xl/workbook.xml"), workbook->saveToXmlData());
+
+	// save calc chain xml file, left out when there are no formulas
+	CalcChain calcChain(CalcChain::F_NewFromScratch);
+	workbook->formulaEngine()->fillCalcChain(calcChain);
+	if (!calcChain.isEmpty()) {
+		contentTypes->addCalcChain();
+		workbook->relationships()->addDocumentRelationship(QStringLiteral("/calcChain"), QStringLiteral("calcChain.xml"));
+		zipWriter.addFile(QStringLiteral("xl/calcChain.xml"), calcChain.saveToXmlData());
+	}
 	zipWriter.addFile(QStringLiteral("xl/_rels/workbook.xml.rels"), workbook->relationships()->saveToXmlData());
 
 	// save drawing xml files
@@ -411,13 +453,10 @@ bool DocumentPrivate::savePackage(QIODevice *device) const
 		zipWriter.addFile(QStringLiteral("xl/sharedStrings.xml"), workbook->sharedStrings()->saveToXmlData());
 	}
 
-    // save calc chain [dev16]
-    contentTypes->addCalcChain();
-    zipWriter.addFile(QStringLiteral("xl/calcChain.xml"), workbook->styles()->saveToXmlData());
-
 	// save styles xml file
 	contentTypes->addStyles();
 	zipWriter.addFile(QStringLiteral("xl/styles.xml"), workbook->styles()->saveToXmlData());
+	workbook->styles()->clearPruning();
 
 	// save theme xml file
 	contentTypes->addTheme();
@@ -438,7 +477,7 @@ bool DocumentPrivate::savePackage(QIODevice *device) const
 		if (!mf->mimeType().isEmpty())
 			contentTypes->addDefault(mf->suffix(), mf->mimeType());
 
-        zipWriter.addFile(QStringLiteral("xl/media/image%1.%2").arg(i+1).arg(mf->suffix()), mf->contents());
+        zipWriter.addFile(QStringLiteral("xl/media/image%1.%2").arg(i+1).arg(mf->suffix()), mf->readContents());
 	}
 
 	// save root .rels xml file
@@ -455,6 +494,22 @@ bool DocumentPrivate::savePackage(QIODevice *device) const
 	return true;
 }
 
+/*!
+ * \internal
+ * Reads the media files left in the loaded package before the file
+ * \a fileName is written, if it is the loaded file.
+ */
+void DocumentPrivate::readPackageMedia(const QString &fileName) const
+{
+	if (packageFile.isEmpty() || QFileInfo(fileName).canonicalFilePath() != packageFile)
+		return;
+	const QList<QSharedPointer<MediaFile> > mediaFiles = workbook->mediaFiles();
+	for (const QSharedPointer<MediaFile> &mf : mediaFiles) {
+		if (mf->isInPackage())
+			mf->contents();
+	}
+}
+
 bool DocumentPrivate::copyStyle(const QString &from, const QString &to)
 {
 	// create a temp file because the zip writer cannot modify already existing zips
@@ -612,6 +667,30 @@ bool Document::write(int row, int col, const QVariant &value, const Format &form
 	return false;
 }
 
+/*!
+ * \overload
+ * Write \a value to cell (\a row, \a col) with the interned \a style.
+ * Returns true on success.
+ *
+ * \sa internStyle()
+ */
+bool Document::write(int row, int col, const QVariant &value, StyleId style)
+{
+	if (Worksheet *sheet = currentWorksheet())
+		return sheet->write(row, col, value, style);
+	return false;
+}
+
+/*!
+ * Registers \a format in the styles of the workbook and returns a handle
+ * that can be passed to write() for any number of cells.
+ */
+StyleId Document::internStyle(const Format &format)
+{
+	Q_D(Document);
+	return d->workbook->styles()->intern(format);
+}
+
 /*!
 	\overload
 	Returns the contents of the cell \a cell.
@@ -649,6 +728,18 @@ int Document::insertImage(int row, int column, const QImage &image)
     return 0;
 }
 
+/*!
+ * Insert the PNG, JPEG, GIF or BMP picture \a encodedImage to current active
+ * worksheet at the position \a row, \a column, without decoding it.
+ */
+int Document::insertImage(int row, int column, const QByteArray &encodedImage)
+{
+	if (Worksheet *sheet = currentWorksheet())
+		return sheet->insertImage(row, column, encodedImage);
+
+    return 0;
+}
+
 bool Document::getImage(int imageIndex, QImage& img)
 {
     if (Worksheet *sheet = currentWorksheet())
@@ -711,6 +802,58 @@ bool Document::unmergeCells(const CellRange &range)
 	return false;
 }
 
+/*!
+  Inserts \a count empty rows before \a row of the current worksheet.
+  Returns true on success.
+
+  \sa Worksheet::insertRows()
+*/
+bool Document::insertRows(int row, int count)
+{
+	if (Worksheet *sheet = currentWorksheet())
+		return sheet->insertRows(row, count);
+	return false;
+}
+
+/*!
+  Deletes \a count rows of the current worksheet, starting with \a row.
+  Returns true on success.
+
+  \sa Worksheet::deleteRows()
+*/
+bool Document::deleteRows(int row, int count)
+{
+	if (Worksheet *sheet = currentWorksheet())
+		return sheet->deleteRows(row, count);
+	return false;
+}
+
+/*!
+  Inserts \a count empty columns before \a column of the current worksheet.
+  Returns true on success.
+
+  \sa Worksheet::insertColumns()
+*/
+bool Document::insertColumns(int column, int count)
+{
+	if (Worksheet *sheet = currentWorksheet())
+		return sheet->insertColumns(column, count);
+	return false;
+}
+
+/*!
+  Deletes \a count columns of the current worksheet, starting with \a column.
+  Returns true on success.
+
+  \sa Worksheet::deleteColumns()
+*/
+bool Document::deleteColumns(int column, int count)
+{
+	if (Worksheet *sheet = currentWorksheet())
+		return sheet->deleteColumns(column, count);
+	return false;
+}
+
 /*!
   Sets width in characters of columns with the given \a range and \a width.
   Returns true on success.
@@ -1253,6 +1396,9 @@ bool Document::save() const
  */
 bool Document::saveAs(const QString &name) const
 {
+	Q_D(const Document);
+	d->readPackageMedia(name);
+
 	QFile file(name);
 	if (file.open(QIODevice::WriteOnly))
 		return saveAs(&file);
@@ -1264,13 +1410,61 @@ bool Document::saveAs(const QString &name) const
  * This function writes a document to the given \a device.
  *
  * \warning The \a device will be closed when this function returned.
+ * A file opened for writing over the loaded file has already lost the
+ * pictures not read yet, let this function open it instead.
  */
 bool Document::saveAs(QIODevice *device) const
 {
 	Q_D(const Document);
+	if (QFile *file = qobject_cast<QFile *>(device))
+		d->readPackageMedia(file->fileName());
 	return d->savePackage(device);
 }
 
+/*!
+ * Evaluates the formulas of all the worksheets and stores the results as
+ * the cached cell values, so that they are saved and returned by
+ * Cell::value() without the need of a spreadsheet application.
+ *
+ * The first call evaluates every formula. Later calls only evaluate the
+ * formulas depending, directly or not, on the cells written through the
+ * Worksheet::write functions in between.
+ *
+ * Formulas using functions the engine doesn't support keep their
+ * current values. Returns false if circular references were found,
+ * see circularReferences().
+ */
+bool Document::calculate()
+{
+	Q_D(Document);
+	return d->workbook->formulaEngine()->calculate();
+}
+
+/*!
+ * Evaluates every formula of the workbook, whether the cells it depends on
+ * changed or not. This is useful after modifying cells through Cell
+ * objects directly.
+ *
+ * Large workbooks are evaluated by several threads unless
+ * Workbook::setParallelCalculationEnabled() turned it off.
+ * Returns false if circular references were found.
+ */
+bool Document::calculateAll()
+{
+	Q_D(Document);
+	return d->workbook->formulaEngine()->calculate(true);
+}
+
+/*!
+ * Returns the cells, such as "Sheet1!B2", found in circular references by
+ * the last calculate().
+ */
+QStringList Document::circularReferences() const
+{
+	Q_D(const Document);
+	return d->workbook->formulaEngine()->circularReferences();
+}
+
 bool Document::isLoadPackage() const
 {
 	Q_D(const Document);
@@ -1331,51 +1525,38 @@ bool Document::changeimage(int filenoinmidea, QString newfile)
 
 
 /*!
-  Returns map of columns with there maximal width
+ * \internal
+ * Returns the width in characters needed by each column of the current
+ * worksheet holding cells in \a range, measured in one pass over its cells.
  */
-QMap<int, int> Document::getMaximalColumnWidth(int firstRow, int lastRow)
+QMap<int, double> DocumentPrivate::contentWidths(const CellRange &range) const
 {
-    const int defaultPixelSize = 11;    //Default font pixel size of excel?
-    int maxRows = -1;
-    int maxCols = -1;
-    QVector<CellLocation> cellLocation = currentWorksheet()->getFullCells(&maxRows, &maxCols);
-
-    QMap<int, int> colWidth;
-
-    for(int i=0; i < cellLocation.size(); i++)
-    {
-        int col = cellLocation.at(i).col;
-        int row = cellLocation.at(i).row;
-        int fs = cellLocation.at(i).cell->format().fontSize();
-        if( fs <= 0)
-        {
-            fs = defaultPixelSize;
-        }
-
-//        QString str = cellLocation.at(i).cell.data()->value().toString();
-        QString str = read(row, col).toString();
+	Q_Q(const Document);
 
-        double w = str.length() * double(fs) / defaultPixelSize + 1; // width not perfect, but works reasonably well
+	QMap<int, double> widths;
+	Worksheet *sheet = q->currentWorksheet();
+	if (!sheet || !range.isValid())
+		return widths;
 
-        if( (row >= firstRow) && (row <= lastRow))
-        {
-            if( w > colWidth.value(col))
-            {
-                colWidth.insert(col, int(w));
-            }
-        }
-    }
+	const WorksheetPrivate *sheetData = sheet->d_func();
+	const CellRange &used = sheetData->dimension;
+	const CellRange clipped(qMax(range.firstRow(), used.firstRow()), qMax(range.firstColumn(), used.firstColumn()),
+	                        qMin(range.lastRow(), used.lastRow()), qMin(range.lastColumn(), used.lastColumn()));
+	if (!used.isValid() || !clipped.isValid())
+		return widths;
 
-    return colWidth;
+	ColumnWidthCalculator calculator(sheetData->cellTable, workbook->styles(), workbook->isDate1904(),
+	                                 workbook->isParallelCalculationEnabled());
+	return calculator.widths(clipped);
 }
 
-
 /*!
   Auto ets width in characters of columns with the given \a range.
   Returns true on success.
  */
 bool Document::autosizeColumnWidth(const CellRange &range)
 {
+    Q_D(Document);
     bool erg = false;
 
     if( !range.isValid())
@@ -1383,15 +1564,9 @@ bool Document::autosizeColumnWidth(const CellRange &range)
         return false;
     }
 
-    const QMap<int, int> colWidth = getMaximalColumnWidth(range.firstRow(), range.lastRow());
-    auto it = colWidth.constBegin();
-    while (it != colWidth.constEnd()) {
-        if( (it.key() >= range.firstColumn()) && (it.key() <= range.lastColumn()) )
-        {
-            erg |= setColumnWidth(it.key(), it.value());
-        }
-        ++it;
-    }
+    const QMap<int, double> colWidth = d->contentWidths(range);
+    for (auto it = colWidth.constBegin(); it != colWidth.constEnd(); ++it)
+        erg |= setColumnWidth(it.key(), it.value());
 
     return erg;
 }
@@ -1403,19 +1578,7 @@ bool Document::autosizeColumnWidth(const CellRange &range)
  */
 bool Document::autosizeColumnWidth(int column)
 {
-    bool erg = false;
-
-    const QMap<int, int> colWidth = getMaximalColumnWidth();
-    auto it = colWidth.constBegin();
-    while (it != colWidth.constEnd()) {
-        if( it.key() == column)
-        {
-            erg |= setColumnWidth(it.key(), it.value());
-        }
-        ++it;
-    }
-
-    return erg;
+    return autosizeColumnWidth(column, column);
 }
 
 
@@ -1425,21 +1588,7 @@ bool Document::autosizeColumnWidth(int column)
  */
 bool Document::autosizeColumnWidth(int colFirst, int colLast)
 {
-    Q_UNUSED(colFirst)
-    Q_UNUSED(colLast)
-    bool erg = false;
-
-    const QMap<int, int> colWidth = getMaximalColumnWidth();
-    auto it = colWidth.constBegin();
-    while (it != colWidth.constEnd()) {
-        if( (it.key() >= colFirst) && (it.key() <= colLast) )
-        {
-            erg |= setColumnWidth(it.key(), it.value());
-        }
-        ++it;
-    }
-
-    return erg;
+    return autosizeColumnWidth(CellRange(1, colFirst, XLSX_ROW_MAX, colLast));
 }
 
 
@@ -1449,16 +1598,7 @@ bool Document::autosizeColumnWidth(int colFirst, int colLast)
  */
 bool Document::autosizeColumnWidth(void)
 {
-    bool erg = false;
-
-    const QMap<int, int> colWidth = getMaximalColumnWidth();
-    auto it = colWidth.constBegin();
-    while (it != colWidth.constEnd()) {
-        erg |= setColumnWidth(it.key(), it.value());
-        ++it;
-    }
-
-    return erg;
+    return autosizeColumnWidth(1, XLSX_COLUMN_MAX);
 }
 
 
@@ -12,7 +12,7 @@
 QT_BEGIN_NAMESPACE_XLSX
 
 Drawing::Drawing(AbstractSheet *sheet, CreateFlag flag)
-    :AbstractOOXmlFile(flag), sheet(sheet)
+    :AbstractOOXmlFile(flag), sheet(sheet), m_anchorsIndexed(0)
 {
     workbook = sheet->workbook();
 }
@@ -40,6 +40,39 @@ void Drawing::saveToXmlFile(QIODevice *device) const
     writer.writeEndDocument();
 }
 
+/*!
+ * \internal
+ * Returns the first anchor whose top left corner is in the cell (\a row,
+ * \a column), or nullptr. The anchors appended since the last lookup are
+ * indexed first. Anchors moved or removed afterwards must be followed by
+ * invalidateAnchorIndex().
+ */
+DrawingAnchor *Drawing::anchorAt(int row, int column)
+{
+    for (; m_anchorsIndexed < anchors.size(); ++m_anchorsIndexed) {
+        DrawingAnchor *anchor = anchors[m_anchorsIndexed];
+        const QPair<int, int> cell(anchor->row(), anchor->col());
+        if (!m_anchorIndex.contains(cell))
+            m_anchorIndex.insert(cell, m_anchorsIndexed);
+    }
+
+    auto it = m_anchorIndex.constFind(qMakePair(row, column));
+    if (it == m_anchorIndex.constEnd())
+        return nullptr;
+    return anchors[it.value()];
+}
+
+/*!
+ * \internal
+ * Drops the index of anchorAt(), the anchors are indexed again on the next
+ * lookup.
+ */
+void Drawing::invalidateAnchorIndex()
+{
+    m_anchorIndex.clear();
+    m_anchorsIndexed = 0;
+}
+
 // check point
 bool Drawing::loadFromXmlFile(QIODevice *device)
 {
@@ -63,12 +63,19 @@ DrawingAnchor::~DrawingAnchor()
 
 void DrawingAnchor::setObjectPicture(const QImage &img)
 {
-    QByteArray ba;
-    QBuffer buffer(&ba);
-    buffer.open(QIODevice::WriteOnly);
-    img.save(&buffer, "PNG");
+    //Encoded to PNG on the thread pool, the file waits for it when saved.
+    m_pictureFile = m_drawing->workbook->addImageFile(img);
 
-    m_pictureFile = QSharedPointer<MediaFile>(new MediaFile(ba, QStringLiteral("png"), QStringLiteral("image/png")));
+    m_objectType = Picture;
+}
+
+/*!
+ * \internal
+ * Uses the already encoded picture \a bytes as they are.
+ */
+void DrawingAnchor::setObjectPicture(const QByteArray &bytes, const QString &suffix, const QString &mimeType)
+{
+    m_pictureFile = QSharedPointer<MediaFile>(new MediaFile(bytes, suffix, mimeType));
     m_drawing->workbook->addMediaFile(m_pictureFile);
 
     m_objectType = Picture;
@@ -83,16 +90,19 @@ bool DrawingAnchor::getObjectPicture(QImage &img)
     return ret;
 }
 
+/*!
+ * \internal
+ * Returns the file of the picture, without decoding it.
+ */
+QSharedPointer<MediaFile> DrawingAnchor::pictureFile() const
+{
+    return m_pictureFile;
+}
+
 //{{ liufeijin
 void DrawingAnchor::setObjectShape(const QImage &img)
 {
-    QByteArray ba;
-    QBuffer buffer(&ba);
-    buffer.open(QIODevice::WriteOnly);
-    img.save(&buffer, "PNG");
-
-    m_pictureFile = QSharedPointer<MediaFile>(new MediaFile(ba, QStringLiteral("png"), QStringLiteral("image/png")));
-    m_drawing->workbook->addMediaFile(m_pictureFile);
+    m_pictureFile = m_drawing->workbook->addImageFile(img);
 
     m_objectType = Shape;
 }
@@ -1,9 +1,11 @@
 // xlsxformat.cpp
 
 #include <QtGlobal>
-#include <QDataStream>
+#include <QtAlgorithms>
 #include <QDebug>
 
+#include <cstring>
+
 #include "xlsxformat.h"
 #include "xlsxformat_p.h"
 #include "xlsxcolor_p.h"
@@ -12,13 +14,14 @@
 QT_BEGIN_NAMESPACE_XLSX
 
 FormatPrivate::FormatPrivate()
-	: dirty(true)
-	, font_dirty(true), font_index_valid(false), font_index(0)
-	, fill_dirty(true), fill_index_valid(false), fill_index(0)
-	, border_dirty(true), border_index_valid(false), border_index(0)
+	: dirty(true), formatKey(0)
+	, font_dirty(true), font_index_valid(false), font_key(0), font_index(0)
+	, fill_dirty(true), fill_index_valid(false), fill_key(0), fill_index(0)
+	, border_dirty(true), border_index_valid(false), border_key(0), border_index(0)
 	, xf_index(-1), xf_indexValid(false)
 	, is_dxf_fomat(false), dxf_index(-1), dxf_indexValid(false)
 	, theme(0)
+	, propertyMask(0)
 {
 }
 
@@ -31,7 +34,7 @@ FormatPrivate::FormatPrivate(const FormatPrivate &other)
 	, xf_index(other.xf_index), xf_indexValid(other.xf_indexValid)
 	, is_dxf_fomat(other.is_dxf_fomat), dxf_index(other.dxf_index), dxf_indexValid(other.dxf_indexValid)
 	, theme(other.theme)
-	, properties(other.properties)
+	, propertyMask(other.propertyMask), propertyValues(other.propertyValues)
 {
 
 }
@@ -41,6 +44,159 @@ FormatPrivate::~FormatPrivate()
 
 }
 
+/*
+ * Returns the bits of the property ids in [startId, endId).
+ */
+quint64 FormatPrivate::rangeMask(int startId, int endId)
+{
+	const quint64 below = endId >= 64 ? ~Q_UINT64_C(0) : (Q_UINT64_C(1) << endId) - 1;
+	return below & ~((Q_UINT64_C(1) << startId) - 1);
+}
+
+/*
+ * Position of the property in propertyValues, which only holds the present ones.
+ */
+int FormatPrivate::slot(int propertyId) const
+{
+	return qPopulationCount(propertyMask & ((Q_UINT64_C(1) << propertyId) - 1));
+}
+
+bool FormatPrivate::hasValue(int propertyId) const
+{
+	if (propertyId < 0 || propertyId >= P_ENDID)
+		return false;
+	return propertyMask & (Q_UINT64_C(1) << propertyId);
+}
+
+QVariant FormatPrivate::value(int propertyId) const
+{
+	if (!hasValue(propertyId))
+		return QVariant();
+	return propertyValues.at(slot(propertyId));
+}
+
+void FormatPrivate::setValue(int propertyId, const QVariant &value)
+{
+	Q_ASSERT(propertyId >= 0 && propertyId < P_ENDID);
+	if (hasValue(propertyId)) {
+		propertyValues[slot(propertyId)] = value;
+	} else {
+		propertyValues.insert(slot(propertyId), value);
+		propertyMask |= Q_UINT64_C(1) << propertyId;
+	}
+}
+
+void FormatPrivate::removeValue(int propertyId)
+{
+	if (!hasValue(propertyId))
+		return;
+	propertyValues.remove(slot(propertyId));
+	propertyMask &= ~(Q_UINT64_C(1) << propertyId);
+}
+
+static inline quint64 mixHash(quint64 h)
+{
+	//splitmix64 finalizer
+	h ^= h >> 30;
+	h *= Q_UINT64_C(0xbf58476d1ce4e5b9);
+	h ^= h >> 27;
+	h *= Q_UINT64_C(0x94d049bb133111eb);
+	h ^= h >> 31;
+	return h;
+}
+
+static quint64 hashValue(const QVariant &value)
+{
+	switch (value.userType()) {
+	case QMetaType::Bool:
+		return value.toBool() ? 1 : 0;
+	case QMetaType::Int:
+		return quint32(value.toInt());
+	case QMetaType::Double: {
+		const double d = value.toDouble();
+		quint64 bits;
+		std::memcpy(&bits, &d, sizeof(bits));
+		return bits;
+	}
+	case QMetaType::QString:
+		return qHash(value.toString());
+	default:
+		break;
+	}
+
+	if (value.userType() == qMetaTypeId<XlsxColor>()) {
+		const XlsxColor color = qvariant_cast<XlsxColor>(value);
+		if (color.isRgbColor())
+			return (Q_UINT64_C(1) << 32) | color.rgbColor().rgba();
+		if (color.isIndexedColor())
+			return (Q_UINT64_C(2) << 32) | quint32(color.indexedColor());
+		if (color.isThemeColor())
+			return (Q_UINT64_C(3) << 32) ^ qHash(color.themeColor().join(QLatin1Char(':')));
+		return 0;
+	}
+
+	return qHash(value.toString());
+}
+
+static bool sameValue(const QVariant &v1, const QVariant &v2)
+{
+	if (v1.userType() != v2.userType())
+		return false;
+
+	if (v1.userType() == qMetaTypeId<XlsxColor>()) {
+		//XlsxColor has no comparison operator registered with QVariant.
+		const XlsxColor c1 = qvariant_cast<XlsxColor>(v1);
+		const XlsxColor c2 = qvariant_cast<XlsxColor>(v2);
+		return c1.isInvalid() == c2.isInvalid()
+				&& c1.rgbColor() == c2.rgbColor()
+				&& c1.indexedColor() == c2.indexedColor()
+				&& c1.themeColor() == c2.themeColor();
+	}
+
+	return v1 == v2;
+}
+
+/*
+ * 64-bit key of the properties in [startId, endId). A format without any
+ * property in the range gets 0. Different formats may share a key, use
+ * equalRange() when that matters.
+ */
+quint64 FormatPrivate::hashRange(int startId, int endId) const
+{
+	quint64 bits = propertyMask & rangeMask(startId, endId);
+	if (!bits)
+		return 0;
+
+	quint64 h = bits;
+	int idx = slot(startId);
+	for (int id = startId; bits; ++id) {
+		const quint64 bit = Q_UINT64_C(1) << id;
+		if (!(bits & bit))
+			continue;
+		bits &= ~bit;
+		const QVariant &v = propertyValues.at(idx++);
+		h = mixHash(h ^ (quint64(id) << 56) ^ quint64(v.userType()));
+		h = mixHash(h ^ hashValue(v));
+	}
+	return h ? h : 1;
+}
+
+bool FormatPrivate::equalRange(const FormatPrivate &other, int startId, int endId) const
+{
+	const quint64 mask = rangeMask(startId, endId);
+	if ((propertyMask & mask) != (other.propertyMask & mask))
+		return false;
+
+	const int count = qPopulationCount(propertyMask & mask);
+	const int idx1 = slot(startId);
+	const int idx2 = other.slot(startId);
+	for (int i = 0; i < count; ++i) {
+		if (!sameValue(propertyValues.at(idx1 + i), other.propertyValues.at(idx2 + i)))
+			return false;
+	}
+	return true;
+}
+
 /*!
  * \class Format
  * \inmodule QtXlsx
@@ -507,22 +663,14 @@ void Format::setFontIndex(int index)
 /*!
  * \internal
  */
-QByteArray Format::fontKey() const
+quint64 Format::fontKey() const
 {
 	if (isEmpty())
-		return QByteArray();
+		return 0;
 
 	if (d->font_dirty) {
-		QByteArray key;
-		QDataStream stream(&key, QIODevice::WriteOnly);
-		for (int i=FormatPrivate::P_Font_STARTID; i<FormatPrivate::P_Font_ENDID; ++i) {
-            auto it = d->properties.constFind(i);
-            if (it != d->properties.constEnd())
-                stream << i << it.value();
-		};
-
-		const_cast<Format*>(this)->d->font_key = key;
-		const_cast<Format*>(this)->d->font_dirty = false;
+		d->font_key = d->hashRange(FormatPrivate::P_Font_STARTID, FormatPrivate::P_Font_ENDID);
+		d->font_dirty = false;
 	}
 
 	return d->font_key;
@@ -537,11 +685,7 @@ bool Format::hasFontData() const
 	if (!d)
 		return false;
 
-	for (int i=FormatPrivate::P_Font_STARTID; i<FormatPrivate::P_Font_ENDID; ++i) {
-		if (hasProperty(i))
-			return true;
-	}
-	return false;
+	return d->propertyMask & FormatPrivate::rangeMask(FormatPrivate::P_Font_STARTID, FormatPrivate::P_Font_ENDID);
 }
 
 /*!
@@ -678,11 +822,7 @@ bool Format::hasAlignmentData() const
 	if (!d)
 		return false;
 
-	for (int i=FormatPrivate::P_Alignment_STARTID; i<FormatPrivate::P_Alignment_ENDID; ++i) {
-		if (hasProperty(i))
-			return true;
-	}
-	return false;
+	return d->propertyMask & FormatPrivate::rangeMask(FormatPrivate::P_Alignment_STARTID, FormatPrivate::P_Alignment_ENDID);
 }
 
 /*!
@@ -916,22 +1056,14 @@ void Format::setBorderIndex(int index)
 
 /*! \internal
  */
-QByteArray Format::borderKey() const
+quint64 Format::borderKey() const
 {
 	if (isEmpty())
-		return QByteArray();
+		return 0;
 
 	if (d->border_dirty) {
-		QByteArray key;
-		QDataStream stream(&key, QIODevice::WriteOnly);
-		for (int i=FormatPrivate::P_Border_STARTID; i<FormatPrivate::P_Border_ENDID; ++i) {
-            auto it = d->properties.constFind(i);
-            if (it != d->properties.constEnd())
-                stream << i << it.value();
-		};
-
-		const_cast<Format*>(this)->d->border_key = key;
-		const_cast<Format*>(this)->d->border_dirty = false;
+		d->border_key = d->hashRange(FormatPrivate::P_Border_STARTID, FormatPrivate::P_Border_ENDID);
+		d->border_dirty = false;
 	}
 
 	return d->border_key;
@@ -946,11 +1078,7 @@ bool Format::hasBorderData() const
 	if (!d)
 		return false;
 
-	for (int i=FormatPrivate::P_Border_STARTID; i<FormatPrivate::P_Border_ENDID; ++i) {
-		if (hasProperty(i))
-			return true;
-	}
-	return false;
+	return d->propertyMask & FormatPrivate::rangeMask(FormatPrivate::P_Border_STARTID, FormatPrivate::P_Border_ENDID);
 }
 
 /*!
@@ -1037,22 +1165,14 @@ void Format::setFillIndex(int index)
 /*!
  * \internal
  */
-QByteArray Format::fillKey() const
+quint64 Format::fillKey() const
 {
 	if (isEmpty())
-		return QByteArray();
+		return 0;
 
 	if (d->fill_dirty) {
-		QByteArray key;
-		QDataStream stream(&key, QIODevice::WriteOnly);
-		for (int i=FormatPrivate::P_Fill_STARTID; i<FormatPrivate::P_Fill_ENDID; ++i) {
-            auto it = d->properties.constFind(i);
-            if (it != d->properties.constEnd())
-                stream << i << it.value();
-		};
-
-		const_cast<Format*>(this)->d->fill_key = key;
-		const_cast<Format*>(this)->d->fill_dirty = false;
+		d->fill_key = d->hashRange(FormatPrivate::P_Fill_STARTID, FormatPrivate::P_Fill_ENDID);
+		d->fill_dirty = false;
 	}
 
 	return d->fill_key;
@@ -1067,11 +1187,7 @@ bool Format::hasFillData() const
 	if (!d)
 		return false;
 
-	for (int i=FormatPrivate::P_Fill_STARTID; i<FormatPrivate::P_Fill_ENDID; ++i) {
-		if (hasProperty(i))
-			return true;
-	}
-	return false;
+	return d->propertyMask & FormatPrivate::rangeMask(FormatPrivate::P_Fill_STARTID, FormatPrivate::P_Fill_ENDID);
 }
 
 /*!
@@ -1135,10 +1251,9 @@ void Format::mergeFormat(const Format &modifier)
 		return;
 	}
 
-	QMapIterator<int, QVariant> it(modifier.d->properties);
-	while(it.hasNext()) {
-		it.next();
-		setProperty(it.key(), it.value());
+	for (int id = FormatPrivate::P_STARTID; id < FormatPrivate::P_ENDID; ++id) {
+		if (modifier.d->hasValue(id))
+			setProperty(id, modifier.d->value(id));
 	}
 }
 
@@ -1159,28 +1274,19 @@ bool Format::isEmpty() const
 {
 	if (!d)
 		return true;
-	return d->properties.isEmpty();
+	return d->propertyMask == 0;
 }
 
 /*!
  * \internal
  */
-QByteArray Format::formatKey() const
+quint64 Format::formatKey() const
 {
 	if (isEmpty())
-		return QByteArray();
+		return 0;
 
 	if (d->dirty) {
-		QByteArray key;
-		QDataStream stream(&key, QIODevice::WriteOnly);
-
-		QMapIterator<int, QVariant> i(d->properties);
-		while (i.hasNext()) {
-			i.next();
-			stream<<i.key()<<i.value();
-		}
-
-		d->formatKey = key;
+		d->formatKey = d->hashRange(FormatPrivate::P_STARTID, FormatPrivate::P_ENDID);
 		d->dirty = false;
 	}
 
@@ -1258,7 +1364,11 @@ bool Format::dxfIndexValid() const
 */
 bool Format::operator ==(const Format &format) const
 {
-	return this->formatKey() == format.formatKey();
+	if (this->formatKey() != format.formatKey())
+		return false;
+	if (isEmpty() || format.isEmpty())
+		return isEmpty() == format.isEmpty();
+	return d->equalRange(*format.d, FormatPrivate::P_STARTID, FormatPrivate::P_ENDID);
 }
 
 /*!
@@ -1266,7 +1376,7 @@ bool Format::operator ==(const Format &format) const
 */
 bool Format::operator !=(const Format &format) const
 {
-	return this->formatKey() != format.formatKey();
+	return !(*this == format);
 }
 
 int Format::theme() const
@@ -1279,11 +1389,8 @@ int Format::theme() const
  */
 QVariant Format::property(int propertyId, const QVariant &defaultValue) const
 {
-    if (d) {
-        auto it = d->properties.constFind(propertyId);
-        if (it != d->properties.constEnd())
-            return it.value();
-    }
+    if (d && d->hasValue(propertyId))
+        return d->value(propertyId);
 	return defaultValue;
 }
 
@@ -1292,29 +1399,31 @@ QVariant Format::property(int propertyId, const QVariant &defaultValue) const
  */
 void Format::setProperty(int propertyId, const QVariant &value, const QVariant &clearValue, bool detach)
 {
+	if (propertyId < FormatPrivate::P_STARTID || propertyId >= FormatPrivate::P_ENDID)
+		return;
+
 	if (!d)
 		d = new FormatPrivate;
 
     if (value != clearValue)
     {
-        auto it = d->properties.constFind(propertyId);
-        if (it != d->properties.constEnd() && it.value() == value)
+        if (d->hasValue(propertyId) && sameValue(d->value(propertyId), value))
 			return;
 
 		if (detach)
 			d.detach();
 
-		d->properties[propertyId] = value;
+		d->setValue(propertyId, value);
     }
     else
     {
-		if (!d->properties.contains(propertyId))
+		if (!d->hasValue(propertyId))
 			return;
 
 		if (detach)
 			d.detach();
 
-		d->properties.remove(propertyId);
+		d->removeValue(propertyId);
 	}
 
 	d->dirty = true;
@@ -1353,7 +1462,7 @@ bool Format::hasProperty(int propertyId) const
 {
 	if (!d)
 		return false;
-	return d->properties.contains(propertyId);
+	return d->hasValue(propertyId);
 }
 
 /*!
@@ -1364,7 +1473,7 @@ bool Format::boolProperty(int propertyId, bool defaultValue) const
 	if (!hasProperty(propertyId))
 		return defaultValue;
 
-	const QVariant prop = d->properties[propertyId];
+	const QVariant prop = d->value(propertyId);
 	if (prop.userType() != QMetaType::Bool)
 		return defaultValue;
 	return prop.toBool();
@@ -1378,7 +1487,7 @@ int Format::intProperty(int propertyId, int defaultValue) const
 	if (!hasProperty(propertyId))
 		return defaultValue;
 
-	const QVariant prop = d->properties[propertyId];
+	const QVariant prop = d->value(propertyId);
 	if (prop.userType() != QMetaType::Int)
 		return defaultValue;
 	return prop.toInt();
@@ -1392,7 +1501,7 @@ double Format::doubleProperty(int propertyId, double defaultValue) const
 	if (!hasProperty(propertyId))
 		return defaultValue;
 
-	const QVariant prop = d->properties[propertyId];
+	const QVariant prop = d->value(propertyId);
 	if (prop.userType() != QMetaType::Double && prop.userType() != QMetaType::Float)
 		return defaultValue;
 	return prop.toDouble();
@@ -1406,7 +1515,7 @@ QString Format::stringProperty(int propertyId, const QString &defaultValue) cons
 	if (!hasProperty(propertyId))
 		return defaultValue;
 
-	const QVariant prop = d->properties[propertyId];
+	const QVariant prop = d->value(propertyId);
 	if (prop.userType() != QMetaType::QString)
 		return defaultValue;
 	return prop.toString();
@@ -1420,16 +1529,56 @@ QColor Format::colorProperty(int propertyId, const QColor &defaultValue) const
 	if (!hasProperty(propertyId))
 		return defaultValue;
 
-	const QVariant prop = d->properties[propertyId];
+	const QVariant prop = d->value(propertyId);
 	if (prop.userType() != qMetaTypeId<XlsxColor>())
 		return defaultValue;
 	return qvariant_cast<XlsxColor>(prop).rgbColor();
 }
 
+/*!
+ * \class StyleId
+ * \inmodule QtXlsx
+ * \brief Handle of a format interned in the styles of a workbook.
+ *
+ * A StyleId is returned by Worksheet::internStyle() or
+ * Document::internStyle(). It can be passed to the write functions
+ * instead of a Format, so that cells written with the same style do not
+ * need any per-cell style lookup. The handle is only meaningful for the
+ * workbook which created it. A default constructed StyleId is invalid and
+ * leaves the cell unstyled.
+ */
+
+/*!
+ * \fn StyleId::StyleId()
+ * Constructs an invalid style handle.
+ */
+
+/*!
+ * \fn StyleId::StyleId(int xfIndex)
+ * \internal
+ */
+
+/*!
+ * \fn bool StyleId::isValid() const
+ * Returns whether the handle refers to a style.
+ */
+
+/*!
+ * \fn int StyleId::xfIndex() const
+ * Returns the index of the style in the cellXfs of styles.xml.
+ */
+
 #ifndef QT_NO_DEBUG_STREAM
 QDebug operator<<(QDebug dbg, const Format &f)
 {
-	dbg.nospace() << "QXlsx::Format(" << f.d->properties << ")";
+	dbg.nospace() << "QXlsx::Format(";
+	if (f.d) {
+		for (int id = FormatPrivate::P_STARTID; id < FormatPrivate::P_ENDID; ++id) {
+			if (f.d->hasValue(id))
+				dbg.nospace() << id << ": " << f.d->value(id) << ", ";
+		}
+	}
+	dbg.nospace() << ")";
 	return dbg.space();
 }
 #endif
@@ -0,0 +1,2517 @@
+// xlsxformulaengine.cpp
+
+#include <QtGlobal>
+#include <QDate>
+#include <QDateTime>
+#include <QTime>
+#include <QRegularExpression>
+#include <QStringList>
+#include <QSet>
+#include <QThreadPool>
+
+#include <algorithm>
+#include <cmath>
+#include <cstring>
+#include <limits>
+
+#include "xlsxformulaengine_p.h"
+#include "xlsxworkbook.h"
+#include "xlsxworkbook_p.h"
+#include "xlsxworksheet.h"
+#include "xlsxworksheet_p.h"
+#include "xlsxcell.h"
+#include "xlsxcell_p.h"
+#include "xlsxcellformula.h"
+#include "xlsxcellreference.h"
+#include "xlsxcalcchain_p.h"
+#include "xlsxnumberformatter_p.h"
+#include "xlsxparallel_p.h"
+#include "xlsxsheetshift_p.h"
+#include "xlsxutility_p.h"
+
+QT_BEGIN_NAMESPACE_XLSX
+
+namespace {
+
+const int maxRowCount = 1048576;
+const int maxColumnCount = 16384;
+const int maxNameDepth = 16;
+
+//Dependency index layout, see FormulaEngine::SheetDependents.
+const int blockRows = 64;
+const int maxBlockedRows = 1024;
+const int maxIndexedColumns = 64;
+
+inline quint64 cellKey(int row, int column)
+{
+    return (quint64(quint32(row)) << 32) | quint32(column);
+}
+
+//Smaller calculations aren't worth the threads.
+const int minParallelFormulas = 4096;
+const int minChunkSize = 64;
+
+enum LookupMode
+{
+    ExactMatch,
+    AscendingMatch,     //largest value not greater, values sorted ascending
+    DescendingMatch,    //smallest value not less, values sorted descending
+    NextSmallerMatch,   //exact match, else the next smaller value
+    NextLargerMatch     //exact match, else the next larger value
+};
+
+enum Function
+{
+    Abs, And, Average, AverageIf, AverageIfs, Column, Columns, Concat, Concatenate, Count, CountA,
+    CountBlank, CountIf, CountIfs, Date, Day, Days, EDate, EOMonth, Exact, Exp, False, Find,
+    HLookup, Hour, If, IfError, IfNa, Index, Int, IsBlank, IsErr, IsError, IsLogical, IsNa,
+    IsNonText, IsNumber, IsText, Left, Len, Ln, Log10, Lower, Match, Max, Mid, Min, Minute, Mod,
+    Month, Na, Not, Now, Or, Pi, Power, Product, Proper, Rept, Right, Round, RoundDown, RoundUp,
+    Row, Rows, Search, Second, Sign, Sqrt, Substitute, Sum, SumIf, SumIfs, Text, TextJoin, Time,
+    Today, Trim, True, Upper, Value, VLookup, Weekday, XLookup, Year
+};
+
+struct FunctionInfo
+{
+    Function id;
+    int minArguments;
+    int maxArguments;
+};
+
+const QHash<QString, FunctionInfo> &functionTable()
+{
+    static const struct {
+        const char *name;
+        FunctionInfo info;
+    } functions[] = {
+        {"ABS", {Abs, 1, 1}}, {"AND", {And, 1, 255}}, {"AVERAGE", {Average, 1, 255}},
+        {"AVERAGEIF", {AverageIf, 2, 3}}, {"AVERAGEIFS", {AverageIfs, 3, 255}},
+        {"COLUMN", {Column, 0, 1}}, {"COLUMNS", {Columns, 1, 1}}, {"CONCAT", {Concat, 1, 255}},
+        {"CONCATENATE", {Concatenate, 1, 255}}, {"COUNT", {Count, 1, 255}},
+        {"COUNTA", {CountA, 1, 255}}, {"COUNTBLANK", {CountBlank, 1, 1}},
+        {"COUNTIF", {CountIf, 2, 2}}, {"COUNTIFS", {CountIfs, 2, 255}}, {"DATE", {Date, 3, 3}},
+        {"DAY", {Day, 1, 1}}, {"DAYS", {Days, 2, 2}}, {"EDATE", {EDate, 2, 2}},
+        {"EOMONTH", {EOMonth, 2, 2}}, {"EXACT", {Exact, 2, 2}}, {"EXP", {Exp, 1, 1}},
+        {"FALSE", {False, 0, 0}}, {"FIND", {Find, 2, 3}}, {"HLOOKUP", {HLookup, 3, 4}},
+        {"HOUR", {Hour, 1, 1}}, {"IF", {If, 1, 3}}, {"IFERROR", {IfError, 2, 2}},
+        {"IFNA", {IfNa, 2, 2}}, {"INDEX", {Index, 2, 3}}, {"INT", {Int, 1, 1}},
+        {"ISBLANK", {IsBlank, 1, 1}}, {"ISERR", {IsErr, 1, 1}}, {"ISERROR", {IsError, 1, 1}},
+        {"ISLOGICAL", {IsLogical, 1, 1}}, {"ISNA", {IsNa, 1, 1}},
+        {"ISNONTEXT", {IsNonText, 1, 1}}, {"ISNUMBER", {IsNumber, 1, 1}},
+        {"ISTEXT", {IsText, 1, 1}}, {"LEFT", {Left, 1, 2}}, {"LEN", {Len, 1, 1}},
+        {"LN", {Ln, 1, 1}}, {"LOG10", {Log10, 1, 1}}, {"LOWER", {Lower, 1, 1}},
+        {"MATCH", {Match, 2, 3}}, {"MAX", {Max, 1, 255}}, {"MID", {Mid, 3, 3}},
+        {"MIN", {Min, 1, 255}}, {"MINUTE", {Minute, 1, 1}}, {"MOD", {Mod, 2, 2}},
+        {"MONTH", {Month, 1, 1}}, {"NA", {Na, 0, 0}}, {"NOT", {Not, 1, 1}}, {"NOW", {Now, 0, 0}},
+        {"OR", {Or, 1, 255}}, {"PI", {Pi, 0, 0}}, {"POWER", {Power, 2, 2}},
+        {"PRODUCT", {Product, 1, 255}}, {"PROPER", {Proper, 1, 1}}, {"REPT", {Rept, 2, 2}},
+        {"RIGHT", {Right, 1, 2}}, {"ROUND", {Round, 2, 2}}, {"ROUNDDOWN", {RoundDown, 2, 2}},
+        {"ROUNDUP", {RoundUp, 2, 2}}, {"ROW", {Row, 0, 1}}, {"ROWS", {Rows, 1, 1}},
+        {"SEARCH", {Search, 2, 3}}, {"SECOND", {Second, 1, 1}}, {"SIGN", {Sign, 1, 1}},
+        {"SQRT", {Sqrt, 1, 1}}, {"SUBSTITUTE", {Substitute, 3, 4}}, {"SUM", {Sum, 1, 255}},
+        {"SUMIF", {SumIf, 2, 3}}, {"SUMIFS", {SumIfs, 3, 255}}, {"TEXT", {Text, 2, 2}},
+        {"TEXTJOIN", {TextJoin, 3, 255}}, {"TIME", {Time, 3, 3}}, {"TODAY", {Today, 0, 0}},
+        {"TRIM", {Trim, 1, 1}}, {"TRUE", {True, 0, 0}}, {"UPPER", {Upper, 1, 1}},
+        {"VALUE", {Value, 1, 1}}, {"VLOOKUP", {VLookup, 3, 4}}, {"WEEKDAY", {Weekday, 1, 2}},
+        {"XLOOKUP", {XLookup, 3, 6}}, {"YEAR", {Year, 1, 1}}
+    };
+
+    static const QHash<QString, FunctionInfo> table = [] {
+        QHash<QString, FunctionInfo> result;
+        for (const auto &function : functions)
+            result.insert(QString::fromLatin1(function.name), function.info);
+        return result;
+    }();
+    return table;
+}
+
+inline FormulaValue errorValue(const char *code)
+{
+    return FormulaValue::error(QString::fromLatin1(code));
+}
+
+inline FormulaValue checkedNumber(double number)
+{
+    return std::isfinite(number) ? FormulaValue::fromNumber(number) : errorValue("#NUM!");
+}
+
+// Text of a number as used by the & operator: up to 15 significant digits.
+QString numberText(double number)
+{
+    return QString::number(number, 'g', 15).toUpper();
+}
+
+bool toNumber(const FormulaValue &value, double &number)
+{
+    switch (value.type) {
+    case FormulaValue::Number:
+    case FormulaValue::Boolean:
+        number = value.number;
+        return true;
+    case FormulaValue::Empty:
+    case FormulaValue::Missing:
+        number = 0;
+        return true;
+    case FormulaValue::String: {
+        bool ok = false;
+        number = value.text.trimmed().toDouble(&ok);
+        return ok;
+    }
+    default:
+        return false;
+    }
+}
+
+QString toText(const FormulaValue &value)
+{
+    switch (value.type) {
+    case FormulaValue::Number:
+        return numberText(value.number);
+    case FormulaValue::Boolean:
+        return value.number != 0 ? QStringLiteral("TRUE") : QStringLiteral("FALSE");
+    case FormulaValue::String:
+    case FormulaValue::Error:
+        return value.text;
+    default:
+        return QString();
+    }
+}
+
+bool toBoolean(const FormulaValue &value, bool &result)
+{
+    switch (value.type) {
+    case FormulaValue::Number:
+    case FormulaValue::Boolean:
+        result = value.number != 0;
+        return true;
+    case FormulaValue::Empty:
+    case FormulaValue::Missing:
+        result = false;
+        return true;
+    case FormulaValue::String:
+        if (value.text.compare(QLatin1String("TRUE"), Qt::CaseInsensitive) == 0) {
+            result = true;
+            return true;
+        }
+        if (value.text.compare(QLatin1String("FALSE"), Qt::CaseInsensitive) == 0) {
+            result = false;
+            return true;
+        }
+        return false;
+    default:
+        return false;
+    }
+}
+
+// Excel orders numbers before text and text before logical values.
+int typeRank(const FormulaValue &value)
+{
+    switch (value.type) {
+    case FormulaValue::Number:
+        return 0;
+    case FormulaValue::String:
+        return 1;
+    case FormulaValue::Boolean:
+        return 2;
+    default:
+        return 3;
+    }
+}
+
+FormulaValue blankAs(const FormulaValue &other)
+{
+    if (other.type == FormulaValue::String)
+        return FormulaValue::fromString(QString());
+    if (other.type == FormulaValue::Boolean)
+        return FormulaValue::fromBoolean(false);
+    return FormulaValue::fromNumber(0);
+}
+
+// Compares two scalars like the comparison operators do. Text is compared
+// case insensitively, and a blank compares as the empty value of the other
+// side's type.
+int compareValues(const FormulaValue &left, const FormulaValue &right)
+{
+    const bool leftBlank = left.type == FormulaValue::Empty || left.type == FormulaValue::Missing;
+    const bool rightBlank = right.type == FormulaValue::Empty || right.type == FormulaValue::Missing;
+    const FormulaValue a = leftBlank ? blankAs(right) : left;
+    const FormulaValue b = rightBlank ? blankAs(left) : right;
+
+    const int rankA = typeRank(a);
+    const int rankB = typeRank(b);
+    if (rankA != rankB)
+        return rankA < rankB ? -1 : 1;
+    if (a.type == FormulaValue::String) {
+        const int result = QString::compare(a.text, b.text, Qt::CaseInsensitive);
+        return result < 0 ? -1 : (result > 0 ? 1 : 0);
+    }
+    return a.number < b.number ? -1 : (a.number > b.number ? 1 : 0);
+}
+
+bool hasWildcards(const QString &text)
+{
+    return text.contains(QLatin1Char('*')) || text.contains(QLatin1Char('?'));
+}
+
+// Turns an Excel pattern, with * ? and ~ escapes, into a regular expression.
+QString wildcardPattern(const QString &pattern)
+{
+    QString expression;
+    for (int i = 0; i < pattern.length(); ++i) {
+        const QChar c = pattern[i];
+        if (c == QLatin1Char('~') && i + 1 < pattern.length()
+                && (pattern[i + 1] == QLatin1Char('*') || pattern[i + 1] == QLatin1Char('?')
+                    || pattern[i + 1] == QLatin1Char('~'))) {
+            expression += QRegularExpression::escape(QString(pattern[++i]));
+        } else if (c == QLatin1Char('*')) {
+            expression += QStringLiteral(".*");
+        } else if (c == QLatin1Char('?')) {
+            expression += QLatin1Char('.');
+        } else {
+            expression += QRegularExpression::escape(QString(c));
+        }
+    }
+    return expression;
+}
+
+QRegularExpression wildcardExpression(const QString &pattern)
+{
+    return QRegularExpression(QStringLiteral("\\A(?:") + wildcardPattern(pattern) + QStringLiteral(")\\z"),
+                              QRegularExpression::CaseInsensitiveOption
+                              | QRegularExpression::DotMatchesEverythingOption);
+}
+
+/*
+ * A criteria argument of COUNTIF, SUMIF and friends, such as 5, ">=10",
+ * "<>done" or "a*".
+ */
+class Criterion
+{
+public:
+    explicit Criterion(const FormulaValue &criteria)
+        : m_op(Equal), m_operand(criteria), m_wildcard(false)
+    {
+        if (criteria.type == FormulaValue::Empty || criteria.type == FormulaValue::Missing) {
+            m_operand = FormulaValue::fromNumber(0);
+            return;
+        }
+        if (criteria.type != FormulaValue::String)
+            return;
+
+        static const struct {
+            const char *prefix;
+            Op op;
+        } prefixes[] = {
+            {">=", GreaterEqual}, {"<=", LessEqual}, {"<>", NotEqual},
+            {">", Greater}, {"<", Less}, {"=", Equal}
+        };
+
+        QString text = criteria.text;
+        for (const auto &prefix : prefixes) {
+            if (text.startsWith(QLatin1String(prefix.prefix))) {
+                m_op = prefix.op;
+                text = text.mid(int(strlen(prefix.prefix)));
+                break;
+            }
+        }
+
+        bool ok = false;
+        const double number = text.trimmed().toDouble(&ok);
+        if (ok) {
+            m_operand = FormulaValue::fromNumber(number);
+        } else if (text.compare(QLatin1String("TRUE"), Qt::CaseInsensitive) == 0) {
+            m_operand = FormulaValue::fromBoolean(true);
+        } else if (text.compare(QLatin1String("FALSE"), Qt::CaseInsensitive) == 0) {
+            m_operand = FormulaValue::fromBoolean(false);
+        } else {
+            m_operand = FormulaValue::fromString(text);
+            if ((m_op == Equal || m_op == NotEqual) && hasWildcards(text)) {
+                m_wildcard = true;
+                m_expression = wildcardExpression(text);
+            }
+        }
+    }
+
+    bool matches(const FormulaValue &value) const
+    {
+        if (m_operand.type == FormulaValue::String && m_operand.text.isEmpty()) {
+            const bool blank = value.type == FormulaValue::Empty
+                    || (value.type == FormulaValue::String && value.text.isEmpty());
+            if (m_op == Equal)
+                return blank;
+            return m_op == NotEqual ? !blank : false;
+        }
+        if (value.type == FormulaValue::Empty)
+            return m_op == NotEqual;
+        if (m_wildcard) {
+            const bool hit = value.type == FormulaValue::String && m_expression.match(value.text).hasMatch();
+            return m_op == Equal ? hit : !hit;
+        }
+
+        FormulaValue item = value;
+        double number = 0;
+        if (m_operand.type == FormulaValue::Number && value.type == FormulaValue::String
+                && toNumber(value, number))
+            item = FormulaValue::fromNumber(number);
+        if (typeRank(item) != typeRank(m_operand))
+            return m_op == NotEqual;
+
+        const int result = compareValues(item, m_operand);
+        switch (m_op) {
+        case Equal:
+            return result == 0;
+        case NotEqual:
+            return result != 0;
+        case Less:
+            return result < 0;
+        case LessEqual:
+            return result <= 0;
+        case Greater:
+            return result > 0;
+        default:
+            return result >= 0;
+        }
+    }
+
+private:
+    enum Op
+    {
+        Equal,
+        NotEqual,
+        Less,
+        LessEqual,
+        Greater,
+        GreaterEqual
+    };
+
+    Op m_op;
+    FormulaValue m_operand;
+    bool m_wildcard;
+    QRegularExpression m_expression;
+};
+
+// Serial numbers keep Excel's fictitious 1900-02-29, serial 60.
+bool dateFromSerial(double serial, bool date1904, int &year, int &month, int &day)
+{
+    if (!std::isfinite(serial) || serial < 0 || serial >= 2958466)
+        return false;
+
+    civilFromSerial(qint64(std::floor(serial)), date1904, year, month, day);
+    return true;
+}
+
+QDate dateFromSerial(double serial, bool date1904)
+{
+    int year, month, day;
+    if (!dateFromSerial(serial, date1904, year, month, day))
+        return QDate();
+    if (month == 2 && day == 29 && year == 1900)
+        return QDate(1900, 2, 28);
+    if (day == 0)
+        return QDate(1899, 12, 31);
+    return QDate(year, month, day);
+}
+
+int secondsOfDay(double serial)
+{
+    const qint64 seconds = qRound64((serial - std::floor(serial)) * 86400);
+    return int(seconds % 86400);
+}
+
+// Rounds half away from zero, after cutting the binary noise at 15 digits.
+double roundTo(double value, int digits, int direction)
+{
+    const double factor = std::pow(10.0, digits);
+    const double scaled = QString::number(value * factor, 'g', 15).toDouble();
+    double rounded;
+    if (direction > 0)
+        rounded = scaled < 0 ? -std::ceil(-scaled) : std::ceil(scaled);
+    else if (direction < 0)
+        rounded = std::trunc(scaled);
+    else
+        rounded = scaled < 0 ? -std::floor(-scaled + 0.5) : std::floor(scaled + 0.5);
+    return rounded / factor;
+}
+
+FormulaValue valueOf(const Cell *cell, bool date1904)
+{
+    if (!cell)
+        return FormulaValue();
+
+    const QVariant &value = cell->d_ptr->value;
+    switch (cell->d_ptr->cellType) {
+    case Cell::BooleanType:
+        return FormulaValue::fromBoolean(value.toBool());
+    case Cell::ErrorType:
+        return FormulaValue::error(value.toString());
+    case Cell::SharedStringType:
+    case Cell::InlineStringType:
+    case Cell::StringType:
+        return FormulaValue::fromString(value.toString());
+    default:
+        break;
+    }
+
+    if (!value.isValid())
+        return FormulaValue();
+    switch (value.userType()) {
+    case QMetaType::QDateTime:
+        return FormulaValue::fromNumber(datetimeToNumber(value.toDateTime(), date1904));
+    case QMetaType::QDate:
+        return FormulaValue::fromNumber(dateToNumber(value.toDate(), date1904));
+    case QMetaType::QTime:
+        return FormulaValue::fromNumber(timeToNumber(value.toTime()));
+    case QMetaType::Bool:
+        return FormulaValue::fromBoolean(value.toBool());
+    default:
+        break;
+    }
+
+    bool ok = false;
+    const double number = value.toDouble(&ok);
+    if (ok)
+        return FormulaValue::fromNumber(number);
+    const QString text = value.toString();
+    return text.isEmpty() ? FormulaValue() : FormulaValue::fromString(text);
+}
+
+} // namespace
+
+FormulaValue FormulaValue::fromNumber(double number)
+{
+    FormulaValue value;
+    value.type = Number;
+    value.number = number;
+    return value;
+}
+
+FormulaValue FormulaValue::fromString(const QString &text)
+{
+    FormulaValue value;
+    value.type = String;
+    value.text = text;
+    return value;
+}
+
+FormulaValue FormulaValue::fromBoolean(bool boolean)
+{
+    FormulaValue value;
+    value.type = Boolean;
+    value.number = boolean ? 1 : 0;
+    return value;
+}
+
+FormulaValue FormulaValue::error(const QString &code)
+{
+    FormulaValue value;
+    value.type = Error;
+    value.text = code;
+    return value;
+}
+
+FormulaValue FormulaValue::reference(Worksheet *sheet, const CellRange &range)
+{
+    FormulaValue value;
+    value.type = Reference;
+    value.sheet = sheet;
+    value.range = range;
+    return value;
+}
+
+FormulaValue FormulaValue::unsupported()
+{
+    FormulaValue value;
+    value.type = Unsupported;
+    return value;
+}
+
+FormulaEngine::FormulaEngine(Workbook *workbook)
+    : m_workbook(workbook), m_date1904(false), m_valid(false), m_deadCount(0)
+{
+}
+
+/*!
+ * \internal
+ * Evaluates the formulas depending on the cells written since the last call
+ * or on TODAY() and NOW(), all of them the first time or when \a full is
+ * true, precedents first, and stores the results as the cell values.
+ * Returns false when circular references were found, the cells involved
+ * are evaluated once with the values at hand.
+ */
+bool FormulaEngine::calculate(bool full)
+{
+    m_date1904 = m_workbook->isDate1904();
+    if (full)
+        invalidate();
+    updateGraph();
+    markVolatileDirty();
+
+    const QVector<int> order = calculationOrder(m_dirty);
+    //Cells of a cycle may read each other, they are evaluated in turn.
+    if (m_workbook->isParallelCalculationEnabled() && m_circular.isEmpty()
+            && order.size() >= minParallelFormulas && QThreadPool::globalInstance()->maxThreadCount() > 1) {
+        evaluateInParallel(order);
+    } else {
+        for (int index : order)
+            storeResult(m_formulas.at(index).cell, evaluateFormula(index));
+    }
+
+    for (int index : m_dirty)
+        m_formulas[index].dirty = false;
+    m_dirty.clear();
+    return m_circular.isEmpty();
+}
+
+/*!
+ * \internal
+ * Adds the formula cells of the workbook to \a chain, precedents first.
+ * Formulas the engine doesn't evaluate, such as array formulas, follow in
+ * sheet order. Cells which don't save their formula are left out.
+ */
+void FormulaEngine::fillCalcChain(CalcChain &chain)
+{
+    //Saving must not change what the next calculation does: a current graph
+    //only takes the pending writes, which would mark the same formulas dirty
+    //anyway, and a graph built for the chain alone is dropped afterwards.
+    const bool built = !m_valid;
+    if (built)
+        buildGraph();
+    else
+        updateGraph();
+
+    auto savesFormula = [](const Cell *cell) {
+        return cell && cell->hasFormula() && cell->cellType() != Cell::SharedStringType
+                && cell->cellType() != Cell::InlineStringType;
+    };
+
+    QVector<int> formulas;
+    formulas.reserve(m_formulas.size() - m_deadCount);
+    for (int i = 0; i < m_formulas.size(); ++i) {
+        if (m_formulas.at(i).alive)
+            formulas.append(i);
+    }
+    //The order of the whole graph isn't a calculation, keep its cycles.
+    const QVector<int> circular = m_circular;
+    const QVector<int> order = calculationOrder(formulas, false);
+    m_circular = circular;
+    for (int index : order) {
+        const FormulaCell &formula = m_formulas.at(index);
+        if (savesFormula(formula.cell))
+            chain.addCell(formula.sheet->sheetId(), CellReference(formula.row, formula.column));
+    }
+
+    for (int i = 0; i < m_workbook->sheetCount(); ++i) {
+        AbstractSheet *abstractSheet = m_workbook->sheet(i);
+        if (abstractSheet->sheetType() != AbstractSheet::ST_WorkSheet)
+            continue;
+
+        Worksheet *sheet = static_cast<Worksheet *>(abstractSheet);
+        const WorksheetPrivate *d = sheet->d_func();
+        for (auto row = d->cellTable.constBegin(); row != d->cellTable.constEnd(); ++row) {
+            for (auto column = row.value().constBegin(); column != row.value().constEnd(); ++column) {
+                const Cell *cell = column.value().data();
+                if (!savesFormula(cell) || formulaAt(sheet, row.key(), column.key()) != -1)
+                    continue;
+                chain.addCell(sheet->sheetId(), CellReference(row.key(), column.key()),
+                              cell->d_ptr->formula.formulaType() == CellFormula::ArrayType);
+            }
+        }
+    }
+
+    if (built)
+        invalidate();
+}
+
+/*!
+ * \internal
+ * Records that the cell at \a row and \a column of \a sheet was written.
+ * Nothing is done before the first calculation builds the graph.
+ */
+void FormulaEngine::cellChanged(Worksheet *sheet, int row, int column)
+{
+    if (!m_valid)
+        return;
+
+    Change change;
+    change.sheet = sheet;
+    change.row = row;
+    change.column = column;
+    m_changes.append(change);
+}
+
+/*!
+ * \internal
+ * Returns, by sheet, the formula cells whose text or position the rows or
+ * columns of \a shift, inserted into or deleted from \a sheet, can change:
+ * the formulas referring to the cells at or after the first shifted row or
+ * column, the ones held by these cells, and the array and data table
+ * formulas. Positions are the ones before the shift. The formulas held by
+ * the moving cells are dropped from the graph; the sheet reports all of
+ * them with cellChanged() once moved, and their dependents are marked
+ * dirty by the next calculation.
+ */
+QHash<Worksheet *, QVector<CellReference> > FormulaEngine::takeShiftedFormulas(Worksheet *sheet, const SheetShift &shift)
+{
+    updateGraph();
+
+    const bool rows = shift.axis() == SheetShift::Rows;
+    const CellRange moved = rows ? CellRange(shift.first(), 1, maxRowCount, maxColumnCount)
+                                 : CellRange(1, shift.first(), maxRowCount, maxColumnCount);
+    QVector<int> found;
+    dependents(sheet, moved, found);
+
+    QVector<int> held;
+    QMap<int, QMap<int, int> > &table = m_formulaTable[sheet];
+    for (auto row = rows ? table.lowerBound(shift.first()) : table.begin(); row != table.end(); ++row) {
+        const QMap<int, int> &columns = row.value();
+        for (auto column = rows ? columns.constBegin() : columns.lowerBound(shift.first());
+             column != columns.constEnd(); ++column)
+            held.append(column.value());
+    }
+    found += held;
+
+    QHash<Worksheet *, QVector<CellReference> > result;
+    QSet<int> seen;
+    for (int index : found) {
+        if (seen.contains(index))
+            continue;
+        seen.insert(index);
+        const FormulaCell &formula = m_formulas.at(index);
+        result[formula.sheet].append(CellReference(formula.row, formula.column));
+    }
+    for (int index : held)
+        removeFormula(index);
+
+    for (auto it = m_unevaluated.begin(); it != m_unevaluated.end(); ++it) {
+        QSet<quint64> kept;
+        for (quint64 key : it.value()) {
+            const CellReference cell(int(key >> 32), int(quint32(key)));
+            const Cell *data = it.key()->cellAt(cell.row(), cell.column());
+            if (!data || (data->d_ptr->formula.formulaType() != CellFormula::ArrayType
+                          && data->d_ptr->formula.formulaType() != CellFormula::DataTableType))
+                continue;
+            result[it.key()].append(cell);
+            const CellReference newCell = it.key() == sheet ? shift.shifted(cell) : cell;
+            if (newCell.isValid())
+                kept.insert(cellKey(newCell.row(), newCell.column()));
+        }
+        it.value() = kept;
+    }
+    return result;
+}
+
+/*!
+ * \internal
+ * Drops the graph, the next calculation evaluates every formula. Used when
+ * sheets or defined names change.
+ */
+void FormulaEngine::invalidate()
+{
+    m_valid = false;
+    m_formulas.clear();
+    m_formulaTable.clear();
+    m_dependents.clear();
+    m_changes.clear();
+    m_dirty.clear();
+    m_volatile.clear();
+    m_circular.clear();
+    m_unevaluated.clear();
+    m_deadCount = 0;
+}
+
+/*!
+ * \internal
+ * Returns the cells found in circular references by the last calculation.
+ */
+QStringList FormulaEngine::circularReferences() const
+{
+    QStringList references;
+    for (int index : m_circular) {
+        const FormulaCell &formula = m_formulas.at(index);
+        references.append(escapeSheetName(formula.sheet->sheetName()) + QLatin1Char('!')
+                          + CellReference(formula.row, formula.column).toString());
+    }
+    return references;
+}
+
+/*!
+ * \internal
+ * Looks up the sheets, defined names and date system of the workbook, for
+ * formulas evaluated outside of a calculation, such as the ones of
+ * conditional formats and data validations.
+ */
+void FormulaEngine::prepareEvaluation()
+{
+    m_date1904 = m_workbook->isDate1904();
+    collectSheets();
+}
+
+void FormulaEngine::collectSheets()
+{
+    m_sheets.clear();
+    m_names.clear();
+
+    for (int i = 0; i < m_workbook->sheetCount(); ++i) {
+        AbstractSheet *sheet = m_workbook->sheet(i);
+        if (sheet->sheetType() == AbstractSheet::ST_WorkSheet)
+            m_sheets.insert(sheet->sheetName().toLower(), static_cast<Worksheet *>(sheet));
+    }
+
+    FormulaCache *cache = m_workbook->formulaCache();
+    for (const XlsxDefineNameData &data : m_workbook->d_func()->definedNamesList) {
+        QString key = data.name.toLower();
+        if (data.sheetId != -1)
+            key = QString::number(data.sheetId) + QLatin1Char('!') + key;
+        m_names.insert(key, cache->parse(data.formula, CellReference(1, 1)));
+    }
+}
+
+/*!
+ * \internal
+ * Brings the graph up to date with the workbook, every formula is dirty
+ * when it's built from scratch.
+ */
+void FormulaEngine::updateGraph()
+{
+    if (!m_valid) {
+        buildGraph();
+        for (int i = 0; i < m_formulas.size(); ++i)
+            markDirty(i);
+    } else {
+        applyChanges();
+        if (m_deadCount > 1024 && m_deadCount > m_formulas.size() / 2)
+            compact();
+    }
+    m_changes.clear();
+}
+
+void FormulaEngine::buildGraph()
+{
+    invalidate();
+    collectSheets();
+
+    for (int i = 0; i < m_workbook->sheetCount(); ++i) {
+        AbstractSheet *abstractSheet = m_workbook->sheet(i);
+        if (abstractSheet->sheetType() != AbstractSheet::ST_WorkSheet)
+            continue;
+
+        Worksheet *sheet = static_cast<Worksheet *>(abstractSheet);
+        const WorksheetPrivate *d = sheet->d_func();
+        for (auto row = d->cellTable.constBegin(); row != d->cellTable.constEnd(); ++row) {
+            for (auto column = row.value().constBegin(); column != row.value().constEnd(); ++column) {
+                Cell *cell = column.value().data();
+                if (cell && cell->hasFormula())
+                    addFormula(sheet, row.key(), column.key(), cell);
+            }
+        }
+    }
+    m_valid = true;
+}
+
+/*!
+ * \internal
+ * Rebuilds the graph without the formulas of rewritten cells, keeping the
+ * pending work.
+ */
+void FormulaEngine::compact()
+{
+    QSet<Cell *> dirtyCells;
+    for (int index : m_dirty) {
+        if (m_formulas.at(index).alive)
+            dirtyCells.insert(m_formulas.at(index).cell);
+    }
+
+    buildGraph();
+    for (int i = 0; i < m_formulas.size(); ++i) {
+        if (dirtyCells.contains(m_formulas.at(i).cell))
+            markDirty(i);
+    }
+}
+
+/*!
+ * \internal
+ * Adds the formula held by \a cell to the graph. Returns its index, or -1
+ * for formulas the engine doesn't evaluate.
+ */
+int FormulaEngine::addFormula(Worksheet *sheet, int row, int column, Cell *cell)
+{
+    const CellFormula &cellFormula = cell->d_ptr->formula;
+    if (cellFormula.formulaType() == CellFormula::ArrayType
+            || cellFormula.formulaType() == CellFormula::DataTableType) {
+        //Not evaluated, only kept for the shifts of rows and columns.
+        m_unevaluated[sheet].insert(cellKey(row, column));
+        return -1;
+    }
+
+    QString text = cellFormula.formulaText();
+    CellReference anchor(row, column);
+    if (cellFormula.formulaType() == CellFormula::SharedType && text.isEmpty()) {
+        const WorksheetPrivate *d = sheet->d_func();
+        const auto root = d->sharedFormulaMap.constFind(cellFormula.sharedIndex());
+        if (root == d->sharedFormulaMap.constEnd())
+            return -1;
+        text = root.value().formulaText();
+        anchor = root.value().reference().topLeft();
+    }
+    if (text.isEmpty() || !anchor.isValid())
+        return -1;
+
+    const int index = m_formulas.size();
+    FormulaCell formula;
+    formula.sheet = sheet;
+    formula.row = row;
+    formula.column = column;
+    formula.cell = cell;
+    formula.formula = m_workbook->formulaCache()->parse(text, anchor);
+    formula.alive = true;
+    formula.dirty = false;
+    formula.isVolatile = isVolatileFormula(*formula.formula, sheet);
+    formula.visit = 0;
+    formula.level = 0;
+    formulaAreas(*formula.formula, sheet, CellReference(row, column), formula.areas);
+    for (const Area &area : formula.areas)
+        addDependency(area, index);
+
+    m_formulaTable[sheet][row][column] = index;
+    m_formulas.append(formula);
+    if (formula.isVolatile)
+        m_volatile.append(index);
+    return index;
+}
+
+/*!
+ * \internal
+ * Takes the formula \a index out of the graph. The entries of its areas are
+ * left in place and skipped by dependents(), compact() drops them.
+ */
+void FormulaEngine::removeFormula(int index)
+{
+    FormulaCell &formula = m_formulas[index];
+    QMap<int, QMap<int, int> > &table = m_formulaTable[formula.sheet];
+    auto row = table.find(formula.row);
+    if (row != table.end()) {
+        row.value().remove(formula.column);
+        if (row.value().isEmpty())
+            table.erase(row);
+    }
+
+    formula.alive = false;
+    formula.cell = nullptr;
+    formula.formula.reset();
+    formula.areas.clear();
+    ++m_deadCount;
+}
+
+void FormulaEngine::addDependency(const Area &area, int index)
+{
+    SheetDependents &dependents = m_dependents[area.sheet];
+    const CellRange &range = area.range;
+    Dependency dependency;
+    dependency.range = range;
+    dependency.formula = index;
+
+    if (range.rowCount() == 1 && range.columnCount() == 1) {
+        dependents.cells[cellKey(range.firstRow(), range.firstColumn())].append(index);
+    } else if (range.rowCount() <= maxBlockedRows) {
+        for (int block = range.firstRow() / blockRows; block <= range.lastRow() / blockRows; ++block)
+            dependents.rowBlocks[block].append(dependency);
+    } else if (range.columnCount() <= maxIndexedColumns) {
+        for (int column = range.firstColumn(); column <= range.lastColumn(); ++column)
+            dependents.columns[column].append(dependency);
+    } else {
+        dependents.others.append(dependency);
+    }
+}
+
+int FormulaEngine::formulaAt(Worksheet *sheet, int row, int column) const
+{
+    const auto table = m_formulaTable.constFind(sheet);
+    if (table == m_formulaTable.constEnd())
+        return -1;
+    const auto columns = table.value().constFind(row);
+    if (columns == table.value().constEnd())
+        return -1;
+    return columns.value().value(column, -1);
+}
+
+/*!
+ * \internal
+ * Updates the graph for the written cells and marks dirty every formula
+ * depending on them, directly or not.
+ */
+void FormulaEngine::applyChanges()
+{
+    QVector<int> queue;
+    QVector<int> found;
+    auto visit = [&](int index) {
+        if (!m_formulas.at(index).dirty) {
+            markDirty(index);
+            queue.append(index);
+        }
+    };
+
+    for (const Change &change : m_changes) {
+        const int existing = formulaAt(change.sheet, change.row, change.column);
+        if (existing >= 0)
+            removeFormula(existing);
+
+        Cell *cell = change.sheet->cellAt(change.row, change.column);
+        if (cell && cell->hasFormula()) {
+            const int index = addFormula(change.sheet, change.row, change.column, cell);
+            if (index >= 0)
+                visit(index);
+        }
+
+        found.clear();
+        dependents(change.sheet, change.row, change.column, found);
+        for (int index : found)
+            visit(index);
+    }
+
+    propagateDirty(queue);
+}
+
+void FormulaEngine::markDirty(int index)
+{
+    m_formulas[index].dirty = true;
+    m_dirty.append(index);
+}
+
+/*!
+ * \internal
+ * Marks dirty the formulas depending on the dirty formulas of \a queue,
+ * directly or not. The queue is emptied.
+ */
+void FormulaEngine::propagateDirty(QVector<int> &queue)
+{
+    QVector<int> found;
+    while (!queue.isEmpty()) {
+        const int index = queue.takeLast();
+        found.clear();
+        dependents(m_formulas.at(index).sheet, m_formulas.at(index).row, m_formulas.at(index).column, found);
+        for (int dependent : found) {
+            if (!m_formulas.at(dependent).dirty) {
+                markDirty(dependent);
+                queue.append(dependent);
+            }
+        }
+    }
+}
+
+/*!
+ * \internal
+ * Marks dirty the formulas calling TODAY() or NOW() and the ones depending
+ * on them: their values change without any cell being written.
+ */
+void FormulaEngine::markVolatileDirty()
+{
+    QVector<int> queue;
+    for (int index : m_volatile) {
+        const FormulaCell &formula = m_formulas.at(index);
+        if (formula.alive && !formula.dirty) {
+            markDirty(index);
+            queue.append(index);
+        }
+    }
+    propagateDirty(queue);
+}
+
+/*!
+ * \internal
+ * Returns whether \a formula, or a defined name it uses, calls a function
+ * whose value changes with time.
+ */
+bool FormulaEngine::isVolatileFormula(const ParsedFormula &formula, Worksheet *sheet, int depth) const
+{
+    for (const FormulaNode &node : formula.nodes()) {
+        if (node.type == FormulaNode::Function) {
+            QString name = node.token.text.toUpper();
+            if (name.startsWith(QLatin1String("_XLFN.")) || name.startsWith(QLatin1String("_XLWS.")))
+                name.remove(0, 6);
+            if (name == QLatin1String("TODAY") || name == QLatin1String("NOW"))
+                return true;
+        } else if (node.type == FormulaNode::Name && depth < maxNameDepth) {
+            Worksheet *scope = node.token.sheet.isEmpty() ? sheet : worksheet(node.token.sheet, sheet);
+            const ParsedFormula *name = scope ? definedName(node.token.text, scope) : nullptr;
+            if (name && isVolatileFormula(*name, scope, depth + 1))
+                return true;
+        }
+    }
+    return false;
+}
+
+/*!
+ * \internal
+ * Appends the live formulas referring to the cell at \a row and \a column
+ * of \a sheet.
+ */
+void FormulaEngine::dependents(Worksheet *sheet, int row, int column, QVector<int> &result) const
+{
+    const auto it = m_dependents.constFind(sheet);
+    if (it == m_dependents.constEnd())
+        return;
+
+    const SheetDependents &sheetDependents = it.value();
+    const auto cells = sheetDependents.cells.constFind(cellKey(row, column));
+    if (cells != sheetDependents.cells.constEnd()) {
+        for (int index : cells.value()) {
+            if (m_formulas.at(index).alive)
+                result.append(index);
+        }
+    }
+
+    auto scan = [&](const QVector<Dependency> &dependencies) {
+        for (const Dependency &dependency : dependencies) {
+            const CellRange &range = dependency.range;
+            if (row >= range.firstRow() && row <= range.lastRow()
+                    && column >= range.firstColumn() && column <= range.lastColumn()
+                    && m_formulas.at(dependency.formula).alive)
+                result.append(dependency.formula);
+        }
+    };
+    const auto block = sheetDependents.rowBlocks.constFind(row / blockRows);
+    if (block != sheetDependents.rowBlocks.constEnd())
+        scan(block.value());
+    const auto columns = sheetDependents.columns.constFind(column);
+    if (columns != sheetDependents.columns.constEnd())
+        scan(columns.value());
+    scan(sheetDependents.others);
+}
+
+/*!
+ * \internal
+ * Appends the live formulas referring to cells of \a range on \a sheet, some
+ * of them more than once. The single cells and the blocks of rows or
+ * columns indexed are only compared, not visited cell by cell.
+ */
+void FormulaEngine::dependents(Worksheet *sheet, const CellRange &range, QVector<int> &result) const
+{
+    const auto it = m_dependents.constFind(sheet);
+    if (it == m_dependents.constEnd())
+        return;
+
+    const SheetDependents &sheetDependents = it.value();
+    for (auto cells = sheetDependents.cells.constBegin(); cells != sheetDependents.cells.constEnd(); ++cells) {
+        const int row = int(cells.key() >> 32);
+        const int column = int(quint32(cells.key()));
+        if (row < range.firstRow() || row > range.lastRow()
+                || column < range.firstColumn() || column > range.lastColumn())
+            continue;
+        for (int index : cells.value()) {
+            if (m_formulas.at(index).alive)
+                result.append(index);
+        }
+    }
+
+    auto scan = [&](const QVector<Dependency> &dependencies) {
+        for (const Dependency &dependency : dependencies) {
+            const CellRange &area = dependency.range;
+            if (area.firstRow() <= range.lastRow() && range.firstRow() <= area.lastRow()
+                    && area.firstColumn() <= range.lastColumn() && range.firstColumn() <= area.lastColumn()
+                    && m_formulas.at(dependency.formula).alive)
+                result.append(dependency.formula);
+        }
+    };
+    for (auto block = sheetDependents.rowBlocks.constBegin(); block != sheetDependents.rowBlocks.constEnd(); ++block) {
+        if (block.key() >= range.firstRow() / blockRows && block.key() <= range.lastRow() / blockRows)
+            scan(block.value());
+    }
+    for (auto columns = sheetDependents.columns.constBegin(); columns != sheetDependents.columns.constEnd(); ++columns) {
+        if (columns.key() >= range.firstColumn() && columns.key() <= range.lastColumn())
+            scan(columns.value());
+    }
+    scan(sheetDependents.others);
+}
+
+/*!
+ * \internal
+ * Appends the areas \a formula, held by \a cell, refers to, including the
+ * areas of the defined names it uses.
+ */
+void FormulaEngine::formulaAreas(const ParsedFormula &formula, Worksheet *sheet, const CellReference &cell,
+                                 QVector<Area> &areas, int depth) const
+{
+    for (const FormulaNode &node : formula.nodes()) {
+        if (node.type == FormulaNode::Reference) {
+            Area area;
+            if (resolveReference(node.token, sheet, cell, area))
+                areas.append(area);
+        } else if (node.type == FormulaNode::Name && depth < maxNameDepth) {
+            Worksheet *scope = node.token.sheet.isEmpty() ? sheet : worksheet(node.token.sheet, sheet);
+            const ParsedFormula *name = scope ? definedName(node.token.text, scope) : nullptr;
+            if (name)
+                formulaAreas(*name, scope, CellReference(1, 1), areas, depth + 1);
+        }
+    }
+}
+
+/*!
+ * \internal
+ * Appends the indexes of the formula cells the formula \a index depends on.
+ */
+void FormulaEngine::precedents(int index, QVector<int> &result) const
+{
+    for (const Area &area : m_formulas.at(index).areas) {
+        const auto table = m_formulaTable.constFind(area.sheet);
+        if (table == m_formulaTable.constEnd())
+            continue;
+
+        const QMap<int, QMap<int, int> > &rows = table.value();
+        for (auto row = rows.lowerBound(area.range.firstRow());
+             row != rows.constEnd() && row.key() <= area.range.lastRow(); ++row) {
+            const QMap<int, int> &columns = row.value();
+            for (auto column = columns.lowerBound(area.range.firstColumn());
+                 column != columns.constEnd() && column.key() <= area.range.lastColumn(); ++column)
+                result.append(column.value());
+        }
+    }
+}
+
+/*!
+ * \internal
+ * Returns \a formulas ordered so that precedents come first, and records
+ * the cells of the circular references met. Each formula also gets its
+ * level, formulas of one level don't depend on each other. When \a dirtyOnly
+ * is true only dirty precedents are followed, the clean ones already hold
+ * their values; otherwise every precedent is. The depth first search keeps
+ * its own stack, long chains must not overflow the call stack.
+ */
+QVector<int> FormulaEngine::calculationOrder(const QVector<int> &formulas, bool dirtyOnly)
+{
+    struct Frame
+    {
+        int index;
+        int next;
+        QVector<int> precedents;
+    };
+
+    enum State : quint8 { NotVisited, Visiting, Visited };
+
+    QVector<int> order;
+    order.reserve(formulas.size());
+    m_circular.clear();
+    QSet<int> circular;
+
+    QVector<Frame> stack;
+    auto push = [&](int index) {
+        Frame frame;
+        frame.index = index;
+        frame.next = 0;
+        precedents(index, frame.precedents);
+        m_formulas[index].visit = Visiting;
+        stack.append(frame);
+    };
+
+    for (int start : formulas) {
+        if (!m_formulas.at(start).alive || m_formulas.at(start).visit != NotVisited)
+            continue;
+
+        push(start);
+        while (!stack.isEmpty()) {
+            Frame &frame = stack.last();
+            if (frame.next < frame.precedents.size()) {
+                const int precedent = frame.precedents.at(frame.next++);
+                const FormulaCell &formula = m_formulas.at(precedent);
+                if (dirtyOnly && !formula.dirty)
+                    continue;
+                if (formula.visit == NotVisited) {
+                    push(precedent);
+                } else if (formula.visit == Visiting) {
+                    //Every cell from the precedent to the top of the stack is in the cycle.
+                    for (int i = stack.size() - 1; i >= 0; --i) {
+                        circular.insert(stack.at(i).index);
+                        if (stack.at(i).index == precedent)
+                            break;
+                    }
+                }
+            } else {
+                int level = 0;
+                for (int precedent : frame.precedents) {
+                    const FormulaCell &formula = m_formulas.at(precedent);
+                    if ((formula.dirty || !dirtyOnly) && formula.visit == Visited)
+                        level = qMax(level, formula.level + 1);
+                }
+                m_formulas[frame.index].level = level;
+                m_formulas[frame.index].visit = Visited;
+                order.append(frame.index);
+                stack.removeLast();
+            }
+        }
+    }
+
+    for (int index : order)
+        m_formulas[index].visit = NotVisited;
+    for (int index : circular)
+        m_circular.append(index);
+    std::sort(m_circular.begin(), m_circular.end());
+    return order;
+}
+
+/*!
+ * \internal
+ * Evaluates the formulas of \a order level by level. The threads of the
+ * global pool and the calling one take chunks of a level from a shared
+ * counter until none is left, writing the results to their own slots. The
+ * results are stored in the cells between the levels, while no thread
+ * reads them.
+ */
+void FormulaEngine::evaluateInParallel(const QVector<int> &order)
+{
+    QVector<QVector<int> > levels;
+    for (int index : order) {
+        const int level = m_formulas.at(index).level;
+        if (level >= levels.size())
+            levels.resize(level + 1);
+        levels[level].append(index);
+    }
+
+    QThreadPool *pool = QThreadPool::globalInstance();
+    QVector<FormulaValue> results;
+    for (const QVector<int> &level : levels) {
+        const int count = level.size();
+        if (count < 2 * minChunkSize) {
+            for (int index : level)
+                storeResult(m_formulas.at(index).cell, evaluateFormula(index));
+            continue;
+        }
+
+        results.resize(count);
+        FormulaValue *slots = results.data();
+        const int chunkSize = qMax(minChunkSize, count / (pool->maxThreadCount() * 8));
+        const int chunks = (count + chunkSize - 1) / chunkSize;
+        runChunked(chunks, [&](int chunk, int) {
+            const int end = qMin(count, (chunk + 1) * chunkSize);
+            for (int i = chunk * chunkSize; i < end; ++i)
+                slots[i] = evaluateFormula(level.at(i));
+        });
+
+        for (int i = 0; i < count; ++i)
+            storeResult(m_formulas.at(level.at(i)).cell, results.at(i));
+    }
+}
+
+FormulaValue FormulaEngine::evaluateFormula(int index) const
+{
+    const FormulaCell &formula = m_formulas.at(index);
+    return evaluate(formula.sheet, CellReference(formula.row, formula.column), *formula.formula);
+}
+
+Worksheet *FormulaEngine::worksheet(const QString &sheetPrefix, Worksheet *current) const
+{
+    if (sheetPrefix.isEmpty())
+        return current;
+    const QString name = sheetPrefix.startsWith(QLatin1Char('\'')) ? unescapeSheetName(sheetPrefix) : sheetPrefix;
+    return m_sheets.value(name.toLower(), nullptr);
+}
+
+const ParsedFormula *FormulaEngine::definedName(const QString &name, Worksheet *current) const
+{
+    const QString key = name.toLower();
+    auto it = m_names.constFind(QString::number(current->sheetId()) + QLatin1Char('!') + key);
+    if (it == m_names.constEnd())
+        it = m_names.constFind(key);
+    return it == m_names.constEnd() ? nullptr : it.value().data();
+}
+
+bool FormulaEngine::resolveReference(const FormulaToken &token, Worksheet *sheet, const CellReference &cell, Area &area) const
+{
+    Worksheet *target = worksheet(token.sheet, sheet);
+    if (!target)
+        return false;
+
+    const int firstRow = token.first.resolvedRow(cell);
+    const int firstColumn = token.first.resolvedColumn(cell);
+    const int lastRow = token.last.resolvedRow(cell);
+    const int lastColumn = token.last.resolvedColumn(cell);
+    if (firstRow < 1 || firstColumn < 1 || lastRow < 1 || lastColumn < 1
+            || firstRow > maxRowCount || lastRow > maxRowCount
+            || firstColumn > maxColumnCount || lastColumn > maxColumnCount)
+        return false;
+
+    area.sheet = target;
+    area.range = CellRange(qMin(firstRow, lastRow), qMin(firstColumn, lastColumn),
+                           qMax(firstRow, lastRow), qMax(firstColumn, lastColumn));
+    return true;
+}
+
+/*!
+ * \internal
+ * Converts \a value like the arithmetic operators do. Returns false for
+ * errors and text that isn't a number.
+ */
+bool FormulaEngine::numberOf(const FormulaValue &value, double &number)
+{
+    return toNumber(value, number);
+}
+
+QString FormulaEngine::textOf(const FormulaValue &value)
+{
+    return toText(value);
+}
+
+bool FormulaEngine::booleanOf(const FormulaValue &value, bool &result)
+{
+    return toBoolean(value, result);
+}
+
+/*!
+ * \internal
+ * Compares two scalars like the comparison operators do: -1, 0 or 1.
+ */
+int FormulaEngine::compare(const FormulaValue &left, const FormulaValue &right)
+{
+    return compareValues(left, right);
+}
+
+FormulaValue FormulaEngine::cellValue(Worksheet *sheet, int row, int column) const
+{
+    return valueOf(sheet->cellAt(row, column), m_date1904);
+}
+
+/*!
+ * \internal
+ * Returns the single value of \a value. Multi-cell references are reduced by
+ * implicit intersection with the row or column of \a cell.
+ */
+FormulaValue FormulaEngine::scalar(const FormulaValue &value, const CellReference &cell) const
+{
+    if (value.type != FormulaValue::Reference)
+        return value;
+
+    const CellRange &range = value.range;
+    if (range.rowCount() == 1 && range.columnCount() == 1)
+        return cellValue(value.sheet, range.firstRow(), range.firstColumn());
+    if (range.columnCount() == 1 && cell.row() >= range.firstRow() && cell.row() <= range.lastRow())
+        return cellValue(value.sheet, cell.row(), range.firstColumn());
+    if (range.rowCount() == 1 && cell.column() >= range.firstColumn() && cell.column() <= range.lastColumn())
+        return cellValue(value.sheet, range.firstRow(), cell.column());
+    return errorValue("#VALUE!");
+}
+
+/*!
+ * \internal
+ * Returns the part of \a reference inside the used area of its sheet, or an
+ * invalid range when they don't overlap.
+ */
+CellRange FormulaEngine::usedRange(const FormulaValue &reference) const
+{
+    const CellRange used = reference.sheet->dimension();
+    const CellRange &range = reference.range;
+    if (!used.isValid())
+        return CellRange();
+
+    const CellRange result(qMax(range.firstRow(), used.firstRow()), qMax(range.firstColumn(), used.firstColumn()),
+                           qMin(range.lastRow(), used.lastRow()), qMin(range.lastColumn(), used.lastColumn()));
+    if (result.firstRow() > result.lastRow() || result.firstColumn() > result.lastColumn())
+        return CellRange();
+    return result;
+}
+
+/*!
+ * \internal
+ * Calls \a visitor with the value, row and column of each existing cell of
+ * \a reference, row by row. Blank cells aren't visited.
+ */
+template <typename Visitor>
+void FormulaEngine::visitCells(const FormulaValue &reference, Visitor visitor) const
+{
+    const CellRange &range = reference.range;
+    const QMap<int, QMap<int, QSharedPointer<Cell> > > &rows = reference.sheet->d_func()->cellTable;
+    for (auto row = rows.lowerBound(range.firstRow());
+         row != rows.constEnd() && row.key() <= range.lastRow(); ++row) {
+        const QMap<int, QSharedPointer<Cell> > &columns = row.value();
+        for (auto column = columns.lowerBound(range.firstColumn());
+             column != columns.constEnd() && column.key() <= range.lastColumn(); ++column)
+            visitor(valueOf(column.value().data(), m_date1904), row.key(), column.key());
+    }
+}
+
+/*!
+ * \internal
+ * Evaluates \a formula held by \a cell of \a sheet and returns its single
+ * value. FormulaValue::Unsupported means the engine can't evaluate it.
+ */
+FormulaValue FormulaEngine::evaluate(Worksheet *sheet, const CellReference &cell, const ParsedFormula &formula, int depth) const
+{
+    if (!formula.isValid())
+        return FormulaValue::unsupported();
+
+    const QVector<FormulaNode> &nodes = formula.nodes();
+    QVector<FormulaValue> stack;
+    stack.reserve(nodes.size());
+
+    for (const FormulaNode &node : nodes) {
+        const FormulaToken &token = node.token;
+        switch (node.type) {
+        case FormulaNode::Number:
+            stack.append(FormulaValue::fromNumber(token.number));
+            break;
+        case FormulaNode::String:
+            stack.append(FormulaValue::fromString(token.text));
+            break;
+        case FormulaNode::Boolean:
+            stack.append(FormulaValue::fromBoolean(token.number != 0));
+            break;
+        case FormulaNode::Error:
+            stack.append(FormulaValue::error(token.text));
+            break;
+        case FormulaNode::Missing: {
+            FormulaValue missing;
+            missing.type = FormulaValue::Missing;
+            stack.append(missing);
+            break;
+        }
+        case FormulaNode::Reference: {
+            Area area;
+            stack.append(resolveReference(token, sheet, cell, area)
+                         ? FormulaValue::reference(area.sheet, area.range) : errorValue("#REF!"));
+            break;
+        }
+        case FormulaNode::Name: {
+            Worksheet *scope = worksheet(token.sheet, sheet);
+            const ParsedFormula *name = scope && depth < maxNameDepth ? definedName(token.text, scope) : nullptr;
+            if (!name) {
+                stack.append(errorValue("#NAME?"));
+                break;
+            }
+            //A name may stand for a range, so the value is kept as it is.
+            FormulaValue value = evaluate(scope, cell, *name, depth + 1);
+            if (value.type == FormulaValue::Unsupported)
+                return value;
+            stack.append(value);
+            break;
+        }
+        case FormulaNode::Function: {
+            const int count = node.argumentCount;
+            if (stack.size() < count)
+                return FormulaValue::unsupported();
+            const QVector<FormulaValue> args = stack.mid(stack.size() - count);
+            stack.resize(stack.size() - count);
+
+            QString name = token.text.toUpper();
+            if (name.startsWith(QLatin1String("_XLFN.")) || name.startsWith(QLatin1String("_XLWS.")))
+                name.remove(0, 6);
+            const FormulaValue value = function(name, args, cell);
+            if (value.type == FormulaValue::Unsupported)
+                return value;
+            stack.append(value);
+            break;
+        }
+        case FormulaNode::UnaryOperator:
+        case FormulaNode::Percent: {
+            if (stack.isEmpty())
+                return FormulaValue::unsupported();
+            const FormulaValue value = scalar(stack.takeLast(), cell);
+            double number = 0;
+            if (value.isError())
+                stack.append(value);
+            else if (!toNumber(value, number))
+                stack.append(errorValue("#VALUE!"));
+            else if (node.type == FormulaNode::Percent)
+                stack.append(FormulaValue::fromNumber(number / 100));
+            else
+                stack.append(FormulaValue::fromNumber(token.text == QLatin1String("-") ? -number : number));
+            break;
+        }
+        case FormulaNode::BinaryOperator: {
+            if (stack.size() < 2)
+                return FormulaValue::unsupported();
+            const FormulaValue right = scalar(stack.takeLast(), cell);
+            const FormulaValue left = scalar(stack.takeLast(), cell);
+            stack.append(binary(token.text, left, right));
+            break;
+        }
+        case FormulaNode::Parenthesis:
+            break;
+        }
+    }
+
+    if (stack.size() != 1)
+        return FormulaValue::unsupported();
+    if (depth > 0)
+        return stack.first();
+
+    const FormulaValue result = scalar(stack.first(), cell);
+    if (result.type == FormulaValue::Empty || result.type == FormulaValue::Missing)
+        return FormulaValue::fromNumber(0);
+    if (result.type == FormulaValue::Number)
+        return checkedNumber(result.number);
+    return result;
+}
+
+/*!
+ * \internal
+ * Stores \a value as the cached result of the formula \a cell.
+ */
+void FormulaEngine::storeResult(Cell *cell, const FormulaValue &value)
+{
+    CellPrivate *d = cell->d_ptr;
+    switch (value.type) {
+    case FormulaValue::Unsupported:
+        return;
+    case FormulaValue::Number:
+        if (d->cellType != Cell::DateType)
+            d->cellType = Cell::NumberType;
+        d->value = value.number;
+        break;
+    case FormulaValue::String:
+        d->cellType = Cell::StringType;
+        d->value = value.text;
+        break;
+    case FormulaValue::Boolean:
+        d->cellType = Cell::BooleanType;
+        d->value = value.number != 0;
+        break;
+    case FormulaValue::Error:
+        d->cellType = Cell::ErrorType;
+        d->value = value.text;
+        break;
+    default:
+        d->cellType = Cell::NumberType;
+        d->value = 0.0;
+        break;
+    }
+}
+
+FormulaValue FormulaEngine::binary(const QString &op, const FormulaValue &left, const FormulaValue &right) const
+{
+    if (left.isError())
+        return left;
+    if (right.isError())
+        return right;
+
+    if (op == QLatin1String("&"))
+        return FormulaValue::fromString(toText(left) + toText(right));
+
+    if (op == QLatin1String("="))
+        return FormulaValue::fromBoolean(compareValues(left, right) == 0);
+    if (op == QLatin1String("<>"))
+        return FormulaValue::fromBoolean(compareValues(left, right) != 0);
+    if (op == QLatin1String("<"))
+        return FormulaValue::fromBoolean(compareValues(left, right) < 0);
+    if (op == QLatin1String("<="))
+        return FormulaValue::fromBoolean(compareValues(left, right) <= 0);
+    if (op == QLatin1String(">"))
+        return FormulaValue::fromBoolean(compareValues(left, right) > 0);
+    if (op == QLatin1String(">="))
+        return FormulaValue::fromBoolean(compareValues(left, right) >= 0);
+
+    double a = 0;
+    double b = 0;
+    if (!toNumber(left, a) || !toNumber(right, b))
+        return errorValue("#VALUE!");
+
+    if (op == QLatin1String("+"))
+        return checkedNumber(a + b);
+    if (op == QLatin1String("-"))
+        return checkedNumber(a - b);
+    if (op == QLatin1String("*"))
+        return checkedNumber(a * b);
+    if (op == QLatin1String("/"))
+        return b == 0 ? errorValue("#DIV/0!") : checkedNumber(a / b);
+    if (op == QLatin1String("^"))
+        return a == 0 && b == 0 ? errorValue("#NUM!") : checkedNumber(std::pow(a, b));
+    return FormulaValue::unsupported();
+}
+
+/*!
+ * \internal
+ * Returns the position of \a value in the one row or one column reference
+ * \a vector, or -1. \a mode is a LookupMode.
+ */
+int FormulaEngine::lookup(const FormulaValue &value, const FormulaValue &vector, int mode, bool wildcards, bool reverse) const
+{
+    const CellRange &range = vector.range;
+    const CellRange used = usedRange(vector);
+    if (!used.isValid())
+        return -1;
+
+    const bool vertical = range.columnCount() == 1;
+    const int first = vertical ? used.firstRow() - range.firstRow() : used.firstColumn() - range.firstColumn();
+    const int last = vertical ? used.lastRow() - range.firstRow() : used.lastColumn() - range.firstColumn();
+    const bool pattern = wildcards && mode == ExactMatch && value.type == FormulaValue::String
+            && hasWildcards(value.text);
+    const QRegularExpression expression = pattern ? wildcardExpression(value.text) : QRegularExpression();
+
+    int found = -1;
+    FormulaValue best;
+    for (int step = 0; step <= last - first; ++step) {
+        const int i = reverse ? last - step : first + step;
+        const FormulaValue item = vertical ? cellValue(vector.sheet, range.firstRow() + i, range.firstColumn())
+                                           : cellValue(vector.sheet, range.firstRow(), range.firstColumn() + i);
+        if (item.type == FormulaValue::Empty)
+            continue;
+        if (pattern) {
+            if (item.type == FormulaValue::String && expression.match(item.text).hasMatch())
+                return i;
+            continue;
+        }
+        if (typeRank(item) != typeRank(value))
+            continue;
+
+        const int result = compareValues(item, value);
+        switch (mode) {
+        case ExactMatch:
+            if (result == 0)
+                return i;
+            break;
+        case AscendingMatch:
+            if (result > 0)
+                return found;
+            found = i;
+            break;
+        case DescendingMatch:
+            if (result < 0)
+                return found;
+            found = i;
+            break;
+        case NextSmallerMatch:
+            if (result == 0)
+                return i;
+            if (result < 0 && (found < 0 || compareValues(item, best) > 0)) {
+                found = i;
+                best = item;
+            }
+            break;
+        case NextLargerMatch:
+            if (result == 0)
+                return i;
+            if (result > 0 && (found < 0 || compareValues(item, best) < 0)) {
+                found = i;
+                best = item;
+            }
+            break;
+        }
+    }
+    return found;
+}
+
+/*!
+ * \internal
+ * Calls the worksheet function \a name. Arguments keep their references,
+ * functions taking single values reduce them themselves.
+ */
+FormulaValue FormulaEngine::function(const QString &name, const QVector<FormulaValue> &args,
+                                     const CellReference &cell) const
+{
+    const QHash<QString, FunctionInfo> &table = functionTable();
+    const auto info = table.constFind(name);
+    if (info == table.constEnd())
+        return FormulaValue::unsupported();
+    if (args.size() < info->minArguments || args.size() > info->maxArguments)
+        return errorValue("#VALUE!");
+
+    QVector<FormulaValue> values;
+    values.reserve(args.size());
+    for (const FormulaValue &arg : args)
+        values.append(scalar(arg, cell));
+
+    FormulaValue failure;
+    auto has = [&](int i) {
+        return i < args.size() && args.at(i).type != FormulaValue::Missing;
+    };
+    auto number = [&](int i, double &result) {
+        const FormulaValue value = i < values.size() ? values.at(i) : FormulaValue();
+        if (value.isError()) {
+            failure = value;
+            return false;
+        }
+        if (!toNumber(value, result)) {
+            failure = errorValue("#VALUE!");
+            return false;
+        }
+        return true;
+    };
+    auto integer = [&](int i, int &result) {
+        double value = 0;
+        if (!number(i, value))
+            return false;
+        if (std::fabs(value) > 2147483647.0) {
+            failure = errorValue("#NUM!");
+            return false;
+        }
+        result = int(std::floor(value));
+        return true;
+    };
+    auto text = [&](int i, QString &result) {
+        const FormulaValue value = i < values.size() ? values.at(i) : FormulaValue();
+        if (value.isError()) {
+            failure = value;
+            return false;
+        }
+        result = toText(value);
+        return true;
+    };
+    auto boolean = [&](int i, bool &result) {
+        const FormulaValue value = i < values.size() ? values.at(i) : FormulaValue();
+        if (value.isError()) {
+            failure = value;
+            return false;
+        }
+        if (!toBoolean(value, result)) {
+            failure = errorValue("#VALUE!");
+            return false;
+        }
+        return true;
+    };
+    auto date = [&](int i, int &year, int &month, int &day) {
+        double serial = 0;
+        if (!number(i, serial))
+            return false;
+        if (!dateFromSerial(serial, m_date1904, year, month, day)) {
+            failure = errorValue("#NUM!");
+            return false;
+        }
+        return true;
+    };
+    auto isReference = [&](int i) {
+        return i < args.size() && args.at(i).type == FormulaValue::Reference;
+    };
+
+    //Shared by the *IF and *IFS functions: the ranges and criteria to test,
+    //and the range whose cells are summed or counted.
+    auto conditional = [&](const QVector<int> &rangeArgs, const QVector<FormulaValue> &criteriaValues,
+                           int targetArg, double &sum, double &count) {
+        sum = 0;
+        count = 0;
+        QVector<FormulaValue> ranges;
+        QList<Criterion> criteria;
+        for (int i = 0; i < rangeArgs.size(); ++i) {
+            if (!isReference(rangeArgs.at(i))) {
+                failure = errorValue("#VALUE!");
+                return false;
+            }
+            const FormulaValue &range = args.at(rangeArgs.at(i));
+            if (!ranges.isEmpty() && (range.range.rowCount() != ranges.first().range.rowCount()
+                                      || range.range.columnCount() != ranges.first().range.columnCount())) {
+                failure = errorValue("#VALUE!");
+                return false;
+            }
+            ranges.append(range);
+            criteria.append(Criterion(criteriaValues.at(i)));
+        }
+
+        FormulaValue target;
+        if (targetArg >= 0) {
+            if (!isReference(targetArg)) {
+                failure = errorValue("#VALUE!");
+                return false;
+            }
+            target = args.at(targetArg);
+        }
+
+        const CellRange &driver = ranges.first().range;
+        auto test = [&](int rowOffset, int columnOffset) {
+            for (int i = 0; i < ranges.size(); ++i) {
+                const CellRange &range = ranges.at(i).range;
+                const FormulaValue value = cellValue(ranges.at(i).sheet, range.firstRow() + rowOffset,
+                                                     range.firstColumn() + columnOffset);
+                if (!criteria.at(i).matches(value))
+                    return;
+            }
+            if (targetArg < 0) {
+                count += 1;
+                return;
+            }
+            const FormulaValue value = cellValue(target.sheet, target.range.firstRow() + rowOffset,
+                                                 target.range.firstColumn() + columnOffset);
+            if (value.type == FormulaValue::Number) {
+                sum += value.number;
+                count += 1;
+            }
+        };
+
+        bool matchesBlank = true;
+        for (const Criterion &criterion : criteria)
+            matchesBlank = matchesBlank && criterion.matches(FormulaValue());
+
+        if (!criteria.first().matches(FormulaValue())) {
+            //Only the existing cells of the first range can match.
+            visitCells(ranges.first(), [&](const FormulaValue &, int row, int column) {
+                test(row - driver.firstRow(), column - driver.firstColumn());
+            });
+        } else {
+            const CellRange used = usedRange(ranges.first());
+            if (used.isValid()) {
+                for (int row = used.firstRow(); row <= used.lastRow(); ++row) {
+                    for (int column = used.firstColumn(); column <= used.lastColumn(); ++column)
+                        test(row - driver.firstRow(), column - driver.firstColumn());
+                }
+            }
+            //Cells outside the used area are blank everywhere.
+            if (targetArg < 0 && matchesBlank) {
+                const double area = double(driver.rowCount()) * driver.columnCount();
+                const double usedArea = used.isValid() ? double(used.rowCount()) * used.columnCount() : 0;
+                count += area - usedArea;
+            }
+        }
+        return true;
+    };
+
+    switch (info->id) {
+    case Sum:
+    case Average:
+    case Min:
+    case Max:
+    case Product:
+    case Count:
+    case CountA: {
+        double sum = 0;
+        double product = 1;
+        double minimum = std::numeric_limits<double>::infinity();
+        double maximum = -std::numeric_limits<double>::infinity();
+        qint64 numbers = 0;
+        qint64 nonBlank = 0;
+        bool failed = false;
+        auto add = [&](double value) {
+            sum += value;
+            product *= value;
+            minimum = qMin(minimum, value);
+            maximum = qMax(maximum, value);
+            ++numbers;
+        };
+        auto fail = [&](const FormulaValue &error) {
+            if (!failed) {
+                failed = true;
+                failure = error;
+            }
+        };
+        for (const FormulaValue &arg : args) {
+            if (arg.type == FormulaValue::Reference && info->id != Product) {
+                XlsxAggregateData data;
+                arg.sheet->d_func()->aggregateRange(arg.range, data);
+                sum += data.sum;
+                minimum = qMin(minimum, data.minimum);
+                maximum = qMax(maximum, data.maximum);
+                numbers += data.numbers;
+                nonBlank += data.nonBlank;
+                if (!data.error.isEmpty())
+                    fail(FormulaValue::error(data.error));
+            } else if (arg.type == FormulaValue::Reference) {
+                visitCells(arg, [&](const FormulaValue &value, int, int) {
+                    if (value.type == FormulaValue::Empty)
+                        return;
+                    ++nonBlank;
+                    if (value.type == FormulaValue::Number)
+                        add(value.number);
+                    else if (value.isError())
+                        fail(value);
+                });
+            } else if (arg.type != FormulaValue::Missing) {
+                ++nonBlank;
+                double value = 0;
+                if (arg.isError())
+                    fail(arg);
+                else if (toNumber(arg, value))
+                    add(value);
+                else
+                    fail(errorValue("#VALUE!"));
+            }
+        }
+
+        if (info->id == Count)
+            return FormulaValue::fromNumber(double(numbers));
+        if (info->id == CountA)
+            return FormulaValue::fromNumber(double(nonBlank));
+        if (failed)
+            return failure;
+        switch (info->id) {
+        case Sum:
+            return checkedNumber(sum);
+        case Average:
+            return numbers ? checkedNumber(sum / numbers) : errorValue("#DIV/0!");
+        case Min:
+            return FormulaValue::fromNumber(numbers ? minimum : 0);
+        case Max:
+            return FormulaValue::fromNumber(numbers ? maximum : 0);
+        default:
+            return checkedNumber(numbers ? product : 0);
+        }
+    }
+    case CountBlank: {
+        if (!isReference(0))
+            return errorValue("#VALUE!");
+        double sum, count;
+        if (!conditional({0}, {FormulaValue::fromString(QString())}, -1, sum, count))
+            return failure;
+        return FormulaValue::fromNumber(count);
+    }
+    case CountIf:
+    case CountIfs: {
+        if (args.size() % 2)
+            return errorValue("#VALUE!");
+        QVector<int> ranges;
+        QVector<FormulaValue> criteria;
+        for (int i = 0; i < args.size(); i += 2) {
+            ranges.append(i);
+            criteria.append(values.at(i + 1));
+        }
+        double sum, count;
+        if (!conditional(ranges, criteria, -1, sum, count))
+            return failure;
+        return FormulaValue::fromNumber(count);
+    }
+    case SumIf:
+    case AverageIf: {
+        double sum, count;
+        if (!conditional({0}, {values.at(1)}, has(2) ? 2 : 0, sum, count))
+            return failure;
+        if (info->id == SumIf)
+            return checkedNumber(sum);
+        return count ? checkedNumber(sum / count) : errorValue("#DIV/0!");
+    }
+    case SumIfs:
+    case AverageIfs: {
+        if (args.size() % 2 == 0)
+            return errorValue("#VALUE!");
+        QVector<int> ranges;
+        QVector<FormulaValue> criteria;
+        for (int i = 1; i < args.size(); i += 2) {
+            ranges.append(i);
+            criteria.append(values.at(i + 1));
+        }
+        double sum, count;
+        if (!conditional(ranges, criteria, 0, sum, count))
+            return failure;
+        if (info->id == SumIfs)
+            return checkedNumber(sum);
+        return count ? checkedNumber(sum / count) : errorValue("#DIV/0!");
+    }
+    case Abs:
+    case Int:
+    case Sqrt:
+    case Exp:
+    case Ln:
+    case Log10:
+    case Sign: {
+        double x;
+        if (!number(0, x))
+            return failure;
+        switch (info->id) {
+        case Abs:
+            return FormulaValue::fromNumber(std::fabs(x));
+        case Int:
+            return FormulaValue::fromNumber(std::floor(x));
+        case Sqrt:
+            return x < 0 ? errorValue("#NUM!") : FormulaValue::fromNumber(std::sqrt(x));
+        case Exp:
+            return checkedNumber(std::exp(x));
+        case Ln:
+            return x <= 0 ? errorValue("#NUM!") : FormulaValue::fromNumber(std::log(x));
+        case Log10:
+            return x <= 0 ? errorValue("#NUM!") : FormulaValue::fromNumber(std::log10(x));
+        default:
+            return FormulaValue::fromNumber(x > 0 ? 1 : (x < 0 ? -1 : 0));
+        }
+    }
+    case Mod: {
+        double a, b;
+        if (!number(0, a) || !number(1, b))
+            return failure;
+        if (b == 0)
+            return errorValue("#DIV/0!");
+        return checkedNumber(a - b * std::floor(a / b));
+    }
+    case Power: {
+        double a, b;
+        if (!number(0, a) || !number(1, b))
+            return failure;
+        return binary(QStringLiteral("^"), FormulaValue::fromNumber(a), FormulaValue::fromNumber(b));
+    }
+    case Round:
+    case RoundUp:
+    case RoundDown: {
+        double x;
+        int digits;
+        if (!number(0, x) || !integer(1, digits))
+            return failure;
+        const int direction = info->id == RoundUp ? 1 : (info->id == RoundDown ? -1 : 0);
+        return checkedNumber(roundTo(x, qBound(-308, digits, 308), direction));
+    }
+    case Pi:
+        return FormulaValue::fromNumber(3.14159265358979323846);
+    case True:
+        return FormulaValue::fromBoolean(true);
+    case False:
+        return FormulaValue::fromBoolean(false);
+    case Na:
+        return errorValue("#N/A");
+    case If: {
+        bool condition;
+        if (!boolean(0, condition))
+            return failure;
+        if (condition)
+            return has(1) ? args.at(1) : FormulaValue::fromNumber(0);
+        if (args.size() < 3)
+            return FormulaValue::fromBoolean(false);
+        return has(2) ? args.at(2) : FormulaValue::fromNumber(0);
+    }
+    case IfError:
+        return values.at(0).isError() ? args.at(1) : args.at(0);
+    case IfNa:
+        return values.at(0).isError() && values.at(0).text == QLatin1String("#N/A") ? args.at(1) : args.at(0);
+    case And:
+    case Or: {
+        bool any = false;
+        bool all = true;
+        int count = 0;
+        bool failed = false;
+        auto add = [&](bool value) {
+            any = any || value;
+            all = all && value;
+            ++count;
+        };
+        for (const FormulaValue &arg : args) {
+            if (arg.type == FormulaValue::Reference) {
+                visitCells(arg, [&](const FormulaValue &value, int, int) {
+                    if (value.isError() && !failed) {
+                        failed = true;
+                        failure = value;
+                    } else if (value.type == FormulaValue::Number || value.type == FormulaValue::Boolean) {
+                        add(value.number != 0);
+                    }
+                });
+            } else if (arg.type != FormulaValue::Missing) {
+                bool value;
+                if (arg.isError()) {
+                    if (!failed) {
+                        failed = true;
+                        failure = arg;
+                    }
+                } else if (toBoolean(arg, value)) {
+                    add(value);
+                } else if (!failed) {
+                    failed = true;
+                    failure = errorValue("#VALUE!");
+                }
+            }
+        }
+        if (failed)
+            return failure;
+        if (!count)
+            return errorValue("#VALUE!");
+        return FormulaValue::fromBoolean(info->id == And ? all : any);
+    }
+    case Not: {
+        bool value;
+        if (!boolean(0, value))
+            return failure;
+        return FormulaValue::fromBoolean(!value);
+    }
+    case IsBlank:
+        return FormulaValue::fromBoolean(values.at(0).type == FormulaValue::Empty);
+    case IsErr:
+        return FormulaValue::fromBoolean(values.at(0).isError() && values.at(0).text != QLatin1String("#N/A"));
+    case IsError:
+        return FormulaValue::fromBoolean(values.at(0).isError());
+    case IsNa:
+        return FormulaValue::fromBoolean(values.at(0).isError() && values.at(0).text == QLatin1String("#N/A"));
+    case IsLogical:
+        return FormulaValue::fromBoolean(values.at(0).type == FormulaValue::Boolean);
+    case IsNumber:
+        return FormulaValue::fromBoolean(values.at(0).type == FormulaValue::Number);
+    case IsText:
+        return FormulaValue::fromBoolean(values.at(0).type == FormulaValue::String);
+    case IsNonText:
+        return FormulaValue::fromBoolean(values.at(0).type != FormulaValue::String);
+    case Row:
+    case Column: {
+        if (!has(0))
+            return FormulaValue::fromNumber(info->id == Row ? cell.row() : cell.column());
+        if (!isReference(0))
+            return errorValue("#VALUE!");
+        const CellRange &range = args.at(0).range;
+        return FormulaValue::fromNumber(info->id == Row ? range.firstRow() : range.firstColumn());
+    }
+    case Rows:
+    case Columns: {
+        if (!isReference(0))
+            return values.at(0).isError() ? values.at(0) : FormulaValue::fromNumber(1);
+        const CellRange &range = args.at(0).range;
+        return FormulaValue::fromNumber(info->id == Rows ? range.rowCount() : range.columnCount());
+    }
+    case VLookup:
+    case HLookup: {
+        if (values.at(0).isError())
+            return values.at(0);
+        if (!isReference(1))
+            return errorValue("#N/A");
+        int index;
+        bool approximate = true;
+        if (!integer(2, index) || (has(3) && !boolean(3, approximate)))
+            return failure;
+
+        const FormulaValue &table = args.at(1);
+        const bool vertical = info->id == VLookup;
+        if (index < 1)
+            return errorValue("#VALUE!");
+        if (index > (vertical ? table.range.columnCount() : table.range.rowCount()))
+            return errorValue("#REF!");
+
+        const CellRange &range = table.range;
+        const FormulaValue vector = FormulaValue::reference(table.sheet, vertical
+                ? CellRange(range.firstRow(), range.firstColumn(), range.lastRow(), range.firstColumn())
+                : CellRange(range.firstRow(), range.firstColumn(), range.firstRow(), range.lastColumn()));
+        const int position = lookup(values.at(0), vector, approximate ? AscendingMatch : ExactMatch, !approximate, false);
+        if (position < 0)
+            return errorValue("#N/A");
+        return vertical ? cellValue(table.sheet, range.firstRow() + position, range.firstColumn() + index - 1)
+                        : cellValue(table.sheet, range.firstRow() + index - 1, range.firstColumn() + position);
+    }
+    case Match: {
+        if (values.at(0).isError())
+            return values.at(0);
+        if (!isReference(1))
+            return errorValue("#N/A");
+        int type = 1;
+        if (has(2) && !integer(2, type))
+            return failure;
+        const FormulaValue &vector = args.at(1);
+        if (vector.range.rowCount() != 1 && vector.range.columnCount() != 1)
+            return errorValue("#N/A");
+
+        const int mode = type == 0 ? ExactMatch : (type > 0 ? AscendingMatch : DescendingMatch);
+        const int position = lookup(values.at(0), vector, mode, type == 0, false);
+        return position < 0 ? errorValue("#N/A") : FormulaValue::fromNumber(position + 1);
+    }
+    case XLookup: {
+        if (values.at(0).isError())
+            return values.at(0);
+        if (!isReference(1) || !isReference(2))
+            return errorValue("#VALUE!");
+        int matchMode = 0;
+        int searchMode = 1;
+        if ((has(4) && !integer(4, matchMode)) || (has(5) && !integer(5, searchMode)))
+            return failure;
+
+        const FormulaValue &vector = args.at(1);
+        const FormulaValue &result = args.at(2);
+        const bool vertical = vector.range.columnCount() == 1;
+        if (!vertical && vector.range.rowCount() != 1)
+            return errorValue("#VALUE!");
+        if (vertical ? result.range.rowCount() != vector.range.rowCount()
+                     : result.range.columnCount() != vector.range.columnCount())
+            return errorValue("#VALUE!");
+
+        int mode = ExactMatch;
+        if (matchMode == -1)
+            mode = NextSmallerMatch;
+        else if (matchMode == 1)
+            mode = NextLargerMatch;
+        const int position = lookup(values.at(0), vector, mode, matchMode == 2, searchMode < 0);
+        if (position < 0)
+            return has(3) ? args.at(3) : errorValue("#N/A");
+
+        const CellRange &range = result.range;
+        return FormulaValue::reference(result.sheet, vertical
+                ? CellRange(range.firstRow() + position, range.firstColumn(), range.firstRow() + position, range.lastColumn())
+                : CellRange(range.firstRow(), range.firstColumn() + position, range.lastRow(), range.firstColumn() + position));
+    }
+    case Index: {
+        int row = 0;
+        int column = 0;
+        if (!integer(1, row) || (has(2) && !integer(2, column)))
+            return failure;
+        if (!isReference(0)) {
+            if (values.at(0).isError())
+                return values.at(0);
+            return row <= 1 && column <= 1 ? values.at(0) : errorValue("#REF!");
+        }
+
+        const FormulaValue &reference = args.at(0);
+        const CellRange &range = reference.range;
+        //A single row takes its position from the only index given.
+        if (!has(2) && range.rowCount() == 1 && range.columnCount() > 1)
+            qSwap(row, column);
+        if (row < 0 || column < 0 || row > range.rowCount() || column > range.columnCount())
+            return errorValue("#REF!");
+
+        const int firstRow = row ? range.firstRow() + row - 1 : range.firstRow();
+        const int lastRow = row ? firstRow : range.lastRow();
+        const int firstColumn = column ? range.firstColumn() + column - 1 : range.firstColumn();
+        const int lastColumn = column ? firstColumn : range.lastColumn();
+        return FormulaValue::reference(reference.sheet, CellRange(firstRow, firstColumn, lastRow, lastColumn));
+    }
+    case Concatenate: {
+        QString result;
+        for (int i = 0; i < values.size(); ++i) {
+            QString part;
+            if (!text(i, part))
+                return failure;
+            result += part;
+        }
+        return FormulaValue::fromString(result);
+    }
+    case Concat:
+    case TextJoin: {
+        QString delimiter;
+        bool ignoreEmpty = false;
+        const int first = info->id == TextJoin ? 2 : 0;
+        if (info->id == TextJoin && (!text(0, delimiter) || !boolean(1, ignoreEmpty)))
+            return failure;
+
+        QStringList parts;
+        bool failed = false;
+        auto add = [&](const FormulaValue &value) {
+            if (value.isError()) {
+                if (!failed) {
+                    failed = true;
+                    failure = value;
+                }
+                return;
+            }
+            const QString part = toText(value);
+            if (!(ignoreEmpty && part.isEmpty()))
+                parts.append(part);
+        };
+        for (int i = first; i < args.size(); ++i) {
+            if (args.at(i).type != FormulaValue::Reference) {
+                add(args.at(i));
+                continue;
+            }
+            //Blank cells count as empty texts, so every position is visited.
+            const FormulaValue &reference = args.at(i);
+            const CellRange used = usedRange(reference);
+            if (!used.isValid())
+                continue;
+            for (int row = used.firstRow(); row <= used.lastRow(); ++row) {
+                for (int column = used.firstColumn(); column <= used.lastColumn(); ++column)
+                    add(cellValue(reference.sheet, row, column));
+            }
+        }
+        if (failed)
+            return failure;
+        return FormulaValue::fromString(parts.join(delimiter));
+    }
+    case Len: {
+        QString value;
+        if (!text(0, value))
+            return failure;
+        return FormulaValue::fromNumber(value.length());
+    }
+    case Left:
+    case Right: {
+        QString value;
+        int count = 1;
+        if (!text(0, value) || (has(1) && !integer(1, count)))
+            return failure;
+        if (count < 0)
+            return errorValue("#VALUE!");
+        return FormulaValue::fromString(info->id == Left ? value.left(count) : value.right(count));
+    }
+    case Mid: {
+        QString value;
+        int start, count;
+        if (!text(0, value) || !integer(1, start) || !integer(2, count))
+            return failure;
+        if (start < 1 || count < 0)
+            return errorValue("#VALUE!");
+        return FormulaValue::fromString(value.mid(start - 1, count));
+    }
+    case Upper:
+    case Lower:
+    case Proper:
+    case Trim: {
+        QString value;
+        if (!text(0, value))
+            return failure;
+        switch (info->id) {
+        case Upper:
+            return FormulaValue::fromString(value.toUpper());
+        case Lower:
+            return FormulaValue::fromString(value.toLower());
+        case Proper: {
+            bool start = true;
+            for (int i = 0; i < value.length(); ++i) {
+                value[i] = start ? value.at(i).toUpper() : value.at(i).toLower();
+                start = !value.at(i).isLetter();
+            }
+            return FormulaValue::fromString(value);
+        }
+        default: {
+            //Only spaces are trimmed, runs inside the text become one space.
+            QStringList words = value.split(QLatin1Char(' '));
+            words.removeAll(QString());
+            return FormulaValue::fromString(words.join(QLatin1Char(' ')));
+        }
+        }
+    }
+    case Substitute: {
+        QString value, before, after;
+        int instance = 0;
+        if (!text(0, value) || !text(1, before) || !text(2, after) || (has(3) && !integer(3, instance)))
+            return failure;
+        if (has(3) && instance < 1)
+            return errorValue("#VALUE!");
+        if (before.isEmpty())
+            return FormulaValue::fromString(value);
+        if (!has(3))
+            return FormulaValue::fromString(value.replace(before, after));
+
+        int position = -1;
+        for (int i = 0; i < instance; ++i) {
+            position = value.indexOf(before, position + 1);
+            if (position < 0)
+                return FormulaValue::fromString(value);
+        }
+        return FormulaValue::fromString(value.replace(position, before.length(), after));
+    }
+    case Rept: {
+        QString value;
+        int count;
+        if (!text(0, value) || !integer(1, count))
+            return failure;
+        if (count < 0 || qint64(value.length()) * count > 32767)
+            return errorValue("#VALUE!");
+        return FormulaValue::fromString(value.repeated(count));
+    }
+    case Find:
+    case Search: {
+        QString needle, haystack;
+        int start = 1;
+        if (!text(0, needle) || !text(1, haystack) || (has(2) && !integer(2, start)))
+            return failure;
+        if (start < 1 || start > haystack.length() + 1)
+            return errorValue("#VALUE!");
+
+        int position = -1;
+        if (info->id == Find) {
+            position = haystack.indexOf(needle, start - 1, Qt::CaseSensitive);
+        } else if (hasWildcards(needle)) {
+            const QRegularExpression expression(wildcardPattern(needle), QRegularExpression::CaseInsensitiveOption
+                                                | QRegularExpression::DotMatchesEverythingOption);
+            const QRegularExpressionMatch match = expression.match(haystack, start - 1);
+            position = match.hasMatch() ? match.capturedStart() : -1;
+        } else {
+            position = haystack.indexOf(needle, start - 1, Qt::CaseInsensitive);
+        }
+        return position < 0 ? errorValue("#VALUE!") : FormulaValue::fromNumber(position + 1);
+    }
+    case Exact: {
+        QString a, b;
+        if (!text(0, a) || !text(1, b))
+            return failure;
+        return FormulaValue::fromBoolean(a == b);
+    }
+    case Text: {
+        QString format;
+        if (values.at(0).isError())
+            return values.at(0);
+        if (!text(1, format))
+            return failure;
+        const NumberFormatter formatter(format);
+        double value = 0;
+        if (values.at(0).type != FormulaValue::String && toNumber(values.at(0), value))
+            return FormulaValue::fromString(formatter.formatNumber(value, m_date1904));
+        return FormulaValue::fromString(formatter.formatText(toText(values.at(0))));
+    }
+    case Value: {
+        if (values.at(0).isError())
+            return values.at(0);
+        double value = 0;
+        if (!toNumber(values.at(0), value))
+            return errorValue("#VALUE!");
+        return FormulaValue::fromNumber(value);
+    }
+    case Date: {
+        int year, month, day;
+        if (!integer(0, year) || !integer(1, month) || !integer(2, day))
+            return failure;
+        if (year >= 0 && year < 1900)
+            year += 1900;
+        if (year < 0 || year > 9999)
+            return errorValue("#NUM!");
+
+        const QDate result = QDate(year, 1, 1).addMonths(month - 1).addDays(day - 1);
+        const double serial = dateToNumber(result, m_date1904);
+        if (!result.isValid() || serial < 0)
+            return errorValue("#NUM!");
+        return FormulaValue::fromNumber(serial);
+    }
+    case Year:
+    case Month:
+    case Day: {
+        int year, month, day;
+        if (!date(0, year, month, day))
+            return failure;
+        return FormulaValue::fromNumber(info->id == Year ? year : (info->id == Month ? month : day));
+    }
+    case Days: {
+        double end, start;
+        if (!number(0, end) || !number(1, start))
+            return failure;
+        return FormulaValue::fromNumber(std::floor(end) - std::floor(start));
+    }
+    case EDate:
+    case EOMonth: {
+        double start;
+        int months;
+        if (!number(0, start) || !integer(1, months))
+            return failure;
+        QDate result = dateFromSerial(start, m_date1904);
+        if (!result.isValid())
+            return errorValue("#NUM!");
+        result = result.addMonths(months);
+        if (info->id == EOMonth)
+            result = QDate(result.year(), result.month(), result.daysInMonth());
+        const double serial = dateToNumber(result, m_date1904);
+        return serial < 0 ? errorValue("#NUM!") : FormulaValue::fromNumber(serial);
+    }
+    case Weekday: {
+        double serial;
+        int type = 1;
+        if (!number(0, serial) || (has(1) && !integer(1, type)))
+            return failure;
+        const QDate value = dateFromSerial(serial, m_date1904);
+        if (!value.isValid())
+            return errorValue("#NUM!");
+        //Before March 1900 Excel's calendar is a day behind, its
+        //fictitious 1900-02-29 falls on a Wednesday.
+        int dayOfWeek = value.dayOfWeek();
+        if (!m_date1904 && serial < 61)
+            dayOfWeek = std::floor(serial) == 60 ? 3 : (dayOfWeek + 5) % 7 + 1;
+        switch (type) {
+        case 1:
+            return FormulaValue::fromNumber(dayOfWeek % 7 + 1);
+        case 2:
+            return FormulaValue::fromNumber(dayOfWeek);
+        case 3:
+            return FormulaValue::fromNumber(dayOfWeek - 1);
+        default:
+            return errorValue("#NUM!");
+        }
+    }
+    case Time: {
+        int hour, minute, second;
+        if (!integer(0, hour) || !integer(1, minute) || !integer(2, second))
+            return failure;
+        const double seconds = double(hour) * 3600 + double(minute) * 60 + second;
+        if (seconds < 0)
+            return errorValue("#NUM!");
+        return FormulaValue::fromNumber(std::fmod(seconds, 86400.0) / 86400.0);
+    }
+    case Hour:
+    case Minute:
+    case Second: {
+        double serial;
+        if (!number(0, serial))
+            return failure;
+        if (serial < 0)
+            return errorValue("#NUM!");
+        const int seconds = secondsOfDay(serial);
+        if (info->id == Hour)
+            return FormulaValue::fromNumber(seconds / 3600);
+        if (info->id == Minute)
+            return FormulaValue::fromNumber(seconds / 60 % 60);
+        return FormulaValue::fromNumber(seconds % 60);
+    }
+    case Today:
+        return FormulaValue::fromNumber(dateToNumber(QDate::currentDate(), m_date1904));
+    case Now: {
+        return FormulaValue::fromNumber(datetimeToNumber(QDateTime::currentDateTime(), m_date1904));
+    }
+    }
+    return FormulaValue::unsupported();
+}
+
+QT_END_NAMESPACE_XLSX
@@ -0,0 +1,826 @@
+// xlsxformulaparser.cpp
+
+#include <QtGlobal>
+#include <QString>
+#include <QStringList>
+
+#include <initializer_list>
+
+#include "xlsxformulaparser_p.h"
+
+QT_BEGIN_NAMESPACE_XLSX
+
+namespace {
+
+const int maxRowCount = 1048576;
+const int maxColumnCount = 16384;
+
+inline bool isAsciiLetter(QChar c)
+{
+    const ushort u = c.unicode();
+    return (u >= 'A' && u <= 'Z') || (u >= 'a' && u <= 'z');
+}
+
+inline bool isAsciiDigit(QChar c)
+{
+    const ushort u = c.unicode();
+    return u >= '0' && u <= '9';
+}
+
+inline bool isNameStart(QChar c)
+{
+    return c.isLetter() || c == QLatin1Char('_') || c == QLatin1Char('\\');
+}
+
+inline bool isNameChar(QChar c)
+{
+    return c.isLetterOrNumber() || c == QLatin1Char('_') || c == QLatin1Char('.')
+            || c == QLatin1Char('\\') || c == QLatin1Char('?');
+}
+
+// Reads "$?[A-Z]{1,3}" at pos, returns 0 if there is no column.
+int readColumn(const QString &s, int &pos, bool &absolute)
+{
+    int i = pos;
+    absolute = false;
+    if (i < s.length() && s[i] == QLatin1Char('$')) {
+        absolute = true;
+        ++i;
+    }
+    int column = 0;
+    int n = 0;
+    while (i < s.length() && n < 3 && isAsciiLetter(s[i])) {
+        column = column * 26 + (s[i].toUpper().unicode() - 'A' + 1);
+        ++i;
+        ++n;
+    }
+    if (n == 0 || column > maxColumnCount || (i < s.length() && isAsciiLetter(s[i])))
+        return 0;
+    pos = i;
+    return column;
+}
+
+// Reads "$?[0-9]+" at pos, returns 0 if there is no row.
+int readRow(const QString &s, int &pos, bool &absolute)
+{
+    int i = pos;
+    absolute = false;
+    if (i < s.length() && s[i] == QLatin1Char('$')) {
+        absolute = true;
+        ++i;
+    }
+    qint64 row = 0;
+    int n = 0;
+    while (i < s.length() && isAsciiDigit(s[i])) {
+        row = row * 10 + (s[i].unicode() - '0');
+        ++i;
+        if (++n > 7)
+            return 0;
+    }
+    if (n == 0 || row < 1 || row > maxRowCount)
+        return 0;
+    pos = i;
+    return int(row);
+}
+
+inline bool endsReference(const QString &s, int pos)
+{
+    return pos >= s.length() || !(isNameChar(s[pos]) || s[pos] == QLatin1Char('(') || s[pos] == QLatin1Char('$'));
+}
+
+FormulaRef makeRef(int row, int column, bool rowAbsolute, bool columnAbsolute, const CellReference &cell)
+{
+    FormulaRef ref;
+    ref.rowAbsolute = rowAbsolute;
+    ref.columnAbsolute = columnAbsolute;
+    ref.row = rowAbsolute ? row : row - cell.row();
+    ref.column = columnAbsolute ? column : column - cell.column();
+    return ref;
+}
+
+// Reads a cell, area, columns or rows reference at pos.
+bool readReference(const QString &s, int &pos, const CellReference &cell, FormulaToken &token)
+{
+    bool columnAbsolute = false;
+    bool rowAbsolute = false;
+    int p = pos;
+    const int column = readColumn(s, p, columnAbsolute);
+    if (column) {
+        int q = p;
+        const int row = readRow(s, q, rowAbsolute);
+        if (row && endsReference(s, q)) {
+            token.type = FormulaToken::Reference;
+            token.refKind = FormulaToken::CellRef;
+            token.first = makeRef(row, column, rowAbsolute, columnAbsolute, cell);
+            token.last = token.first;
+            if (q < s.length() && s[q] == QLatin1Char(':')) {
+                int r = q + 1;
+                bool lastColumnAbsolute = false;
+                bool lastRowAbsolute = false;
+                const int lastColumn = readColumn(s, r, lastColumnAbsolute);
+                const int lastRow = lastColumn ? readRow(s, r, lastRowAbsolute) : 0;
+                if (lastRow && endsReference(s, r)) {
+                    token.refKind = FormulaToken::AreaRef;
+                    token.last = makeRef(lastRow, lastColumn, lastRowAbsolute, lastColumnAbsolute, cell);
+                    q = r;
+                }
+            }
+            pos = q;
+            return true;
+        }
+
+        if (p < s.length() && s[p] == QLatin1Char(':')) {
+            int r = p + 1;
+            bool lastColumnAbsolute = false;
+            const int lastColumn = readColumn(s, r, lastColumnAbsolute);
+            if (lastColumn && endsReference(s, r)) {
+                token.type = FormulaToken::Reference;
+                token.refKind = FormulaToken::ColumnsRef;
+                token.first = makeRef(1, column, true, columnAbsolute, cell);
+                token.last = makeRef(maxRowCount, lastColumn, true, lastColumnAbsolute, cell);
+                pos = r;
+                return true;
+            }
+        }
+        return false;
+    }
+
+    p = pos;
+    const int row = readRow(s, p, rowAbsolute);
+    if (row && p < s.length() && s[p] == QLatin1Char(':')) {
+        int r = p + 1;
+        bool lastRowAbsolute = false;
+        const int lastRow = readRow(s, r, lastRowAbsolute);
+        if (lastRow && endsReference(s, r)) {
+            token.type = FormulaToken::Reference;
+            token.refKind = FormulaToken::RowsRef;
+            token.first = makeRef(row, 1, rowAbsolute, true, cell);
+            token.last = makeRef(lastRow, maxColumnCount, lastRowAbsolute, true, cell);
+            pos = r;
+            return true;
+        }
+    }
+    return false;
+}
+
+void appendColumnName(QString &text, int column)
+{
+    QChar letters[4];
+    int count = 0;
+    while (column > 0) {
+        letters[count++] = QChar(ushort('A' + (column - 1) % 26));
+        column = (column - 1) / 26;
+    }
+    while (count > 0)
+        text += letters[--count];
+}
+
+// Appends the reference token as seen from the cell, #REF! once moved off the sheet.
+void appendReference(QString &text, const FormulaToken &token, const CellReference &cell)
+{
+    if (!token.sheet.isEmpty()) {
+        text += token.sheet;
+        text += QLatin1Char('!');
+    }
+    const int firstRow = token.first.resolvedRow(cell);
+    const int firstColumn = token.first.resolvedColumn(cell);
+    const int lastRow = token.last.resolvedRow(cell);
+    const int lastColumn = token.last.resolvedColumn(cell);
+    if (firstRow < 1 || firstColumn < 1 || lastRow < 1 || lastColumn < 1
+            || lastRow > maxRowCount || lastColumn > maxColumnCount) {
+        text += QLatin1String("#REF!");
+        return;
+    }
+
+    auto appendColumn = [&text](const FormulaRef &ref, int column) {
+        if (ref.columnAbsolute)
+            text += QLatin1Char('$');
+        appendColumnName(text, column);
+    };
+    auto appendRow = [&text](const FormulaRef &ref, int row) {
+        if (ref.rowAbsolute)
+            text += QLatin1Char('$');
+        text += QString::number(row);
+    };
+
+    switch (token.refKind) {
+    case FormulaToken::ColumnsRef:
+        appendColumn(token.first, firstColumn);
+        text += QLatin1Char(':');
+        appendColumn(token.last, lastColumn);
+        break;
+    case FormulaToken::RowsRef:
+        appendRow(token.first, firstRow);
+        text += QLatin1Char(':');
+        appendRow(token.last, lastRow);
+        break;
+    case FormulaToken::AreaRef:
+        appendColumn(token.first, firstColumn);
+        appendRow(token.first, firstRow);
+        text += QLatin1Char(':');
+        appendColumn(token.last, lastColumn);
+        appendRow(token.last, lastRow);
+        break;
+    default:
+        appendColumn(token.first, firstColumn);
+        appendRow(token.first, firstRow);
+        break;
+    }
+}
+
+QString refKey(const FormulaRef &ref)
+{
+    return QStringLiteral("R%1%2C%3%4").arg(ref.rowAbsolute ? QString() : QStringLiteral("~"))
+            .arg(ref.row).arg(ref.columnAbsolute ? QString() : QStringLiteral("~")).arg(ref.column);
+}
+
+// The formula with its references in offset form, which doesn't depend on the cell.
+QString formulaKey(const QVector<FormulaToken> &tokens)
+{
+    QString key;
+    for (const FormulaToken &token : tokens) {
+        key += QChar(ushort('a' + token.type));
+        if (token.type == FormulaToken::Reference) {
+            key += token.sheet;
+            key += QLatin1Char('!');
+            key += QChar(ushort('0' + token.refKind));
+            key += refKey(token.first);
+            key += refKey(token.last);
+        } else {
+            if (!token.sheet.isEmpty()) {
+                key += token.sheet;
+                key += QLatin1Char('!');
+            }
+            key += token.text;
+        }
+        key += QChar(0x1f);
+    }
+    return key;
+}
+
+/*
+ * Recursive descent parser emitting the nodes in reverse polish order.
+ * Precedence, from low to high: comparison, &, + -, * /, ^, unary + -, %.
+ */
+class FormulaParser
+{
+public:
+    FormulaParser(const QVector<FormulaToken> &tokens, QVector<FormulaNode> &nodes)
+        : m_tokens(tokens), m_nodes(nodes), m_pos(0)
+    {
+    }
+
+    bool parse()
+    {
+        if (m_tokens.isEmpty() || !comparison())
+            return false;
+        return m_pos == m_tokens.size();
+    }
+
+private:
+    bool isOperator(const char *op) const
+    {
+        return m_pos < m_tokens.size() && m_tokens[m_pos].type == FormulaToken::Operator
+                && m_tokens[m_pos].text == QLatin1String(op);
+    }
+
+    bool isType(FormulaToken::Type type) const
+    {
+        return m_pos < m_tokens.size() && m_tokens[m_pos].type == type;
+    }
+
+    void addNode(FormulaNode::Type type, const FormulaToken &token, int argumentCount = 0)
+    {
+        FormulaNode node;
+        node.type = type;
+        node.token = token;
+        node.argumentCount = argumentCount;
+        m_nodes.append(node);
+    }
+
+    template <typename Next>
+    bool binary(Next next, std::initializer_list<const char *> ops)
+    {
+        if (!(this->*next)())
+            return false;
+        for (;;) {
+            bool found = false;
+            for (const char *op : ops) {
+                if (isOperator(op)) {
+                    found = true;
+                    break;
+                }
+            }
+            if (!found)
+                return true;
+            const FormulaToken op = m_tokens[m_pos++];
+            if (!(this->*next)())
+                return false;
+            addNode(FormulaNode::BinaryOperator, op);
+        }
+    }
+
+    bool comparison() { return binary(&FormulaParser::concatenation, {"=", "<>", "<", "<=", ">", ">="}); }
+    bool concatenation() { return binary(&FormulaParser::additive, {"&"}); }
+    bool additive() { return binary(&FormulaParser::multiplicative, {"+", "-"}); }
+    bool multiplicative() { return binary(&FormulaParser::power, {"*", "/"}); }
+    bool power() { return binary(&FormulaParser::unary, {"^"}); }
+
+    bool unary()
+    {
+        if (isOperator("-") || isOperator("+")) {
+            const FormulaToken op = m_tokens[m_pos++];
+            if (!unary())
+                return false;
+            addNode(FormulaNode::UnaryOperator, op);
+            return true;
+        }
+        if (!primary())
+            return false;
+        while (isOperator("%")) {
+            addNode(FormulaNode::Percent, m_tokens[m_pos++]);
+        }
+        return true;
+    }
+
+    bool primary()
+    {
+        if (m_pos >= m_tokens.size())
+            return false;
+
+        const FormulaToken &token = m_tokens[m_pos];
+        switch (token.type) {
+        case FormulaToken::Number:
+            addNode(FormulaNode::Number, token);
+            ++m_pos;
+            return true;
+        case FormulaToken::String:
+            addNode(FormulaNode::String, token);
+            ++m_pos;
+            return true;
+        case FormulaToken::Boolean:
+            addNode(FormulaNode::Boolean, token);
+            ++m_pos;
+            return true;
+        case FormulaToken::Error:
+            addNode(FormulaNode::Error, token);
+            ++m_pos;
+            return true;
+        case FormulaToken::Reference:
+            addNode(FormulaNode::Reference, token);
+            ++m_pos;
+            return true;
+        case FormulaToken::Name:
+            addNode(FormulaNode::Name, token);
+            ++m_pos;
+            return true;
+        case FormulaToken::Function:
+            return function();
+        case FormulaToken::OpenParen: {
+            const FormulaToken open = token;
+            ++m_pos;
+            if (!comparison() || !isType(FormulaToken::CloseParen))
+                return false;
+            ++m_pos;
+            addNode(FormulaNode::Parenthesis, open);
+            return true;
+        }
+        default:
+            return false;
+        }
+    }
+
+    bool function()
+    {
+        const FormulaToken name = m_tokens[m_pos++];
+        if (!isType(FormulaToken::OpenParen))
+            return false;
+        ++m_pos;
+
+        int argumentCount = 0;
+        if (isType(FormulaToken::CloseParen)) {
+            ++m_pos;
+        } else {
+            for (;;) {
+                if (isType(FormulaToken::Separator) || isType(FormulaToken::CloseParen))
+                    addNode(FormulaNode::Missing, FormulaToken());
+                else if (!comparison())
+                    return false;
+                ++argumentCount;
+
+                if (isType(FormulaToken::Separator)) {
+                    ++m_pos;
+                } else if (isType(FormulaToken::CloseParen)) {
+                    ++m_pos;
+                    break;
+                } else {
+                    return false;
+                }
+            }
+        }
+        addNode(FormulaNode::Function, name, argumentCount);
+        return true;
+    }
+
+    const QVector<FormulaToken> &m_tokens;
+    QVector<FormulaNode> &m_nodes;
+    int m_pos;
+};
+
+} // namespace
+
+/*!
+ * \internal
+ * Splits \a formula into tokens. References are stored relative to \a cell
+ * unless they are absolute. Returns false for unsupported syntax, such as
+ * array constants.
+ */
+bool FormulaTokenizer::tokenize(const QString &formula, const CellReference &cell, QVector<FormulaToken> &tokens)
+{
+    static const char * const errors[] = {
+        "#NULL!", "#DIV/0!", "#VALUE!", "#REF!", "#NAME?", "#NUM!", "#N/A", "#GETTING_DATA"
+    };
+
+    const QString &s = formula;
+    const int length = s.length();
+    int i = s.startsWith(QLatin1Char('=')) ? 1 : 0;
+    while (i < length) {
+        const QChar c = s[i];
+        if (c.isSpace()) {
+            ++i;
+            continue;
+        }
+
+        FormulaToken token;
+        const int start = i;
+
+        if (c == QLatin1Char('"')) {
+            QString text;
+            ++i;
+            for (;;) {
+                if (i >= length)
+                    return false;
+                if (s[i] == QLatin1Char('"')) {
+                    if (i + 1 < length && s[i+1] == QLatin1Char('"')) {
+                        text += QLatin1Char('"');
+                        i += 2;
+                        continue;
+                    }
+                    ++i;
+                    break;
+                }
+                text += s[i++];
+            }
+            token.type = FormulaToken::String;
+            token.text = text;
+            tokens.append(token);
+            continue;
+        }
+
+        if (c == QLatin1Char('#')) {
+            bool found = false;
+            for (const char *error : errors) {
+                const QLatin1String e(error);
+                if (s.mid(i, e.size()).compare(e, Qt::CaseInsensitive) == 0) {
+                    token.type = FormulaToken::Error;
+                    token.text = e;
+                    tokens.append(token);
+                    i += e.size();
+                    found = true;
+                    break;
+                }
+            }
+            if (!found)
+                return false;
+            continue;
+        }
+
+        //Sheet prefix, 'Sheet 1'!A1 or Sheet1!A1
+        QString sheet;
+        if (c == QLatin1Char('\'')) {
+            int j = i + 1;
+            for (;;) {
+                if (j >= length)
+                    return false;
+                if (s[j] == QLatin1Char('\'')) {
+                    if (j + 1 < length && s[j+1] == QLatin1Char('\'')) {
+                        j += 2;
+                        continue;
+                    }
+                    break;
+                }
+                ++j;
+            }
+            if (j + 1 >= length || s[j+1] != QLatin1Char('!'))
+                return false;
+            sheet = s.mid(i, j - i + 1);
+            i = j + 2;
+        } else if (isNameStart(c) || isAsciiDigit(c)) {
+            int j = i;
+            while (j < length && isNameChar(s[j]))
+                ++j;
+            if (j < length && s[j] == QLatin1Char('!')) {
+                sheet = s.mid(i, j - i);
+                i = j + 1;
+            }
+        }
+
+        if (!sheet.isEmpty()) {
+            if (readReference(s, i, cell, token)) {
+                token.sheet = sheet;
+                token.position = start;
+                token.length = i - start;
+                tokens.append(token);
+                continue;
+            }
+            if (s.mid(i, 5) == QLatin1String("#REF!")) {
+                token.type = FormulaToken::Error;
+                token.text = QStringLiteral("#REF!");
+                tokens.append(token);
+                i += 5;
+                continue;
+            }
+            //Sheet scoped defined name
+            int j = i;
+            while (j < length && isNameChar(s[j]))
+                ++j;
+            if (j == i)
+                return false;
+            token.type = FormulaToken::Name;
+            token.text = s.mid(i, j - i);
+            token.sheet = sheet;
+            tokens.append(token);
+            i = j;
+            continue;
+        }
+
+        if (isAsciiLetter(c) || isAsciiDigit(c) || c == QLatin1Char('$')) {
+            int p = i;
+            if (readReference(s, p, cell, token)) {
+                token.position = i;
+                token.length = p - i;
+                tokens.append(token);
+                i = p;
+                continue;
+            }
+        }
+
+        if (isAsciiDigit(c) || (c == QLatin1Char('.') && i + 1 < length && isAsciiDigit(s[i+1]))) {
+            int j = i;
+            while (j < length && isAsciiDigit(s[j]))
+                ++j;
+            if (j < length && s[j] == QLatin1Char('.')) {
+                ++j;
+                while (j < length && isAsciiDigit(s[j]))
+                    ++j;
+            }
+            if (j < length && (s[j] == QLatin1Char('e') || s[j] == QLatin1Char('E'))) {
+                int k = j + 1;
+                if (k < length && (s[k] == QLatin1Char('+') || s[k] == QLatin1Char('-')))
+                    ++k;
+                if (k < length && isAsciiDigit(s[k])) {
+                    while (k < length && isAsciiDigit(s[k]))
+                        ++k;
+                    j = k;
+                }
+            }
+            token.type = FormulaToken::Number;
+            token.text = s.mid(i, j - i);
+            token.number = token.text.toDouble();
+            tokens.append(token);
+            i = j;
+            continue;
+        }
+
+        if (isNameStart(c)) {
+            int j = i;
+            while (j < length && isNameChar(s[j]))
+                ++j;
+            const QString name = s.mid(i, j - i);
+            int k = j;
+            while (k < length && s[k].isSpace())
+                ++k;
+            if (k < length && s[k] == QLatin1Char('(')) {
+                token.type = FormulaToken::Function;
+                token.text = name;
+            } else if (name.compare(QLatin1String("TRUE"), Qt::CaseInsensitive) == 0
+                       || name.compare(QLatin1String("FALSE"), Qt::CaseInsensitive) == 0) {
+                token.type = FormulaToken::Boolean;
+                token.text = name.toUpper();
+                token.number = token.text == QLatin1String("TRUE") ? 1 : 0;
+            } else {
+                token.type = FormulaToken::Name;
+                token.text = name;
+            }
+            tokens.append(token);
+            i = j;
+            continue;
+        }
+
+        switch (c.unicode()) {
+        case '<':
+            token.type = FormulaToken::Operator;
+            if (i + 1 < length && (s[i+1] == QLatin1Char('=') || s[i+1] == QLatin1Char('>')))
+                token.text = s.mid(i, 2);
+            else
+                token.text = QStringLiteral("<");
+            break;
+        case '>':
+            token.type = FormulaToken::Operator;
+            if (i + 1 < length && s[i+1] == QLatin1Char('='))
+                token.text = QStringLiteral(">=");
+            else
+                token.text = QStringLiteral(">");
+            break;
+        case '=':
+        case '+':
+        case '-':
+        case '*':
+        case '/':
+        case '^':
+        case '&':
+        case '%':
+            token.type = FormulaToken::Operator;
+            token.text = QString(c);
+            break;
+        case ',':
+            token.type = FormulaToken::Separator;
+            token.text = QStringLiteral(",");
+            break;
+        case '(':
+            token.type = FormulaToken::OpenParen;
+            token.text = QStringLiteral("(");
+            break;
+        case ')':
+            token.type = FormulaToken::CloseParen;
+            token.text = QStringLiteral(")");
+            break;
+        default:
+            return false;
+        }
+        tokens.append(token);
+        i += token.text.length();
+    }
+    return true;
+}
+
+ParsedFormula::ParsedFormula(const QVector<FormulaNode> &nodes, bool valid)
+    : m_nodes(nodes), m_valid(valid)
+{
+}
+
+/*!
+ * \internal
+ * Returns whether the formula gives the same value in every cell: it reads
+ * no reference nor defined name, and doesn't call ROW() or COLUMN().
+ */
+bool ParsedFormula::isCellIndependent() const
+{
+    for (const FormulaNode &node : m_nodes) {
+        if (node.type == FormulaNode::Reference || node.type == FormulaNode::Name)
+            return false;
+        if (node.type == FormulaNode::Function
+                && (node.token.text.compare(QLatin1String("ROW"), Qt::CaseInsensitive) == 0
+                    || node.token.text.compare(QLatin1String("COLUMN"), Qt::CaseInsensitive) == 0))
+            return false;
+    }
+    return true;
+}
+
+/*!
+ * \internal
+ * Returns the text of the reference \a token, as seen from \a cell.
+ * References moved off the sheet become #REF!.
+ */
+QString ParsedFormula::referenceText(const FormulaToken &token, const CellReference &cell)
+{
+    QString text;
+    appendReference(text, token, cell);
+    return text;
+}
+
+/*!
+ * \internal
+ * Returns the formula text, without the leading '=', as written in \a cell.
+ */
+QString ParsedFormula::formulaText(const CellReference &cell) const
+{
+    QStringList stack;
+    for (const FormulaNode &node : m_nodes) {
+        const FormulaToken &token = node.token;
+        switch (node.type) {
+        case FormulaNode::Number:
+        case FormulaNode::Boolean:
+        case FormulaNode::Error:
+            stack.append(token.text);
+            break;
+        case FormulaNode::String: {
+            QString text = token.text;
+            text.replace(QLatin1Char('"'), QLatin1String("\"\""));
+            stack.append(QStringLiteral("\"") + text + QStringLiteral("\""));
+            break;
+        }
+        case FormulaNode::Missing:
+            stack.append(QString());
+            break;
+        case FormulaNode::Reference:
+            stack.append(referenceText(token, cell));
+            break;
+        case FormulaNode::Name:
+            stack.append(token.sheet.isEmpty() ? token.text : token.sheet + QLatin1Char('!') + token.text);
+            break;
+        case FormulaNode::Function: {
+            QStringList arguments;
+            for (int i = 0; i < node.argumentCount; ++i)
+                arguments.prepend(stack.takeLast());
+            stack.append(token.text + QLatin1Char('(') + arguments.join(QLatin1Char(',')) + QLatin1Char(')'));
+            break;
+        }
+        case FormulaNode::UnaryOperator:
+            stack.last().prepend(token.text);
+            break;
+        case FormulaNode::BinaryOperator: {
+            const QString right = stack.takeLast();
+            stack.last() += token.text + right;
+            break;
+        }
+        case FormulaNode::Percent:
+            stack.last() += QLatin1Char('%');
+            break;
+        case FormulaNode::Parenthesis:
+            stack.last() = QStringLiteral("(") + stack.last() + QStringLiteral(")");
+            break;
+        }
+    }
+    return stack.isEmpty() ? QString() : stack.last();
+}
+
+/*!
+ * \internal
+ * Returns the parsed form of \a formula written in \a cell. Formulas that
+ * are equal once their relative references are taken as offsets share one
+ * parse. An unsupported formula gives an invalid ParsedFormula.
+ */
+QSharedPointer<const ParsedFormula> FormulaCache::parse(const QString &formula, const CellReference &cell)
+{
+    QVector<FormulaToken> tokens;
+    if (!FormulaTokenizer::tokenize(formula, cell, tokens)) {
+        static const QSharedPointer<const ParsedFormula> invalid(new ParsedFormula(QVector<FormulaNode>(), false));
+        return invalid;
+    }
+
+    const QString key = formulaKey(tokens);
+    const auto it = m_formulas.constFind(key);
+    if (it != m_formulas.constEnd())
+        return it.value();
+
+    QVector<FormulaNode> nodes;
+    nodes.reserve(tokens.size());
+    FormulaParser parser(tokens, nodes);
+    const bool valid = parser.parse();
+    QSharedPointer<const ParsedFormula> parsed(new ParsedFormula(valid ? nodes : QVector<FormulaNode>(), valid));
+    m_formulas.insert(key, parsed);
+    return parsed;
+}
+
+FormulaTemplate::FormulaTemplate(const QString &formula, const CellReference &cell)
+    : m_text(formula)
+{
+    QVector<FormulaToken> tokens;
+    m_valid = FormulaTokenizer::tokenize(formula, cell, tokens);
+    for (const FormulaToken &token : tokens) {
+        if (token.type == FormulaToken::Reference)
+            m_references.append(token);
+    }
+}
+
+/*!
+ * \internal
+ * Returns the formula text as written in \a cell: the text between the
+ * references is copied and the references are moved along.
+ */
+QString FormulaTemplate::formulaText(const CellReference &cell) const
+{
+    QString text;
+    text.reserve(m_text.size() + m_references.size() * 4);
+    int position = 0;
+    for (const FormulaToken &token : m_references) {
+        text.append(m_text.constData() + position, token.position - position);
+        appendReference(text, token, cell);
+        position = token.position + token.length;
+    }
+    text.append(m_text.constData() + position, m_text.size() - position);
+    return text;
+}
+
+int FormulaCache::count() const
+{
+    return m_formulas.size();
+}
+
+void FormulaCache::clear()
+{
+    m_formulas.clear();
+}
+
+QT_END_NAMESPACE_XLSX
@@ -1,31 +1,167 @@
 // xlsxmediafile.cpp
 
 #include <QtGlobal>
-#include <QCryptographicHash>
+#include <QBuffer>
+#include <QMutexLocker>
+#include <QRunnable>
+#include <QSemaphore>
+#include <QThreadPool>
+
+#include <cstring>
 
 #include "xlsxmediafile_p.h"
+#include "xlsxzipreader_p.h"
 
 QT_BEGIN_NAMESPACE_XLSX
 
+namespace {
+
+// MurmurHash64A, reading the bytes eight at a time. Not cryptographic, the
+// workbook compares the contents when two hashes are equal.
+quint64 contentHash(const QByteArray &bytes)
+{
+    const quint64 m = Q_UINT64_C(0xc6a4a7935bd1e995);
+    const int r = 47;
+    const int size = bytes.size();
+    const char *data = bytes.constData();
+
+    quint64 h = quint64(size) * m;
+    const int blocks = size / 8;
+    for (int i = 0; i < blocks; ++i) {
+        quint64 k;
+        std::memcpy(&k, data + i * 8, 8);
+        k *= m;
+        k ^= k >> r;
+        k *= m;
+        h ^= k;
+        h *= m;
+    }
+
+    const uchar *tail = reinterpret_cast<const uchar *>(data + blocks * 8);
+    switch (size & 7) {
+    case 7: h ^= quint64(tail[6]) << 48; Q_FALLTHROUGH();
+    case 6: h ^= quint64(tail[5]) << 40; Q_FALLTHROUGH();
+    case 5: h ^= quint64(tail[4]) << 32; Q_FALLTHROUGH();
+    case 4: h ^= quint64(tail[3]) << 24; Q_FALLTHROUGH();
+    case 3: h ^= quint64(tail[2]) << 16; Q_FALLTHROUGH();
+    case 2: h ^= quint64(tail[1]) << 8; Q_FALLTHROUGH();
+    case 1: h ^= quint64(tail[0]);
+        h *= m;
+    }
+
+    h ^= h >> r;
+    h *= m;
+    h ^= h >> r;
+    return h;
+}
+
+} // namespace
+
+/*
+ * A picture encoded to PNG on the global thread pool. The bytes are handed
+ * over once the semaphore is released.
+ */
+class ImageEncoding
+{
+public:
+    explicit ImageEncoding(const QImage &image) : m_image(image) {}
+
+    void encode()
+    {
+        QBuffer buffer(&m_bytes);
+        buffer.open(QIODevice::WriteOnly);
+        m_image.save(&buffer, "PNG");
+        m_image = QImage();
+        m_done.release();
+    }
+
+    bool isDone() const
+    {
+        return m_done.available() > 0;
+    }
+
+    QByteArray take()
+    {
+        m_done.acquire();
+        return m_bytes;
+    }
+
+private:
+    QImage m_image;
+    QByteArray m_bytes;
+    QSemaphore m_done;
+};
+
+namespace {
+
+class EncodingTask : public QRunnable
+{
+public:
+    explicit EncodingTask(const QSharedPointer<ImageEncoding> &encoding) : m_encoding(encoding) {}
+    void run() override { m_encoding->encode(); }
+
+private:
+    QSharedPointer<ImageEncoding> m_encoding;
+};
+
+} // namespace
+
 MediaFile::MediaFile(const QByteArray &bytes, const QString &suffix, const QString &mimeType)
     : m_contents(bytes), m_suffix(suffix), m_mimeType(mimeType)
-      , m_index(0), m_indexValid(false)
+      , m_index(0), m_indexValid(false), m_imageKey(0), m_packageSize(0)
 {
-    m_hashKey = QCryptographicHash::hash(m_contents, QCryptographicHash::Md5);
+    m_hashKey = contentHash(m_contents);
 }
 
 MediaFile::MediaFile(const QString &fileName)
-    :m_fileName(fileName), m_index(0), m_indexValid(false)
+    :m_fileName(fileName), m_index(0), m_indexValid(false), m_hashKey(0), m_imageKey(0), m_packageSize(0)
 {
 
 }
 
+/*!
+ * \internal
+ * Creates a PNG file from \a image. The image is encoded on the global
+ * thread pool, the contents wait for it on first use.
+ */
+MediaFile::MediaFile(const QImage &image)
+    : m_suffix(QStringLiteral("png")), m_mimeType(QStringLiteral("image/png"))
+      , m_index(0), m_indexValid(false), m_hashKey(0), m_imageKey(image.cacheKey()), m_packageSize(0)
+{
+    m_encoding = QSharedPointer<ImageEncoding>(new ImageEncoding(image));
+    QThreadPool::globalInstance()->start(new EncodingTask(m_encoding));
+}
+
 void MediaFile::set(const QByteArray &bytes, const QString &suffix, const QString &mimeType)
 {
+    QMutexLocker locker(&m_mutex);
+    m_encoding.reset();
+    m_package.reset();
+    m_imageKey = 0;
     m_contents = bytes;
     m_suffix = suffix;
     m_mimeType = mimeType;
-    m_hashKey = QCryptographicHash::hash(m_contents, QCryptographicHash::Md5);
+    m_hashKey = contentHash(m_contents);
+    m_indexValid = false;
+}
+
+/*!
+ * \internal
+ * Leaves the contents of the file in \a package, under the current file
+ * name. They are only decompressed when first asked for.
+ */
+void MediaFile::setSource(const QSharedPointer<ZipReader> &package, const QString &suffix, const QString &mimeType)
+{
+    QMutexLocker locker(&m_mutex);
+    m_encoding.reset();
+    m_imageKey = 0;
+    m_contents.clear();
+    m_package = package;
+    m_packagePath = m_fileName;
+    m_packageSize = package->fileSize(m_fileName);
+    m_suffix = suffix;
+    m_mimeType = mimeType;
+    m_hashKey = 0;
     m_indexValid = false;
 }
 
@@ -51,9 +187,40 @@ QString MediaFile::mimeType() const
 
 QByteArray MediaFile::contents() const
 {
+    waitForContents();
     return m_contents;
 }
 
+/*!
+ * \internal
+ * Returns the contents without keeping them when they have to be read from
+ * the package, as done when saving.
+ */
+QByteArray MediaFile::readContents() const
+{
+    {
+        QMutexLocker locker(&m_mutex);
+        if (!m_package.isNull())
+            return m_package->fileData(m_packagePath);
+    }
+    return contents();
+}
+
+/*!
+ * \internal
+ * Returns the size of the contents, known without reading them for the
+ * files still in the package.
+ */
+qint64 MediaFile::size() const
+{
+    {
+        QMutexLocker locker(&m_mutex);
+        if (!m_package.isNull())
+            return m_packageSize;
+    }
+    return contents().size();
+}
+
 int MediaFile::index() const
 {
     return m_index;
@@ -70,9 +237,89 @@ void MediaFile::setIndex(int idx)
     m_indexValid = true;
 }
 
-QByteArray MediaFile::hashKey() const
+quint64 MediaFile::hashKey() const
 {
+    waitForContents();
     return m_hashKey;
 }
 
+/*!
+ * \internal
+ * Returns whether the contents are still being encoded. Once the encoding
+ * is done, its bytes are taken over without waiting.
+ */
+bool MediaFile::isPending() const
+{
+    QMutexLocker locker(&m_mutex);
+    if (m_encoding.isNull())
+        return false;
+    if (!m_encoding->isDone())
+        return true;
+    m_contents = m_encoding->take();
+    m_hashKey = contentHash(m_contents);
+    m_encoding.reset();
+    return false;
+}
+
+/*!
+ * \internal
+ * Returns whether the contents haven't been read from the loaded package yet.
+ */
+bool MediaFile::isInPackage() const
+{
+    QMutexLocker locker(&m_mutex);
+    return !m_package.isNull();
+}
+
+/*!
+ * \internal
+ * Returns the cache key of the image the file was created from, 0 when it
+ * wasn't created from an image.
+ */
+qint64 MediaFile::imageKey() const
+{
+    return m_imageKey;
+}
+
+void MediaFile::waitForContents() const
+{
+    QMutexLocker locker(&m_mutex);
+    if (!m_package.isNull()) {
+        m_contents = m_package->fileData(m_packagePath);
+        m_hashKey = contentHash(m_contents);
+        m_package.reset();
+        return;
+    }
+    if (m_encoding.isNull())
+        return;
+    m_contents = m_encoding->take();
+    m_hashKey = contentHash(m_contents);
+    m_encoding.reset();
+}
+
+/*!
+ * \internal
+ * Recognizes the encoded pictures which can be stored as they are, from
+ * their first bytes. Returns false for the other formats.
+ */
+bool MediaFile::imageFormat(const QByteArray &bytes, QString &suffix, QString &mimeType)
+{
+    if (bytes.startsWith("\x89PNG\r\n\x1a\n")) {
+        suffix = QStringLiteral("png");
+        mimeType = QStringLiteral("image/png");
+    } else if (bytes.startsWith("\xff\xd8\xff")) {
+        suffix = QStringLiteral("jpeg");
+        mimeType = QStringLiteral("image/jpeg");
+    } else if (bytes.startsWith("GIF87a") || bytes.startsWith("GIF89a")) {
+        suffix = QStringLiteral("gif");
+        mimeType = QStringLiteral("image/gif");
+    } else if (bytes.startsWith("BM")) {
+        suffix = QStringLiteral("bmp");
+        mimeType = QStringLiteral("image/bmp");
+    } else {
+        return false;
+    }
+    return true;
+}
+
 QT_END_NAMESPACE_XLSX
@@ -0,0 +1,1036 @@
+// xlsxnumberformatter.cpp
+
+#include <QtGlobal>
+#include <QString>
+#include <QDate>
+#include <QDateTime>
+#include <QTime>
+#include <QStringList>
+
+#include <cmath>
+
+#include "xlsxnumberformatter_p.h"
+#include "xlsxnumformatparser_p.h"
+#include "xlsxutility_p.h"
+
+QT_BEGIN_NAMESPACE_XLSX
+
+namespace {
+
+const char * const monthNames[] = {
+    "January", "February", "March", "April", "May", "June",
+    "July", "August", "September", "October", "November", "December"
+};
+
+const char * const dayNames[] = {
+    "Sunday", "Monday", "Tuesday", "Wednesday", "Thursday", "Friday", "Saturday"
+};
+
+QString padded(qint64 value, int width)
+{
+    return QStringLiteral("%1").arg(value, width, 10, QLatin1Char('0'));
+}
+
+/*
+ * Splits Excel day serial \a days into a calendar date. The 1900 date system
+ * keeps Excel's fictitious 1900-02-29 (serial 60) and its day 0, 1900-01-00.
+ * \a dayOfWeek is 0 for Sunday.
+ */
+void excelDate(qint64 days, bool date1904, int *year, int *month, int *day, int *dayOfWeek)
+{
+    //1904-01-01 was a Friday, serial 1 of the 1900 system a Sunday.
+    *dayOfWeek = int((days + (date1904 ? 5 : 6)) % 7);
+    civilFromSerial(days, date1904, *year, *month, *day);
+}
+
+/*
+ * Best rational approximation of \a value with a denominator not larger
+ * than \a maxDenominator, using continued fractions.
+ */
+void approximate(double value, qint64 maxDenominator, qint64 *numerator, qint64 *denominator)
+{
+    qint64 p0 = 0, q0 = 1, p1 = 1, q1 = 0;
+    double r = value;
+    for (int i = 0; i < 64; ++i) {
+        const double a = std::floor(r);
+        if (a > 1e15)
+            break;
+        const qint64 ai = qint64(a);
+        const qint64 q2 = q0 + ai * q1;
+        if (q2 > maxDenominator)
+            break;
+        const qint64 p2 = p0 + ai * p1;
+        p0 = p1;
+        q0 = q1;
+        p1 = p2;
+        q1 = q2;
+        if (r - a < 1e-12)
+            break;
+        r = 1.0 / (r - a);
+    }
+
+    if (q1 == 0) {
+        *numerator = qRound64(value);
+        *denominator = 1;
+        return;
+    }
+
+    const qint64 k = (maxDenominator - q0) / q1;
+    const qint64 p2 = p0 + k * p1;
+    const qint64 q2 = q0 + k * q1;
+    if (q2 > 0 && std::fabs(value - double(p2) / q2) < std::fabs(value - double(p1) / q1)) {
+        *numerator = p2;
+        *denominator = q2;
+    } else {
+        *numerator = p1;
+        *denominator = q1;
+    }
+}
+
+bool hasNonZeroDigit(const QString &text)
+{
+    for (const QChar &c : text) {
+        if (c.unicode() >= '1' && c.unicode() <= '9')
+            return true;
+    }
+    return false;
+}
+
+} // namespace
+
+NumberFormatter::Section::Section()
+    : condition(NoCondition), conditionValue(0), isDateTime(false), isText(false), hasAmPm(false)
+    , thousands(false), hasExponent(false), hasFraction(false), hasDigits(false), multiplier(1.0)
+    , decimalDigits(0), integerDigits(0), denominatorDigits(0), fixedDenominator(0)
+    , subSecondDigits(0), engineering(false)
+{
+}
+
+bool NumberFormatter::Section::matches(double value) const
+{
+    switch (condition) {
+    case LessThan:
+        return value < conditionValue;
+    case LessEqual:
+        return value <= conditionValue;
+    case GreaterThan:
+        return value > conditionValue;
+    case GreaterEqual:
+        return value >= conditionValue;
+    case Equal:
+        return value == conditionValue;
+    case NotEqual:
+        return value != conditionValue;
+    default:
+        return true;
+    }
+}
+
+/*!
+ * \internal
+ * Compiles \a formatCode into its sections once, so that formatting a value
+ * only walks the precomputed tokens.
+ */
+NumberFormatter::NumberFormatter(const QString &formatCode)
+    : m_formatCode(formatCode), m_textSection(-1)
+{
+    QStringList codes;
+    QString current;
+    const int length = formatCode.length();
+    for (int i = 0; i < length; ++i) {
+        const QChar c = formatCode[i];
+        if (c == QLatin1Char('"')) {
+            const int end = formatCode.indexOf(QLatin1Char('"'), i + 1);
+            const int stop = end < 0 ? length - 1 : end;
+            current += formatCode.mid(i, stop - i + 1);
+            i = stop;
+        } else if (c == QLatin1Char('\\') || c == QLatin1Char('_') || c == QLatin1Char('*')) {
+            current += formatCode.mid(i, 2);
+            ++i;
+        } else if (c == QLatin1Char(';')) {
+            codes.append(current);
+            current.clear();
+        } else {
+            current += c;
+        }
+    }
+    codes.append(current);
+
+    for (const QString &code : codes)
+        m_sections.append(compileSection(code));
+
+    if (m_sections.size() >= 4)
+        m_textSection = 3;
+    else if (m_sections.size() == 1 && m_sections[0].isText)
+        m_textSection = 0;
+}
+
+NumberFormatter::Section NumberFormatter::compileSection(const QString &code)
+{
+    Section section;
+    const NumFormatParser::Kind kind = NumFormatParser::kind(code);
+    section.isDateTime = kind == NumFormatParser::DateKind
+            || kind == NumFormatParser::TimeKind
+            || kind == NumFormatParser::DateTimeKind;
+
+    QVector<Token> &tokens = section.tokens;
+    auto appendLiteral = [&tokens](const QString &text) {
+        if (!tokens.isEmpty() && tokens.last().type == Literal)
+            tokens.last().text += text;
+        else
+            tokens.append(Token(Literal, text));
+    };
+    auto runLength = [&code](int i) {
+        int j = i;
+        while (j < code.length() - 1 && code[j+1].toLower() == code[i].toLower())
+            ++j;
+        return j - i + 1;
+    };
+
+    bool afterHour = false;
+    const int length = code.length();
+    for (int i = 0; i < length; ++i) {
+        const QChar c = code[i];
+        const ushort lc = c.toLower().unicode();
+
+        switch (lc) {
+        case '[': {
+            const int end = code.indexOf(QLatin1Char(']'), i);
+            if (end < 0) {
+                appendLiteral(code.mid(i));
+                i = length;
+                break;
+            }
+            const QString content = code.mid(i + 1, end - i - 1);
+            const QString lower = content.toLower();
+            i = end;
+
+            if (!lower.isEmpty() && (lower[0] == QLatin1Char('h') || lower[0] == QLatin1Char('m')
+                                     || lower[0] == QLatin1Char('s'))
+                    && lower.count(lower[0]) == lower.length()) {
+                const TokenType type = lower[0] == QLatin1Char('h') ? ElapsedHour
+                        : lower[0] == QLatin1Char('m') ? ElapsedMinute : ElapsedSecond;
+                tokens.append(Token(type, QString(), lower.length()));
+                section.isDateTime = true;
+                afterHour = (type == ElapsedHour);
+            } else if (lower.startsWith(QLatin1Char('$'))) {
+                //Currency and locale: [$symbol-lcid]
+                const int dash = content.indexOf(QLatin1Char('-'));
+                const QString symbol = content.mid(1, dash < 0 ? -1 : dash - 1);
+                if (!symbol.isEmpty())
+                    appendLiteral(symbol);
+            } else if (lower.startsWith(QLatin1Char('<')) || lower.startsWith(QLatin1Char('>'))
+                       || lower.startsWith(QLatin1Char('='))) {
+                int opLength = 1;
+                if (lower.startsWith(QLatin1String("<="))) {
+                    section.condition = LessEqual;
+                    opLength = 2;
+                } else if (lower.startsWith(QLatin1String(">="))) {
+                    section.condition = GreaterEqual;
+                    opLength = 2;
+                } else if (lower.startsWith(QLatin1String("<>"))) {
+                    section.condition = NotEqual;
+                    opLength = 2;
+                } else if (lower[0] == QLatin1Char('<')) {
+                    section.condition = LessThan;
+                } else if (lower[0] == QLatin1Char('>')) {
+                    section.condition = GreaterThan;
+                } else {
+                    section.condition = Equal;
+                }
+                section.conditionValue = lower.mid(opLength).trimmed().toDouble();
+            } else if (lower == QLatin1String("black")) {
+                section.color = QColor(Qt::black);
+            } else if (lower == QLatin1String("blue")) {
+                section.color = QColor(Qt::blue);
+            } else if (lower == QLatin1String("cyan")) {
+                section.color = QColor(Qt::cyan);
+            } else if (lower == QLatin1String("green")) {
+                section.color = QColor(Qt::green);
+            } else if (lower == QLatin1String("magenta")) {
+                section.color = QColor(Qt::magenta);
+            } else if (lower == QLatin1String("red")) {
+                section.color = QColor(Qt::red);
+            } else if (lower == QLatin1String("white")) {
+                section.color = QColor(Qt::white);
+            } else if (lower == QLatin1String("yellow")) {
+                section.color = QColor(Qt::yellow);
+            }
+            // [ColorN] and unknown modifiers are ignored
+            break;
+        }
+
+        case '"': {
+            const int end = code.indexOf(QLatin1Char('"'), i + 1);
+            const int stop = end < 0 ? length : end;
+            appendLiteral(code.mid(i + 1, stop - i - 1));
+            i = stop;
+            break;
+        }
+
+        case '\\':
+            if (i < length - 1)
+                appendLiteral(code.mid(++i, 1));
+            break;
+
+        case '_':
+            // padding with the width of the next char
+            appendLiteral(QStringLiteral(" "));
+            ++i;
+            break;
+
+        case '*':
+            // fill char, the cell width is unknown here
+            ++i;
+            break;
+
+        case '@':
+            tokens.append(Token(TextValue));
+            section.isText = true;
+            break;
+
+        case 'g':
+            if (code.mid(i, 7).compare(QLatin1String("general"), Qt::CaseInsensitive) == 0) {
+                tokens.append(Token(General));
+                i += 6;
+            } else {
+                appendLiteral(QString(c));
+            }
+            break;
+
+        case '0':
+        case '#':
+        case '?':
+            if (section.isDateTime)
+                appendLiteral(QString(c));
+            else
+                tokens.append(Token(Digit, QString(c)));
+            break;
+
+        case '.':
+            if (section.isDateTime) {
+                int zeros = 0;
+                while (i + zeros + 1 < length && code[i + zeros + 1] == QLatin1Char('0'))
+                    ++zeros;
+                appendLiteral(QStringLiteral("."));
+                if (zeros > 0) {
+                    tokens.append(Token(SubSecond, QString(), zeros));
+                    section.subSecondDigits = qMax(section.subSecondDigits, zeros);
+                    i += zeros;
+                }
+            } else {
+                bool hasPoint = false;
+                for (const Token &token : tokens)
+                    hasPoint = hasPoint || token.type == DecimalPoint || token.type == Exponent;
+                if (hasPoint)
+                    appendLiteral(QStringLiteral("."));
+                else
+                    tokens.append(Token(DecimalPoint));
+            }
+            break;
+
+        case ',':
+            if (section.isDateTime)
+                appendLiteral(QStringLiteral(","));
+            else
+                tokens.append(Token(Thousands));
+            break;
+
+        case '%':
+            if (section.isDateTime) {
+                appendLiteral(QStringLiteral("%"));
+            } else {
+                tokens.append(Token(Percent));
+                section.multiplier *= 100.0;
+            }
+            break;
+
+        case 'e':
+            if (!section.isDateTime && i < length - 1
+                    && (code[i+1] == QLatin1Char('+') || code[i+1] == QLatin1Char('-'))) {
+                tokens.append(Token(Exponent, QString(c) + code[i+1]));
+                ++i;
+            } else {
+                appendLiteral(QString(c));
+            }
+            break;
+
+        case '/':
+            if (!section.isDateTime && !tokens.isEmpty() && tokens.last().type == Digit) {
+                int j = i + 1;
+                while (j < length && code[j].isDigit())
+                    ++j;
+                if (j > i + 1 && code.mid(i + 1, j - i - 1).toInt() > 0) {
+                    //Fixed denominator, such as ?/8
+                    tokens.append(Token(FractionSlash));
+                    section.fixedDenominator = code.mid(i + 1, j - i - 1).toInt();
+                    tokens.append(Token(Denominator, code.mid(i + 1, j - i - 1)));
+                    i = j - 1;
+                } else if (i < length - 1 && (code[i+1] == QLatin1Char('?') || code[i+1] == QLatin1Char('#')
+                                              || code[i+1] == QLatin1Char('0'))) {
+                    tokens.append(Token(FractionSlash));
+                } else {
+                    appendLiteral(QStringLiteral("/"));
+                }
+            } else {
+                appendLiteral(QStringLiteral("/"));
+            }
+            break;
+
+        case 'a':
+            if (section.isDateTime && code.mid(i, 5).compare(QLatin1String("am/pm"), Qt::CaseInsensitive) == 0) {
+                tokens.append(Token(AmPm, code.mid(i, 5)));
+                section.hasAmPm = true;
+                i += 4;
+            } else if (section.isDateTime && code.mid(i, 3).compare(QLatin1String("a/p"), Qt::CaseInsensitive) == 0) {
+                tokens.append(Token(AmPm, code.mid(i, 3)));
+                section.hasAmPm = true;
+                i += 2;
+            } else {
+                appendLiteral(QString(c));
+            }
+            break;
+
+        case 'y':
+        case 'd':
+        case 'h':
+        case 's':
+        case 'm': {
+            if (!section.isDateTime) {
+                appendLiteral(QString(c));
+                break;
+            }
+            const int width = runLength(i);
+            TokenType type = Year;
+            if (lc == 'd') {
+                type = Day;
+            } else if (lc == 'h') {
+                type = Hour;
+            } else if (lc == 's') {
+                type = Second;
+            } else if (lc == 'm') {
+                //Minutes follow an hour or precede seconds, months otherwise.
+                bool beforeSecond = false;
+                for (int k = i + width; k < length; ++k) {
+                    const ushort n = code[k].toLower().unicode();
+                    if (n == 's') {
+                        beforeSecond = true;
+                        break;
+                    }
+                    if (n == 'd' || n == 'y' || n == 'h' || n == 'm' || n == ';')
+                        break;
+                }
+                type = (afterHour || beforeSecond) && width <= 2 ? Minute : Month;
+            }
+            tokens.append(Token(type, QString(), width));
+            afterHour = (type == Hour);
+            i += width - 1;
+            break;
+        }
+
+        default:
+            appendLiteral(QString(c));
+            break;
+        }
+    }
+
+    if (!section.isDateTime)
+        resolveNumberTokens(section);
+
+    return section;
+}
+
+/*
+ * Assigns the digit placeholders to their zones and resolves the commas
+ * into thousands separators, scaling by 1000 or plain literals.
+ */
+void NumberFormatter::resolveNumberTokens(Section &section)
+{
+    QVector<Token> &tokens = section.tokens;
+
+    int slash = -1;
+    Zone zone = IntegerZone;
+    for (int i = 0; i < tokens.size(); ++i) {
+        Token &token = tokens[i];
+        switch (token.type) {
+        case DecimalPoint:
+            zone = DecimalZone;
+            break;
+        case Exponent:
+            zone = ExponentZone;
+            section.hasExponent = true;
+            break;
+        case FractionSlash:
+            zone = DenominatorZone;
+            section.hasFraction = true;
+            if (slash < 0)
+                slash = i;
+            break;
+        case Digit:
+            token.zone = zone;
+            break;
+        default:
+            break;
+        }
+    }
+    if (slash >= 0) {
+        for (int j = slash - 1; j >= 0 && tokens[j].type == Digit; --j)
+            tokens[j].zone = NumeratorZone;
+    }
+
+    QVector<Token> resolved;
+    resolved.reserve(tokens.size());
+    bool scaling = false;
+    for (int i = 0; i < tokens.size(); ++i) {
+        const Token &token = tokens[i];
+        if (token.type != Thousands) {
+            resolved.append(token);
+            scaling = false;
+            continue;
+        }
+
+        const bool afterDigit = !resolved.isEmpty() && resolved.last().type == Digit;
+        const bool beforeDigit = i + 1 < tokens.size() && tokens[i+1].type == Digit;
+        if (afterDigit && beforeDigit && resolved.last().zone == IntegerZone) {
+            section.thousands = true;
+        } else if (afterDigit || scaling) {
+            section.multiplier /= 1000.0;
+            scaling = true;
+        } else if (!resolved.isEmpty() && resolved.last().type == Literal) {
+            resolved.last().text += QLatin1Char(',');
+        } else {
+            resolved.append(Token(Literal, QStringLiteral(",")));
+        }
+    }
+    tokens = resolved;
+
+    for (const Token &token : tokens) {
+        if (token.type != Digit)
+            continue;
+        section.hasDigits = true;
+        if (token.zone == IntegerZone) {
+            ++section.integerDigits;
+            if (token.text == QLatin1String("#"))
+                section.engineering = section.hasExponent;
+        } else if (token.zone == DecimalZone) {
+            ++section.decimalDigits;
+        } else if (token.zone == DenominatorZone) {
+            ++section.denominatorDigits;
+        }
+    }
+}
+
+/*
+ * Fills the placeholders of a right aligned \a zone with \a digits into
+ * \a parts. Extra leading digits go to the first placeholder.
+ */
+void NumberFormatter::fillDigits(const QVector<Token> &tokens, Zone zone, const QString &digits,
+                                 QVector<QString> &parts, bool group)
+{
+    QVector<int> indexes;
+    for (int i = 0; i < tokens.size(); ++i) {
+        if (tokens[i].type == Digit && tokens[i].zone == zone)
+            indexes.append(i);
+    }
+
+    int remaining = digits.length();
+    int position = 0;
+    for (int k = indexes.size() - 1; k >= 0; --k) {
+        QString part;
+        auto prependDigit = [&](QChar c) {
+            if (group && position > 0 && position % 3 == 0)
+                part.prepend(QLatin1Char(','));
+            part.prepend(c);
+            ++position;
+        };
+
+        const QString &placeholder = tokens[indexes[k]].text;
+        if (remaining > 0)
+            prependDigit(digits[--remaining]);
+        else if (placeholder == QLatin1String("0"))
+            prependDigit(QLatin1Char('0'));
+        else if (placeholder == QLatin1String("?"))
+            part.prepend(QLatin1Char(' '));
+
+        if (k == 0) {
+            while (remaining > 0)
+                prependDigit(digits[--remaining]);
+        }
+        parts[indexes[k]] = part;
+    }
+}
+
+/*
+ * Fills the placeholders of a left aligned \a zone with \a digits. Trailing
+ * zeros are dropped for '#' and blanked for '?' placeholders.
+ */
+void NumberFormatter::fillLeftDigits(const QVector<Token> &tokens, Zone zone, const QString &digits,
+                                     QVector<QString> &parts, bool trimZeros)
+{
+    QVector<int> indexes;
+    for (int i = 0; i < tokens.size(); ++i) {
+        if (tokens[i].type == Digit && tokens[i].zone == zone)
+            indexes.append(i);
+    }
+
+    int last = digits.length() - 1;
+    if (trimZeros) {
+        while (last >= 0 && last < indexes.size() && digits[last] == QLatin1Char('0')
+               && tokens[indexes[last]].text != QLatin1String("0"))
+            --last;
+    }
+
+    for (int k = 0; k < indexes.size(); ++k) {
+        const QString &placeholder = tokens[indexes[k]].text;
+        QString part;
+        if (k <= last && k < digits.length())
+            part = digits[k];
+        else if (placeholder == QLatin1String("0"))
+            part = QStringLiteral("0");
+        else if (placeholder == QLatin1String("?"))
+            part = QStringLiteral(" ");
+        if (k == indexes.size() - 1 && digits.length() > indexes.size())
+            part += digits.mid(indexes.size());
+        parts[indexes[k]] = part;
+    }
+}
+
+QString NumberFormatter::renderNumber(const Section &section, double value) const
+{
+    if (section.hasFraction)
+        return renderFraction(section, value);
+
+    const double number = value * section.multiplier;
+    const QVector<Token> &tokens = section.tokens;
+    QVector<QString> parts(tokens.size());
+    QString exponentSign;
+
+    if (section.hasDigits) {
+        double mantissa = number;
+        int exponent = 0;
+        if (section.hasExponent && number != 0) {
+            const int integerDigits = qMax(1, section.integerDigits);
+            exponent = int(std::floor(std::log10(number)));
+            if (section.engineering)
+                exponent -= ((exponent % integerDigits) + integerDigits) % integerDigits;
+            else
+                exponent -= integerDigits - 1;
+            mantissa = number / std::pow(10.0, exponent);
+            if (QString::number(mantissa, 'f', section.decimalDigits).toDouble() >= std::pow(10.0, integerDigits)) {
+                exponent += section.engineering ? integerDigits : 1;
+                mantissa = number / std::pow(10.0, exponent);
+            }
+        }
+
+        const QString rounded = QString::number(mantissa, 'f', section.decimalDigits);
+        const int point = rounded.indexOf(QLatin1Char('.'));
+        QString integerPart = point < 0 ? rounded : rounded.left(point);
+        if (integerPart == QLatin1String("0"))
+            integerPart.clear();
+
+        fillDigits(tokens, IntegerZone, integerPart, parts, section.thousands);
+        if (point >= 0)
+            fillLeftDigits(tokens, DecimalZone, rounded.mid(point + 1), parts, true);
+        if (section.hasExponent) {
+            fillDigits(tokens, ExponentZone, exponent == 0 ? QString() : QString::number(qAbs(exponent)),
+                       parts, false);
+            exponentSign = exponent < 0 ? QStringLiteral("-") : QString();
+        }
+    }
+
+    QString result;
+    for (int i = 0; i < tokens.size(); ++i) {
+        const Token &token = tokens[i];
+        switch (token.type) {
+        case Literal:
+            result += token.text;
+            break;
+        case Digit:
+            result += parts[i];
+            break;
+        case DecimalPoint:
+            result += QLatin1Char('.');
+            break;
+        case Percent:
+            result += QLatin1Char('%');
+            break;
+        case Exponent:
+            result += token.text[0];
+            if (!exponentSign.isEmpty())
+                result += exponentSign;
+            else if (token.text[1] == QLatin1Char('+'))
+                result += QLatin1Char('+');
+            break;
+        case General:
+            result += generalNumber(number);
+            break;
+        default:
+            break;
+        }
+    }
+    return result;
+}
+
+QString NumberFormatter::renderFraction(const Section &section, double value) const
+{
+    const double number = value * section.multiplier;
+    const QVector<Token> &tokens = section.tokens;
+    const bool hasInteger = section.integerDigits > 0;
+
+    double whole = hasInteger ? std::floor(number) : 0;
+    const double fraction = number - whole;
+    qint64 numerator = 0;
+    qint64 denominator = 1;
+    if (section.fixedDenominator > 0) {
+        denominator = section.fixedDenominator;
+        numerator = qRound64(fraction * denominator);
+    } else {
+        qint64 maxDenominator = 1;
+        for (int i = 0; i < section.denominatorDigits; ++i)
+            maxDenominator *= 10;
+        approximate(fraction, qMax<qint64>(1, maxDenominator - 1), &numerator, &denominator);
+    }
+    if (hasInteger && numerator == denominator) {
+        whole += 1;
+        numerator = 0;
+    }
+
+    const bool blankFraction = hasInteger && numerator == 0;
+    QString integerPart = whole > 0 ? QString::number(whole, 'f', 0) : QString();
+    if (blankFraction && integerPart.isEmpty())
+        integerPart = QStringLiteral("0");
+
+    QVector<QString> parts(tokens.size());
+    fillDigits(tokens, IntegerZone, integerPart, parts, section.thousands);
+    fillDigits(tokens, NumeratorZone, QString::number(numerator), parts, false);
+    fillLeftDigits(tokens, DenominatorZone, QString::number(denominator), parts, false);
+
+    QString result;
+    for (int i = 0; i < tokens.size(); ++i) {
+        const Token &token = tokens[i];
+        QString text;
+        switch (token.type) {
+        case Literal:
+            text = token.text;
+            break;
+        case Digit:
+            text = parts[i];
+            break;
+        case FractionSlash:
+            text = QStringLiteral("/");
+            break;
+        case Denominator:
+            text = token.text;
+            break;
+        case Percent:
+            text = QStringLiteral("%");
+            break;
+        default:
+            break;
+        }
+        const bool inFraction = token.type == FractionSlash || token.type == Denominator
+                || token.zone == NumeratorZone || token.zone == DenominatorZone;
+        if (blankFraction && inFraction)
+            text = QString(text.length(), QLatin1Char(' '));
+        result += text;
+    }
+    return result;
+}
+
+QString NumberFormatter::renderDateTime(const Section &section, double value, bool date1904) const
+{
+    if (value < 0 || !std::isfinite(value))
+        return QString(8, QLatin1Char('#'));
+
+    qint64 scale = 1;
+    for (int i = 0; i < section.subSecondDigits; ++i)
+        scale *= 10;
+    const qint64 unitsPerDay = Q_INT64_C(86400) * scale;
+    const qint64 total = qRound64(value * unitsPerDay);
+    const qint64 days = total / unitsPerDay;
+    const qint64 remainder = total % unitsPerDay;
+    const qint64 totalSeconds = total / scale;
+    const qint64 secondOfDay = remainder / scale;
+    const qint64 subSecond = remainder % scale;
+    const int hour = int(secondOfDay / 3600);
+    const int minute = int(secondOfDay / 60 % 60);
+    const int second = int(secondOfDay % 60);
+
+    int year = 0, month = 0, day = 0, dayOfWeek = 0;
+    excelDate(days, date1904, &year, &month, &day, &dayOfWeek);
+
+    QString result;
+    for (const Token &token : section.tokens) {
+        switch (token.type) {
+        case Literal:
+            result += token.text;
+            break;
+        case Year:
+            result += token.width <= 2 ? padded(year % 100, 2) : padded(year, 4);
+            break;
+        case Month: {
+            const QString name = QLatin1String(monthNames[qBound(1, month, 12) - 1]);
+            if (token.width == 1)
+                result += QString::number(month);
+            else if (token.width == 2)
+                result += padded(month, 2);
+            else if (token.width == 3)
+                result += name.left(3);
+            else if (token.width == 5)
+                result += name.left(1);
+            else
+                result += name;
+            break;
+        }
+        case Day:
+            if (token.width <= 2)
+                result += padded(day, token.width);
+            else if (token.width == 3)
+                result += QLatin1String(dayNames[dayOfWeek]).left(3);
+            else
+                result += QLatin1String(dayNames[dayOfWeek]);
+            break;
+        case Hour: {
+            int h = hour;
+            if (section.hasAmPm) {
+                h = hour % 12;
+                if (h == 0)
+                    h = 12;
+            }
+            result += padded(h, qMin(token.width, 2));
+            break;
+        }
+        case Minute:
+            result += padded(minute, qMin(token.width, 2));
+            break;
+        case Second:
+            result += padded(second, qMin(token.width, 2));
+            break;
+        case SubSecond:
+            result += padded(subSecond, section.subSecondDigits).left(token.width);
+            break;
+        case ElapsedHour:
+            result += padded(totalSeconds / 3600, token.width);
+            break;
+        case ElapsedMinute:
+            result += padded(totalSeconds / 60, token.width);
+            break;
+        case ElapsedSecond:
+            result += padded(totalSeconds, token.width);
+            break;
+        case AmPm:
+            if (token.text.length() == 5)
+                result += hour < 12 ? token.text.left(2) : token.text.mid(3, 2);
+            else
+                result += hour < 12 ? token.text.left(1) : token.text.mid(2, 1);
+            break;
+        case General:
+            result += generalNumber(value);
+            break;
+        default:
+            break;
+        }
+    }
+    return result;
+}
+
+QString NumberFormatter::renderText(const Section &section, const QString &text) const
+{
+    QString result;
+    for (const Token &token : section.tokens) {
+        if (token.type == TextValue)
+            result += text;
+        else if (token.type == Literal)
+            result += token.text;
+    }
+    return result;
+}
+
+/*!
+ * \internal
+ * Renders \a value the way Excel displays it with this format. Strings go
+ * to the text section, dates and times are converted to serial numbers.
+ * The color of the used section, if any, is stored in \a color.
+ */
+QString NumberFormatter::format(const QVariant &value, bool date1904, QColor *color) const
+{
+    switch (value.userType()) {
+    case QMetaType::UnknownType:
+        return QString();
+    case QMetaType::Bool:
+        return value.toBool() ? QStringLiteral("TRUE") : QStringLiteral("FALSE");
+    case QMetaType::QString:
+        return formatText(value.toString(), color);
+    case QMetaType::QDateTime:
+        return formatNumber(datetimeToNumber(value.toDateTime(), date1904), date1904, color);
+    case QMetaType::QDate:
+        return formatNumber(dateToNumber(value.toDate(), date1904), date1904, color);
+    case QMetaType::QTime:
+        return formatNumber(timeToNumber(value.toTime()), date1904, color);
+    default:
+        break;
+    }
+
+    bool ok = false;
+    const double number = value.toDouble(&ok);
+    if (ok)
+        return formatNumber(number, date1904, color);
+    return formatText(value.toString(), color);
+}
+
+QString NumberFormatter::formatNumber(double value, bool date1904, QColor *color) const
+{
+    const int numberSections = qMin(3, m_sections.size());
+    if (numberSections == 0 || (m_textSection == 0 && m_sections.size() == 1))
+        return generalNumber(value);
+
+    bool conditional = false;
+    for (int i = 0; i < qMin(2, numberSections); ++i)
+        conditional = conditional || m_sections[i].condition != NoCondition;
+
+    const Section *section = nullptr;
+    bool negative = false;
+    if (conditional) {
+        for (int i = 0; i < numberSections && !section; ++i) {
+            if (m_sections[i].matches(value))
+                section = &m_sections[i];
+        }
+        if (!section)
+            return QString(8, QLatin1Char('#'));
+        // a section meant for negative numbers shows them without sign
+        negative = value < 0 && !((section->condition == LessThan || section->condition == LessEqual)
+                                  && section->conditionValue <= 0);
+    } else if (value < 0 && numberSections >= 2) {
+        section = &m_sections[1];
+    } else if (value == 0 && numberSections >= 3) {
+        section = &m_sections[2];
+    } else {
+        section = &m_sections[0];
+        negative = value < 0;
+    }
+
+    if (color && section->color.isValid())
+        *color = section->color;
+
+    if (section->isDateTime)
+        return renderDateTime(*section, negative ? value : std::fabs(value), date1904);
+    if (section->isText && !section->hasDigits)
+        return renderText(*section, generalNumber(std::fabs(value)));
+
+    const QString result = renderNumber(*section, std::fabs(value));
+    if (negative && hasNonZeroDigit(result))
+        return QStringLiteral("-") + result;
+    return result;
+}
+
+QString NumberFormatter::formatText(const QString &text, QColor *color) const
+{
+    if (m_textSection < 0)
+        return text;
+
+    const Section &section = m_sections[m_textSection];
+    if (color && section.color.isValid())
+        *color = section.color;
+    if (!section.isText && section.tokens.isEmpty())
+        return text;
+    return renderText(section, text);
+}
+
+/*!
+ * \internal
+ * Returns the number in the General format: at most 11 characters, and
+ * scientific notation for very large or small numbers.
+ */
+QString NumberFormatter::generalNumber(double value)
+{
+    if (value == 0)
+        return QStringLiteral("0");
+    if (!std::isfinite(value))
+        return QStringLiteral("#NUM!");
+
+    const double a = std::fabs(value);
+    if (a >= 1e11 || a < 1e-9) {
+        QString text = QString::number(value, 'E', 5);
+        const int e = text.indexOf(QLatin1Char('E'));
+        QString mantissa = text.left(e);
+        if (mantissa.contains(QLatin1Char('.'))) {
+            while (mantissa.endsWith(QLatin1Char('0')))
+                mantissa.chop(1);
+            if (mantissa.endsWith(QLatin1Char('.')))
+                mantissa.chop(1);
+        }
+        return mantissa + text.mid(e);
+    }
+
+    const int integerLength = a >= 1 ? int(std::floor(std::log10(a))) + 1 : 1;
+    QString text = QString::number(value, 'f', qMax(0, 10 - integerLength));
+    if (text.contains(QLatin1Char('.'))) {
+        while (text.endsWith(QLatin1Char('0')))
+            text.chop(1);
+        if (text.endsWith(QLatin1Char('.')))
+            text.chop(1);
+    }
+    if (text == QLatin1String("-0"))
+        return QStringLiteral("0");
+    return text;
+}
+
+/*!
+ * \internal
+ * Returns the format code of the built-in number format \a numFmtId, as
+ * shown by an en-US Excel. The CJK ids 27-36 and 50-58 fall back to the
+ * plain date and time formats.
+ */
+QString NumberFormatter::builtinFormatCode(int numFmtId)
+{
+    switch (numFmtId) {
+    case 1: return QStringLiteral("0");
+    case 2: return QStringLiteral("0.00");
+    case 3: return QStringLiteral("#,##0");
+    case 4: return QStringLiteral("#,##0.00");
+    case 5: return QStringLiteral("$#,##0_);($#,##0)");
+    case 6: return QStringLiteral("$#,##0_);[Red]($#,##0)");
+    case 7: return QStringLiteral("$#,##0.00_);($#,##0.00)");
+    case 8: return QStringLiteral("$#,##0.00_);[Red]($#,##0.00)");
+    case 9: return QStringLiteral("0%");
+    case 10: return QStringLiteral("0.00%");
+    case 11: return QStringLiteral("0.00E+00");
+    case 12: return QStringLiteral("# ?/?");
+    case 13: return QStringLiteral("# ?\?/??");
+    case 14: return QStringLiteral("m/d/yy");
+    case 15: return QStringLiteral("d-mmm-yy");
+    case 16: return QStringLiteral("d-mmm");
+    case 17: return QStringLiteral("mmm-yy");
+    case 18: return QStringLiteral("h:mm AM/PM");
+    case 19: return QStringLiteral("h:mm:ss AM/PM");
+    case 20: return QStringLiteral("h:mm");
+    case 21: return QStringLiteral("h:mm:ss");
+    case 22: return QStringLiteral("m/d/yy h:mm");
+    case 37: return QStringLiteral("#,##0_);(#,##0)");
+    case 38: return QStringLiteral("#,##0_);[Red](#,##0)");
+    case 39: return QStringLiteral("#,##0.00_);(#,##0.00)");
+    case 40: return QStringLiteral("#,##0.00_);[Red](#,##0.00)");
+    case 41: return QStringLiteral("_(* #,##0_);_(* (#,##0);_(* \"-\"_);_(@_)");
+    case 42: return QStringLiteral("_($* #,##0_);_($* (#,##0);_($* \"-\"_);_(@_)");
+    case 43: return QStringLiteral("_(* #,##0.00_);_(* (#,##0.00);_(* \"-\"??_);_(@_)");
+    case 44: return QStringLiteral("_($* #,##0.00_);_($* (#,##0.00);_($* \"-\"??_);_(@_)");
+    case 45: return QStringLiteral("mm:ss");
+    case 46: return QStringLiteral("[h]:mm:ss");
+    case 47: return QStringLiteral("mm:ss.0");
+    case 48: return QStringLiteral("##0.0E+0");
+    case 49: return QStringLiteral("@");
+    default:
+        break;
+    }
+
+    switch (NumFormatParser::builtinKind(numFmtId)) {
+    case NumFormatParser::DateKind:
+        return QStringLiteral("m/d/yy");
+    case NumFormatParser::TimeKind:
+        return QStringLiteral("h:mm:ss");
+    default:
+        return QStringLiteral("General");
+    }
+}
+
+QT_END_NAMESPACE_XLSX
@@ -70,4 +70,138 @@ bool NumFormatParser::isDateTime(const QString &formatCode)
     return false;
 }
 
+/*
+ * Classifies the first section of \a formatCode. Unlike isDateTime() this
+ * has to tell minutes from months: 'm' is a minute when it follows an hour
+ * or is followed by seconds, and a month otherwise.
+ */
+NumFormatParser::Kind NumFormatParser::kind(const QString &formatCode)
+{
+    bool hasDate = false;
+    bool hasTime = false;
+    bool hasText = false;
+    bool afterHour = false;
+
+    const int length = formatCode.length();
+    for (int i = 0; i < length; ++i) {
+        const ushort c = formatCode[i].toLower().unicode();
+
+        switch (c) {
+        case '[':
+            if (i < length-2 && formatCode[i+2] == QLatin1Char(']')) {
+                const QChar cc = formatCode[i+1].toLower();
+                if (cc == QLatin1Char('h') || cc == QLatin1Char('m') || cc == QLatin1Char('s'))
+                    hasTime = true;
+                afterHour = (cc == QLatin1Char('h'));
+                i+=2;
+            } else {
+                while (i < length && formatCode[i] != QLatin1Char(']'))
+                    ++i;
+            }
+            break;
+
+        case '"':
+            while (i < length-1 && formatCode[++i] != QLatin1Char('"'))
+                ;
+            break;
+
+        case '\\':
+            if (i < length - 1)
+                ++i;
+            break;
+
+        case ';':
+            i = length;
+            break;
+
+        case '@':
+            hasText = true;
+            break;
+
+        case 'a':
+            // AM/PM and A/P markers
+            if (formatCode.mid(i, 5).compare(QLatin1String("am/pm"), Qt::CaseInsensitive) == 0) {
+                hasTime = true;
+                i += 4;
+            } else if (formatCode.mid(i, 3).compare(QLatin1String("a/p"), Qt::CaseInsensitive) == 0) {
+                hasTime = true;
+                i += 2;
+            }
+            break;
+
+        case 'd':
+        case 'y':
+            hasDate = true;
+            afterHour = false;
+            break;
+
+        case 'h':
+            hasTime = true;
+            afterHour = true;
+            break;
+
+        case 's':
+            hasTime = true;
+            afterHour = false;
+            break;
+
+        case 'm': {
+            int j = i;
+            while (j < length-1 && formatCode[j+1].toLower() == QLatin1Char('m'))
+                ++j;
+            bool beforeSecond = false;
+            for (int k = j+1; k < length; ++k) {
+                const ushort n = formatCode[k].toLower().unicode();
+                if (n == 's') {
+                    beforeSecond = true;
+                    break;
+                }
+                if (n == 'd' || n == 'y' || n == 'h' || n == 'm' || n == ';')
+                    break;
+            }
+            if (afterHour || beforeSecond)
+                hasTime = true;
+            else
+                hasDate = true;
+            afterHour = false;
+            i = j;
+            break;
+        }
+
+        default:
+            break;
+        }
+    }
+
+    if (hasDate && hasTime)
+        return DateTimeKind;
+    if (hasDate)
+        return DateKind;
+    if (hasTime)
+        return TimeKind;
+    if (hasText)
+        return TextKind;
+    return NumberKind;
+}
+
+/*
+ * Classifies the built-in number format \a numFmtId. Ids 27-36 and 50-58
+ * are the CJK date/time formats.
+ */
+NumFormatParser::Kind NumFormatParser::builtinKind(int numFmtId)
+{
+    if ((numFmtId >= 14 && numFmtId <= 17)
+            || (numFmtId >= 27 && numFmtId <= 31) || numFmtId == 36
+            || (numFmtId >= 50 && numFmtId <= 54) || numFmtId == 57 || numFmtId == 58)
+        return DateKind;
+    if ((numFmtId >= 18 && numFmtId <= 21) || (numFmtId >= 32 && numFmtId <= 35)
+            || (numFmtId >= 45 && numFmtId <= 47) || numFmtId == 55 || numFmtId == 56)
+        return TimeKind;
+    if (numFmtId == 22)
+        return DateTimeKind;
+    if (numFmtId == 49)
+        return TextKind;
+    return NumberKind;
+}
+
 QT_END_NAMESPACE_XLSX
@@ -0,0 +1,72 @@
+// xlsxparallel.cpp
+
+#include <QtGlobal>
+#include <QAtomicInt>
+#include <QRunnable>
+#include <QSemaphore>
+#include <QThreadPool>
+
+#include "xlsxparallel_p.h"
+
+QT_BEGIN_NAMESPACE_XLSX
+
+namespace {
+
+class FunctionTask : public QRunnable
+{
+public:
+    explicit FunctionTask(const std::function<void()> &function) : m_function(function) {}
+    void run() override { m_function(); }
+
+private:
+    std::function<void()> m_function;
+};
+
+} // namespace
+
+/*!
+ * \internal
+ * Returns the most threads runChunked() uses for \a chunks chunks, the
+ * calling one included.
+ */
+int chunkWorkerCount(int chunks)
+{
+    return qMax(1, qMin(chunks, QThreadPool::globalInstance()->maxThreadCount()));
+}
+
+/*!
+ * \internal
+ * Calls \a work once for each chunk from 0 to \a chunks - 1 and returns
+ * when all of them are done. The chunks are taken from a shared counter by
+ * the calling thread and the threads of the global pool free to help, a
+ * busy pool leaves more chunks to the calling thread. The worker passed
+ * along, below chunkWorkerCount(), tells the threads apart: the chunks of
+ * one worker are run one after the other.
+ */
+void runChunked(int chunks, const std::function<void(int chunk, int worker)> &work)
+{
+    QAtomicInt nextChunk(0);
+    auto take = [&](int worker) {
+        for (int chunk = nextChunk.fetchAndAddRelaxed(1); chunk < chunks; chunk = nextChunk.fetchAndAddRelaxed(1))
+            work(chunk, worker);
+    };
+
+    QThreadPool *pool = QThreadPool::globalInstance();
+    QSemaphore finished;
+    int helpers = 0;
+    for (int worker = 1; worker < chunkWorkerCount(chunks); ++worker) {
+        FunctionTask *task = new FunctionTask([&, worker]() {
+            take(worker);
+            finished.release();
+        });
+        if (!pool->tryStart(task)) {
+            delete task;
+            break;
+        }
+        ++helpers;
+    }
+    take(0);
+    finished.acquire(helpers);
+}
+
+QT_END_NAMESPACE_XLSX
@@ -0,0 +1,340 @@
+// xlsxrangeindex.cpp
+
+#include <QtGlobal>
+#include <QVector>
+
+#include <algorithm>
+
+#include "xlsxrangeindex_p.h"
+
+QT_BEGIN_NAMESPACE_XLSX
+
+namespace {
+
+const int maxEntries = 16;
+const int minEntries = 4;
+
+inline bool overlaps(const CellRange &a, const CellRange &b)
+{
+    return a.firstRow() <= b.lastRow() && b.firstRow() <= a.lastRow()
+            && a.firstColumn() <= b.lastColumn() && b.firstColumn() <= a.lastColumn();
+}
+
+inline bool covers(const CellRange &outer, const CellRange &inner)
+{
+    return outer.firstRow() <= inner.firstRow() && inner.lastRow() <= outer.lastRow()
+            && outer.firstColumn() <= inner.firstColumn() && inner.lastColumn() <= outer.lastColumn();
+}
+
+inline CellRange united(const CellRange &a, const CellRange &b)
+{
+    return CellRange(qMin(a.firstRow(), b.firstRow()), qMin(a.firstColumn(), b.firstColumn()),
+                     qMax(a.lastRow(), b.lastRow()), qMax(a.lastColumn(), b.lastColumn()));
+}
+
+inline qint64 area(const CellRange &range)
+{
+    return qint64(range.rowCount()) * range.columnCount();
+}
+
+CellRange bounds(const QVector<CellRange> &boxes)
+{
+    CellRange result = boxes.first();
+    for (int i = 1; i < boxes.size(); ++i)
+        result = united(result, boxes[i]);
+    return result;
+}
+
+} // namespace
+
+RangeIndex::RangeIndex()
+    : m_root(-1), m_size(0)
+{
+}
+
+/*!
+ * \internal
+ * Adds \a range with \a value. Invalid ranges are ignored.
+ */
+void RangeIndex::insert(const CellRange &range, int value)
+{
+    if (!range.isValid())
+        return;
+
+    if (m_root == -1)
+        m_root = newNode(true, -1);
+    append(chooseLeaf(range), range, value);
+    ++m_size;
+}
+
+/*!
+ * \internal
+ * Removes \a range stored with \a value. Nodes left with too few entries
+ * are taken out of the tree, their entries are inserted again.
+ */
+bool RangeIndex::remove(const CellRange &range, int value)
+{
+    if (m_root == -1 || !range.isValid())
+        return false;
+
+    int position = -1;
+    int node = findLeaf(range, value, position);
+    if (node == -1)
+        return false;
+    m_nodes[node].boxes.remove(position);
+    m_nodes[node].items.remove(position);
+    --m_size;
+
+    QVector<CellRange> orphanRanges;
+    QVector<int> orphanValues;
+    while (node != m_root) {
+        const int parent = m_nodes[node].parent;
+        const int index = m_nodes[parent].items.indexOf(node);
+        if (m_nodes[node].items.size() < minEntries) {
+            m_nodes[parent].boxes.remove(index);
+            m_nodes[parent].items.remove(index);
+            collectEntries(node, orphanRanges, orphanValues);
+        } else {
+            m_nodes[parent].boxes[index] = bounds(m_nodes[node].boxes);
+        }
+        node = parent;
+    }
+
+    while (!m_nodes[m_root].leaf && m_nodes[m_root].items.size() == 1) {
+        const int child = m_nodes[m_root].items.first();
+        freeNode(m_root);
+        m_root = child;
+        m_nodes[m_root].parent = -1;
+    }
+    if (m_nodes[m_root].items.isEmpty()) {
+        freeNode(m_root);
+        m_root = -1;
+    }
+
+    m_size -= orphanValues.size();
+    for (int i = 0; i < orphanValues.size(); ++i)
+        insert(orphanRanges[i], orphanValues[i]);
+    return true;
+}
+
+void RangeIndex::clear()
+{
+    m_nodes.clear();
+    m_freeNodes.clear();
+    m_root = -1;
+    m_size = 0;
+}
+
+/*!
+ * \internal
+ * Returns the values of the ranges holding the cell (\a row, \a column).
+ */
+QVector<int> RangeIndex::find(int row, int column) const
+{
+    return find(CellRange(row, column, row, column));
+}
+
+/*!
+ * \internal
+ * Returns the values of the ranges overlapping \a range, in no particular
+ * order.
+ */
+QVector<int> RangeIndex::find(const CellRange &range) const
+{
+    QVector<int> values;
+    if (m_root == -1 || !range.isValid())
+        return values;
+
+    QVector<int> stack;
+    stack.append(m_root);
+    while (!stack.isEmpty()) {
+        const Node &node = m_nodes[stack.takeLast()];
+        for (int i = 0; i < node.boxes.size(); ++i) {
+            if (!overlaps(node.boxes[i], range))
+                continue;
+            if (node.leaf)
+                values.append(node.items[i]);
+            else
+                stack.append(node.items[i]);
+        }
+    }
+    return values;
+}
+
+bool RangeIndex::intersects(const CellRange &range) const
+{
+    if (m_root == -1 || !range.isValid())
+        return false;
+
+    QVector<int> stack;
+    stack.append(m_root);
+    while (!stack.isEmpty()) {
+        const Node &node = m_nodes[stack.takeLast()];
+        for (int i = 0; i < node.boxes.size(); ++i) {
+            if (!overlaps(node.boxes[i], range))
+                continue;
+            if (node.leaf)
+                return true;
+            stack.append(node.items[i]);
+        }
+    }
+    return false;
+}
+
+int RangeIndex::newNode(bool leaf, int parent)
+{
+    int node;
+    if (!m_freeNodes.isEmpty()) {
+        node = m_freeNodes.takeLast();
+    } else {
+        node = m_nodes.size();
+        m_nodes.append(Node());
+    }
+    m_nodes[node].parent = parent;
+    m_nodes[node].leaf = leaf;
+    return node;
+}
+
+void RangeIndex::freeNode(int node)
+{
+    m_nodes[node].boxes.clear();
+    m_nodes[node].items.clear();
+    m_freeNodes.append(node);
+}
+
+/*!
+ * \internal
+ * Walks down to the leaf whose bounds grow the least to take \a range,
+ * the smaller one on ties.
+ */
+int RangeIndex::chooseLeaf(const CellRange &range) const
+{
+    int node = m_root;
+    while (!m_nodes[node].leaf) {
+        const Node &n = m_nodes[node];
+        int best = 0;
+        qint64 bestGrowth = 0;
+        qint64 bestArea = 0;
+        for (int i = 0; i < n.boxes.size(); ++i) {
+            const qint64 size = area(n.boxes[i]);
+            const qint64 growth = area(united(n.boxes[i], range)) - size;
+            if (i == 0 || growth < bestGrowth || (growth == bestGrowth && size < bestArea)) {
+                best = i;
+                bestGrowth = growth;
+                bestArea = size;
+            }
+        }
+        node = n.items[best];
+    }
+    return node;
+}
+
+int RangeIndex::findLeaf(const CellRange &range, int value, int &position) const
+{
+    QVector<int> stack;
+    stack.append(m_root);
+    while (!stack.isEmpty()) {
+        const int index = stack.takeLast();
+        const Node &node = m_nodes[index];
+        for (int i = 0; i < node.boxes.size(); ++i) {
+            if (node.leaf) {
+                if (node.items[i] == value && node.boxes[i] == range) {
+                    position = i;
+                    return index;
+                }
+            } else if (covers(node.boxes[i], range)) {
+                stack.append(node.items[i]);
+            }
+        }
+    }
+    return -1;
+}
+
+void RangeIndex::append(int node, const CellRange &range, int item)
+{
+    m_nodes[node].boxes.append(range);
+    m_nodes[node].items.append(item);
+    if (!m_nodes[node].leaf)
+        m_nodes[item].parent = node;
+
+    if (m_nodes[node].items.size() > maxEntries)
+        split(node);
+    else
+        updateBounds(node);
+}
+
+/*!
+ * \internal
+ * Splits a full node in two halves, its entries sorted along the axis they
+ * are the most spread on.
+ */
+void RangeIndex::split(int node)
+{
+    const QVector<CellRange> boxes = m_nodes[node].boxes;
+    const QVector<int> items = m_nodes[node].items;
+    const bool leaf = m_nodes[node].leaf;
+
+    const CellRange all = bounds(boxes);
+    const bool byRow = all.rowCount() >= all.columnCount();
+    QVector<int> order(boxes.size());
+    for (int i = 0; i < order.size(); ++i)
+        order[i] = i;
+    std::sort(order.begin(), order.end(), [&](int a, int b) {
+        if (byRow)
+            return boxes[a].firstRow() + boxes[a].lastRow() < boxes[b].firstRow() + boxes[b].lastRow();
+        return boxes[a].firstColumn() + boxes[a].lastColumn() < boxes[b].firstColumn() + boxes[b].lastColumn();
+    });
+
+    const int sibling = newNode(leaf, m_nodes[node].parent);
+    m_nodes[node].boxes.clear();
+    m_nodes[node].items.clear();
+    const int half = order.size() / 2;
+    for (int i = 0; i < order.size(); ++i) {
+        const int target = i < half ? node : sibling;
+        m_nodes[target].boxes.append(boxes[order[i]]);
+        m_nodes[target].items.append(items[order[i]]);
+        if (!leaf)
+            m_nodes[items[order[i]]].parent = target;
+    }
+
+    const int parent = m_nodes[node].parent;
+    if (parent == -1) {
+        m_root = newNode(false, -1);
+        m_nodes[m_root].boxes.append(bounds(m_nodes[node].boxes));
+        m_nodes[m_root].items.append(node);
+        m_nodes[node].parent = m_root;
+        append(m_root, bounds(m_nodes[sibling].boxes), sibling);
+        return;
+    }
+
+    m_nodes[parent].boxes[m_nodes[parent].items.indexOf(node)] = bounds(m_nodes[node].boxes);
+    append(parent, bounds(m_nodes[sibling].boxes), sibling);
+}
+
+void RangeIndex::updateBounds(int node)
+{
+    while (m_nodes[node].parent != -1) {
+        const int parent = m_nodes[node].parent;
+        const int index = m_nodes[parent].items.indexOf(node);
+        const CellRange box = bounds(m_nodes[node].boxes);
+        if (m_nodes[parent].boxes[index] == box)
+            return;
+        m_nodes[parent].boxes[index] = box;
+        node = parent;
+    }
+}
+
+void RangeIndex::collectEntries(int node, QVector<CellRange> &ranges, QVector<int> &values)
+{
+    if (m_nodes[node].leaf) {
+        ranges += m_nodes[node].boxes;
+        values += m_nodes[node].items;
+    } else {
+        const QVector<int> children = m_nodes[node].items;
+        for (int child : children)
+            collectEntries(child, ranges, values);
+    }
+    freeNode(node);
+}
+
+QT_END_NAMESPACE_XLSX
@@ -225,7 +225,7 @@ QByteArray RichStringPrivate::idKey() const
                 bytes.append(fragmentTexts[i].toUtf8());
                 bytes.append("@Format");
                 if (fragmentFormats[i].hasFontData())
-                    bytes.append(fragmentFormats[i].fontKey());
+                    bytes.append(QByteArray::number(fragmentFormats[i].fontKey(), 16));
             }
         }
         rs->_idKey = bytes;
@@ -0,0 +1,188 @@
+// xlsxsheetshift.cpp
+
+#include <QtGlobal>
+#include <QString>
+#include <QVector>
+
+#include "xlsxsheetshift_p.h"
+#include "xlsxformulaparser_p.h"
+#include "xlsxutility_p.h"
+#include "xlsxworksheet_p.h"
+
+QT_BEGIN_NAMESPACE_XLSX
+
+namespace {
+
+bool isSheet(const QString &sheetPrefix, const QString &sheetName, bool onSheet)
+{
+    if (sheetPrefix.isEmpty())
+        return onSheet;
+    const QString name = sheetPrefix.startsWith(QLatin1Char('\'')) ? unescapeSheetName(sheetPrefix) : sheetPrefix;
+    return name.compare(sheetName, Qt::CaseInsensitive) == 0;
+}
+
+// Stores the absolute position in the reference, as an offset from the cell when relative.
+void setRow(FormulaRef &ref, int row, const CellReference &cell)
+{
+    ref.row = ref.rowAbsolute ? row : row - cell.row();
+}
+
+void setColumn(FormulaRef &ref, int column, const CellReference &cell)
+{
+    ref.column = ref.columnAbsolute ? column : column - cell.column();
+}
+
+} // namespace
+
+SheetShift::SheetShift(Axis axis, int first, int count)
+    : m_axis(axis), m_first(first), m_count(count),
+      m_limit(axis == Rows ? XLSX_ROW_MAX : XLSX_COLUMN_MAX)
+{
+}
+
+/*!
+ * \internal
+ * Returns the new position of the row or column \a index, or -1 when it
+ * was deleted or pushed off the sheet.
+ */
+int SheetShift::shifted(int index) const
+{
+    if (index < m_first)
+        return index;
+    if (m_count > 0)
+        return index + m_count <= m_limit ? index + m_count : -1;
+    if (index < m_first - m_count)
+        return -1;
+    return index + m_count;
+}
+
+/*!
+ * \internal
+ * Moves the span from \a first to \a last. Insertions inside the span widen
+ * it, deletions shrink it. Returns false when nothing is left of it.
+ */
+bool SheetShift::shiftSpan(int &first, int &last) const
+{
+    if (m_count > 0) {
+        if (first >= m_first)
+            first += m_count;
+        if (last >= m_first)
+            last = qMin(last + m_count, m_limit);
+        return first <= m_limit;
+    }
+
+    const int end = m_first - m_count; //first one kept after the deleted ones
+    if (first >= m_first && last < end)
+        return false;
+    first = first < m_first ? first : (first < end ? m_first : first + m_count);
+    last = last < m_first ? last : (last < end ? m_first - 1 : last + m_count);
+    return true;
+}
+
+CellReference SheetShift::shifted(const CellReference &cell) const
+{
+    if (m_axis == Rows) {
+        const int row = shifted(cell.row());
+        return row == -1 ? CellReference() : CellReference(row, cell.column());
+    }
+    const int column = shifted(cell.column());
+    return column == -1 ? CellReference() : CellReference(cell.row(), column);
+}
+
+/*!
+ * \internal
+ * Returns the moved \a range, or an invalid one when it was deleted.
+ */
+CellRange SheetShift::shifted(const CellRange &range) const
+{
+    if (!range.isValid())
+        return range;
+
+    if (m_axis == Rows) {
+        int first = range.firstRow();
+        int last = range.lastRow();
+        if (!shiftSpan(first, last))
+            return CellRange();
+        return CellRange(first, range.firstColumn(), last, range.lastColumn());
+    }
+    int first = range.firstColumn();
+    int last = range.lastColumn();
+    if (!shiftSpan(first, last))
+        return CellRange();
+    return CellRange(range.firstRow(), first, range.lastRow(), last);
+}
+
+/*!
+ * \internal
+ * Returns \a formula, held by \a oldCell and moved to \a newCell, with its
+ * references to the sheet named \a sheetName moved along. References
+ * without a sheet name are to that sheet when \a onSheet is true. Deleted
+ * references become #REF!, the rest of the text is kept as it is.
+ */
+QString SheetShift::shiftedFormula(const QString &formula, const CellReference &oldCell, const CellReference &newCell,
+                                   const QString &sheetName, bool onSheet) const
+{
+    QVector<FormulaToken> tokens;
+    if (!FormulaTokenizer::tokenize(formula, oldCell, tokens))
+        return formula;
+
+    QString text;
+    int position = 0;
+    for (const FormulaToken &token : tokens) {
+        if (token.type != FormulaToken::Reference || !isSheet(token.sheet, sheetName, onSheet))
+            continue;
+
+        int firstRow = token.first.resolvedRow(oldCell);
+        int firstColumn = token.first.resolvedColumn(oldCell);
+        int lastRow = token.last.resolvedRow(oldCell);
+        int lastColumn = token.last.resolvedColumn(oldCell);
+        bool kept = true;
+        if (m_axis == Rows && token.refKind != FormulaToken::ColumnsRef)
+            kept = shiftSpan(firstRow, lastRow);
+        else if (m_axis == Columns && token.refKind != FormulaToken::RowsRef)
+            kept = shiftSpan(firstColumn, lastColumn);
+
+        QString replacement;
+        if (!kept) {
+            replacement = token.sheet.isEmpty() ? QStringLiteral("#REF!") : token.sheet + QLatin1String("!#REF!");
+        } else {
+            FormulaToken moved = token;
+            setRow(moved.first, firstRow, newCell);
+            setColumn(moved.first, firstColumn, newCell);
+            setRow(moved.last, lastRow, newCell);
+            setColumn(moved.last, lastColumn, newCell);
+            if (firstRow == token.first.resolvedRow(oldCell) && lastRow == token.last.resolvedRow(oldCell)
+                    && firstColumn == token.first.resolvedColumn(oldCell)
+                    && lastColumn == token.last.resolvedColumn(oldCell))
+                continue;
+            replacement = ParsedFormula::referenceText(moved, newCell);
+        }
+
+        text.append(formula.constData() + position, token.position - position);
+        text += replacement;
+        position = token.position + token.length;
+    }
+
+    if (position == 0)
+        return formula;
+    text.append(formula.constData() + position, formula.size() - position);
+    return text;
+}
+
+/*!
+ * \internal
+ * Returns whether \a formula refers to cells of the sheet \a sheetName.
+ */
+bool SheetShift::refersToSheet(const QString &formula, const QString &sheetName, bool onSheet)
+{
+    QVector<FormulaToken> tokens;
+    if (!FormulaTokenizer::tokenize(formula, CellReference(1, 1), tokens))
+        return false;
+    for (const FormulaToken &token : tokens) {
+        if (token.type == FormulaToken::Reference && isSheet(token.sheet, sheetName, onSheet))
+            return true;
+    }
+    return false;
+}
+
+QT_END_NAMESPACE_XLSX
@@ -8,6 +8,7 @@
 #include <QDataStream>
 #include <QDebug>
 #include <QBuffer>
+#include <QMutexLocker>
 
 #include "xlsxglobal.h"
 #include "xlsxstyles_p.h"
@@ -86,6 +87,90 @@ Format Styles::xfFormat(int idx) const
     return m_xf_formatsList[idx];
 }
 
+/*!
+ * \internal
+ * Registers \a format and returns the handle of its xf. An invalid or
+ * empty format gives an invalid handle, which means no style at all.
+ */
+StyleId Styles::intern(const Format &format)
+{
+    if (!format.isValid() || format.isEmpty())
+        return StyleId();
+
+    addXfFormat(format);
+    return StyleId(format.xfIndex());
+}
+
+/*!
+ * \internal
+ * Returns the kind of the number format used by the xf \a idx. The kind is
+ * computed once when the xf is registered, so this is a plain lookup.
+ */
+NumFormatParser::Kind Styles::xfNumberKind(int idx) const
+{
+    if (idx < 0 || idx >= m_xfNumberKinds.size())
+        return NumFormatParser::NumberKind;
+
+    return NumFormatParser::Kind(m_xfNumberKinds[idx]);
+}
+
+/*!
+ * \internal
+ * Returns whether the xf \a idx has a date, time or datetime number format.
+ */
+bool Styles::isDateTimeXf(int idx) const
+{
+    const NumFormatParser::Kind kind = xfNumberKind(idx);
+    return kind == NumFormatParser::DateKind
+            || kind == NumFormatParser::TimeKind
+            || kind == NumFormatParser::DateTimeKind;
+}
+
+/*!
+ * \internal
+ * Returns the compiled number format of the xf \a idx. Formatters are
+ * cached by numFmt id, so each format code is compiled only once. The cache
+ * is locked, the function can be called from several threads as long as no
+ * xf is being added.
+ */
+QSharedPointer<const NumberFormatter> Styles::numberFormatter(int idx) const
+{
+    const Format format = xfFormat(idx);
+    int id = 0;
+    if (format.hasProperty(FormatPrivate::P_NumFmt_Id))
+        id = format.numberFormatIndex();
+    else if (format.hasProperty(FormatPrivate::P_NumFmt_FormatCode))
+        id = -1;
+
+    if (id < 0)
+        return QSharedPointer<const NumberFormatter>(new NumberFormatter(numberFormatCode(format)));
+
+    QMutexLocker locker(&m_numberFormattersMutex);
+    const auto it = m_numberFormatters.constFind(id);
+    if (it != m_numberFormatters.constEnd())
+        return it.value();
+
+    QSharedPointer<const NumberFormatter> formatter(new NumberFormatter(numberFormatCode(format)));
+    m_numberFormatters.insert(id, formatter);
+    return formatter;
+}
+
+/*!
+ * \internal
+ * Returns the format code of \a format, the one of its builtin numFmt when
+ * it has no code of its own. Unlike numberFormatter(), nothing is cached,
+ * so it can be called from any thread.
+ */
+QString Styles::numberFormatCode(const Format &format)
+{
+    if (format.hasProperty(FormatPrivate::P_NumFmt_FormatCode))
+        return format.numberFormat();
+    int id = 0;
+    if (format.hasProperty(FormatPrivate::P_NumFmt_Id))
+        id = format.numberFormatIndex();
+    return NumberFormatter::builtinFormatCode(id);
+}
+
 Format Styles::dxfFormat(int idx) const
 {
     if (idx <0 || idx >= m_dxf_formatsList.size())
@@ -94,6 +179,15 @@ Format Styles::dxfFormat(int idx) const
     return m_dxf_formatsList[idx];
 }
 
+NumFormatParser::Kind Styles::numberKind(const Format &format)
+{
+    if (format.hasProperty(FormatPrivate::P_NumFmt_FormatCode))
+        return NumFormatParser::kind(format.numberFormat());
+    if (format.hasProperty(FormatPrivate::P_NumFmt_Id))
+        return NumFormatParser::builtinKind(format.numberFormatIndex());
+    return NumFormatParser::NumberKind;
+}
+
 // dev74 issue#57
 void Styles::fixNumFmt(const Format &format)
 {
@@ -236,7 +330,8 @@ void Styles::addXfFormat(const Format &format, bool force)
     }
 
     //Font
-    const auto& fontIt = m_fontsHash.constFind(format.fontKey());
+    const auto fontIt = findFormat(m_fontsHash, format.fontKey(), format,
+                                   FormatPrivate::P_Font_STARTID, FormatPrivate::P_Font_ENDID);
     if (format.hasFontData() && !format.fontIndexValid())
     {
         //Assign proper font index, if has font data.
@@ -253,7 +348,8 @@ void Styles::addXfFormat(const Format &format, bool force)
     }
 
     //Fill
-    const auto& fillIt = m_fillsHash.constFind(format.fillKey());
+    const auto fillIt = findFormat(m_fillsHash, format.fillKey(), format,
+                                   FormatPrivate::P_Fill_STARTID, FormatPrivate::P_Fill_ENDID);
     if (format.hasFillData() && !format.fillIndexValid()) {
         //Assign proper fill index, if has fill data.
         if (fillIt == m_fillsHash.constEnd())
@@ -268,7 +364,8 @@ void Styles::addXfFormat(const Format &format, bool force)
     }
 
     //Border
-    const auto& borderIt = m_bordersHash.constFind(format.borderKey());
+    const auto borderIt = findFormat(m_bordersHash, format.borderKey(), format,
+                                     FormatPrivate::P_Border_STARTID, FormatPrivate::P_Border_ENDID);
     if (format.hasBorderData() && !format.borderIndexValid()) {
         //Assign proper border index, if has border data.
         if (borderIt == m_bordersHash.constEnd())
@@ -283,7 +380,8 @@ void Styles::addXfFormat(const Format &format, bool force)
     }
 
     //Format
-    const auto& formatIt = m_xf_formatsHash.constFind(format.formatKey());
+    const auto formatIt = findFormat(m_xf_formatsHash, format.formatKey(), format,
+                                     FormatPrivate::P_STARTID, FormatPrivate::P_ENDID);
     if (!format.isEmpty() && !format.xfIndexValid())
     {
         if (formatIt == m_xf_formatsHash.constEnd())
@@ -297,9 +395,26 @@ void Styles::addXfFormat(const Format &format, bool force)
     {
         m_xf_formatsList.append(format);
         m_xf_formatsHash[format.formatKey()] = format;
+        m_xfNumberKinds.append(quint8(numberKind(format)));
     }
 }
 
+/*
+ * The format keys are 64-bit hashes, so a hit is only trusted when the
+ * stored format carries the same properties in [startId, endId).
+ */
+QHash<quint64, Format>::const_iterator Styles::findFormat(const QHash<quint64, Format> &hash, quint64 key,
+                                                          const Format &format, int startId, int endId)
+{
+    const auto it = hash.constFind(key);
+    if (it == hash.constEnd() || key == 0)
+        return it;
+
+    if (!it->d->equalRange(*format.d, startId, endId))
+        return hash.constEnd();
+    return it;
+}
+
 void Styles::addDxfFormat(const Format &format, bool force)
 {
     //numFmt
@@ -308,7 +423,8 @@ void Styles::addDxfFormat(const Format &format, bool force)
         fixNumFmt(format);
     }
 
-    const auto& formatIt = m_dxf_formatsHash.constFind(format.formatKey());
+    const auto formatIt = findFormat(m_dxf_formatsHash, format.formatKey(), format,
+                                     FormatPrivate::P_STARTID, FormatPrivate::P_ENDID);
     if ( !format.isEmpty() &&
             !format.dxfIndexValid() )
     {
@@ -322,7 +438,7 @@ void Styles::addDxfFormat(const Format &format, bool force)
         }
     }
 
-    if (formatIt == m_xf_formatsHash.constEnd() ||
+    if (formatIt == m_dxf_formatsHash.constEnd() ||
          force )
     {
         m_dxf_formatsList.append(format);
@@ -330,6 +446,121 @@ void Styles::addDxfFormat(const Format &format, bool force)
     }
 }
 
+static QVector<int> compactIndexes(const QVector<bool> &used)
+{
+    QVector<int> map(used.size(), -1);
+    int next = 0;
+    for (int i = 0; i < used.size(); ++i) {
+        if (used[i])
+            map[i] = next++;
+    }
+    return map;
+}
+
+static inline int savedIndex(const QVector<int> &map, int idx)
+{
+    if (map.isEmpty() || idx < 0 || idx >= map.size())
+        return idx;
+    return map[idx] >= 0 ? map[idx] : 0;
+}
+
+/*!
+ * \internal
+ * Prepares the next save to only write the xfs in \a usedXfIndexes, plus
+ * the default one, and the fonts, fills, borders and number formats they
+ * use. Equal xfs are written once. The worksheets must map their style
+ * indexes through savedXfIndex() until clearPruning() is called.
+ */
+void Styles::pruneUnusedStyles(const QSet<int> &usedXfIndexes)
+{
+    const int xfCount = m_xf_formatsList.size();
+
+    //Loaded duplicates keep the xf index of the first equal format.
+    QVector<int> canonical(xfCount);
+    int firstEmpty = -1;
+    for (int i = 0; i < xfCount; ++i) {
+        const Format &format = m_xf_formatsList[i];
+        if (format.isEmpty()) {
+            if (firstEmpty == -1)
+                firstEmpty = i;
+            canonical[i] = firstEmpty;
+        } else {
+            const int idx = format.xfIndex();
+            canonical[i] = (format.xfIndexValid() && idx >= 0 && idx < i) ? idx : i;
+        }
+    }
+
+    QVector<bool> keepXf(xfCount, false);
+    if (xfCount > 0)
+        keepXf[0] = true;
+    for (int idx : usedXfIndexes) {
+        if (idx >= 0 && idx < xfCount)
+            keepXf[canonical[idx]] = true;
+    }
+
+    QVector<bool> keepFont(m_fontsList.size(), false);
+    QVector<bool> keepFill(m_fillsList.size(), false);
+    QVector<bool> keepBorder(m_bordersList.size(), false);
+    //Excel expects the default font and border and the two default fills.
+    if (!keepFont.isEmpty())
+        keepFont[0] = true;
+    for (int i = 0; i < keepFill.size() && i < 2; ++i)
+        keepFill[i] = true;
+    if (!keepBorder.isEmpty())
+        keepBorder[0] = true;
+
+    m_usedNumFmtIds.clear();
+    for (int i = 0; i < xfCount; ++i) {
+        if (!keepXf[i])
+            continue;
+        const Format &format = m_xf_formatsList[i];
+        if (format.fontIndex() < keepFont.size())
+            keepFont[format.fontIndex()] = true;
+        if (format.fillIndex() < keepFill.size())
+            keepFill[format.fillIndex()] = true;
+        if (format.borderIndex() < keepBorder.size())
+            keepBorder[format.borderIndex()] = true;
+        if (format.hasNumFmtData())
+            m_usedNumFmtIds.insert(format.numberFormatIndex());
+    }
+    for (const Format &format : m_dxf_formatsList) {
+        if (format.hasNumFmtData())
+            m_usedNumFmtIds.insert(format.numberFormatIndex());
+    }
+
+    m_xfSaveMap = compactIndexes(keepXf);
+    for (int i = 0; i < xfCount; ++i) {
+        if (!keepXf[i])
+            m_xfSaveMap[i] = m_xfSaveMap[canonical[i]];
+    }
+    m_fontSaveMap = compactIndexes(keepFont);
+    m_fillSaveMap = compactIndexes(keepFill);
+    m_borderSaveMap = compactIndexes(keepBorder);
+}
+
+/*!
+ * \internal
+ * Makes the following saves write all the styles again.
+ */
+void Styles::clearPruning()
+{
+    m_xfSaveMap.clear();
+    m_fontSaveMap.clear();
+    m_fillSaveMap.clear();
+    m_borderSaveMap.clear();
+    m_usedNumFmtIds.clear();
+}
+
+/*!
+ * \internal
+ * Returns the index under which the xf \a xfIndex is written by the
+ * current save.
+ */
+int Styles::savedXfIndex(int xfIndex) const
+{
+    return savedIndex(m_xfSaveMap, xfIndex);
+}
+
 void Styles::saveToXmlFile(QIODevice *device) const
 {
     QXmlStreamWriter writer(device);
@@ -380,15 +611,27 @@ void Styles::saveToXmlFile(QIODevice *device) const
 
 void Styles::writeNumFmts(QXmlStreamWriter &writer) const
 {
-    if (m_customNumFmtIdMap.size() == 0)
+    const bool pruned = !m_xfSaveMap.isEmpty();
+    int count = m_customNumFmtIdMap.size();
+    if (pruned) {
+        count = 0;
+        for (auto it = m_customNumFmtIdMap.constBegin(); it != m_customNumFmtIdMap.constEnd(); ++it) {
+            if (m_usedNumFmtIds.contains(it.key()))
+                ++count;
+        }
+    }
+
+    if (count == 0)
         return;
 
     writer.writeStartElement(QStringLiteral("numFmts"));
-    writer.writeAttribute(QStringLiteral("count"), QString::number(m_customNumFmtIdMap.count()));
+    writer.writeAttribute(QStringLiteral("count"), QString::number(count));
 
     QMapIterator<int, QSharedPointer<XlsxFormatNumberData> > it(m_customNumFmtIdMap);
     while (it.hasNext()) {
         it.next();
+        if (pruned && !m_usedNumFmtIds.contains(it.key()))
+            continue;
         writer.writeEmptyElement(QStringLiteral("numFmt"));
         writer.writeAttribute(QStringLiteral("numFmtId"), QString::number(it.value()->formatIndex));
         writer.writeAttribute(QStringLiteral("formatCode"), it.value()->formatString);
@@ -401,9 +644,11 @@ void Styles::writeNumFmts(QXmlStreamWriter &writer) const
 void Styles::writeFonts(QXmlStreamWriter &writer) const
 {
     writer.writeStartElement(QStringLiteral("fonts"));
-    writer.writeAttribute(QStringLiteral("count"), QString::number(m_fontsList.count()));
-    for (const auto &font : m_fontsList) {
-        writeFont(writer, font, false);
+    writer.writeAttribute(QStringLiteral("count"), QString::number(m_fontSaveMap.isEmpty()
+                          ? m_fontsList.count() : int(m_fontSaveMap.count() - m_fontSaveMap.count(-1))));
+    for (int i = 0; i < m_fontsList.size(); ++i) {
+        if (m_fontSaveMap.isEmpty() || m_fontSaveMap[i] >= 0)
+            writeFont(writer, m_fontsList[i], false);
     }
     writer.writeEndElement();//fonts
 }
@@ -492,10 +737,12 @@ void Styles::writeFont(QXmlStreamWriter &writer, const Format &format, bool isDx
 void Styles::writeFills(QXmlStreamWriter &writer) const
 {
     writer.writeStartElement(QStringLiteral("fills"));
-    writer.writeAttribute(QStringLiteral("count"), QString::number(m_fillsList.size()));
+    writer.writeAttribute(QStringLiteral("count"), QString::number(m_fillSaveMap.isEmpty()
+                          ? m_fillsList.size() : int(m_fillSaveMap.count() - m_fillSaveMap.count(-1))));
 
-    for (const auto &fill : m_fillsList) {
-        writeFill(writer, fill);
+    for (int i = 0; i < m_fillsList.size(); ++i) {
+        if (m_fillSaveMap.isEmpty() || m_fillSaveMap[i] >= 0)
+            writeFill(writer, m_fillsList[i]);
     }
 
     writer.writeEndElement(); //fills
@@ -552,10 +799,12 @@ void Styles::writeFill(QXmlStreamWriter &writer, const Format &fill, bool isDxf)
 void Styles::writeBorders(QXmlStreamWriter &writer) const
 {
     writer.writeStartElement(QStringLiteral("borders"));
-    writer.writeAttribute(QStringLiteral("count"), QString::number(m_bordersList.count()));
+    writer.writeAttribute(QStringLiteral("count"), QString::number(m_borderSaveMap.isEmpty()
+                          ? m_bordersList.count() : int(m_borderSaveMap.count() - m_borderSaveMap.count(-1))));
 
-    for (const auto &border : m_bordersList) {
-        writeBorder(writer, border);
+    for (int i = 0; i < m_bordersList.size(); ++i) {
+        if (m_borderSaveMap.isEmpty() || m_borderSaveMap[i] >= 0)
+            writeBorder(writer, m_bordersList[i]);
     }
 
     writer.writeEndElement();//borders
@@ -626,15 +875,30 @@ void Styles::writeSubBorder(QXmlStreamWriter &writer, const QString &type, int s
 
 void Styles::writeCellXfs(QXmlStreamWriter &writer) const
 {
+    //When pruning, only the xfs which are the target of their own index are written.
+    int count = 0;
+    for (int i = 0; i < m_xf_formatsList.size(); ++i) {
+        if (m_xfSaveMap.isEmpty() || m_xfSaveMap[i] == count)
+            ++count;
+    }
+
     writer.writeStartElement(QStringLiteral("cellXfs"));
-    writer.writeAttribute(QStringLiteral("count"), QString::number(m_xf_formatsList.size()));
-    for (const Format &format : m_xf_formatsList) {
+    writer.writeAttribute(QStringLiteral("count"), QString::number(count));
+    int written = 0;
+    for (int i = 0; i < m_xf_formatsList.size(); ++i) {
+        if (!m_xfSaveMap.isEmpty()) {
+            if (m_xfSaveMap[i] != written)
+                continue;
+            ++written;
+        }
+
+        const Format &format = m_xf_formatsList[i];
         int xf_id = 0;
         writer.writeStartElement(QStringLiteral("xf"));
         writer.writeAttribute(QStringLiteral("numFmtId"), QString::number(format.numberFormatIndex()));
-        writer.writeAttribute(QStringLiteral("fontId"), QString::number(format.fontIndex()));
-        writer.writeAttribute(QStringLiteral("fillId"), QString::number(format.fillIndex()));
-        writer.writeAttribute(QStringLiteral("borderId"), QString::number(format.borderIndex()));
+        writer.writeAttribute(QStringLiteral("fontId"), QString::number(savedIndex(m_fontSaveMap, format.fontIndex())));
+        writer.writeAttribute(QStringLiteral("fillId"), QString::number(savedIndex(m_fillSaveMap, format.fillIndex())));
+        writer.writeAttribute(QStringLiteral("borderId"), QString::number(savedIndex(m_borderSaveMap, format.borderIndex())));
         writer.writeAttribute(QStringLiteral("xfId"), QString::number(xf_id));
         if (format.hasNumFmtData())
             writer.writeAttribute(QStringLiteral("applyNumberFormat"), QStringLiteral("1"));
@@ -14,6 +14,7 @@
 #include <QStringList>
 #include <QColor>
 #include <QDateTime>
+#include <QVector>
 #include <QDebug>
 
 #include <cmath>
@@ -60,72 +61,192 @@ QString getRelFilePath(const QString &filePath)
     return ret;
 }
 
-double datetimeToNumber(const QDateTime &dt, bool is1904)
-{
-    //Note, for number 0, Excel2007 shown as 1900-1-0, which should be 1899-12-31
-    QDateTime epoch(is1904 ? QDate(1904, 1, 1): QDate(1899, 12, 31), QTime(0,0));
+namespace {
 
-    double excel_time = epoch.msecsTo(dt) / (1000*60*60*24.0);
+const qint64 msecsPerDay = Q_INT64_C(86400000);
+const qint64 epoch1900 = -25569; // 1899-12-30, in days since 1970-01-01
+const qint64 epoch1904 = -24107; // 1904-01-01
+const double maxSerial = 2958466; // 10000-01-01
 
-#if QT_VERSION >= 0x050200
-    if (dt.isDaylightTime())    // Add one hour if the date is Daylight
-        excel_time += 1.0 / 24.0;
-#endif
+// Splits \a num into a date and a time of day, with millisecond precision.
+// Excel's day 0 and its 1900-02-29 don't exist in QDate, they are read as
+// the day before.
+bool splitSerial(double num, bool is1904, QDate &date, QTime &time)
+{
+    if (!std::isfinite(num) || num < 0 || num >= maxSerial)
+        return false;
 
-    if (!is1904 && excel_time > 59) {//31+28
-        //Account for Excel erroneously treating 1900 as a leap year.
-        excel_time += 1;
-    }
+    const qint64 msecs = qRound64(num * msecsPerDay);
+    int year, month, day;
+    civilFromSerial(msecs / msecsPerDay, is1904, year, month, day);
+    if (day == 0)
+        date = QDate(1899, 12, 31);
+    else if (year == 1900 && month == 2 && day == 29)
+        date = QDate(1900, 2, 28);
+    else
+        date = QDate(year, month, day);
+    time = QTime(0, 0).addMSecs(int(msecs % msecsPerDay));
+    return true;
+}
+
+} // namespace
 
-    return excel_time;
+/*
+ * Days from 1970-01-01 to the proleptic Gregorian date, counted without
+ * any calendar or time zone lookup.
+ */
+qint64 daysFromCivil(int year, int month, int day)
+{
+    const qint64 y = month <= 2 ? year - 1 : year;
+    const qint64 era = (y >= 0 ? y : y - 399) / 400;
+    const qint64 yearOfEra = y - era * 400;
+    const qint64 dayOfYear = (153 * (month + (month > 2 ? -3 : 9)) + 2) / 5 + day - 1;
+    const qint64 dayOfEra = yearOfEra * 365 + yearOfEra / 4 - yearOfEra / 100 + dayOfYear;
+    return era * 146097 + dayOfEra - 719468;
 }
 
-double timeToNumber(const QTime &time)
+void civilFromDays(qint64 days, int &year, int &month, int &day)
 {
-    return QTime(0,0).msecsTo(time) / (1000*60*60*24.0);
+    days += 719468;
+    const qint64 era = (days >= 0 ? days : days - 146096) / 146097;
+    const qint64 dayOfEra = days - era * 146097;
+    const qint64 yearOfEra = (dayOfEra - dayOfEra / 1460 + dayOfEra / 36524 - dayOfEra / 146096) / 365;
+    const qint64 dayOfYear = dayOfEra - (365 * yearOfEra + yearOfEra / 4 - yearOfEra / 100);
+    const qint64 mp = (5 * dayOfYear + 2) / 153;
+    day = int(dayOfYear - (153 * mp + 2) / 5 + 1);
+    month = int(mp < 10 ? mp + 3 : mp - 9);
+    year = int(yearOfEra + era * 400 + (month <= 2 ? 1 : 0));
 }
 
-QVariant datetimeFromNumber(double num, bool is1904)
+/*
+ * The serial number of a date. The 1900 date system keeps Excel's
+ * fictitious 1900-02-29, serial 60: dates before it are one day lower.
+ */
+double serialFromCivil(int year, int month, int day, bool is1904)
 {
-    QDateTime dtRet; // return value
+    const qint64 days = daysFromCivil(year, month, day);
+    if (is1904)
+        return double(days - epoch1904);
+    const qint64 serial = days - epoch1900;
+    return double(serial <= 60 ? serial - 1 : serial);
+}
 
-    if (!is1904 && num > 60) // for mac os excel
-    {
-        num = num - 1;
+/*
+ * The date of the day serial \a serial. The 1900 date system gives Excel's
+ * day 0, 1900-01-00, and 1900-02-29 for serial 60.
+ */
+void civilFromSerial(qint64 serial, bool is1904, int &year, int &month, int &day)
+{
+    if (is1904) {
+        civilFromDays(epoch1904 + serial, year, month, day);
+    } else if (serial == 0) {
+        year = 1900;
+        month = 1;
+        day = 0;
+    } else if (serial == 60) {
+        year = 1900;
+        month = 2;
+        day = 29;
+    } else {
+        civilFromDays(epoch1900 + (serial < 60 ? serial + 1 : serial), year, month, day);
     }
+}
 
-    qint64 msecs = static_cast<qint64>(num * 1000*60*60*24.0 + 0.5);
-    QDateTime epoch(is1904 ? QDate(1904, 1, 1): QDate(1899, 12, 31), QTime(0,0));
-    QDateTime dtOld = epoch.addMSecs(msecs);
-    dtRet = dtOld;
+double dateToNumber(const QDate &date, bool is1904)
+{
+    if (!date.isValid())
+        return 0;
+    int year, month, day;
+    date.getDate(&year, &month, &day);
+    return serialFromCivil(year, month, day, is1904);
+}
 
-#if QT_VERSION >= 0x050200
-    // Remove one hour to see whether the date is Daylight
-    QDateTime dtNew = dtRet.addMSecs( -3600000 ); // issue102
-    if ( dtNew.isDaylightTime() )
-    {
-        dtRet = dtNew;
-    }
-#endif
+/*
+ * The wall clock date and time of \a dt are converted, whatever its time
+ * spec: there is no time zone or daylight saving time adjustment.
+ */
+double datetimeToNumber(const QDateTime &dt, bool is1904)
+{
+    if (!dt.isValid())
+        return 0;
+    return dateToNumber(dt.date(), is1904) + timeToNumber(dt.time());
+}
 
-    double whole = 0;
-    double fractional = std::modf(num, &whole);
+double timeToNumber(const QTime &time)
+{
+    return QTime(0,0).msecsTo(time) / (1000*60*60*24.0);
+}
+
+/*
+ * Returns a QTime for numbers below 1, a QDate for whole numbers and a
+ * QDateTime, in local time, for the others.
+ */
+QVariant datetimeFromNumber(double num, bool is1904)
+{
+    QDate date;
+    QTime time;
+    if (!splitSerial(num, is1904, date, time))
+        return QVariant();
 
     if ( num < double(1) )
     {
         // only time
-        QTime t = dtRet.time();
-        return QVariant(t);
+        return QVariant(time);
     }
 
-    if ( fractional == 0.0 )
+    double whole = 0;
+    if ( std::modf(num, &whole) == 0.0 )
     {
         // only date
-        QDate onlyDT = dtRet.date();
-        return QVariant(onlyDT);
+        return QVariant(date);
     }
 
-    return QVariant(dtRet);
+    return QVariant(QDateTime(date, time));
+}
+
+QDateTime datetimeFromSerial(double num, bool is1904, Qt::TimeSpec spec)
+{
+    QDate date;
+    QTime time;
+    if (!splitSerial(num, is1904, date, time))
+        return QDateTime();
+    return QDateTime(date, time, spec);
+}
+
+QVector<double> datetimesToNumbers(const QVector<QDateTime> &dateTimes, bool is1904)
+{
+    QVector<double> numbers;
+    numbers.reserve(dateTimes.size());
+    for (const QDateTime &dt : dateTimes)
+        numbers.append(datetimeToNumber(dt, is1904));
+    return numbers;
+}
+
+/*
+ * Consecutive numbers often fall on the same day, its date is then
+ * converted once.
+ */
+QVector<QDateTime> datetimesFromNumbers(const QVector<double> &numbers, bool is1904, Qt::TimeSpec spec)
+{
+    QVector<QDateTime> dateTimes;
+    dateTimes.reserve(numbers.size());
+    qint64 lastDay = -1;
+    QDate lastDate;
+    for (double num : numbers) {
+        if (!std::isfinite(num) || num < 0 || num >= maxSerial) {
+            dateTimes.append(QDateTime());
+            continue;
+        }
+        const qint64 msecs = qRound64(num * msecsPerDay);
+        const qint64 day = msecs / msecsPerDay;
+        if (day != lastDay) {
+            QTime time;
+            splitSerial(double(day), is1904, lastDate, time);
+            lastDay = day;
+        }
+        dateTimes.append(QDateTime(lastDate, QTime(0, 0).addMSecs(int(msecs % msecsPerDay)), spec));
+    }
+    return dateTimes;
 }
 
 /*
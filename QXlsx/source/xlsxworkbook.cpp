@@ -24,7 +24,7 @@
 QT_BEGIN_NAMESPACE_XLSX
 
 WorkbookPrivate::WorkbookPrivate(Workbook *q, Workbook::CreateFlag flag) :
-    AbstractOOXmlFilePrivate(q, flag)
+    AbstractOOXmlFilePrivate(q, flag), formulaEngine(q)
 {
     sharedStrings = QSharedPointer<SharedStrings> (new SharedStrings(flag));
     styles = QSharedPointer<Styles>(new Styles(flag));
@@ -38,11 +38,14 @@ WorkbookPrivate::WorkbookPrivate(Workbook *q, Workbook::CreateFlag flag) :
     strings_to_numbers_enabled = false;
     strings_to_hyperlinks_enabled = true;
     html_to_richstring_enabled = false;
+    unused_styles_pruning_enabled = false;
+    parallel_calculation_enabled = true;
     date1904 = false;
     defaultDateFormat = QStringLiteral("yyyy-mm-dd");
     activesheetIndex = 0;
     firstsheet = 0;
     table_count = 0;
+    mediaHashed = 0;
 
     last_worksheet_index = 0;
     last_chartsheet_index = 0;
@@ -79,6 +82,7 @@ void Workbook::setDate1904(bool date1904)
 {
     Q_D(Workbook);
     d->date1904 = date1904;
+    d->formulaEngine.invalidate();
 }
 
 /*
@@ -124,6 +128,43 @@ bool Workbook::isHtmlToRichStringEnabled() const
     return d->html_to_richstring_enabled;
 }
 
+/*
+  Drop the cell formats which no cell, row or column refers to when
+  saving, together with the fonts, fills, borders and number formats
+  only they used. Duplicated formats are written once.
+
+  The default is false
+ */
+void Workbook::setUnusedStylesPruningEnabled(bool enable)
+{
+    Q_D(Workbook);
+    d->unused_styles_pruning_enabled = enable;
+}
+
+bool Workbook::isUnusedStylesPruningEnabled() const
+{
+    Q_D(const Workbook);
+    return d->unused_styles_pruning_enabled;
+}
+
+/*
+  Evaluate large batches of independent formulas on the threads of
+  QThreadPool::globalInstance() when calculating.
+
+  The default is true
+ */
+void Workbook::setParallelCalculationEnabled(bool enable)
+{
+    Q_D(Workbook);
+    d->parallel_calculation_enabled = enable;
+}
+
+bool Workbook::isParallelCalculationEnabled() const
+{
+    Q_D(const Workbook);
+    return d->parallel_calculation_enabled;
+}
+
 QString Workbook::defaultDateFormat() const
 {
     Q_D(const Workbook);
@@ -164,6 +205,7 @@ bool Workbook::defineName(const QString &name, const QString &formula, const QSt
     }
 
     d->definedNamesList.append(XlsxDefineNameData(name, formulaString, comment, id));
+    d->formulaEngine.invalidate();
     return true;
 }
 
@@ -212,6 +254,7 @@ AbstractSheet *Workbook::addSheet(const QString &name, int sheetId, AbstractShee
 
     d->sheets.append(QSharedPointer<AbstractSheet>(sheet));
     d->sheetNames.append(name);
+    d->formulaEngine.invalidate();
 
     return sheet;
 }
@@ -266,6 +309,7 @@ AbstractSheet *Workbook::insertSheet(int index, const QString &name, AbstractShe
     d->sheets.insert(index, QSharedPointer<AbstractSheet>(sheet));
     d->sheetNames.insert(index, sheetName);
     d->activesheetIndex = index;
+    d->formulaEngine.invalidate();
 
     return sheet;
 }
@@ -310,6 +354,7 @@ bool Workbook::renameSheet(int index, const QString &newName)
 
     d->sheets[index]->setSheetName(name);
     d->sheetNames[index] = name;
+    d->formulaEngine.invalidate();
     return true;
 }
 
@@ -325,6 +370,7 @@ bool Workbook::deleteSheet(int index)
         return false;
     d->sheets.removeAt(index);
     d->sheetNames.removeAt(index);
+    d->formulaEngine.invalidate();
     return true;
 }
 
@@ -375,6 +421,7 @@ bool Workbook::copySheet(int index, const QString &newName)
     AbstractSheet *sheet = d->sheets[index]->copy(worksheetName, d->last_sheet_id);
     d->sheets.append(QSharedPointer<AbstractSheet> (sheet));
     d->sheetNames.append(sheet->sheetName());
+    d->formulaEngine.invalidate();
 
     return true; // #162
 }
@@ -411,6 +458,18 @@ Styles *Workbook::styles()
     return d->styles.data();
 }
 
+FormulaCache *Workbook::formulaCache()
+{
+    Q_D(Workbook);
+    return &d->formulaCache;
+}
+
+FormulaEngine *Workbook::formulaEngine()
+{
+    Q_D(Workbook);
+    return &d->formulaEngine;
+}
+
 Theme *Workbook::theme()
 {
     Q_D(Workbook);
@@ -711,11 +770,44 @@ void Workbook::addMediaFile(QSharedPointer<MediaFile> media, bool force)
 
     if (!force)
     {
-        for (int i=0; i<d->mediaFiles.size(); ++i)
+        //Files loaded from the package get their contents after being added,
+        //they are hashed on the next lookup. The ones still in the package
+        //are only read when their size matches. Indexing stops at the first
+        //image still being encoded, isPending() takes over the bytes of the
+        //finished ones so that the next lookup goes on from there.
+        for (; d->mediaHashed < d->mediaFiles.size(); ++d->mediaHashed) {
+            const MediaFile *file = d->mediaFiles[d->mediaHashed].data();
+            if (file->isPending())
+                break;
+            if (file->isInPackage())
+                d->mediaSizes.insert(file->size(), d->mediaHashed);
+            else if (!d->mediaHashes.contains(file->hashKey()))
+                d->mediaHashes.insert(file->hashKey(), d->mediaHashed);
+        }
+
+        auto it = d->mediaHashes.constFind(media->hashKey());
+        if (it != d->mediaHashes.constEnd())
         {
-            if (d->mediaFiles[i]->hashKey() == media->hashKey())
+            const MediaFile *existing = d->mediaFiles[it.value()].data();
+            if (existing->hashKey() == media->hashKey() && existing->contents() == media->contents())
             {
-                media->setIndex(i);
+                media->setIndex(it.value());
+                return;
+            }
+        }
+
+        const qint64 size = media->size();
+        auto candidate = d->mediaSizes.find(size);
+        while (candidate != d->mediaSizes.end() && candidate.key() == size)
+        {
+            const int position = candidate.value();
+            candidate = d->mediaSizes.erase(candidate);
+            const MediaFile *existing = d->mediaFiles[position].data();
+            if (!d->mediaHashes.contains(existing->hashKey()))
+                d->mediaHashes.insert(existing->hashKey(), position);
+            if (existing->hashKey() == media->hashKey() && existing->contents() == media->contents())
+            {
+                media->setIndex(position);
                 return;
             }
         }
@@ -725,6 +817,27 @@ void Workbook::addMediaFile(QSharedPointer<MediaFile> media, bool force)
     d->mediaFiles.append(media);
 }
 
+/*!
+ * \internal
+ * Returns the media file of \a image, a new one encoded in the background
+ * unless the same image was added before. Images are told apart by their
+ * cache key, without waiting for the encoding.
+ */
+QSharedPointer<MediaFile> Workbook::addImageFile(const QImage &image)
+{
+    Q_D(Workbook);
+
+    auto it = d->mediaImageKeys.constFind(image.cacheKey());
+    if (it != d->mediaImageKeys.constEnd() && d->mediaFiles[it.value()]->imageKey() == image.cacheKey())
+        return d->mediaFiles[it.value()];
+
+    QSharedPointer<MediaFile> media(new MediaFile(image));
+    d->mediaImageKeys.insert(image.cacheKey(), d->mediaFiles.size());
+    media->setIndex(d->mediaFiles.size());
+    d->mediaFiles.append(media);
+    return media;
+}
+
 /*!
  * \internal
  */
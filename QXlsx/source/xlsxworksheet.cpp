@@ -10,34 +10,49 @@
 #include <QUrl>
 #include <QDebug>
 #include <QBuffer>
+#include <QImageReader>
 #include <QXmlStreamWriter>
 #include <QXmlStreamReader>
 #include <QTextDocument>
 #include <QDir>
 #include <QMapIterator>
 #include <QMap>
+#include <QMutexLocker>
 
 #include <cmath>
+#include <algorithm>
+
+#if defined(__SSE2__) || defined(_M_X64) || (defined(_M_IX86_FP) && _M_IX86_FP >= 2)
+#include <emmintrin.h>
+#define QXLSX_AGGREGATE_SSE2
+#endif
 
 #include "xlsxrichstring.h"
 #include "xlsxcellreference.h"
 #include "xlsxworksheet.h"
 #include "xlsxworksheet_p.h"
 #include "xlsxworkbook.h"
+#include "xlsxworkbook_p.h"
 #include "xlsxformat.h"
 #include "xlsxformat_p.h"
 #include "xlsxutility_p.h"
 #include "xlsxsharedstrings_p.h"
 #include "xlsxdrawing_p.h"
+#include "xlsxmediafile_p.h"
 #include "xlsxstyles_p.h"
 #include "xlsxcell.h"
 #include "xlsxcell_p.h"
 #include "xlsxcellrange.h"
 #include "xlsxconditionalformatting_p.h"
+#include "xlsxconditionalformattingevaluator_p.h"
+#include "xlsxdatavalidation_p.h"
+#include "xlsxdatavalidationchecker_p.h"
 #include "xlsxdrawinganchor_p.h"
 #include "xlsxchart.h"
 #include "xlsxcellformula.h"
 #include "xlsxcellformula_p.h"
+#include "xlsxformulaparser_p.h"
+#include "xlsxformulaengine_p.h"
 #include "xlsxcelllocation.h"
 
 QT_BEGIN_NAMESPACE_XLSX
@@ -54,6 +69,7 @@ WorksheetPrivate::WorksheetPrivate(Worksheet *p, Worksheet::CreateFlag flag)
   showRuler(false),
   showOutlineSymbols(true),
   showWhiteSpace(true),
+  rangeIndexesValid(0),
   urlPattern(QStringLiteral("^([fh]tt?ps?://)|(mailto:)|(file://)"))
 {
 	previous_row = 0;
@@ -78,51 +94,48 @@ WorksheetPrivate::~WorksheetPrivate()
 void WorksheetPrivate::calculateSpans() const
 {
 	row_spans.clear();
+	int span_index = -1;
 	int span_min = XLSX_COLUMN_MAX+1;
 	int span_max = -1;
 
-	for (int row_num = dimension.firstRow(); row_num <= dimension.lastRow(); row_num++) {
-        auto it = cellTable.constFind(row_num);
-        if (it != cellTable.constEnd()) {
-			for (int col_num = dimension.firstColumn(); col_num <= dimension.lastColumn(); col_num++) {
-                if (it->contains(col_num)) {
-					if (span_max == -1) {
-						span_min = col_num;
-						span_max = col_num;
-					} else {
-						if (col_num < span_min)
-							span_min = col_num;
-						else if (col_num > span_max)
-							span_max = col_num;
-					}
-				}
-			}
+	//The cells and comments of a row are kept by column, the first and last
+	//keys are the bounds of the row. Only the rows holding some are visited.
+	auto ctIt = cellTable.lowerBound(dimension.firstRow());
+	auto cIt = comments.lowerBound(dimension.firstRow());
+	for (;;) {
+		int row_num = dimension.lastRow() + 1;
+		if (ctIt != cellTable.constEnd())
+			row_num = qMin(row_num, ctIt.key());
+		if (cIt != comments.constEnd())
+			row_num = qMin(row_num, cIt.key());
+		if (row_num > dimension.lastRow())
+			break;
+
+		if ((row_num-1) / 16 != span_index) {
+			if (span_max != -1)
+				row_spans[span_index] = QStringLiteral("%1:%2").arg(span_min).arg(span_max);
+			span_index = (row_num-1) / 16;
+			span_min = XLSX_COLUMN_MAX+1;
+			span_max = -1;
 		}
-        auto cIt = comments.constFind(row_num);
-        if (cIt != comments.constEnd()) {
-			for (int col_num = dimension.firstColumn(); col_num <= dimension.lastColumn(); col_num++) {
-                if (cIt->contains(col_num)) {
-					if (span_max == -1) {
-						span_min = col_num;
-						span_max = col_num;
-					} else {
-						if (col_num < span_min)
-							span_min = col_num;
-						else if (col_num > span_max)
-							span_max = col_num;
-					}
-				}
+
+		if (ctIt != cellTable.constEnd() && ctIt.key() == row_num) {
+			if (!ctIt->isEmpty()) {
+				span_min = qMin(span_min, ctIt->firstKey());
+				span_max = qMax(span_max, ctIt->lastKey());
 			}
+			++ctIt;
 		}
-
-		if (row_num%16 == 0 || row_num == dimension.lastRow()) {
-			if (span_max != -1) {
-                row_spans[row_num / 16] = QStringLiteral("%1:%2").arg(span_min).arg(span_max);
-				span_min = XLSX_COLUMN_MAX+1;
-				span_max = -1;
+		if (cIt != comments.constEnd() && cIt.key() == row_num) {
+			if (!cIt->isEmpty()) {
+				span_min = qMin(span_min, cIt->firstKey());
+				span_max = qMax(span_max, cIt->lastKey());
 			}
+			++cIt;
 		}
 	}
+	if (span_max != -1)
+		row_spans[span_index] = QStringLiteral("%1:%2").arg(span_min).arg(span_max);
 }
 
 
@@ -518,6 +531,91 @@ bool Worksheet::write(const CellReference &row_column, const QVariant &value, co
 	return write(row_column.row(), row_column.column(), value, format);
 }
 
+/*!
+ * \overload
+ * Write \a value to cell (\a row, \a column) with the interned \a style.
+ * Unlike the Format overload, no style work is done per cell, which makes
+ * it suited to writing many cells with the same look.
+ * Returns true on success.
+ *
+ * \sa internStyle()
+ */
+bool Worksheet::write(int row, int column, const QVariant &value, StyleId style)
+{
+	Q_D(Worksheet);
+
+	if (d->checkDimensions(row, column))
+		return false;
+
+	bool ret = true;
+	if (value.isNull())
+	{
+		ret = writeBlank(row, column, style);
+	}
+	else if (value.userType() == QMetaType::QString)
+	{
+		QString token = value.toString();
+		bool ok;
+
+		if (token.startsWith(QLatin1String("=")))
+			ret = writeFormula(row, column, CellFormula(token), style);
+		else if (d->workbook->isStringsToHyperlinksEnabled() && token.contains(d->urlPattern))
+			ret = writeHyperlink(row, column, QUrl(token));
+		else if (d->workbook->isStringsToNumbersEnabled() && (value.toDouble(&ok), ok))
+			ret = writeNumeric(row, column, value.toDouble(), style);
+		else
+			ret = writeString(row, column, token, style);
+	}
+	else if (value.userType() == qMetaTypeId<RichString>())
+	{
+		ret = writeString(row, column, value.value<RichString>(), style);
+	}
+	else if (value.userType() == QMetaType::Int || value.userType() == QMetaType::UInt
+			   || value.userType() == QMetaType::LongLong || value.userType() == QMetaType::ULongLong
+			   || value.userType() == QMetaType::Double || value.userType() == QMetaType::Float)
+	{
+		ret = writeNumeric(row, column, value.toDouble(), style);
+	}
+	else if (value.userType() == QMetaType::Bool)
+	{
+		ret = writeBool(row, column, value.toBool(), style);
+	}
+	else if (value.userType() == QMetaType::QDateTime)
+	{
+		ret = writeDateTime(row, column, value.toDateTime(), style);
+	}
+	else if (value.userType() == QMetaType::QDate)
+	{
+		ret = writeDate(row, column, value.toDate(), style);
+	}
+	else if (value.userType() == QMetaType::QTime)
+	{
+		ret = writeTime(row, column, value.toTime(), style);
+	}
+	else if (value.userType() == QMetaType::QUrl)
+	{
+		ret = writeHyperlink(row, column, value.toUrl(), d->workbook->styles()->xfFormat(style.xfIndex()));
+	}
+	else
+	{
+		//Wrong type
+		return false;
+	}
+
+	return ret;
+}
+
+/*!
+ * Registers \a format in the styles of the workbook and returns a handle
+ * which can be passed to the write functions of any sheet of this workbook.
+ * An invalid or empty \a format gives an invalid handle.
+ */
+StyleId Worksheet::internStyle(const Format &format)
+{
+	Q_D(Worksheet);
+	return d->workbook->styles()->intern(format);
+}
+
 /*!
 	\overload
 	Return the contents of the cell \a row_column.
@@ -556,6 +654,10 @@ QVariant Worksheet::read(int row, int column) const
             else
             {
                 int si = cell->formula().sharedIndex();
+				const auto root = d->sharedFormulaTemplates.constFind(si);
+				if (root != d->sharedFormulaTemplates.constEnd() && root->isValid())
+					return QVariant(QLatin1String("=")+root->formulaText(CellReference(row, column)));
+
                 const CellFormula &rootFormula = d->sharedFormulaMap[ si ];
 				CellReference rootCellRef = rootFormula.reference().topLeft();
 				QString rootFormulaText = rootFormula.formulaText();
@@ -574,6 +676,243 @@ QVariant Worksheet::read(int row, int column) const
 	return cell->value();
 }
 
+/*!
+ * Returns the display texts of the cells in \a range, one list per row.
+ * Each text is rendered with the number format of its cell, see
+ * Cell::formattedText(). Empty cells give empty strings.
+ */
+QList<QStringList> Worksheet::formatRange(const CellRange &range) const
+{
+	Q_D(const Worksheet);
+
+	QList<QStringList> rows;
+	if (!range.isValid())
+		return rows;
+
+	//The number formats are resolved once per style, not once per cell.
+	Styles *styles = d->workbook->styles();
+	const bool date1904 = d->workbook->isDate1904();
+	QHash<int, QSharedPointer<const NumberFormatter> > formatters;
+
+	rows.reserve(range.rowCount());
+	for (int row = range.firstRow(); row <= range.lastRow(); ++row) {
+		QStringList texts;
+		texts.reserve(range.columnCount());
+		const auto it = d->cellTable.constFind(row);
+		for (int col = range.firstColumn(); col <= range.lastColumn(); ++col) {
+			QString text;
+			if (it != d->cellTable.constEnd()) {
+				const auto cIt = it->constFind(col);
+				if (cIt != it->constEnd()) {
+					const CellPrivate *cell = cIt.value()->d_ptr;
+					auto formatter = formatters.constFind(cell->styleNumber);
+					if (formatter == formatters.constEnd())
+						formatter = formatters.insert(cell->styleNumber, styles->numberFormatter(cell->styleNumber));
+					text = cell->formattedText(*formatter.value(), date1904);
+				}
+			}
+			texts.append(text);
+		}
+		rows.append(texts);
+	}
+	return rows;
+}
+
+/*!
+ * Returns \a function computed over the cells of \a range, the way the
+ * spreadsheet function of the same name does with a reference argument:
+ * text, booleans and blank cells are skipped, dates count as their serial
+ * numbers. AggregateCountA counts every cell holding a value.
+ *
+ * The result is a double. When the range holds an error value, the error
+ * code string, such as "#N/A", is returned instead, except for the count
+ * functions. AVERAGE of no numbers gives "#DIV/0!". An invalid \a range
+ * gives an invalid QVariant.
+ *
+ * This is much faster than calling read() for each cell of a large range.
+ */
+QVariant Worksheet::aggregate(const CellRange &range, AggregateFunction function) const
+{
+	Q_D(const Worksheet);
+
+	if (!range.isValid())
+		return QVariant();
+
+	XlsxAggregateData data;
+	d->aggregateRange(range, data);
+
+	switch (function) {
+	case AggregateCount:
+		return double(data.numbers);
+	case AggregateCountA:
+		return double(data.nonBlank);
+	default:
+		break;
+	}
+	if (!data.error.isEmpty())
+		return data.error;
+
+	switch (function) {
+	case AggregateAverage:
+		if (!data.numbers)
+			return QStringLiteral("#DIV/0!");
+		return data.sum / data.numbers;
+	case AggregateMin:
+		return data.numbers ? data.minimum : 0.0;
+	case AggregateMax:
+		return data.numbers ? data.maximum : 0.0;
+	default:
+		return data.sum;
+	}
+}
+
+namespace {
+
+//Numbers are gathered in blocks of this size before being added up.
+const int aggregateBlockSize = 1024;
+
+void aggregateBlock(const double *values, int count, XlsxAggregateData &data)
+{
+	int i = 0;
+#ifdef QXLSX_AGGREGATE_SSE2
+	//Two registers of two lanes each, the lanes are added up at the end.
+	__m128d sum0 = _mm_setzero_pd();
+	__m128d sum1 = _mm_setzero_pd();
+	__m128d min0 = _mm_set1_pd(data.minimum);
+	__m128d min1 = min0;
+	__m128d max0 = _mm_set1_pd(data.maximum);
+	__m128d max1 = max0;
+	for (; i + 4 <= count; i += 4) {
+		const __m128d a = _mm_loadu_pd(values + i);
+		const __m128d b = _mm_loadu_pd(values + i + 2);
+		sum0 = _mm_add_pd(sum0, a);
+		sum1 = _mm_add_pd(sum1, b);
+		min0 = _mm_min_pd(min0, a);
+		min1 = _mm_min_pd(min1, b);
+		max0 = _mm_max_pd(max0, a);
+		max1 = _mm_max_pd(max1, b);
+	}
+	double lanes[2];
+	_mm_storeu_pd(lanes, _mm_add_pd(sum0, sum1));
+	data.sum += lanes[0] + lanes[1];
+	_mm_storeu_pd(lanes, _mm_min_pd(min0, min1));
+	data.minimum = qMin(lanes[0], lanes[1]);
+	_mm_storeu_pd(lanes, _mm_max_pd(max0, max1));
+	data.maximum = qMax(lanes[0], lanes[1]);
+#endif
+	double sum = 0;
+	for (; i < count; ++i) {
+		sum += values[i];
+		data.minimum = qMin(data.minimum, values[i]);
+		data.maximum = qMax(data.maximum, values[i]);
+	}
+	data.sum += sum;
+	data.numbers += count;
+}
+
+} // namespace
+
+/*!
+ * \internal
+ * Fills \a cells with the cells of \a range, row by row, nullptr for the
+ * missing ones. The rows are looked up once each.
+ */
+void WorksheetPrivate::collectCells(const CellRange &range, QVector<const Cell *> &cells) const
+{
+	const int columnCount = range.columnCount();
+	cells.fill(nullptr, range.rowCount() * columnCount);
+	for (auto row = cellTable.lowerBound(range.firstRow());
+		 row != cellTable.constEnd() && row.key() <= range.lastRow(); ++row) {
+		const QMap<int, QSharedPointer<Cell> > &columns = row.value();
+		const int offset = (row.key() - range.firstRow()) * columnCount - range.firstColumn();
+		for (auto column = columns.lowerBound(range.firstColumn());
+			 column != columns.constEnd() && column.key() <= range.lastColumn(); ++column)
+			cells[offset + column.key()] = column.value().data();
+	}
+}
+
+/*!
+ * \internal
+ * Adds the cells of \a range to \a data. Only existing cells are visited,
+ * the numbers are collected into blocks handed to the vectorized kernel.
+ */
+void WorksheetPrivate::aggregateRange(const CellRange &range, XlsxAggregateData &data) const
+{
+	const bool date1904 = workbook->isDate1904();
+	double block[aggregateBlockSize];
+	int count = 0;
+	auto addNumber = [&](double number) {
+		block[count++] = number;
+		if (count == aggregateBlockSize) {
+			aggregateBlock(block, count, data);
+			count = 0;
+		}
+	};
+
+	for (auto row = cellTable.lowerBound(range.firstRow());
+		 row != cellTable.constEnd() && row.key() <= range.lastRow(); ++row) {
+		const QMap<int, QSharedPointer<Cell> > &columns = row.value();
+		for (auto column = columns.lowerBound(range.firstColumn());
+			 column != columns.constEnd() && column.key() <= range.lastColumn(); ++column) {
+			const Cell *cell = column.value().data();
+			if (!cell)
+				continue;
+			const QVariant &value = cell->d_ptr->value;
+			switch (cell->d_ptr->cellType) {
+			case Cell::BooleanType:
+			case Cell::SharedStringType:
+			case Cell::InlineStringType:
+			case Cell::StringType:
+				++data.nonBlank;
+				continue;
+			case Cell::ErrorType:
+				++data.nonBlank;
+				if (data.error.isEmpty())
+					data.error = value.toString();
+				continue;
+			default:
+				break;
+			}
+
+			switch (value.userType()) {
+			case QMetaType::UnknownType:
+				break;
+			case QMetaType::Double:
+				++data.nonBlank;
+				addNumber(*static_cast<const double *>(value.constData()));
+				break;
+			case QMetaType::QDateTime:
+				++data.nonBlank;
+				addNumber(datetimeToNumber(value.toDateTime(), date1904));
+				break;
+			case QMetaType::QDate:
+				++data.nonBlank;
+				addNumber(dateToNumber(value.toDate(), date1904));
+				break;
+			case QMetaType::QTime:
+				++data.nonBlank;
+				addNumber(timeToNumber(value.toTime()));
+				break;
+			case QMetaType::Bool:
+				++data.nonBlank;
+				break;
+			default: {
+				bool ok = false;
+				const double number = value.toDouble(&ok);
+				if (ok) {
+					++data.nonBlank;
+					addNumber(number);
+				} else if (!value.toString().isEmpty()) {
+					++data.nonBlank;
+				}
+				break;
+			}
+			}
+		}
+	}
+	aggregateBlock(block, count, data);
+}
+
 /*!
  * Returns the cell at the given \a row_column. If there
  * is no cell at the specified position, the function returns 0.
@@ -602,6 +941,29 @@ Cell *Worksheet::cellAt(int row, int col) const
     return (*it)[col].data();
 }
 
+/*
+ * Adds the xf indexes used by the cells, rows and columns of the sheet.
+ */
+void WorksheetPrivate::collectXfIndexes(QSet<int> &xfIndexes) const
+{
+	for (auto it = cellTable.constBegin(); it != cellTable.constEnd(); ++it) {
+		for (auto cIt = it->constBegin(); cIt != it->constEnd(); ++cIt) {
+			const int idx = cIt.value()->styleNumber();
+			if (idx >= 0)
+				xfIndexes.insert(idx);
+		}
+	}
+
+	for (const auto &rowInfo : rowsInfo) {
+		if (!rowInfo->format.isEmpty())
+			xfIndexes.insert(rowInfo->format.xfIndex());
+	}
+	for (const auto &colInfo : colsInfo) {
+		if (!colInfo->format.isEmpty())
+			xfIndexes.insert(colInfo->format.xfIndex());
+	}
+}
+
 Format WorksheetPrivate::cellFormat(int row, int col) const
 {
     auto it = cellTable.constFind(row);
@@ -612,6 +974,29 @@ Format WorksheetPrivate::cellFormat(int row, int col) const
     return (*it)[col]->format();
 }
 
+/*
+ * Returns \a style if it already has a date time number format, otherwise
+ * the style with \a numFmt applied on top of it. The derived styles are
+ * cached, repeated writes with one style only do a lookup.
+ */
+StyleId WorksheetPrivate::dateTimeStyle(StyleId style, const QString &numFmt)
+{
+	Styles *styles = workbook->styles();
+	if (styles->isDateTimeXf(style.xfIndex()))
+		return style;
+
+	const QPair<int, QString> key(style.xfIndex(), numFmt);
+	auto it = dateTimeStyles.constFind(key);
+	if (it != dateTimeStyles.constEnd())
+		return it.value();
+
+	Format fmt = styles->xfFormat(style.xfIndex());
+	fmt.setNumberFormat(numFmt);
+	const StyleId dateStyle = styles->intern(fmt);
+	dateTimeStyles.insert(key, dateStyle);
+	return dateStyle;
+}
+
 /*!
   \overload
   Write string \a value to the cell \a row_column with the \a format.
@@ -642,14 +1027,30 @@ bool Worksheet::writeString(int row, int column, const RichString &value, const
 //        error = -2;
 //    }
 
-	d->sharedStrings()->addSharedString(value);
 	Format fmt = format.isValid() ? format : d->cellFormat(row, column);
 	if (value.fragmentCount() == 1 && value.fragmentFormat(0).isValid())
 		fmt.mergeFormat(value.fragmentFormat(0));
-	d->workbook->styles()->addXfFormat(fmt);
-	QSharedPointer<Cell> cell = QSharedPointer<Cell>(new Cell(value.toPlainString(), Cell::SharedStringType, fmt, this));
+
+	return writeString(row, column, value, d->workbook->styles()->intern(fmt));
+}
+
+/*!
+  \overload
+  Write string \a value to the cell (\a row, \a column) with the interned
+  \a style. The formats of the fragments are not merged into the style.
+  Returns true on success.
+*/
+bool Worksheet::writeString(int row, int column, const RichString &value, StyleId style)
+{
+	Q_D(Worksheet);
+	if (d->checkDimensions(row, column))
+		return false;
+
+	d->sharedStrings()->addSharedString(value);
+	QSharedPointer<Cell> cell = QSharedPointer<Cell>(new Cell(value.toPlainString(), Cell::SharedStringType, Format(), this, style.xfIndex()));
 	cell->d_ptr->richString = value;
 	d->cellTable[row][column] = cell;
+	d->workbook->formulaEngine()->cellChanged(this, row, column);
 	return true;
 }
 
@@ -686,6 +1087,27 @@ bool Worksheet::writeString(int row, int column, const QString &value, const For
 	return writeString(row, column, rs, format);
 }
 
+/*!
+	\overload
+
+	Write string \a value to the cell (\a row, \a column) with the interned \a style.
+	Returns true on success.
+*/
+bool Worksheet::writeString(int row, int column, const QString &value, StyleId style)
+{
+	Q_D(Worksheet);
+	if (d->checkDimensions(row, column))
+		return false;
+
+	RichString rs;
+	if (d->workbook->isHtmlToRichStringEnabled() && Qt::mightBeRichText(value))
+		rs.setHtml(value);
+	else
+		rs.addFragment(value, Format());
+
+	return writeString(row, column, rs, style);
+}
+
 /*!
 	\overload
 	Write string \a value to the cell \a row_column with the \a format
@@ -703,6 +1125,21 @@ bool Worksheet::writeInlineString(const CellReference &row_column, const QString
 	Returns true on success.
 */
 bool Worksheet::writeInlineString(int row, int column, const QString &value, const Format &format)
+{
+	Q_D(Worksheet);
+	if (d->checkDimensions(row, column))
+		return false;
+
+	Format fmt = format.isValid() ? format : d->cellFormat(row, column);
+	return writeInlineString(row, column, value, d->workbook->styles()->intern(fmt));
+}
+
+/*!
+	\overload
+	Write string \a value to the cell (\a row, \a column) with the interned \a style.
+	Returns true on success.
+*/
+bool Worksheet::writeInlineString(int row, int column, const QString &value, StyleId style)
 {
 	Q_D(Worksheet);
 	//int error = 0;
@@ -715,9 +1152,8 @@ bool Worksheet::writeInlineString(int row, int column, const QString &value, con
 		//error = -2;
 	}
 
-	Format fmt = format.isValid() ? format : d->cellFormat(row, column);
-	d->workbook->styles()->addXfFormat(fmt);
-	d->cellTable[row][column] = QSharedPointer<Cell>(new Cell(value, Cell::InlineStringType, fmt, this));
+	d->cellTable[row][column] = QSharedPointer<Cell>(new Cell(value, Cell::InlineStringType, Format(), this, style.xfIndex()));
+	d->workbook->formulaEngine()->cellChanged(this, row, column);
 	return true;
 }
 
@@ -745,8 +1181,22 @@ bool Worksheet::writeNumeric(int row, int column, double value, const Format &fo
 		return false;
 
 	Format fmt = format.isValid() ? format : d->cellFormat(row, column);
-	d->workbook->styles()->addXfFormat(fmt);
-	d->cellTable[row][column] = QSharedPointer<Cell>(new Cell(value, Cell::NumberType, fmt, this));
+	return writeNumeric(row, column, value, d->workbook->styles()->intern(fmt));
+}
+
+/*!
+	\overload
+	Write numeric \a value to the cell (\a row, \a column) with the interned \a style.
+	Returns true on success.
+*/
+bool Worksheet::writeNumeric(int row, int column, double value, StyleId style)
+{
+	Q_D(Worksheet);
+	if (d->checkDimensions(row, column))
+		return false;
+
+	d->cellTable[row][column] = QSharedPointer<Cell>(new Cell(value, Cell::NumberType, Format(), this, style.xfIndex()));
+	d->workbook->formulaEngine()->cellChanged(this, row, column);
 	return true;
 }
 
@@ -776,7 +1226,20 @@ bool Worksheet::writeFormula(int row, int column, const CellFormula &formula_, c
 		return false;
 
 	Format fmt = format.isValid() ? format : d->cellFormat(row, column);
-	d->workbook->styles()->addXfFormat(fmt);
+	return writeFormula(row, column, formula_, d->workbook->styles()->intern(fmt), result);
+}
+
+/*!
+	\overload
+	Write \a formula_ to the cell (\a row, \a column) with the interned \a style and \a result.
+	Returns true on success.
+*/
+bool Worksheet::writeFormula(int row, int column, const CellFormula &formula_, StyleId style, double result)
+{
+	Q_D(Worksheet);
+
+	if (d->checkDimensions(row, column))
+		return false;
 
 	CellFormula formula = formula_;
 	formula.d->ca = true;
@@ -789,12 +1252,13 @@ bool Worksheet::writeFormula(int row, int column, const CellFormula &formula_, c
 			++si;
         }
 		formula.d->si = si;
-		d->sharedFormulaMap[si] = formula;
+		d->addSharedFormula(si, formula);
 	}
 
-	QSharedPointer<Cell> data = QSharedPointer<Cell>(new Cell(result, Cell::NumberType, fmt, this));
+	QSharedPointer<Cell> data = QSharedPointer<Cell>(new Cell(result, Cell::NumberType, Format(), this, style.xfIndex()));
 	data->d_ptr->formula = formula;
 	d->cellTable[row][column] = data;
+	d->workbook->formulaEngine()->cellChanged(this, row, column);
 
 	CellRange range = formula.reference();
 	if (formula.formulaType() == CellFormula::SharedType) {
@@ -806,10 +1270,11 @@ bool Worksheet::writeFormula(int row, int column, const CellFormula &formula_, c
 					if(Cell *cell = cellAt(r, c)) {
 						cell->d_ptr->formula = sf;
 					} else {
-						QSharedPointer<Cell> newCell = QSharedPointer<Cell>(new Cell(result, Cell::NumberType, fmt, this));
+						QSharedPointer<Cell> newCell = QSharedPointer<Cell>(new Cell(result, Cell::NumberType, Format(), this, style.xfIndex()));
 						newCell->d_ptr->formula = sf;
 						d->cellTable[r][c] = newCell;
 					}
+					d->workbook->formulaEngine()->cellChanged(this, r, c);
 				}
 			}
 		}
@@ -844,10 +1309,23 @@ bool Worksheet::writeBlank(int row, int column, const Format &format)
 		return false;
 
 	Format fmt = format.isValid() ? format : d->cellFormat(row, column);
-	d->workbook->styles()->addXfFormat(fmt);
+	return writeBlank(row, column, d->workbook->styles()->intern(fmt));
+}
+
+/*!
+	\overload
+	Write a empty cell (\a row, \a column) with the interned \a style.
+	Returns true on success.
+ */
+bool Worksheet::writeBlank(int row, int column, StyleId style)
+{
+	Q_D(Worksheet);
+	if (d->checkDimensions(row, column))
+		return false;
 
 	//Note: NumberType with an invalid QVariant value means blank.
-	d->cellTable[row][column] = QSharedPointer<Cell>(new Cell(QVariant(), Cell::NumberType, fmt, this));
+	d->cellTable[row][column] = QSharedPointer<Cell>(new Cell(QVariant(), Cell::NumberType, Format(), this, style.xfIndex()));
+	d->workbook->formulaEngine()->cellChanged(this, row, column);
 
 	return true;
 }
@@ -875,8 +1353,22 @@ bool Worksheet::writeBool(int row, int column, bool value, const Format &format)
 		return false;
 
 	Format fmt = format.isValid() ? format : d->cellFormat(row, column);
-	d->workbook->styles()->addXfFormat(fmt);
-	d->cellTable[row][column] = QSharedPointer<Cell>(new Cell(value, Cell::BooleanType, fmt, this));
+	return writeBool(row, column, value, d->workbook->styles()->intern(fmt));
+}
+
+/*!
+	\overload
+	Write a bool \a value to the cell (\a row, \a column) with the interned \a style.
+	Returns true on success.
+ */
+bool Worksheet::writeBool(int row, int column, bool value, StyleId style)
+{
+	Q_D(Worksheet);
+	if (d->checkDimensions(row, column))
+		return false;
+
+	d->cellTable[row][column] = QSharedPointer<Cell>(new Cell(value, Cell::BooleanType, Format(), this, style.xfIndex()));
+	d->workbook->formulaEngine()->cellChanged(this, row, column);
 
 	return true;
 }
@@ -906,11 +1398,27 @@ bool Worksheet::writeDateTime(int row, int column, const QDateTime &dt, const Fo
 	Format fmt = format.isValid() ? format : d->cellFormat(row, column);
 	if (!fmt.isValid() || !fmt.isDateTimeFormat())
 		fmt.setNumberFormat(d->workbook->defaultDateFormat());
-	d->workbook->styles()->addXfFormat(fmt);
 
+	return writeDateTime(row, column, dt, d->workbook->styles()->intern(fmt));
+}
+
+/*!
+	\overload
+	Write a QDateTime \a dt to the cell (\a row, \a column) with the interned \a style.
+	The default date format is used when \a style has no date time number format.
+	Returns true on success.
+ */
+bool Worksheet::writeDateTime(int row, int column, const QDateTime &dt, StyleId style)
+{
+	Q_D(Worksheet);
+	if (d->checkDimensions(row, column))
+		return false;
+
+	style = d->dateTimeStyle(style, d->workbook->defaultDateFormat());
 	double value = datetimeToNumber(dt, d->workbook->isDate1904());
 
-	d->cellTable[row][column] = QSharedPointer<Cell>(new Cell(value, Cell::NumberType, fmt, this));
+	d->cellTable[row][column] = QSharedPointer<Cell>(new Cell(value, Cell::NumberType, Format(), this, style.xfIndex()));
+	d->workbook->formulaEngine()->cellChanged(this, row, column);
 
 	return true;
 }
@@ -936,11 +1444,26 @@ bool Worksheet::writeDate(int row, int column, const QDate &dt, const Format &fo
     if (!fmt.isValid() || !fmt.isDateTimeFormat())
         fmt.setNumberFormat(d->workbook->defaultDateFormat());
 
-    d->workbook->styles()->addXfFormat(fmt);
+    return writeDate(row, column, dt, d->workbook->styles()->intern(fmt));
+}
+
+/*!
+	\overload
+	Write a QDate \a dt to the cell (\a row, \a column) with the interned \a style.
+	The default date format is used when \a style has no date time number format.
+	Returns true on success.
+ */
+bool Worksheet::writeDate(int row, int column, const QDate &dt, StyleId style)
+{
+    Q_D(Worksheet);
+    if (d->checkDimensions(row, column))
+        return false;
 
-    double value = datetimeToNumber(QDateTime(dt, QTime(0,0,0)), d->workbook->isDate1904());
+    style = d->dateTimeStyle(style, d->workbook->defaultDateFormat());
+    double value = dateToNumber(dt, d->workbook->isDate1904());
 
-    d->cellTable[row][column] = QSharedPointer<Cell>(new Cell(value, Cell::NumberType, fmt, this));
+    d->cellTable[row][column] = QSharedPointer<Cell>(new Cell(value, Cell::NumberType, Format(), this, style.xfIndex()));
+    d->workbook->formulaEngine()->cellChanged(this, row, column);
 
     return true;
 }
@@ -971,25 +1494,40 @@ bool Worksheet::writeTime(int row, int column, const QTime &t, const Format &for
 	Format fmt = format.isValid() ? format : d->cellFormat(row, column);
 	if (!fmt.isValid() || !fmt.isDateTimeFormat())
 		fmt.setNumberFormat(QStringLiteral("hh:mm:ss"));
-	d->workbook->styles()->addXfFormat(fmt);
-
-	d->cellTable[row][column] = QSharedPointer<Cell>(new Cell(timeToNumber(t), Cell::NumberType, fmt, this));
 
-	return true;
+	return writeTime(row, column, t, d->workbook->styles()->intern(fmt));
 }
 
 /*!
 	\overload
-	Write a QUrl \a url to the cell \a row_column with the given \a format \a display and \a tip.
+	Write a QTime \a t to the cell (\a row, \a column) with the interned \a style.
 	Returns true on success.
  */
-bool Worksheet::writeHyperlink(const CellReference &row_column, const QUrl &url, const Format &format, const QString &display, const QString &tip)
+bool Worksheet::writeTime(int row, int column, const QTime &t, StyleId style)
 {
-	if (!row_column.isValid())
+	Q_D(Worksheet);
+	if (d->checkDimensions(row, column))
 		return false;
 
-	return writeHyperlink(row_column.row(), row_column.column(), url, format, display, tip);
-}
+	style = d->dateTimeStyle(style, QStringLiteral("hh:mm:ss"));
+	d->cellTable[row][column] = QSharedPointer<Cell>(new Cell(timeToNumber(t), Cell::NumberType, Format(), this, style.xfIndex()));
+	d->workbook->formulaEngine()->cellChanged(this, row, column);
+
+	return true;
+}
+
+/*!
+	\overload
+	Write a QUrl \a url to the cell \a row_column with the given \a format \a display and \a tip.
+	Returns true on success.
+ */
+bool Worksheet::writeHyperlink(const CellReference &row_column, const QUrl &url, const Format &format, const QString &display, const QString &tip)
+{
+	if (!row_column.isValid())
+		return false;
+
+	return writeHyperlink(row_column.row(), row_column.column(), url, format, display, tip);
+}
 
 /*!
 	Write a QUrl \a url to the cell (\a row, \a column) with the given \a format \a display and \a tip.
@@ -1035,11 +1573,12 @@ bool Worksheet::writeHyperlink(int row, int column, const QUrl &url, const Forma
 		fmt.setFontColor(Qt::blue);
 		fmt.setFontUnderline(Format::FontUnderlineSingle);
 	}
-	d->workbook->styles()->addXfFormat(fmt);
+	const StyleId style = d->workbook->styles()->intern(fmt);
 
 	//Write the hyperlink string as normal string.
 	d->sharedStrings()->addSharedString(displayString);
-	d->cellTable[row][column] = QSharedPointer<Cell>(new Cell(displayString, Cell::SharedStringType, fmt, this));
+	d->cellTable[row][column] = QSharedPointer<Cell>(new Cell(displayString, Cell::SharedStringType, Format(), this, style.xfIndex()));
+	d->workbook->formulaEngine()->cellChanged(this, row, column);
 
 	//Store the hyperlink data in a separate table
 	d->urlTable[row][column] = QSharedPointer<XlsxHyperlinkData>(new XlsxHyperlinkData(XlsxHyperlinkData::External, urlString, locationString, QString(), tip));
@@ -1058,6 +1597,10 @@ bool Worksheet::addDataValidation(const DataValidation &validation)
 		return false;
 
 	d->dataValidationsList.append(validation);
+	if (d->rangeIndexesValid.loadAcquire()) {
+		for (const CellRange &range : validation.ranges())
+			d->validationIndex.insert(range, d->dataValidationsList.size() - 1);
+	}
 	return true;
 }
 
@@ -1078,6 +1621,10 @@ bool Worksheet::addConditionalFormatting(const ConditionalFormatting &cf)
 		rule->priority = 1;
 	}
 	d->conditionalFormattingList.append(cf);
+	if (d->rangeIndexesValid.loadAcquire()) {
+		for (const CellRange &range : cf.ranges())
+			d->formattingIndex.insert(range, d->conditionalFormattingList.size() - 1);
+	}
 	return true;
 }
 
@@ -1117,6 +1664,41 @@ int Worksheet::insertImage(int row, int column, const QImage &image)
     return imageIndex;
 }
 
+/*!
+ * Insert the picture \a encodedImage at the position \a row, \a column.
+ * PNG, JPEG, GIF and BMP pictures are stored as they are, only their header
+ * is read for the size. Other formats are decoded and stored as PNG.
+ */
+int Worksheet::insertImage(int row, int column, const QByteArray &encodedImage)
+{
+	Q_D(Worksheet);
+
+	QString suffix;
+	QString mimeType;
+	if (!MediaFile::imageFormat(encodedImage, suffix, mimeType))
+		return insertImage(row, column, QImage::fromData(encodedImage));
+
+	QBuffer buffer;
+	buffer.setData(encodedImage);
+	QImageReader reader(&buffer);
+	const QSize size = reader.size();
+	if (!size.isValid())
+		return 0;
+
+	if (!d->drawing)
+		d->drawing = QSharedPointer<Drawing>(new Drawing(this, F_NewFromScratch));
+
+	DrawingOneCellAnchor* anchor = new DrawingOneCellAnchor(d->drawing.data(), DrawingAnchor::Picture);
+	//The resolution isn't read, pictures are taken as 96 dpi like QImage does.
+	anchor->from = XlsxMarker(row, column, 0, 0);
+	const float scale = 36e6f / 3780;
+	anchor->ext = QSize(int(size.width() * scale), int(size.height() * scale));
+
+	anchor->setObjectPicture(encodedImage, suffix, mimeType);
+
+	return anchor->getm_id();
+}
+
 bool Worksheet::getImage(int imageIndex, QImage& img)
 {
     Q_D(Worksheet);
@@ -1153,22 +1735,14 @@ bool Worksheet::getImage(int row, int column, QImage &img)
         return false;
     }
 
-    for(int i = 0; i < d->drawing->anchors.size(); i++)
+    DrawingAnchor* danchor = d->drawing->anchorAt( row, column );
+    if ( danchor == nullptr )
     {
-        if(d->drawing->anchors[i]->row() == row && d->drawing->anchors[i]->col() == column)
-        {
-            DrawingAnchor* danchor = d->drawing->anchors.at( i );
-
-            if ( danchor == nullptr )
-            {
-                return false;
-            }
-
-            bool ret= danchor->getObjectPicture(img);
-            return ret;
-        }
+        return false;
     }
-    return false;
+
+    bool ret= danchor->getObjectPicture(img);
+    return ret;
 }
 
 uint Worksheet::getImageCount()
@@ -1184,6 +1758,35 @@ uint Worksheet::getImageCount()
     return uint(size);
 }
 
+/*!
+ * Returns the pictures of the worksheet with their anchor cell and their
+ * encoded bytes, without decoding any of them.
+ */
+QList<WorksheetImage> Worksheet::images() const
+{
+	Q_D(const Worksheet);
+
+	QList<WorksheetImage> result;
+	if (!d->drawing)
+		return result;
+
+	const QList<DrawingAnchor *> &anchors = d->drawing->anchors;
+	for (int i = 0; i < anchors.size(); ++i) {
+		const QSharedPointer<MediaFile> file = anchors[i]->pictureFile();
+		if (file.isNull())
+			continue;
+		WorksheetImage image;
+		image.index = i + 1;
+		image.row = anchors[i]->row();
+		image.column = anchors[i]->col();
+		image.data = file->contents();
+		image.suffix = file->suffix();
+		image.mimeType = file->mimeType();
+		result.append(image);
+	}
+	return result;
+}
+
 
 
 /*!
@@ -1217,7 +1820,7 @@ Chart *Worksheet::insertChart(int row, int column, const QSize &size)
 /*!
 	Merge a \a range of cells. The first cell should contain the data and the others should
 	be blank. All cells will be applied the same style if a valid \a format is given.
-	Returns true on success.
+	Returns true on success, false when \a range overlaps merged cells.
 
 	\note All cells except the top-left one will be cleared.
  */
@@ -1230,9 +1833,14 @@ bool Worksheet::mergeCells(const CellRange &range, const Format &format)
 	if (d->checkDimensions(range.firstRow(), range.firstColumn()))
 		return false;
 
+	d->buildRangeIndexes();
+	if (d->mergeIndex.intersects(range))
+		return false;
+
+	StyleId style;
 	if (format.isValid())
     {
-		d->workbook->styles()->addXfFormat(format);
+		style = d->workbook->styles()->intern(format);
     }
 
     for (int row = range.firstRow(); row <= range.lastRow(); ++row)
@@ -1245,7 +1853,7 @@ bool Worksheet::mergeCells(const CellRange &range, const Format &format)
                 if (cell)
                 {
 					if (format.isValid())
-						cell->d_ptr->format = format;
+						cell->d_ptr->styleNumber = style.xfIndex();
                 }
                 else
                 {
@@ -1260,6 +1868,7 @@ bool Worksheet::mergeCells(const CellRange &range, const Format &format)
 	}
 
 	d->merges.append(range);
+	d->mergeIndex.insert(range, d->merges.size() - 1);
 	return true;
 }
 
@@ -1269,8 +1878,160 @@ bool Worksheet::mergeCells(const CellRange &range, const Format &format)
 */
 bool Worksheet::unmergeCells(const CellRange &range)
 {
-    Q_D(Worksheet);
-    return d->merges.removeOne(range);
+	Q_D(Worksheet);
+	d->buildRangeIndexes();
+	const QVector<int> found = d->mergeIndex.find(range);
+	for (int index : found) {
+		if (d->merges[index] != range)
+			continue;
+
+		//The last merge takes the place of the removed one.
+		const int last = d->merges.size() - 1;
+		d->mergeIndex.remove(range, index);
+		if (index != last) {
+			d->mergeIndex.remove(d->merges[last], last);
+			d->merges[index] = d->merges[last];
+			d->mergeIndex.insert(d->merges[index], index);
+		}
+		d->merges.removeLast();
+		return true;
+	}
+	return false;
+}
+
+/*!
+  Returns the merged cells holding the cell (\a row, \a column), or an
+  invalid range when it isn't merged.
+*/
+CellRange Worksheet::mergedRangeAt(int row, int column) const
+{
+	Q_D(const Worksheet);
+	d->buildRangeIndexes();
+	const QVector<int> found = d->mergeIndex.find(row, column);
+	return found.isEmpty() ? CellRange() : d->merges[found.first()];
+}
+
+/*!
+  Returns the data validations applied to the cell (\a row, \a column), in
+  the order they were added.
+*/
+QList<DataValidation> Worksheet::dataValidationsAt(int row, int column) const
+{
+	Q_D(const Worksheet);
+	d->buildRangeIndexes();
+	QVector<int> found = d->validationIndex.find(row, column);
+	std::sort(found.begin(), found.end());
+	found.erase(std::unique(found.begin(), found.end()), found.end());
+
+	QList<DataValidation> validations;
+	for (int index : found)
+		validations.append(d->dataValidationsList[index]);
+	return validations;
+}
+
+/*!
+  Returns the conditional formattings applied to the cell (\a row, \a column),
+  in the order they were added.
+*/
+QList<ConditionalFormatting> Worksheet::conditionalFormattingsAt(int row, int column) const
+{
+	Q_D(const Worksheet);
+	d->buildRangeIndexes();
+	QVector<int> found = d->formattingIndex.find(row, column);
+	std::sort(found.begin(), found.end());
+	found.erase(std::unique(found.begin(), found.end()), found.end());
+
+	QList<ConditionalFormatting> formattings;
+	for (int index : found)
+		formattings.append(d->conditionalFormattingList[index]);
+	return formattings;
+}
+
+/*!
+  Checks the cells of \a range against the data validations of the sheet,
+  and returns the cells whose value breaks one of them, row by row. Blank
+  cells aren't checked. Each validation is compiled once, list sources
+  being read into a hash set, and large ranges are checked by several
+  threads when parallel calculation is enabled for the workbook.
+*/
+QList<DataValidationViolation> Worksheet::validate(const CellRange &range) const
+{
+	Q_D(const Worksheet);
+	d->buildRangeIndexes();
+	QVector<int> found = d->validationIndex.find(range);
+	std::sort(found.begin(), found.end());
+	found.erase(std::unique(found.begin(), found.end()), found.end());
+
+	QList<DataValidation> validations;
+	for (int index : found)
+		validations.append(d->dataValidationsList[index]);
+	if (validations.isEmpty())
+		return QList<DataValidationViolation>();
+
+	FormulaEngine *engine = d->workbook->formulaEngine();
+	engine->prepareEvaluation();
+	DataValidationChecker checker(const_cast<Worksheet *>(this), d->cellTable, engine,
+	                              d->workbook->formulaCache(), d->workbook->isParallelCalculationEnabled());
+	return checker.check(validations, range);
+}
+
+/*!
+  Evaluates the conditional formattings of the sheet over \a range, and
+  returns the formatting shown by each cell which at least one rule applies
+  to, row by row. Only the cells of the used range are returned. The
+  statistics of rules such as top 10, above average, color scales and data
+  bars are computed once per rule, over all the cells the rule covers.
+*/
+QList<CellConditionalFormat> Worksheet::conditionalFormats(const CellRange &range) const
+{
+	Q_D(const Worksheet);
+	d->buildRangeIndexes();
+	QVector<int> found = d->formattingIndex.find(range);
+	std::sort(found.begin(), found.end());
+	found.erase(std::unique(found.begin(), found.end()), found.end());
+
+	QList<ConditionalFormatting> formattings;
+	for (int index : found)
+		formattings.append(d->conditionalFormattingList[index]);
+
+	d->workbook->formulaEngine()->prepareEvaluation();
+	ConditionalFormattingEvaluator evaluator(const_cast<Worksheet *>(this), d->cellTable,
+	                                        d->workbook->formulaEngine(), d->workbook->formulaCache(),
+	                                        d->dimension, d->workbook->isDate1904());
+	return evaluator.evaluate(formattings, range);
+}
+
+/*!
+ * \internal
+ * Indexes the merged cells, data validations and conditional formattings by
+ * their ranges. The indexes are built on the first search after loading or
+ * moving cells, then kept up to date as ranges are added. The const getters
+ * may search from several threads, the first of them builds the indexes
+ * under the lock while the others wait.
+ */
+void WorksheetPrivate::buildRangeIndexes() const
+{
+	if (rangeIndexesValid.loadAcquire())
+		return;
+
+	QMutexLocker locker(&rangeIndexesMutex);
+	if (rangeIndexesValid.loadAcquire())
+		return;
+
+	mergeIndex.clear();
+	for (int i = 0; i < merges.size(); ++i)
+		mergeIndex.insert(merges[i], i);
+	validationIndex.clear();
+	for (int i = 0; i < dataValidationsList.size(); ++i) {
+		for (const CellRange &range : dataValidationsList[i].ranges())
+			validationIndex.insert(range, i);
+	}
+	formattingIndex.clear();
+	for (int i = 0; i < conditionalFormattingList.size(); ++i) {
+		for (const CellRange &range : conditionalFormattingList[i].ranges())
+			formattingIndex.insert(range, i);
+	}
+	rangeIndexesValid.storeRelease(1);
 }
 
 /*!
@@ -1304,6 +2065,380 @@ QList<CellRange> Worksheet::mergedCells() const
     return emptyList;
 }
 
+/*!
+	Inserts \a count empty rows before \a row. The rows from \a row on move
+	down along with their cells, comments, hyperlinks, merged cells, data
+	validations, conditional formats and drawings. Formula references to the
+	moved cells, on any sheet of the workbook and in defined names, move too.
+
+	Returns false when the rows would push used cells off the sheet.
+ */
+bool Worksheet::insertRows(int row, int count)
+{
+	Q_D(Worksheet);
+	if (count < 1)
+		return false;
+	return d->shiftCells(SheetShift(SheetShift::Rows, row, count));
+}
+
+/*!
+	Deletes \a count rows, starting with \a row. The rows below move up.
+	Formula references to deleted cells become #REF!, ranges that lose some
+	of their rows shrink. Returns true on success.
+ */
+bool Worksheet::deleteRows(int row, int count)
+{
+	Q_D(Worksheet);
+	if (count < 1)
+		return false;
+	return d->shiftCells(SheetShift(SheetShift::Rows, row, -count));
+}
+
+/*!
+	Inserts \a count empty columns before \a column, see insertRows().
+	Returns true on success.
+ */
+bool Worksheet::insertColumns(int column, int count)
+{
+	Q_D(Worksheet);
+	if (count < 1)
+		return false;
+	return d->shiftCells(SheetShift(SheetShift::Columns, column, count));
+}
+
+/*!
+	Deletes \a count columns, starting with \a column, see deleteRows().
+	Returns true on success.
+ */
+bool Worksheet::deleteColumns(int column, int count)
+{
+	Q_D(Worksheet);
+	if (count < 1)
+		return false;
+	return d->shiftCells(SheetShift(SheetShift::Columns, column, -count));
+}
+
+namespace {
+
+// Moves the entries from the first shifted row or column on, the ones
+// before it stay where they are.
+template <typename T>
+void shiftKeys(QMap<int, T> &map, const SheetShift &shift)
+{
+	auto it = map.lowerBound(shift.first());
+	if (it == map.end())
+		return;
+
+	QVector<QPair<int, T> > moved;
+	while (it != map.end()) {
+		const int key = shift.shifted(it.key());
+		if (key != -1)
+			moved.append(qMakePair(key, it.value()));
+		it = map.erase(it);
+	}
+	for (const auto &entry : moved)
+		map.insert(entry.first, entry.second);
+}
+
+template <typename T>
+void shiftColumnKeys(QMap<int, QMap<int, T> > &table, const SheetShift &shift)
+{
+	for (auto row = table.begin(); row != table.end();) {
+		shiftKeys(row.value(), shift);
+		if (row.value().isEmpty())
+			row = table.erase(row);
+		else
+			++row;
+	}
+}
+
+void shiftRanges(QList<CellRange> &ranges, const SheetShift &shift)
+{
+	for (auto it = ranges.begin(); it != ranges.end();) {
+		const CellRange range = shift.shifted(*it);
+		if (range.isValid()) {
+			*it = range;
+			++it;
+		} else {
+			it = ranges.erase(it);
+		}
+	}
+}
+
+// Markers count rows and columns from 0. An object whose cells were all
+// deleted shrinks to the row or column after them.
+void shiftMarkers(XlsxMarker &from, XlsxMarker &to, const SheetShift &shift)
+{
+	const bool rows = shift.axis() == SheetShift::Rows;
+	int first = (rows ? from.row() : from.col()) + 1;
+	int last = (rows ? to.row() : to.col()) + 1;
+	if (!shift.shiftSpan(first, last)) {
+		first = last = shift.count() > 0 ? shift.limit() : shift.first();
+		if (rows) {
+			from.offset.setWidth(0);
+			to.offset.setWidth(0);
+		} else {
+			from.offset.setHeight(0);
+			to.offset.setHeight(0);
+		}
+	}
+
+	if (rows) {
+		from.cell.setX(first - 1);
+		to.cell.setX(last - 1);
+	} else {
+		from.cell.setY(first - 1);
+		to.cell.setY(last - 1);
+	}
+}
+
+} // namespace
+
+/*!
+ * \internal
+ * Inserts or deletes the rows or columns of \a shift. Only the entries at
+ * or after the first shifted row or column are moved, the formulas of the
+ * workbook are rewritten where they refer to moved cells.
+ */
+bool WorksheetPrivate::shiftCells(const SheetShift &shift)
+{
+	Q_Q(Worksheet);
+	if (shift.first() < 1 || shift.first() > shift.limit())
+		return false;
+
+	const bool rows = shift.axis() == SheetShift::Rows;
+	if (shift.count() > 0 && dimension.isValid()) {
+		const int last = rows ? dimension.lastRow() : dimension.lastColumn();
+		if (last >= shift.first() && last + shift.count() > shift.limit())
+			return false;
+	}
+
+	//Only the formulas the dependency graph of the engine finds referring to
+	//the moved cells, and the ones held by them, are rewritten.
+	FormulaEngine *engine = workbook->formulaEngine();
+	const QHash<Worksheet *, QVector<CellReference> > formulas = engine->takeShiftedFormulas(q, shift);
+
+	//Shared formulas can't be moved cell by cell, the groups the shift
+	//doesn't move as a whole are expanded first.
+	unshareFormulas(shift, name, true);
+	shiftFormulas(shift, name, true, formulas.value(q));
+	for (int i = 0; i < workbook->sheetCount(); ++i) {
+		AbstractSheet *sheet = workbook->sheet(i);
+		if (sheet == q || sheet->sheetType() != AbstractSheet::ST_WorkSheet)
+			continue;
+		WorksheetPrivate *other = static_cast<Worksheet *>(sheet)->d_func();
+		other->unshareFormulas(shift, name, false);
+		other->shiftFormulas(shift, name, false, formulas.value(static_cast<Worksheet *>(sheet)));
+	}
+	bool namesChanged = false;
+	for (XlsxDefineNameData &data : workbook->d_func()->definedNamesList) {
+		const QString shifted = shift.shiftedFormula(data.formula, CellReference(1, 1), CellReference(1, 1), name, false);
+		if (shifted != data.formula) {
+			data.formula = shifted;
+			namesChanged = true;
+		}
+	}
+
+	if (rows) {
+		shiftKeys(cellTable, shift);
+		shiftKeys(comments, shift);
+		shiftKeys(urlTable, shift);
+		shiftKeys(rowsInfo, shift);
+		shiftKeys(row_sizes, shift);
+	} else {
+		shiftColumnKeys(cellTable, shift);
+		shiftColumnKeys(comments, shift);
+		shiftColumnKeys(urlTable, shift);
+		shiftKeys(col_sizes, shift);
+
+		QMap<int, QSharedPointer<XlsxColumnInfo> > columns;
+		for (auto it = colsInfo.constBegin(); it != colsInfo.constEnd(); ++it) {
+			const QSharedPointer<XlsxColumnInfo> &info = it.value();
+			if (shift.shiftSpan(info->firstColumn, info->lastColumn))
+				columns.insert(info->firstColumn, info);
+		}
+		colsInfo = columns;
+		colsInfoHelper.clear();
+		for (auto it = colsInfo.constBegin(); it != colsInfo.constEnd(); ++it) {
+			for (int col = it.value()->firstColumn; col <= it.value()->lastColumn; ++col)
+				colsInfoHelper.insert(col, it.value());
+		}
+	}
+
+	for (auto it = merges.begin(); it != merges.end();) {
+		const CellRange range = shift.shifted(*it);
+		if (range.isValid() && (range.rowCount() > 1 || range.columnCount() > 1)) {
+			*it = range;
+			++it;
+		} else {
+			it = merges.erase(it);
+		}
+	}
+
+	for (auto it = dataValidationsList.begin(); it != dataValidationsList.end();) {
+		shiftRanges(it->d->ranges, shift);
+		if (it->d->ranges.isEmpty())
+			it = dataValidationsList.erase(it);
+		else
+			++it;
+	}
+	for (auto it = conditionalFormattingList.begin(); it != conditionalFormattingList.end();) {
+		shiftRanges(it->d->ranges, shift);
+		if (it->d->ranges.isEmpty())
+			it = conditionalFormattingList.erase(it);
+		else
+			++it;
+	}
+
+	if (drawing) {
+		for (DrawingAnchor *anchor : drawing->anchors) {
+			if (DrawingOneCellAnchor *oneCell = dynamic_cast<DrawingOneCellAnchor *>(anchor))
+				shiftMarkers(oneCell->from, oneCell->from, shift);
+			else if (DrawingTwoCellAnchor *twoCell = dynamic_cast<DrawingTwoCellAnchor *>(anchor))
+				shiftMarkers(twoCell->from, twoCell->to, shift);
+		}
+		drawing->invalidateAnchorIndex();
+	}
+
+	rangeIndexesValid.storeRelease(0);
+	dimension = shift.shifted(dimension);
+	validateDimension();
+
+	//The engine keeps the names parsed, it starts over when one was rewritten.
+	if (namesChanged) {
+		engine->invalidate();
+		return true;
+	}
+	for (auto it = formulas.constBegin(); it != formulas.constEnd(); ++it) {
+		for (const CellReference &cell : it.value()) {
+			const CellReference newCell = it.key() == q ? shift.shifted(cell) : cell;
+			if (newCell.isValid())
+				engine->cellChanged(it.key(), newCell.row(), newCell.column());
+		}
+	}
+	return true;
+}
+
+/*!
+ * \internal
+ * Rewrites the formulas of \a cells whose references move with \a shift,
+ * made on the sheet \a sheetName. References without a sheet name are to
+ * that sheet when \a onSheet is true, the cells holding the formulas then
+ * move too. The cells are given by their positions before the shift.
+ */
+void WorksheetPrivate::shiftFormulas(const SheetShift &shift, const QString &sheetName, bool onSheet,
+									 const QVector<CellReference> &cells)
+{
+	for (const CellReference &oldCell : cells) {
+		const auto row = cellTable.constFind(oldCell.row());
+		if (row == cellTable.constEnd())
+			continue;
+		Cell *cell = row.value().value(oldCell.column()).data();
+		if (!cell || !cell->hasFormula())
+			continue;
+
+		const CellFormula &formula = cell->d_ptr->formula;
+		const QString text = formula.formulaText();
+		if (text.isEmpty() || (!onSheet && !text.contains(QLatin1Char('!'))))
+			continue;
+
+		const CellReference newCell = onSheet ? shift.shifted(oldCell) : oldCell;
+		if (!newCell.isValid())
+			continue;
+
+		CellRange reference = formula.reference();
+		if (onSheet && (formula.formulaType() == CellFormula::ArrayType
+						|| formula.formulaType() == CellFormula::DataTableType
+						|| formula.formulaType() == CellFormula::SharedType))
+			reference = shift.shifted(reference);
+		const QString shifted = shift.shiftedFormula(text, oldCell, newCell, sheetName, onSheet);
+		if (shifted == text && reference == formula.reference())
+			continue;
+
+		CellFormula moved(shifted, reference, formula.formulaType());
+		moved.d->ca = formula.d->ca;
+		moved.d->si = formula.d->si;
+		cell->d_ptr->formula = moved;
+	}
+}
+
+/*!
+ * \internal
+ * Turns the shared formulas that \a shift can't move as a whole into normal
+ * ones. A group is kept when its first and last cells, with their formulas
+ * rewritten the way shiftFormulas() does, are still the relative translation
+ * of each other: its range then isn't cut by the shift and none of its
+ * references cross the first shifted row or column. The master formulas of
+ * the kept groups are moved along. \a sheetName and \a onSheet are as in
+ * shiftFormulas().
+ */
+void WorksheetPrivate::unshareFormulas(const SheetShift &shift, const QString &sheetName, bool onSheet)
+{
+	QSet<int> groups;
+	QMap<int, CellFormula> moved;
+	for (auto it = sharedFormulaMap.constBegin(); it != sharedFormulaMap.constEnd(); ++it) {
+		const CellFormula &master = it.value();
+		const QString text = master.formulaText();
+		if (!onSheet && !SheetShift::refersToSheet(text, sheetName, false))
+			continue;
+
+		const CellRange range = master.reference();
+		const CellRange newRange = onSheet ? shift.shifted(range) : range;
+		if (!newRange.isValid() || newRange.rowCount() != range.rowCount()
+				|| newRange.columnCount() != range.columnCount()) {
+			groups.insert(it.key());
+			continue;
+		}
+
+		const QString firstText = shift.shiftedFormula(text, range.topLeft(), newRange.topLeft(), sheetName, onSheet);
+		const QString lastText = shift.shiftedFormula(convertSharedFormula(text, range.topLeft(), range.bottomRight()),
+													  range.bottomRight(), newRange.bottomRight(), sheetName, onSheet);
+		if (convertSharedFormula(firstText, newRange.topLeft(), newRange.bottomRight()) != lastText) {
+			groups.insert(it.key());
+		} else if (firstText != text || newRange != range) {
+			CellFormula formula(firstText, newRange, CellFormula::SharedType);
+			formula.d->ca = master.d->ca;
+			formula.d->si = master.d->si;
+			moved.insert(it.key(), formula);
+		}
+	}
+	for (auto it = moved.constBegin(); it != moved.constEnd(); ++it)
+		addSharedFormula(it.key(), it.value());
+	if (groups.isEmpty())
+		return;
+
+	for (auto row = cellTable.begin(); row != cellTable.end(); ++row) {
+		for (auto column = row.value().begin(); column != row.value().end(); ++column) {
+			Cell *cell = column.value().data();
+			if (!cell)
+				continue;
+			const CellFormula &formula = cell->d_ptr->formula;
+			if (formula.formulaType() != CellFormula::SharedType || !groups.contains(formula.sharedIndex()))
+				continue;
+
+			QString text = formula.formulaText();
+			if (text.isEmpty()) {
+				const CellReference ref(row.key(), column.key());
+				const auto root = sharedFormulaTemplates.constFind(formula.sharedIndex());
+				if (root != sharedFormulaTemplates.constEnd() && root->isValid()) {
+					text = root->formulaText(ref);
+				} else {
+					const CellFormula master = sharedFormulaMap.value(formula.sharedIndex());
+					text = convertSharedFormula(master.formulaText(), master.reference().topLeft(), ref);
+				}
+			}
+			CellFormula normal(text);
+			normal.d->ca = formula.d->ca;
+			cell->d_ptr->formula = normal;
+		}
+	}
+
+	for (int si : groups) {
+		sharedFormulaMap.remove(si);
+		sharedFormulaTemplates.remove(si);
+	}
+}
+
 /*!
  * \internal
  */
@@ -1389,7 +2524,7 @@ void Worksheet::saveToXmlFile(QIODevice *device) const
 			if (col_info->width)
 				writer.writeAttribute(QStringLiteral("width"), QString::number(col_info->width, 'g', 15));
 			if (!col_info->format.isEmpty())
-				writer.writeAttribute(QStringLiteral("style"), QString::number(col_info->format.xfIndex()));
+				writer.writeAttribute(QStringLiteral("style"), QString::number(d->workbook->styles()->savedXfIndex(col_info->format.xfIndex())));
 			if (col_info->hidden)
 				writer.writeAttribute(QStringLiteral("hidden"), QStringLiteral("1"));
 			if (col_info->width)
@@ -1609,15 +2744,28 @@ bool Worksheet::setStartPage(int spagen)
 void WorksheetPrivate::saveXmlSheetData(QXmlStreamWriter &writer) const
 {
 	calculateSpans();
-    for (int row_num = dimension.firstRow(); row_num <= dimension.lastRow(); row_num++)
-    {
-        auto ctIt = cellTable.constFind(row_num);
-        auto riIt = rowsInfo.constFind(row_num);
-        if (ctIt == cellTable.constEnd() && riIt == rowsInfo.constEnd() && !comments.contains(row_num))
-        {
-			//Only process rows with cell data / comments / formatting
-			continue;
-		}
+	collectSharedFormulaRuns();
+
+	//Only the rows with cell data / comments / formatting are visited.
+	auto ctIt = cellTable.lowerBound(dimension.firstRow());
+	auto riIt = rowsInfo.lowerBound(dimension.firstRow());
+	auto cmIt = comments.lowerBound(dimension.firstRow());
+	for (;;)
+	{
+		int row_num = dimension.lastRow() + 1;
+		if (ctIt != cellTable.constEnd())
+			row_num = qMin(row_num, ctIt.key());
+		if (riIt != rowsInfo.constEnd())
+			row_num = qMin(row_num, riIt.key());
+		if (cmIt != comments.constEnd())
+			row_num = qMin(row_num, cmIt.key());
+		if (row_num > dimension.lastRow())
+			break;
+
+		const bool hasCells = ctIt != cellTable.constEnd() && ctIt.key() == row_num;
+		const bool hasInfo = riIt != rowsInfo.constEnd() && riIt.key() == row_num;
+		if (cmIt != comments.constEnd() && cmIt.key() == row_num)
+			++cmIt;
 
 		int span_index = (row_num-1) / 16;
 		QString span;
@@ -1631,12 +2779,13 @@ void WorksheetPrivate::saveXmlSheetData(QXmlStreamWriter &writer) const
 		if (!span.isEmpty())
 			writer.writeAttribute(QStringLiteral("spans"), span);
 
-        if (riIt != rowsInfo.constEnd())
+        if (hasInfo)
         {
             QSharedPointer<XlsxRowInfo> rowInfo = riIt.value();
+            ++riIt;
             if (!rowInfo->format.isEmpty())
             {
-				writer.writeAttribute(QStringLiteral("s"), QString::number(rowInfo->format.xfIndex()));
+				writer.writeAttribute(QStringLiteral("s"), QString::number(workbook->styles()->savedXfIndex(rowInfo->format.xfIndex())));
 				writer.writeAttribute(QStringLiteral("customFormat"), QStringLiteral("1"));
 			}
 
@@ -1658,18 +2807,123 @@ void WorksheetPrivate::saveXmlSheetData(QXmlStreamWriter &writer) const
 		}
 
 		//Write cell data if row contains filled cells
-        if (ctIt != cellTable.constEnd())
+        if (hasCells)
         {
-            for (int col_num = dimension.firstColumn(); col_num <= dimension.lastColumn(); col_num++)
-            {
-                if (ctIt->contains(col_num))
-                {
-                    saveXmlCellData(writer, row_num, col_num, (*ctIt)[col_num]);
+            auto cellIt = ctIt->lowerBound(dimension.firstColumn());
+            for (; cellIt != ctIt->constEnd() && cellIt.key() <= dimension.lastColumn(); ++cellIt)
+                saveXmlCellData(writer, row_num, cellIt.key(), cellIt.value());
+            ++ctIt;
+		}
+		writer.writeEndElement(); //row
+	}
+	sharedFormulaRuns.clear();
+}
+
+/*!
+ * \internal
+ * Registers the master \a formula of the shared group \a si, along with the
+ * template its followers are read from.
+ */
+void WorksheetPrivate::addSharedFormula(int si, const CellFormula &formula)
+{
+	sharedFormulaMap[si] = formula;
+	sharedFormulaTemplates.insert(si, FormulaTemplate(formula.formulaText(), formula.reference().topLeft()));
+}
+
+/*!
+ * \internal
+ * Finds the formulas filled down a column, each one the relative translation
+ * of the one above: they parse to the same cell independent formula. Runs of
+ * two cells or more are saved as shared formulas, with the formula text only
+ * in their first cell.
+ */
+void WorksheetPrivate::collectSharedFormulaRuns() const
+{
+	sharedFormulaRuns.clear();
+
+	struct OpenRun
+	{
+		int firstRow;
+		int lastRow;
+		const ParsedFormula *formula;
+	};
+
+	FormulaCache *cache = workbook->formulaCache();
+	int si = sharedFormulaMap.isEmpty() ? 0 : sharedFormulaMap.lastKey() + 1;
+	QMap<int, OpenRun> openRuns; // by column
+	auto closeRun = [&](int column, const OpenRun &run) {
+		if (run.lastRow == run.firstRow)
+			return;
+		XlsxSharedFormulaRun shared;
+		shared.lastRow = run.lastRow;
+		shared.si = si++;
+		sharedFormulaRuns[column].insert(run.firstRow, shared);
+	};
+
+	for (auto row = cellTable.constBegin(); row != cellTable.constEnd(); ++row) {
+		for (auto column = row.value().constBegin(); column != row.value().constEnd(); ++column) {
+			//The parsed formulas are kept by the cache, equal pointers mean equal formulas.
+			const ParsedFormula *formula = nullptr;
+			const Cell *cell = column.value().data();
+			if (cell && cell->d_ptr->formula.formulaType() == CellFormula::NormalType
+					&& cell->cellType() != Cell::SharedStringType && cell->cellType() != Cell::InlineStringType) {
+				const QString text = cell->d_ptr->formula.formulaText();
+				if (!text.isEmpty()) {
+					const QSharedPointer<const ParsedFormula> parsed = cache->parse(text, CellReference(row.key(), column.key()));
+					if (parsed->isValid())
+						formula = parsed.data();
 				}
 			}
+
+			auto open = openRuns.find(column.key());
+			if (open != openRuns.end()) {
+				if (formula && open->formula == formula && open->lastRow == row.key() - 1) {
+					open->lastRow = row.key();
+					continue;
+				}
+				closeRun(open.key(), open.value());
+				openRuns.erase(open);
+			}
+			if (formula) {
+				OpenRun run;
+				run.firstRow = row.key();
+				run.lastRow = row.key();
+				run.formula = formula;
+				openRuns.insert(column.key(), run);
+			}
 		}
-		writer.writeEndElement(); //row
 	}
+	for (auto open = openRuns.constBegin(); open != openRuns.constEnd(); ++open)
+		closeRun(open.key(), open.value());
+}
+
+/*!
+ * \internal
+ * Writes the formula of \a cell, as a member of a shared formula when
+ * collectSharedFormulaRuns() found it in a run.
+ */
+void WorksheetPrivate::saveXmlCellFormula(QXmlStreamWriter &writer, int row, int col, const Cell *cell) const
+{
+	const CellFormula &formula = cell->d_ptr->formula;
+	const auto runs = sharedFormulaRuns.constFind(col);
+	if (runs != sharedFormulaRuns.constEnd() && formula.formulaType() == CellFormula::NormalType) {
+		auto run = runs->upperBound(row);
+		if (run != runs->constBegin() && (--run).value().lastRow >= row) {
+			const bool master = run.key() == row;
+			writer.writeStartElement(QStringLiteral("f"));
+			writer.writeAttribute(QStringLiteral("t"), QStringLiteral("shared"));
+			if (master)
+				writer.writeAttribute(QStringLiteral("ref"), CellRange(row, col, run.value().lastRow, col).toString());
+			if (formula.d->ca)
+				writer.writeAttribute(QStringLiteral("ca"), QStringLiteral("1"));
+			writer.writeAttribute(QStringLiteral("si"), QString::number(run.value().si));
+			if (master)
+				writer.writeCharacters(formula.formulaText());
+			writer.writeEndElement(); // f
+			return;
+		}
+	}
+	formula.saveToXml(writer);
 }
 
 void WorksheetPrivate::saveXmlCellData(QXmlStreamWriter &writer, int row, int col, QSharedPointer<Cell> cell) const
@@ -1686,12 +2940,14 @@ void WorksheetPrivate::saveXmlCellData(QXmlStreamWriter &writer, int row, int co
     QMap<int, QSharedPointer<XlsxColumnInfo> >::ConstIterator cIt;
 
 	//Style used by the cell, row or col
-	if (!cell->format().isEmpty())
-		writer.writeAttribute(QStringLiteral("s"), QString::number(cell->format().xfIndex()));
+	Styles *styles = workbook->styles();
+	const int styleIndex = cell->styleNumber();
+	if (styleIndex >= 0 && !styles->xfFormat(styleIndex).isEmpty())
+		writer.writeAttribute(QStringLiteral("s"), QString::number(styles->savedXfIndex(styleIndex)));
     else if ((rIt = rowsInfo.constFind(row)) != rowsInfo.constEnd() && !(*rIt)->format.isEmpty())
-        writer.writeAttribute(QStringLiteral("s"), QString::number((*rIt)->format.xfIndex()));
+        writer.writeAttribute(QStringLiteral("s"), QString::number(styles->savedXfIndex((*rIt)->format.xfIndex())));
     else if ((cIt = colsInfoHelper.constFind(col)) != colsInfoHelper.constEnd() && !(*cIt)->format.isEmpty())
-        writer.writeAttribute(QStringLiteral("s"), QString::number((*cIt)->format.xfIndex()));
+        writer.writeAttribute(QStringLiteral("s"), QString::number(styles->savedXfIndex((*cIt)->format.xfIndex())));
 
     if (cell->cellType() == Cell::SharedStringType) // 's'
     {
@@ -1748,7 +3004,7 @@ void WorksheetPrivate::saveXmlCellData(QXmlStreamWriter &writer, int row, int co
         {
             QString strFormula = cell->formula().d->formula;
             Q_UNUSED(strFormula);
-            cell->formula().saveToXml(writer);
+            saveXmlCellFormula(writer, row, col, cell.data());
         }
 
         if (cell->value().isValid())
@@ -1761,7 +3017,7 @@ void WorksheetPrivate::saveXmlCellData(QXmlStreamWriter &writer, int row, int co
     {
 		writer.writeAttribute(QStringLiteral("t"), QStringLiteral("str"));
 		if (cell->hasFormula())
-			cell->formula().saveToXml(writer);
+			saveXmlCellFormula(writer, row, col, cell.data());
 
 		writer.writeTextElement(QStringLiteral("v"), cell->value().toString());
     }
@@ -1775,7 +3031,7 @@ void WorksheetPrivate::saveXmlCellData(QXmlStreamWriter &writer, int row, int co
         {
             QString strFormula = cell->formula().d->formula;
             Q_UNUSED(strFormula);
-            cell->formula().saveToXml(writer);
+            saveXmlCellFormula(writer, row, col, cell.data());
         }
 
 		writer.writeTextElement(QStringLiteral("v"), cell->value().toBool() ? QStringLiteral("1") : QStringLiteral("0"));
@@ -1793,12 +3049,16 @@ void WorksheetPrivate::saveXmlCellData(QXmlStreamWriter &writer, int row, int co
 
          // number type. see for 18.18.11 ST_CellType (Cell Type) more information.
          writer.writeAttribute(QStringLiteral("t"), QStringLiteral("n"));
+         if (cell->hasFormula())
+             saveXmlCellFormula(writer, row, col, cell.data());
          writer.writeTextElement(QStringLiteral("v"), cell->value().toString() );
 
     }
     else if (cell->cellType() == Cell::ErrorType) // 'e'
     {
         writer.writeAttribute(QStringLiteral("t"), QStringLiteral("e"));
+        if (cell->hasFormula())
+            saveXmlCellFormula(writer, row, col, cell.data());
         writer.writeTextElement(QStringLiteral("v"), cell->value().toString() );
     }
     else // if (cell->cellType() == Cell::CustomType)
@@ -1809,7 +3069,7 @@ void WorksheetPrivate::saveXmlCellData(QXmlStreamWriter &writer, int row, int co
         {
             QString strFormula = cell->formula().d->formula;
             Q_UNUSED(strFormula);
-            cell->formula().saveToXml(writer);
+            saveXmlCellFormula(writer, row, col, cell.data());
         }
 
         if (cell->value().isValid())
@@ -2503,15 +3763,12 @@ void WorksheetPrivate::loadXmlSheetData(QXmlStreamReader &reader)
 				QString r = attributes.value(QLatin1String("r")).toString();
 				CellReference pos(r);
 
-				//get format
-				Format format;
+				//get style
 				qint32 styleIndex = -1;
 				if (attributes.hasAttribute(QLatin1String("s"))) // Style (defined in the styles.xml file)
 				{ 
 					//"s" == style index
-					int idx = attributes.value(QLatin1String("s")).toInt();
-					format = workbook->styles()->xfFormat(idx);
-					styleIndex = idx;
+					styleIndex = attributes.value(QLatin1String("s")).toInt();
 				}
 
                 // Cell::CellType cellType = Cell::NumberType;
@@ -2555,13 +3812,14 @@ void WorksheetPrivate::loadXmlSheetData(QXmlStreamReader &reader)
 					}
 				}
 
-				if (Cell::isDateType(cellType, format))
+				if ((cellType == Cell::NumberType || cellType == Cell::CustomType)
+						&& workbook->styles()->isDateTimeXf(styleIndex))
 				{
 					cellType = Cell::DateType;
 				}
 
 				// create a heap of new cell
-				QSharedPointer<Cell> cell(new Cell(QVariant(), cellType, format, q, styleIndex));
+				QSharedPointer<Cell> cell(new Cell(QVariant(), cellType, Format(), q, styleIndex));
 
                 while (!reader.atEnd() &&
                        !(reader.name() == QLatin1String("c") &&
@@ -2576,8 +3834,7 @@ void WorksheetPrivate::loadXmlSheetData(QXmlStreamReader &reader)
                             if (formula.formulaType() == CellFormula::SharedType &&
                                     !formula.formulaText().isEmpty())
 							{
-                                int si = formula.sharedIndex();
-                                sharedFormulaMap[ si ] = formula;
+                                addSharedFormula(formula.sharedIndex(), formula);
 							}
 						} 
 						else if (reader.name() == QLatin1String("v")) // Value 
@@ -2,12 +2,14 @@
 
 #include "xlsxzipreader_p.h"
 
+#include <QMutexLocker>
+
 #include <private/qzipreader_p.h>
 
 QT_BEGIN_NAMESPACE_XLSX
 
 ZipReader::ZipReader(const QString &filePath) :
-    m_reader(new QZipReader(filePath))
+    m_reader(new QZipReader(filePath)), m_filePath(filePath)
 {
     init();
 }
@@ -18,6 +20,19 @@ ZipReader::ZipReader(QIODevice *device) :
     init();
 }
 
+/*!
+ * \internal
+ * Reads the package held in \a data, which is shared rather than copied.
+ */
+ZipReader::ZipReader(const QByteArray &data) :
+    m_buffer(new QBuffer)
+{
+    m_buffer->setData(data);
+    m_buffer->open(QIODevice::ReadOnly);
+    m_reader.reset(new QZipReader(m_buffer.data()));
+    init();
+}
+
 ZipReader::~ZipReader()
 {
 
@@ -27,13 +42,20 @@ void ZipReader::init()
 {
     const auto& allFiles = m_reader->fileInfoList();
     for (const auto &fi : allFiles) {
-        if (fi.isFile || (!fi.isDir && !fi.isFile && !fi.isSymLink))
+        if (fi.isFile || (!fi.isDir && !fi.isFile && !fi.isSymLink)) {
             m_filePaths.append(fi.filePath);
+            m_fileSizes.insert(fi.filePath, fi.size);
+        }
     }
 }
 
 bool ZipReader::exists() const
 {
+    QMutexLocker locker(&m_mutex);
+    if (m_reader.isNull()) {
+        QZipReader reader(m_filePath);
+        return reader.exists();
+    }
     return m_reader->exists();
 }
 
@@ -42,9 +64,41 @@ QStringList ZipReader::filePaths() const
     return m_filePaths;
 }
 
+/*!
+ * \internal
+ * Can be called from any thread, the reads are serialized. A released file
+ * is opened again for the read and closed right after it.
+ */
 QByteArray ZipReader::fileData(const QString &fileName) const
 {
+    QMutexLocker locker(&m_mutex);
+    if (m_reader.isNull()) {
+        QZipReader reader(m_filePath);
+        return reader.fileData(fileName);
+    }
     return m_reader->fileData(fileName);
 }
 
+/*!
+ * \internal
+ * Returns the uncompressed size of \a fileName, -1 if it isn't in the package.
+ */
+qint64 ZipReader::fileSize(const QString &fileName) const
+{
+    return m_fileSizes.value(fileName, -1);
+}
+
+/*!
+ * \internal
+ * Closes the package file of a reader created from a file name, so that no
+ * handle stays open while its parts wait to be read. The file and its
+ * directory are read again by each later fileData() call.
+ */
+void ZipReader::releaseFile()
+{
+    QMutexLocker locker(&m_mutex);
+    if (!m_filePath.isEmpty())
+        m_reader.reset();
+}
+
 QT_END_NAMESPACE_XLSX
@@ -135,9 +135,8 @@ bool loadXlsx(QString fileName, QString& strHtml)
 
             QSharedPointer<Cell> ptrCell = cl.cell; // cell pointer
 
-            // value of cell
-            QVariant var = cl.cell.data()->value();
-            QString str = var.toString();
+            // value of cell, as displayed by Excel
+            QString str = cl.cell.data()->formattedText();
 
             cellValues[row][col] = str;
         }